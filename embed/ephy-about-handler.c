@@ -22,6 +22,7 @@
 #include "ephy-about-handler.h"
 
 #include "ephy-file-helpers.h"
+#include "ephy-latency-tracker.h"
 #include "ephy-smaps.h"
 #include "ephy-web-app-utils.h"
 
@@ -178,6 +179,24 @@ ephy_about_handler_handle_memory (GString *data_str)
   }
 }
 
+static void
+ephy_about_handler_handle_latency (GString *data_str)
+{
+  char *latency;
+
+  latency = ephy_latency_tracker_to_html ();
+
+  g_string_append_printf (data_str, "<head><title>%s</title>"           \
+                          "<style type=\"text/css\">%s</style></head><body>",
+                          _("Location bar latency"),
+                          css_style);
+
+  g_string_append_printf (data_str, "<h1>%s</h1>", _("Location bar latency"));
+  g_string_append (data_str, latency);
+  g_string_append (data_str, "</body>");
+  g_free (latency);
+}
+
 static void
 ephy_about_handler_handle_epiphany (GString *data_str)
 {
@@ -245,6 +264,8 @@ ephy_about_handler_handle (const char *about)
     ephy_about_handler_handle_plugins (data_str);
   else if (!g_strcmp0 (about, "memory"))
     ephy_about_handler_handle_memory (data_str);
+  else if (!g_strcmp0 (about, "latency"))
+    ephy_about_handler_handle_latency (data_str);
   else if (!g_strcmp0 (about, "epiphany"))
     ephy_about_handler_handle_epiphany (data_str);
   else if (!g_strcmp0 (about, "applications"))
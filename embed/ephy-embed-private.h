@@ -51,8 +51,22 @@ void                       ephy_web_view_set_loading_title        (EphyWebView
                                                                    const char                *title,
                                                                    gboolean                   is_address);
 void                       ephy_web_view_popups_manager_reset     (EphyWebView               *view);
+typedef void (* EphyWebViewSaveProgressFunc) (guint n_saved,
+                                              guint n_total,
+                                              gpointer user_data);
+
+typedef void (* EphyWebViewSaveCallback) (EphyWebView *view,
+                                          gboolean success,
+                                          gpointer user_data);
+
 void                       ephy_web_view_save                     (EphyWebView               *view,
                                                                    const char                *uri);
+void                       ephy_web_view_save_full                (EphyWebView               *view,
+                                                                   const char                *uri,
+                                                                   GCancellable              *cancellable,
+                                                                   EphyWebViewSaveProgressFunc progress_func,
+                                                                   EphyWebViewSaveCallback    callback,
+                                                                   gpointer                   user_data);
 void                       ephy_web_view_load_homepage            (EphyWebView               *view);
 
 char *                     ephy_web_view_create_web_application   (EphyWebView               *view,
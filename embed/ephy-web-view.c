@@ -80,10 +80,15 @@ struct _EphyWebViewPrivate {
   guint is_loading : 1;
 #endif
   guint load_failed : 1;
+  guint has_placeholder_scroll : 1;
+  guint restore_scroll : 1;
 
   char *address;
   char *typed_address;
   char *title;
+  char *placeholder_address;
+  double placeholder_scroll_x;
+  double placeholder_scroll_y;
   char *loading_title;
   char *status_message;
   char *link_message;
@@ -1095,6 +1100,7 @@ ephy_web_view_finalize (GObject *object)
   g_free (priv->address);
   g_free (priv->typed_address);
   g_free (priv->title);
+  g_free (priv->placeholder_address);
   g_free (priv->status_message);
   g_free (priv->link_message);
   g_free (priv->loading_title);
@@ -2384,6 +2390,15 @@ load_status_cb (WebKitWebView *web_view,
     if (uri)
       soup_uri_free (uri);
 
+    /* Go back to where a discarded tab was scrolled to. */
+    if (priv->restore_scroll) {
+      priv->restore_scroll = FALSE;
+      gtk_adjustment_set_value (gtk_scrollable_get_hadjustment (GTK_SCROLLABLE (web_view)),
+                                priv->placeholder_scroll_x);
+      gtk_adjustment_set_value (gtk_scrollable_get_vadjustment (GTK_SCROLLABLE (web_view)),
+                                priv->placeholder_scroll_y);
+    }
+
     /* Reset visit type. */
     priv->visit_type = EPHY_PAGE_VISIT_NONE;
 
@@ -2391,6 +2406,7 @@ load_status_cb (WebKitWebView *web_view,
   }
   case WEBKIT_LOAD_FAILED:
     priv->load_failed = TRUE;
+    priv->restore_scroll = FALSE;
     ephy_web_view_set_link_message (view, NULL);
     ephy_web_view_set_loading_title (view, NULL, FALSE);
 
@@ -2895,6 +2911,17 @@ normalize_or_autosearch_url (EphyWebView *view, const char *url)
   return effective_url;
 }
 
+static void
+ephy_web_view_clear_placeholder (EphyWebView *view)
+{
+  EphyWebViewPrivate *priv = view->priv;
+
+  g_free (priv->placeholder_address);
+  priv->placeholder_address = NULL;
+  priv->has_placeholder_scroll = FALSE;
+  priv->restore_scroll = FALSE;
+}
+
 /**
  * ephy_web_view_load_request:
  * @view: the #EphyWebView in which to load the request
@@ -2919,6 +2946,9 @@ ephy_web_view_load_request (EphyWebView *view,
   char *effective_url;
 
   g_return_if_fail (EPHY_IS_WEB_VIEW(view));
+
+  ephy_web_view_clear_placeholder (view);
+
 #ifdef HAVE_WEBKIT2
   g_return_if_fail (WEBKIT_IS_URI_REQUEST(request));
 
@@ -2997,6 +3027,8 @@ ephy_web_view_load_url (EphyWebView *view,
   g_return_if_fail (EPHY_IS_WEB_VIEW (view));
   g_return_if_fail (url);
 
+  ephy_web_view_clear_placeholder (view);
+
   effective_url = normalize_or_autosearch_url (view, url);
 
   /* After normalization there are still some cases that are
@@ -3054,6 +3086,183 @@ ephy_web_view_load_url (EphyWebView *view,
   g_free (effective_url);
 }
 
+#ifndef HAVE_WEBKIT2
+static void
+copy_back_list (WebKitWebBackForwardList *source_bflist,
+                WebKitWebBackForwardList *dest_bflist)
+{
+  WebKitWebHistoryItem *item;
+  GList *items, *i;
+
+  items = webkit_web_back_forward_list_get_back_list_with_limit (source_bflist, EPHY_WEBKIT_BACK_FORWARD_LIMIT);
+  /* We want to add the items in the reverse order here, so the
+     history ends up the same */
+  items = g_list_reverse (items);
+  for (i = items; i; i = i->next) {
+    item = webkit_web_history_item_copy ((WebKitWebHistoryItem*)i->data);
+    webkit_web_back_forward_list_add_item (dest_bflist, item);
+    g_object_unref (item);
+  }
+  g_list_free (items);
+}
+#endif
+
+/**
+ * ephy_web_view_set_placeholder:
+ * @view: an #EphyWebView
+ * @uri: the address of the page @view stands for
+ * @title: (allow-none): the title of that page
+ *
+ * Makes @view stand for the page at @uri without loading it: @view
+ * takes the address, title and icon of the page, but nothing is
+ * fetched until ephy_web_view_load_placeholder() is called, or
+ * something else is loaded in @view.
+ **/
+void
+ephy_web_view_set_placeholder (EphyWebView *view,
+                               const char *uri,
+                               const char *title)
+{
+  EphyWebViewPrivate *priv;
+
+  g_return_if_fail (EPHY_IS_WEB_VIEW (view));
+  g_return_if_fail (uri != NULL);
+
+  priv = view->priv;
+
+  g_free (priv->placeholder_address);
+  priv->placeholder_address = g_strdup (uri);
+
+  ephy_web_view_set_address (view, uri);
+  ephy_web_view_set_title (view, title);
+
+#ifdef HAVE_WEBKIT2
+  /* TODO: Favicons */
+#else
+  if (priv->icon != NULL)
+    g_object_unref (priv->icon);
+  priv->icon = webkit_favicon_database_try_get_favicon_pixbuf (webkit_get_favicon_database (), uri,
+                                                               FAVICON_SIZE, FAVICON_SIZE);
+  g_object_notify (G_OBJECT (view), "icon");
+#endif
+}
+
+/**
+ * ephy_web_view_is_placeholder:
+ * @view: an #EphyWebView
+ *
+ * Return value: %TRUE if @view stands for a page it did not load yet
+ **/
+gboolean
+ephy_web_view_is_placeholder (EphyWebView *view)
+{
+  g_return_val_if_fail (EPHY_IS_WEB_VIEW (view), FALSE);
+
+  return view->priv->placeholder_address != NULL;
+}
+
+/**
+ * ephy_web_view_load_placeholder:
+ * @view: an #EphyWebView
+ *
+ * Loads the page @view stands for, if it is a placeholder. Does
+ * nothing otherwise.
+ **/
+void
+ephy_web_view_load_placeholder (EphyWebView *view)
+{
+#ifdef HAVE_WEBKIT2
+  WebKitURIRequest *request;
+#else
+  WebKitNetworkRequest *request;
+#endif
+  gboolean restore_scroll;
+
+  g_return_if_fail (EPHY_IS_WEB_VIEW (view));
+
+  if (view->priv->placeholder_address == NULL)
+    return;
+
+  restore_scroll = view->priv->has_placeholder_scroll;
+
+  LOG ("Loading placeholder %s", view->priv->placeholder_address);
+
+#ifdef HAVE_WEBKIT2
+  request = webkit_uri_request_new (view->priv->placeholder_address);
+#else
+  request = webkit_network_request_new (view->priv->placeholder_address);
+#endif
+  ephy_web_view_load_request (view, request);
+  g_object_unref (request);
+
+  /* Loading forgets the placeholder, but not where it was scrolled to. */
+  view->priv->restore_scroll = restore_scroll;
+}
+
+/**
+ * ephy_web_view_copy_placeholder:
+ * @source: the #EphyWebView to stand for
+ * @dest: a blank #EphyWebView
+ *
+ * Makes @dest a placeholder for the page @source shows, see
+ * ephy_web_view_set_placeholder(). @dest also takes the icon and back
+ * history of @source, and goes back to where @source was scrolled once
+ * it loads, so @source can be destroyed to free what the page holds.
+ * With WebKit2 the back history and scroll position are not copied
+ * yet, which is why nothing discards tabs there.
+ **/
+void
+ephy_web_view_copy_placeholder (EphyWebView *source,
+                                EphyWebView *dest)
+{
+  EphyWebViewPrivate *source_priv, *dest_priv;
+  const char *address;
+#ifndef HAVE_WEBKIT2
+  WebKitWebBackForwardList *source_bflist, *dest_bflist;
+#endif
+
+  g_return_if_fail (EPHY_IS_WEB_VIEW (source));
+  g_return_if_fail (EPHY_IS_WEB_VIEW (dest));
+
+  source_priv = source->priv;
+  dest_priv = dest->priv;
+
+  address = source_priv->placeholder_address ? source_priv->placeholder_address : source_priv->address;
+  g_return_if_fail (address != NULL);
+
+  ephy_web_view_set_placeholder (dest, address, source_priv->title);
+
+  if (source_priv->icon != NULL) {
+    if (dest_priv->icon != NULL)
+      g_object_unref (dest_priv->icon);
+    dest_priv->icon = g_object_ref (source_priv->icon);
+    g_object_notify (G_OBJECT (dest), "icon");
+  }
+
+  if (source_priv->placeholder_address != NULL) {
+    dest_priv->has_placeholder_scroll = source_priv->has_placeholder_scroll;
+    dest_priv->placeholder_scroll_x = source_priv->placeholder_scroll_x;
+    dest_priv->placeholder_scroll_y = source_priv->placeholder_scroll_y;
+  } else {
+#ifdef HAVE_WEBKIT2
+    /* TODO: Scroll position */
+#else
+    dest_priv->has_placeholder_scroll = TRUE;
+    dest_priv->placeholder_scroll_x = gtk_adjustment_get_value (gtk_scrollable_get_hadjustment (GTK_SCROLLABLE (source)));
+    dest_priv->placeholder_scroll_y = gtk_adjustment_get_value (gtk_scrollable_get_vadjustment (GTK_SCROLLABLE (source)));
+#endif
+  }
+
+#ifdef HAVE_WEBKIT2
+  /* TODO: BackForwardList */
+#else
+  /* Only the back history: the current item comes back with the load. */
+  source_bflist = webkit_web_view_get_back_forward_list (WEBKIT_WEB_VIEW (source));
+  dest_bflist = webkit_web_view_get_back_forward_list (WEBKIT_WEB_VIEW (dest));
+  copy_back_list (source_bflist, dest_bflist);
+#endif
+}
+
 /**
  * ephy_web_view_copy_back_history:
  * @source: the #EphyWebView from which to get the back history
@@ -3075,7 +3284,6 @@ ephy_web_view_copy_back_history (EphyWebView *source,
   WebKitWebView *source_view, *dest_view;
   WebKitWebBackForwardList* source_bflist, *dest_bflist;
   WebKitWebHistoryItem *item;
-  GList *items, *i;
 
   g_return_if_fail(EPHY_IS_WEB_VIEW(source));
   g_return_if_fail(EPHY_IS_WEB_VIEW(dest));
@@ -3086,16 +3294,7 @@ ephy_web_view_copy_back_history (EphyWebView *source,
   source_bflist = webkit_web_view_get_back_forward_list (source_view);
   dest_bflist = webkit_web_view_get_back_forward_list (dest_view);
 
-  items = webkit_web_back_forward_list_get_back_list_with_limit (source_bflist, EPHY_WEBKIT_BACK_FORWARD_LIMIT);
-  /* We want to add the items in the reverse order here, so the
-     history ends up the same */
-  items = g_list_reverse (items);
-  for (i = items; i; i = i->next) {
-    item = webkit_web_history_item_copy ((WebKitWebHistoryItem*)i->data);
-    webkit_web_back_forward_list_add_item (dest_bflist, item);
-    g_object_unref (item);
-  }
-  g_list_free (items);
+  copy_back_list (source_bflist, dest_bflist);
 
   /* The ephy/gecko behavior is to add the current item of the source
      embed at the end of the back history, so keep doing that */
@@ -3703,186 +3902,222 @@ ephy_web_view_get_title_composite (EphyWebView *view)
 #ifdef HAVE_WEBKIT2
 /* TODO: webkit_web_view_save() */
 #else
-static void
-ephy_web_view_save_sub_resource_start (GList *subresources, char *destination_uri);
+/* How many files are written at once when saving a page. */
+#define SAVE_MAX_WRITERS 6
 
-static void
-ephy_web_view_close_cb (GOutputStream *ostream, GAsyncResult *result, GString *data)
-{
-  GList *subresources;
-  char *destination_uri;
-  GError *error = NULL;
+typedef struct {
+  EphyWebView *view;
+  GCancellable *cancellable;
+  EphyWebViewSaveProgressFunc progress_func;
+  EphyWebViewSaveCallback callback;
+  gpointer user_data;
+
+  GQueue pending;
+  guint n_writers;
+  guint n_saved;
+  guint n_total;
+  gboolean failed;
+} SaveJob;
 
-  subresources = (GList*)g_object_get_data (G_OBJECT (ostream),
-                                            "ephy-web-view-save-subresources");
+typedef struct {
+  SaveJob *job;
+  GFile *file;
+  GOutputStream *ostream;
 
-  destination_uri = (char*)g_object_get_data (G_OBJECT (ostream),
-                                              "ephy-web-view-save-dest-uri");
+  /* The data belongs to owner, a resource or data source. */
+  GObject *owner;
+  const GString *data;
+  gsize written;
+} SaveWriter;
 
-  g_output_stream_close_finish (ostream, result, &error);
-  g_object_unref (ostream);
+static SaveWriter *
+save_writer_new (SaveJob *job, GFile *file, GObject *owner, const GString *data)
+{
+  SaveWriter *writer;
 
-  if (error) {
-    g_list_free (subresources);
-    g_free (destination_uri);
-    g_warning ("Unable to write to file: %s", error->message);
-    g_error_free (error);
-    return;
-  }
+  writer = g_slice_new0 (SaveWriter);
+  writer->job = job;
+  writer->file = file;
+  writer->owner = g_object_ref (owner);
+  writer->data = data;
 
-  if (!subresources || !subresources->next) {
-    g_list_free (subresources);
-    g_free (destination_uri);
-    return;
-  }
+  return writer;
+}
+
+static void
+save_writer_free (SaveWriter *writer)
+{
+  g_object_unref (writer->file);
+  if (writer->ostream)
+    g_object_unref (writer->ostream);
+  g_object_unref (writer->owner);
 
-  subresources = subresources->next;
-  ephy_web_view_save_sub_resource_start (subresources, destination_uri);
+  g_slice_free (SaveWriter, writer);
 }
 
 static void
-ephy_web_view_save_write_cb (GOutputStream *ostream, GAsyncResult *result, GString *data)
+save_job_finish (SaveJob *job)
 {
-  GError *error = NULL;
-  gssize written;
+  LOG ("Saved %u of %u files", job->n_saved, job->n_total);
 
-  written = g_output_stream_write_finish (ostream, result, &error);
-  if (error) {
-    GList *subresources;
-    char *destination_uri;
+  if (job->callback)
+    job->callback (job->view, !job->failed, job->user_data);
 
-    subresources = (GList*)g_object_get_data (G_OBJECT (ostream),
-                                             "ephy-web-view-save-subresources");
-    g_list_free (subresources);
+  g_queue_foreach (&job->pending, (GFunc)save_writer_free, NULL);
+  g_queue_clear (&job->pending);
+
+  if (job->cancellable)
+    g_object_unref (job->cancellable);
+  g_object_unref (job->view);
+
+  g_slice_free (SaveJob, job);
+}
 
-    destination_uri = (char*)g_object_get_data (G_OBJECT (ostream),
-                                                "ephy-web-view-save-dest-uri");
-    g_free (destination_uri);
+static void save_writer_start (SaveWriter *writer);
 
-    g_string_free (data, FALSE);
-    g_object_unref (ostream);
+static void
+save_writer_done (SaveWriter *writer, GError *error)
+{
+  SaveJob *job = writer->job;
 
-    g_warning ("Unable to write to file: %s", error->message);
+  if (error) {
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+      char *name = g_file_get_parse_name (writer->file);
+      g_warning ("Failed to save %s: %s", name, error->message);
+      g_free (name);
+    }
 
+    job->failed = TRUE;
     g_error_free (error);
-    return;
+  } else {
+    job->n_saved++;
+    if (job->progress_func)
+      job->progress_func (job->n_saved, job->n_total, job->user_data);
   }
 
-  if (written == data->len) {
-    g_string_free (data, FALSE);
-    g_output_stream_close_async (ostream, G_PRIORITY_DEFAULT, NULL,
-                                 (GAsyncReadyCallback)ephy_web_view_close_cb,
-                                 NULL);
-    return;
-  }
+  save_writer_free (writer);
+  job->n_writers--;
 
-  data->len -= written;
-  data->str += written;
+  /* Once a file fails, or the save is cancelled, no more are started,
+   * but the ones being written are left to finish. */
+  if (g_cancellable_is_cancelled (job->cancellable))
+    job->failed = TRUE;
 
-  g_output_stream_write_async (ostream,
-                               data->str, data->len,
-                               G_PRIORITY_DEFAULT, NULL,
-                               (GAsyncReadyCallback)ephy_web_view_save_write_cb,
-                               data);
+  if (!job->failed && !g_queue_is_empty (&job->pending)) {
+    job->n_writers++;
+    save_writer_start (g_queue_pop_head (&job->pending));
+  } else if (job->n_writers == 0)
+    save_job_finish (job);
 }
 
 static void
-ephy_web_view_save_replace_cb (GFile *file, GAsyncResult *result, GString *const_data)
+save_close_cb (GOutputStream *ostream, GAsyncResult *result, SaveWriter *writer)
 {
-  GFileOutputStream *ostream;
-  GList *subresources;
-  char *destination_uri;
-  GString *data;
   GError *error = NULL;
 
-  subresources = (GList*)g_object_get_data (G_OBJECT (file),
-                                            "ephy-web-view-save-subresources");
-
-  destination_uri = (char*)g_object_get_data (G_OBJECT (file),
-                                              "ephy-web-view-save-dest-uri");
-
-  ostream = g_file_replace_finish (file, result, &error);
-  if (error) {
-    g_warning ("Failed to save page: %s", error->message);
-    g_list_free (subresources);
-    g_free (destination_uri);
-    g_error_free (error);
-    return;
-  }
+  g_output_stream_close_finish (ostream, result, &error);
+  save_writer_done (writer, error);
+}
 
-  if (const_data) {
-    data = g_string_sized_new (const_data->len);
-    data->str = const_data->str;
-    data->len = const_data->len;
-  } else
-    data = g_string_new ("");
+static void save_writer_write (SaveWriter *writer);
 
-  /* If we have subresources to handle, pass the information along */
-  if (subresources) {
-    g_object_set_data (G_OBJECT (ostream),
-                       "ephy-web-view-save-subresources",
-                       subresources);
+static void
+save_write_cb (GOutputStream *ostream, GAsyncResult *result, SaveWriter *writer)
+{
+  GError *error = NULL;
+  gssize written;
 
-    g_object_set_data (G_OBJECT (ostream),
-                       "ephy-web-view-save-dest-uri",
-                       destination_uri);
+  written = g_output_stream_write_finish (ostream, result, &error);
+  if (written < 0) {
+    save_writer_done (writer, error);
+    return;
   }
 
-  g_output_stream_write_async (G_OUTPUT_STREAM (ostream),
-                               data->str, data->len,
-                               G_PRIORITY_DEFAULT, NULL,
-                               (GAsyncReadyCallback)ephy_web_view_save_write_cb,
-                               data);
+  writer->written += written;
+  save_writer_write (writer);
 }
 
 static void
-ephy_web_view_save_sub_resource_start (GList *subresources, char *destination_uri)
+save_writer_write (SaveWriter *writer)
 {
-  WebKitWebResource *resource;
-  GFile *file;
-  const char *resource_uri;
-  char *resource_basename;
-  char *resource_name;
-  char *resource_dest_uri;
-  const GString *data;
-
-  resource = WEBKIT_WEB_RESOURCE (subresources->data);
-
-  resource_uri = webkit_web_resource_get_uri (resource);
-  resource_basename = g_path_get_basename (resource_uri);
-
-  resource_name = g_uri_escape_string (resource_basename, NULL, TRUE);
-  g_free (resource_basename);
+  GCancellable *cancellable = writer->job->cancellable;
+
+  /* Straight from the resource, which outlives the writer. */
+  if (writer->data && writer->written < writer->data->len)
+    g_output_stream_write_async (writer->ostream,
+                                 writer->data->str + writer->written,
+                                 writer->data->len - writer->written,
+                                 G_PRIORITY_DEFAULT, cancellable,
+                                 (GAsyncReadyCallback)save_write_cb,
+                                 writer);
+  else
+    g_output_stream_close_async (writer->ostream,
+                                 G_PRIORITY_DEFAULT, cancellable,
+                                 (GAsyncReadyCallback)save_close_cb,
+                                 writer);
+}
 
-  resource_dest_uri = g_strdup_printf ("%s/%s", destination_uri, resource_name);
-  g_free (resource_name);
+static void
+save_replace_cb (GFile *file, GAsyncResult *result, SaveWriter *writer)
+{
+  GFileOutputStream *ostream;
+  GError *error = NULL;
 
-  file = g_file_new_for_uri (resource_dest_uri);
-  g_free (resource_dest_uri);
+  ostream = g_file_replace_finish (file, result, &error);
+  if (ostream == NULL) {
+    save_writer_done (writer, error);
+    return;
+  }
 
-  g_object_set_data (G_OBJECT (file),
-                     "ephy-web-view-save-dest-uri",
-                     destination_uri);
+  writer->ostream = G_OUTPUT_STREAM (ostream);
+  save_writer_write (writer);
+}
 
-  g_object_set_data (G_OBJECT (file),
-                     "ephy-web-view-save-subresources",
-                     subresources);
+static void
+save_writer_start (SaveWriter *writer)
+{
+  g_file_replace_async (writer->file, NULL, FALSE,
+                        G_FILE_CREATE_REPLACE_DESTINATION|G_FILE_CREATE_PRIVATE,
+                        G_PRIORITY_DEFAULT, writer->job->cancellable,
+                        (GAsyncReadyCallback)save_replace_cb,
+                        writer);
+}
 
-  data = webkit_web_resource_get_data (resource);
+/* Returns a file name for @resource that is not in @names yet, and adds
+ * it there. The name is the last component of the resource URI as it
+ * appears there, query included, so it is used as a plain file name. */
+static const char *
+get_sub_resource_name (WebKitWebResource *resource, GHashTable *names)
+{
+  char *name, *unique, *dot;
+  guint i;
+
+  name = g_path_get_basename (webkit_web_resource_get_uri (resource));
+
+  /* Many pages have several resources with the same name in different
+   * directories, so number the repeated ones before the extension. */
+  unique = g_strdup (name);
+  dot = strrchr (name, '.');
+  for (i = 1; g_hash_table_lookup (names, unique); i++) {
+    g_free (unique);
+    if (dot && dot != name)
+      unique = g_strdup_printf ("%.*s-%u%s", (int)(dot - name), name, i, dot);
+    else
+      unique = g_strdup_printf ("%s-%u", name, i);
+  }
+  g_free (name);
 
-  g_file_replace_async (file, NULL, FALSE,
-                        G_FILE_CREATE_REPLACE_DESTINATION|G_FILE_CREATE_PRIVATE,
-                        G_PRIORITY_DEFAULT, NULL,
-                        (GAsyncReadyCallback)ephy_web_view_save_replace_cb,
-                        (GString*)data);
+  g_hash_table_insert (names, unique, unique);
 
-  g_object_unref (file);
+  return unique;
 }
 
 static void
-ephy_web_view_save_sub_resources (EphyWebView *view, const char *uri, GList *subresources)
+ephy_web_view_save_sub_resources (SaveJob *job, const char *uri, GList *subresources)
 {
   GFile *file;
+  GHashTable *names;
+  GList *l;
   char *filename;
   char *dotpos;
   char *directory_uri;
@@ -3915,57 +4150,111 @@ ephy_web_view_save_sub_resources (EphyWebView *view, const char *uri, GList *sub
       g_warning ("Could not create directory: %s", error->message);
       g_error_free (error);
       g_object_unref (file);
+      g_free (destination_uri);
       return;
     }
+    g_error_free (error);
   }
-  g_object_unref (file);
 
-  /* Now, let's start saving sub resources */
-  ephy_web_view_save_sub_resource_start (subresources, destination_uri);
+  names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  for (l = subresources; l; l = l->next) {
+    WebKitWebResource *resource = WEBKIT_WEB_RESOURCE (l->data);
+
+    g_queue_push_tail (&job->pending,
+                       save_writer_new (job,
+                                        g_file_get_child (file, get_sub_resource_name (resource, names)),
+                                        G_OBJECT (resource),
+                                        webkit_web_resource_get_data (resource)));
+  }
+
+  g_hash_table_destroy (names);
+  g_object_unref (file);
+  g_free (destination_uri);
 }
 #endif
+
 /**
- * ephy_web_view_save:
+ * ephy_web_view_save_full:
  * @view: an #EphyWebView
  * @uri: location to store the saved page
+ * @cancellable: (allow-none): a #GCancellable, or %NULL
+ * @progress_func: (allow-none): called every time a file is saved
+ * @callback: (allow-none): called once the save finished
+ * @user_data: data for @progress_func and @callback
  *
- * Saves the currently loaded page of @view to @uri.
+ * Saves the currently loaded page of @view to @uri, and the images,
+ * style sheets and other resources it uses to a directory next to it.
+ * Several files are written at once, straight from the data @view holds.
+ * Cancelling @cancellable stops the save; @callback then gets %FALSE.
  **/
 void
-ephy_web_view_save (EphyWebView *view, const char *uri)
+ephy_web_view_save_full (EphyWebView *view,
+                         const char *uri,
+                         GCancellable *cancellable,
+                         EphyWebViewSaveProgressFunc progress_func,
+                         EphyWebViewSaveCallback callback,
+                         gpointer user_data)
 {
 #ifdef HAVE_WEBKIT2
   /* TODO: webkit_web_view_save() */
+  if (callback)
+    callback (view, FALSE, user_data);
 #else
   WebKitWebFrame *frame;
   WebKitWebDataSource *data_source;
   GList *subresources;
-  const GString *data;
-  GFile *file;
+  SaveJob *job;
 
-  /* Save main resource */
-  frame = webkit_web_view_get_main_frame (WEBKIT_WEB_VIEW(view));
+  g_return_if_fail (EPHY_IS_WEB_VIEW (view));
+  g_return_if_fail (uri != NULL);
+
+  job = g_slice_new0 (SaveJob);
+  job->view = g_object_ref (view);
+  job->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
+  job->progress_func = progress_func;
+  job->callback = callback;
+  job->user_data = user_data;
+  g_queue_init (&job->pending);
+
+  /* Main resource first */
+  frame = webkit_web_view_get_main_frame (WEBKIT_WEB_VIEW (view));
   data_source = webkit_web_frame_get_data_source (frame);
-  data = webkit_web_data_source_get_data (data_source);
-
-  file = g_file_new_for_uri (uri);
-  g_file_replace_async (file, NULL, FALSE,
-                        G_FILE_CREATE_REPLACE_DESTINATION|G_FILE_CREATE_PRIVATE,
-                        G_PRIORITY_DEFAULT, NULL,
-                        (GAsyncReadyCallback)ephy_web_view_save_replace_cb,
-                        (GString*)data);
 
-  g_object_unref (file);
+  g_queue_push_tail (&job->pending,
+                     save_writer_new (job, g_file_new_for_uri (uri),
+                                      G_OBJECT (data_source),
+                                      webkit_web_data_source_get_data (data_source)));
 
-  /* If subresources exist, save them */
+  /* If subresources exist, save them too */
   subresources = webkit_web_data_source_get_subresources (data_source);
-  if (!subresources)
-    return;
+  if (subresources) {
+    ephy_web_view_save_sub_resources (job, uri, subresources);
+    g_list_free (subresources);
+  }
+
+  job->n_total = g_queue_get_length (&job->pending);
 
-  ephy_web_view_save_sub_resources (view, uri, subresources);
+  while (job->n_writers < SAVE_MAX_WRITERS && !g_queue_is_empty (&job->pending)) {
+    job->n_writers++;
+    save_writer_start (g_queue_pop_head (&job->pending));
+  }
 #endif
 }
 
+/**
+ * ephy_web_view_save:
+ * @view: an #EphyWebView
+ * @uri: location to store the saved page
+ *
+ * Saves the currently loaded page of @view to @uri.
+ **/
+void
+ephy_web_view_save (EphyWebView *view, const char *uri)
+{
+  ephy_web_view_save_full (view, uri, NULL, NULL, NULL, NULL);
+}
+
 /**
  * ephy_web_view_load_homepage:
  * @view: an #EphyWebView
@@ -134,6 +134,13 @@ void                       ephy_web_view_load_request             (EphyWebView
 #endif
 void                       ephy_web_view_load_url                 (EphyWebView               *view,
                                                                    const char                *url);
+void                       ephy_web_view_set_placeholder          (EphyWebView               *view,
+                                                                   const char                *uri,
+                                                                   const char                *title);
+gboolean                   ephy_web_view_is_placeholder           (EphyWebView               *view);
+void                       ephy_web_view_load_placeholder         (EphyWebView               *view);
+void                       ephy_web_view_copy_placeholder         (EphyWebView               *source,
+                                                                   EphyWebView               *dest);
 void                       ephy_web_view_copy_back_history        (EphyWebView               *source,
                                                                    EphyWebView               *dest);
 gboolean                   ephy_web_view_is_loading               (EphyWebView               *view);
@@ -42,6 +42,8 @@ static const char *ephy_debug_break = NULL;
 
 #ifndef DISABLE_PROFILING
 static GHashTable *ephy_profilers_hash = NULL;
+/* Profilers are also used from worker threads. */
+static GMutex ephy_profilers_lock;
 static char **ephy_profile_modules;
 static gboolean ephy_profile_all_modules;
 #endif /* !DISABLE_PROFILING */
@@ -267,6 +269,13 @@ ephy_profiler_start (const char *name, const char *module)
 {
 	EphyProfiler *profiler;
 
+	if (!ephy_profile_all_modules &&
+	    (ephy_profile_modules == NULL || !ephy_should_profile (module))) return;
+
+	profiler = ephy_profiler_new (name, module);
+
+	g_mutex_lock (&ephy_profilers_lock);
+
 	if (ephy_profilers_hash == NULL)
 	{
 		ephy_profilers_hash =
@@ -274,12 +283,9 @@ ephy_profiler_start (const char *name, const char *module)
 					       g_free, NULL);
 	}
 
-	if (!ephy_profile_all_modules &&
-	    (ephy_profile_modules == NULL || !ephy_should_profile (module))) return;
-
-	profiler = ephy_profiler_new (name, module);
-
 	g_hash_table_insert (ephy_profilers_hash, g_strdup (name), profiler);
+
+	g_mutex_unlock (&ephy_profilers_lock);
 }
 
 /**
@@ -291,11 +297,22 @@ ephy_profiler_start (const char *name, const char *module)
 void
 ephy_profiler_stop (const char *name)
 {
-	EphyProfiler *profiler;
+	EphyProfiler *profiler = NULL;
+
+	g_mutex_lock (&ephy_profilers_lock);
+
+	if (ephy_profilers_hash != NULL)
+	{
+		profiler = g_hash_table_lookup (ephy_profilers_hash, name);
+		if (profiler != NULL)
+		{
+			g_hash_table_remove (ephy_profilers_hash, name);
+		}
+	}
+
+	g_mutex_unlock (&ephy_profilers_lock);
 
-	profiler = g_hash_table_lookup (ephy_profilers_hash, name);
 	if (profiler == NULL) return;
-	g_hash_table_remove (ephy_profilers_hash, name);
 
 	ephy_profiler_dump (profiler);
 	ephy_profiler_free (profiler);
@@ -0,0 +1,264 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2012 Igalia S.L.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include "config.h"
+#include "ephy-latency-tracker.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * SECTION:ephy-latency-tracker
+ * @short_description: Keystroke to completion popup latency accounting
+ *
+ * The location entry, the completion model and the history service
+ * mark the stages of a completion cycle as they go through them. Each
+ * stage is stored as the time elapsed since the keystroke that started
+ * the cycle, in a rolling window of the most recent samples.
+ *
+ * A stage is only accepted when the stage before it was already marked
+ * in the current cycle. This keeps unrelated history queries, and
+ * cycles superseded by a newer keystroke, out of the numbers.
+ *
+ * If the EPHY_LATENCY_TRACE environment variable is set, every finished
+ * cycle is also appended to the file it names, one line per cycle.
+ */
+
+#define N_SAMPLES 256
+
+typedef struct {
+  gint64 samples[N_SAMPLES];
+  guint n_samples;
+  guint next;
+} LatencyWindow;
+
+static GMutex tracker_lock;
+static gint64 current_cycle[EPHY_LATENCY_STAGE_LAST];
+static LatencyWindow windows[EPHY_LATENCY_STAGE_LAST];
+static guint n_cycles;
+static guint n_superseded;
+static FILE *trace_file;
+
+static const char *stage_names[EPHY_LATENCY_STAGE_LAST] = {
+  "Keystroke",
+  "Query dispatched",
+  "History thread start",
+  "History thread end",
+  "Query completed",
+  "Model replaced"
+};
+
+static FILE *
+get_trace_file (void)
+{
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized)) {
+    const char *filename = g_getenv ("EPHY_LATENCY_TRACE");
+
+    if (filename != NULL && filename[0] != '\0') {
+      trace_file = fopen (filename, "a");
+      if (trace_file)
+        setvbuf (trace_file, NULL, _IOLBF, 0);
+      else
+        g_warning ("Could not open latency trace file %s", filename);
+    }
+
+    g_once_init_leave (&initialized, 1);
+  }
+
+  return trace_file;
+}
+
+static void
+window_add_sample (LatencyWindow *window, gint64 sample)
+{
+  window->samples[window->next] = sample;
+  window->next = (window->next + 1) % N_SAMPLES;
+
+  if (window->n_samples < N_SAMPLES)
+    window->n_samples++;
+}
+
+static void
+write_trace_line (FILE *file)
+{
+  int i;
+
+  fprintf (file, "%u\t%" G_GINT64_FORMAT, n_cycles, current_cycle[EPHY_LATENCY_STAGE_KEYSTROKE]);
+
+  for (i = EPHY_LATENCY_STAGE_KEYSTROKE + 1; i < EPHY_LATENCY_STAGE_LAST; i++)
+    fprintf (file, "\t%" G_GINT64_FORMAT,
+             current_cycle[i] - current_cycle[EPHY_LATENCY_STAGE_KEYSTROKE]);
+
+  fputc ('\n', file);
+}
+
+/**
+ * ephy_latency_tracker_mark:
+ * @stage: the #EphyLatencyStage that was just reached
+ *
+ * Records that the current completion cycle reached @stage. Marking
+ * %EPHY_LATENCY_STAGE_KEYSTROKE starts a new cycle. This can be called
+ * from any thread.
+ **/
+void
+ephy_latency_tracker_mark (EphyLatencyStage stage)
+{
+  gint64 now;
+  FILE *file;
+
+  g_return_if_fail (stage < EPHY_LATENCY_STAGE_LAST);
+
+  now = g_get_monotonic_time ();
+  file = get_trace_file ();
+
+  g_mutex_lock (&tracker_lock);
+
+  if (stage == EPHY_LATENCY_STAGE_KEYSTROKE) {
+    if (current_cycle[EPHY_LATENCY_STAGE_KEYSTROKE] != 0)
+      n_superseded++;
+
+    memset (current_cycle, 0, sizeof (current_cycle));
+    current_cycle[EPHY_LATENCY_STAGE_KEYSTROKE] = now;
+    goto out;
+  }
+
+  if (current_cycle[stage - 1] == 0 || current_cycle[stage] != 0)
+    goto out;
+
+  current_cycle[stage] = now;
+  window_add_sample (&windows[stage], now - current_cycle[EPHY_LATENCY_STAGE_KEYSTROKE]);
+
+  if (stage == EPHY_LATENCY_STAGE_LAST - 1) {
+    n_cycles++;
+
+    if (file)
+      write_trace_line (file);
+
+    /* The cycle is over, ignore any further marks until the next
+     * keystroke. */
+    current_cycle[EPHY_LATENCY_STAGE_KEYSTROKE] = 0;
+  }
+
+out:
+  g_mutex_unlock (&tracker_lock);
+}
+
+static int
+compare_samples (gconstpointer a, gconstpointer b)
+{
+  gint64 sample_a = *(gint64 *)a;
+  gint64 sample_b = *(gint64 *)b;
+
+  if (sample_a < sample_b)
+    return -1;
+  if (sample_a > sample_b)
+    return 1;
+  return 0;
+}
+
+/**
+ * ephy_latency_tracker_get_percentiles:
+ * @stage: an #EphyLatencyStage
+ * @p50: (out) (allow-none): return location for the median, in microseconds
+ * @p90: (out) (allow-none): return location for the 90th percentile
+ * @p99: (out) (allow-none): return location for the 99th percentile
+ * @n_samples: (out) (allow-none): return location for the number of samples
+ *
+ * Computes the percentiles of the time elapsed between the keystroke and
+ * @stage over the recent completion cycles.
+ *
+ * Returns: %TRUE if there were samples for @stage
+ **/
+gboolean
+ephy_latency_tracker_get_percentiles (EphyLatencyStage stage,
+                                      gint64 *p50,
+                                      gint64 *p90,
+                                      gint64 *p99,
+                                      guint *n_samples)
+{
+  gint64 sorted[N_SAMPLES];
+  guint n;
+
+  g_return_val_if_fail (stage < EPHY_LATENCY_STAGE_LAST, FALSE);
+
+  g_mutex_lock (&tracker_lock);
+  n = windows[stage].n_samples;
+  memcpy (sorted, windows[stage].samples, n * sizeof (gint64));
+  g_mutex_unlock (&tracker_lock);
+
+  if (n_samples)
+    *n_samples = n;
+
+  if (n == 0)
+    return FALSE;
+
+  qsort (sorted, n, sizeof (gint64), compare_samples);
+
+  if (p50)
+    *p50 = sorted[(n - 1) * 50 / 100];
+  if (p90)
+    *p90 = sorted[(n - 1) * 90 / 100];
+  if (p99)
+    *p99 = sorted[(n - 1) * 99 / 100];
+
+  return TRUE;
+}
+
+/**
+ * ephy_latency_tracker_to_html:
+ *
+ * Returns: a newly allocated HTML table with the latency percentiles
+ * of every completion stage
+ **/
+char *
+ephy_latency_tracker_to_html (void)
+{
+  GString *str;
+  guint cycles, superseded;
+  int i;
+
+  g_mutex_lock (&tracker_lock);
+  cycles = n_cycles;
+  superseded = n_superseded;
+  g_mutex_unlock (&tracker_lock);
+
+  str = g_string_new ("<table class=\"memory-table\"><caption>Time since keystroke (ms)</caption>");
+  g_string_append (str, "<thead><tr><th>Stage</th><th>Samples</th><th>50%</th><th>90%</th><th>99%</th></tr></thead><tbody>");
+
+  for (i = EPHY_LATENCY_STAGE_KEYSTROKE + 1; i < EPHY_LATENCY_STAGE_LAST; i++) {
+    gint64 p50, p90, p99;
+    guint n;
+
+    if (ephy_latency_tracker_get_percentiles (i, &p50, &p90, &p99, &n))
+      g_string_append_printf (str, "<tr><td>%s</td><td>%u</td><td>%.1f</td><td>%.1f</td><td>%.1f</td></tr>",
+                              stage_names[i], n, p50 / 1000.0, p90 / 1000.0, p99 / 1000.0);
+    else
+      g_string_append_printf (str, "<tr><td>%s</td><td>0</td><td></td><td></td><td></td></tr>",
+                              stage_names[i]);
+  }
+
+  g_string_append_printf (str, "</tbody></table><p>Completed cycles: %u, superseded by a newer keystroke: %u</p>",
+                          cycles, superseded);
+
+  return g_string_free (str, FALSE);
+}
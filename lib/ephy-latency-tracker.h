@@ -0,0 +1,52 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2012 Igalia S.L.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef EPHY_LATENCY_TRACKER_H
+#define EPHY_LATENCY_TRACKER_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Stages of a location entry completion cycle, in the order in which
+ * they are expected to happen. */
+typedef enum {
+  EPHY_LATENCY_STAGE_KEYSTROKE,
+  EPHY_LATENCY_STAGE_QUERY_DISPATCH,
+  EPHY_LATENCY_STAGE_HISTORY_START,
+  EPHY_LATENCY_STAGE_HISTORY_END,
+  EPHY_LATENCY_STAGE_QUERY_COMPLETED,
+  EPHY_LATENCY_STAGE_MODEL_REPLACED,
+  EPHY_LATENCY_STAGE_LAST
+} EphyLatencyStage;
+
+void     ephy_latency_tracker_mark            (EphyLatencyStage stage);
+
+gboolean ephy_latency_tracker_get_percentiles (EphyLatencyStage stage,
+                                               gint64 *p50,
+                                               gint64 *p90,
+                                               gint64 *p99,
+                                               guint *n_samples);
+
+char    *ephy_latency_tracker_to_html         (void);
+
+G_END_DECLS
+
+#endif /* EPHY_LATENCY_TRACKER_H */
@@ -24,10 +24,15 @@
 #include "ephy-node-db.h"
 #include "ephy-file-helpers.h"
 #include "ephy-debug.h"
+#include "ephy-node-index.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
 #include <libxml/xmlreader.h>
 #include <libxml/xmlwriter.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/stat.h>
 
@@ -48,9 +53,30 @@ struct _EphyNodeDbPrivate
 	char *name;
 	gboolean immutable;
 
-	guint id_factory;
-
 	GPtrArray *id_to_node;
+
+	/* Unused ids below id_to_node->len, see _ephy_node_db_new_id(). */
+	GArray *free_ids;
+
+	/* String property values, shared by all the nodes. */
+	GHashTable *strings;
+
+	/* Parent node id to the GSList of its indexes. */
+	GHashTable *indexes;
+
+	/* See ephy_node_db_begin_batch(). */
+	guint batch_depth;
+	EphyNodeBatch *batch;
+
+	/* The change journal, see ephy_node_db_enable_journal(). */
+	char *journal_file;
+	int journal_fd;
+	gsize journal_size;
+	GString *journal_buffer;
+	gboolean journal_replayed;
+	gboolean journal_invalid;
+	gsize journal_valid_size;
+	gsize journal_old_valid_size;
 };
 
 static GObjectClass *parent_class = NULL;
@@ -109,7 +135,22 @@ ephy_node_db_init (EphyNodeDb *db)
 	db->priv->id_to_node = g_ptr_array_new_with_free_func ((GDestroyNotify)ephy_node_db_free_func);
 
 	/* id factory */
-	db->priv->id_factory = RESERVED_IDS;
+	db->priv->free_ids = g_array_new (FALSE, FALSE, sizeof (guint));
+
+	db->priv->strings = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, g_free);
+
+	db->priv->indexes = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+	db->priv->journal_fd = -1;
+	db->priv->journal_buffer = g_string_new (NULL);
+}
+
+static void
+free_indexes (gpointer parent_id,
+	      GSList *indexes,
+	      gpointer user_data)
+{
+	g_slist_free_full (indexes, (GDestroyNotify) _ephy_node_index_free);
 }
 
 static void
@@ -117,7 +158,18 @@ ephy_node_db_finalize (GObject *object)
 {
 	EphyNodeDb *db = EPHY_NODE_DB (object);
 
+	/* Destroying the nodes below is not a change to be journaled. */
+	ephy_node_db_disable_journal (db);
+	g_string_free (db->priv->journal_buffer, TRUE);
+
+	/* Nor is it worth keeping the indexes up to date. */
+	g_hash_table_foreach (db->priv->indexes, (GHFunc) free_indexes, NULL);
+	g_hash_table_remove_all (db->priv->indexes);
+
 	g_ptr_array_free (db->priv->id_to_node, TRUE);
+	g_array_free (db->priv->free_ids, TRUE);
+	g_hash_table_destroy (db->priv->strings);
+	g_hash_table_destroy (db->priv->indexes);
 
 	g_free (db->priv->name);
 
@@ -216,19 +268,35 @@ ephy_node_db_get_node_from_id (EphyNodeDb *db, guint id)
 	return ret;
 }
 
+static inline void
+push_free_id (EphyNodeDb *db, guint id)
+{
+	g_array_append_val (db->priv->free_ids, id);
+}
+
+/*
+ * Ids are handed out from a stack of the holes in id_to_node, and
+ * past its end once there are none. Nodes created with an explicit id,
+ * as when loading, can take an id that is still on the stack, so
+ * entries are checked when popped instead of being searched for and
+ * removed then. Either way allocating and releasing an id is O(1).
+ */
 guint
 _ephy_node_db_new_id (EphyNodeDb *db)
 {
-	guint ret;
+	GArray *free_ids = db->priv->free_ids;
 
-	while (node_from_id_real (db, db->priv->id_factory) != NULL)
+	while (free_ids->len > 0)
 	{
-		db->priv->id_factory++;
-	}
+		guint id;
 
-	ret = db->priv->id_factory;
+		id = g_array_index (free_ids, guint, free_ids->len - 1);
+		g_array_set_size (free_ids, free_ids->len - 1);
 
-	return ret;
+		if (node_from_id_real (db, id) == NULL) return id;
+	}
+
+	return MAX (db->priv->id_to_node->len, RESERVED_IDS);
 }
 
 void
@@ -238,7 +306,17 @@ _ephy_node_db_add_id (EphyNodeDb *db,
 {
 	/* resize array if needed */
 	if (id >= db->priv->id_to_node->len)
+	{
+		guint i;
+
+		/* The ids skipped over are holes. */
+		for (i = MAX (db->priv->id_to_node->len, RESERVED_IDS); i < id; i++)
+		{
+			push_free_id (db, i);
+		}
+
 		g_ptr_array_set_size (db->priv->id_to_node, id + 1);
+	}
 
 	g_ptr_array_index (db->priv->id_to_node, id) = node;
 }
@@ -249,8 +327,385 @@ _ephy_node_db_remove_id (EphyNodeDb *db,
 {
 	g_ptr_array_index (db->priv->id_to_node, id) = NULL;
 
-	/* reset id factory so we use the freed node id */
-	db->priv->id_factory = RESERVED_IDS;
+	if (id >= RESERVED_IDS)
+		push_free_id (db, id);
+}
+
+/*
+ * Interned strings
+ *
+ * Titles, topics and the like repeat a lot across nodes, so string
+ * properties point into a refcounted table owned by the db. The count
+ * lives right before the characters, so releasing a string only needs
+ * a lookup once its last user is gone.
+ */
+
+typedef struct
+{
+	guint ref_count;
+	char string[1];
+} InternedString;
+
+#define INTERNED_STRING(str) \
+	((InternedString *) ((str) - G_STRUCT_OFFSET (InternedString, string)))
+
+const char *
+_ephy_node_db_intern_string (EphyNodeDb *db,
+			     const char *string)
+{
+	InternedString *interned;
+	gsize len;
+
+	if (string == NULL) return NULL;
+
+	interned = g_hash_table_lookup (db->priv->strings, string);
+	if (interned == NULL)
+	{
+		len = strlen (string);
+		interned = g_malloc (G_STRUCT_OFFSET (InternedString, string) + len + 1);
+		interned->ref_count = 0;
+		memcpy (interned->string, string, len + 1);
+
+		g_hash_table_insert (db->priv->strings, interned->string, interned);
+	}
+
+	interned->ref_count++;
+
+	return interned->string;
+}
+
+void
+_ephy_node_db_release_string (EphyNodeDb *db,
+			      const char *string)
+{
+	InternedString *interned;
+
+	if (string == NULL) return;
+
+	interned = INTERNED_STRING (string);
+	if (--interned->ref_count == 0)
+	{
+		g_hash_table_remove (db->priv->strings, string);
+	}
+}
+
+/**
+ * ephy_node_db_compact_ids:
+ * @db: an #EphyNodeDb
+ *
+ * Releases the memory used to map the unused ids at the end of the id
+ * range of @db, and rebuilds the list of unused ids so that the lowest
+ * ones are handed out first. Ids of existing nodes do not change.
+ *
+ * This walks every id, so it is meant to be called when @db is saved
+ * rather than after each change.
+ **/
+void
+ephy_node_db_compact_ids (EphyNodeDb *db)
+{
+	EphyNodeDbPrivate *priv;
+	guint len, i;
+
+	g_return_if_fail (EPHY_IS_NODE_DB (db));
+
+	priv = db->priv;
+
+	len = priv->id_to_node->len;
+	while (len > RESERVED_IDS &&
+	       g_ptr_array_index (priv->id_to_node, len - 1) == NULL)
+	{
+		len--;
+	}
+
+	/* GPtrArray never gives memory back when it shrinks, so copy it
+	 * if that is worth it. */
+	if (len < priv->id_to_node->len / 2)
+	{
+		GPtrArray *id_to_node;
+
+		id_to_node = g_ptr_array_new_with_free_func ((GDestroyNotify)ephy_node_db_free_func);
+		g_ptr_array_set_size (id_to_node, len);
+		memcpy (id_to_node->pdata, priv->id_to_node->pdata, len * sizeof (gpointer));
+
+		g_ptr_array_set_free_func (priv->id_to_node, NULL);
+		g_ptr_array_free (priv->id_to_node, TRUE);
+		priv->id_to_node = id_to_node;
+	}
+	else
+	{
+		g_ptr_array_set_size (priv->id_to_node, len);
+	}
+
+	g_array_free (priv->free_ids, TRUE);
+	priv->free_ids = g_array_new (FALSE, FALSE, sizeof (guint));
+
+	for (i = len; i > RESERVED_IDS; i--)
+	{
+		if (g_ptr_array_index (priv->id_to_node, i - 1) == NULL)
+			push_free_id (db, i - 1);
+	}
+}
+
+/**
+ * ephy_node_db_add_index:
+ * @db: an #EphyNodeDb
+ * @parent: the #EphyNode whose children will be indexed
+ * @property_id: the string property to index them by
+ * @key_func: (allow-none): a function mapping property values to the
+ * keys they are indexed by, or %NULL to use the values themselves
+ * @ordered: whether the index also supports prefix lookups
+ *
+ * Declares an index on the children of @parent, which is then kept up to
+ * date as their @property_id changes and as children are added to and
+ * removed from @parent. It is best declared before @db is populated.
+ *
+ * Return value: (transfer none): the new #EphyNodeIndex, owned by @db
+ * until @db or @parent are destroyed
+ **/
+EphyNodeIndex *
+ephy_node_db_add_index (EphyNodeDb *db,
+			EphyNode *parent,
+			guint property_id,
+			EphyNodeIndexKeyFunc key_func,
+			gboolean ordered)
+{
+	EphyNodeIndex *index;
+	gpointer parent_id;
+	GSList *indexes;
+
+	g_return_val_if_fail (EPHY_IS_NODE_DB (db), NULL);
+	g_return_val_if_fail (EPHY_IS_NODE (parent), NULL);
+	g_return_val_if_fail (ephy_node_get_db (parent) == db, NULL);
+
+	index = _ephy_node_index_new (parent, property_id, key_func, ordered);
+
+	parent_id = GUINT_TO_POINTER (ephy_node_get_id (parent));
+	indexes = g_hash_table_lookup (db->priv->indexes, parent_id);
+	g_hash_table_insert (db->priv->indexes, parent_id,
+			     g_slist_prepend (indexes, index));
+
+	return index;
+}
+
+/**
+ * ephy_node_db_begin_batch:
+ * @db: an #EphyNodeDb
+ *
+ * Starts a batch of changes to the nodes in @db. Until the matching
+ * ephy_node_db_end_batch(), the %EPHY_NODE_CHILD_ADDED signals are held
+ * back, and the %EPHY_NODE_CHANGED and %EPHY_NODE_CHILD_CHANGED signals
+ * are held back and emitted only once per node and property, so bulk
+ * changes do not make every listener react to each of them. Batches can
+ * be nested.
+ *
+ * Listeners must not rely on a node's state during a batch being the
+ * one they were last notified of. Other signals are emitted right away.
+ **/
+void
+ephy_node_db_begin_batch (EphyNodeDb *db)
+{
+	g_return_if_fail (EPHY_IS_NODE_DB (db));
+
+	if (db->priv->batch_depth++ == 0 && db->priv->batch == NULL)
+	{
+		db->priv->batch = _ephy_node_batch_new ();
+	}
+}
+
+/**
+ * ephy_node_db_end_batch:
+ * @db: an #EphyNodeDb
+ *
+ * Ends a batch started with ephy_node_db_begin_batch(), emitting the
+ * signals held back if it is the outermost one.
+ **/
+void
+ephy_node_db_end_batch (EphyNodeDb *db)
+{
+	EphyNodeBatch *batch;
+
+	g_return_if_fail (EPHY_IS_NODE_DB (db));
+	g_return_if_fail (db->priv->batch_depth > 0);
+
+	/* A batch started from a listener while the outer one is emitting
+	 * its signals has nothing of its own to emit. */
+	if (--db->priv->batch_depth > 0 || _ephy_node_batch_is_flushing (db->priv->batch)) return;
+
+	batch = db->priv->batch;
+
+	START_PROFILER ("Emitting batched node signals")
+	_ephy_node_batch_flush (batch);
+	STOP_PROFILER ("Emitting batched node signals")
+
+	db->priv->batch = NULL;
+	_ephy_node_batch_free (batch);
+}
+
+EphyNodeBatch *
+_ephy_node_db_get_batch (EphyNodeDb *db)
+{
+	return db->priv->batch;
+}
+
+GSList *
+_ephy_node_db_get_indexes (EphyNodeDb *db,
+			   guint parent_id)
+{
+	return g_hash_table_lookup (db->priv->indexes, GUINT_TO_POINTER (parent_id));
+}
+
+gboolean
+_ephy_node_db_has_indexes (EphyNodeDb *db)
+{
+	return g_hash_table_size (db->priv->indexes) > 0;
+}
+
+void
+_ephy_node_db_remove_indexes (EphyNodeDb *db,
+			      guint parent_id)
+{
+	GSList *indexes;
+
+	indexes = g_hash_table_lookup (db->priv->indexes, GUINT_TO_POINTER (parent_id));
+	if (indexes == NULL) return;
+
+	g_hash_table_remove (db->priv->indexes, GUINT_TO_POINTER (parent_id));
+	g_slist_free_full (indexes, (GDestroyNotify) _ephy_node_index_free);
+}
+
+/*
+ * Loading
+ *
+ * The reader runs on the calling thread and copies each <node> element
+ * out of the document, a chunk at a time. A thread pool parses the
+ * chunks into EphyNodeXmlRecords, and the calling thread creates the
+ * nodes from the parsed chunks strictly in document order. That way the
+ * result, and every signal emitted on the way, are the same as when
+ * creating one node after the other with ephy_node_new_from_xml().
+ */
+
+#define LOAD_CHUNK_SIZE 256
+#define LOAD_MAX_THREADS 4
+
+typedef struct
+{
+	GPtrArray *xml_nodes;
+	GPtrArray *records;
+	gboolean parsed;
+} LoadChunk;
+
+typedef struct
+{
+	EphyNodeDb *db;
+	GThreadPool *pool;
+	GQueue chunks;
+	LoadChunk *current;
+	GMutex lock;
+	GCond cond;
+} LoadContext;
+
+static void
+load_chunk_parse (LoadChunk *chunk,
+		  LoadContext *context)
+{
+	GPtrArray *records;
+	guint i;
+
+	records = g_ptr_array_sized_new (chunk->xml_nodes->len);
+
+	for (i = 0; i < chunk->xml_nodes->len; i++)
+	{
+		xmlNodePtr xml_node = g_ptr_array_index (chunk->xml_nodes, i);
+		EphyNodeXmlRecord *record;
+
+		/* Nodes without an id are skipped, as they always were. */
+		record = _ephy_node_xml_record_new (xml_node);
+		if (record != NULL)
+		{
+			g_ptr_array_add (records, record);
+		}
+
+		xmlFreeNode (xml_node);
+	}
+
+	g_mutex_lock (&context->lock);
+	chunk->records = records;
+	chunk->parsed = TRUE;
+	g_cond_broadcast (&context->cond);
+	g_mutex_unlock (&context->lock);
+}
+
+static void
+load_add_node (LoadContext *context,
+	       xmlNodePtr subtree)
+{
+	if (context->current == NULL)
+	{
+		context->current = g_slice_new0 (LoadChunk);
+		context->current->xml_nodes = g_ptr_array_sized_new (LOAD_CHUNK_SIZE);
+	}
+
+	g_ptr_array_add (context->current->xml_nodes, xmlCopyNode (subtree, 1));
+}
+
+static void
+load_submit_chunk (LoadContext *context,
+		   gboolean last)
+{
+	LoadChunk *chunk = context->current;
+
+	if (chunk == NULL) return;
+
+	context->current = NULL;
+	g_queue_push_tail (&context->chunks, chunk);
+
+	/* Nothing is left for this thread to do but wait for the last
+	 * chunk, so it might as well parse it. */
+	if (context->pool != NULL && !last)
+	{
+		g_thread_pool_push (context->pool, chunk, NULL);
+	}
+	else
+	{
+		load_chunk_parse (chunk, context);
+	}
+}
+
+static void
+load_create_nodes (LoadContext *context,
+		   gboolean wait)
+{
+	LoadChunk *chunk;
+
+	while ((chunk = g_queue_peek_head (&context->chunks)) != NULL)
+	{
+		gboolean parsed;
+		guint i;
+
+		g_mutex_lock (&context->lock);
+		while (wait && !chunk->parsed)
+		{
+			g_cond_wait (&context->cond, &context->lock);
+		}
+		parsed = chunk->parsed;
+		g_mutex_unlock (&context->lock);
+
+		if (!parsed) return;
+
+		g_queue_pop_head (&context->chunks);
+
+		for (i = 0; i < chunk->records->len; i++)
+		{
+			EphyNodeXmlRecord *record = g_ptr_array_index (chunk->records, i);
+
+			_ephy_node_new_from_xml_record (context->db, record);
+			_ephy_node_xml_record_free (record);
+		}
+
+		g_ptr_array_free (chunk->records, TRUE);
+		g_ptr_array_free (chunk->xml_nodes, TRUE);
+		g_slice_free (LoadChunk, chunk);
+	}
 }
 
 /**
@@ -277,8 +732,10 @@ ephy_node_db_load_from_file (EphyNodeDb *db,
 			     const xmlChar *xml_version)
 {
 	xmlTextReaderPtr reader;
+	LoadContext context = { 0, };
 	gboolean success = TRUE;
 	gboolean was_immutable;
+	long n_cpus;
 	int ret;
 
 	LOG ("ephy_node_db_load_from_file %s", xml_file);
@@ -299,6 +756,19 @@ ephy_node_db_load_from_file (EphyNodeDb *db,
 	was_immutable = db->priv->immutable;
 	db->priv->immutable = FALSE;
 
+	context.db = db;
+	g_queue_init (&context.chunks);
+	g_mutex_init (&context.lock);
+	g_cond_init (&context.cond);
+
+	n_cpus = sysconf (_SC_NPROCESSORS_ONLN);
+	if (n_cpus > 1)
+	{
+		context.pool = g_thread_pool_new ((GFunc) load_chunk_parse, &context,
+						  MIN (n_cpus, LOAD_MAX_THREADS),
+						  FALSE, NULL);
+	}
+
 	ret = xmlTextReaderRead (reader);
 	while (ret == 1)
 	{
@@ -319,9 +789,16 @@ ephy_node_db_load_from_file (EphyNodeDb *db,
 
 			if (subtree != NULL)
 			{
-				ephy_node_new_from_xml (db, subtree);
-			}			
-				
+				load_add_node (&context, subtree);
+			}
+
+			if (context.current != NULL &&
+			    context.current->xml_nodes->len == LOAD_CHUNK_SIZE)
+			{
+				load_submit_chunk (&context, FALSE);
+				load_create_nodes (&context, FALSE);
+			}
+
 			skip = TRUE;
 		}
 		else if (xmlStrEqual (name, xml_root)
@@ -349,6 +826,16 @@ ephy_node_db_load_from_file (EphyNodeDb *db,
 
 	xmlFreeTextReader (reader);
 
+	load_submit_chunk (&context, TRUE);
+	load_create_nodes (&context, TRUE);
+
+	if (context.pool != NULL)
+	{
+		g_thread_pool_free (context.pool, FALSE, TRUE);
+	}
+	g_mutex_clear (&context.lock);
+	g_cond_clear (&context.cond);
+
 	db->priv->immutable = was_immutable;
 
 	STOP_PROFILER ("loading node db")
@@ -521,6 +1008,1911 @@ failed:
 	return ret;
 }
 
+/*
+ * Binary snapshots
+ *
+ * A snapshot holds the same data as the XML file written by
+ * ephy_node_db_write_to_xml_safe(), in a form that can be mapped and
+ * walked without any text parsing. All integers are little endian.
+ *
+ *   header     magic, format version, then the fields of SnapshotHeader
+ *   records    for every node: id, number of properties, number of
+ *              parents, the properties as fixed size (id, type, value)
+ *              entries and the parent ids
+ *   strings    for every string: its length, its bytes and a NUL byte
+ *
+ * String properties and the version store an index into the string
+ * table, so that repeated strings are only stored once.
+ */
+
+#define SNAPSHOT_MAGIC "EPHYNDB\n"
+#define SNAPSHOT_MAGIC_LEN 8
+#define SNAPSHOT_FORMAT_VERSION 1
+
+/* The header fields following the magic, in file order. */
+enum
+{
+	HEADER_FORMAT_VERSION,
+	HEADER_VERSION_STRING,
+	HEADER_N_NODES,
+	HEADER_RECORDS_OFFSET,
+	HEADER_STRINGS_OFFSET,
+	HEADER_N_STRINGS,
+	HEADER_LAST
+};
+
+#define SNAPSHOT_HEADER_SIZE (SNAPSHOT_MAGIC_LEN + HEADER_LAST * 4)
+#define SNAPSHOT_NODE_SIZE 12
+#define SNAPSHOT_PROPERTY_SIZE 16
+
+/* Nodes and properties are stored in arrays indexed by their id, so a
+ * broken snapshot must not be able to make these grow without bounds. */
+#define SNAPSHOT_MAX_NODE_ID (1 << 24)
+#define SNAPSHOT_MAX_PROPERTY_ID 255
+
+typedef enum
+{
+	SNAPSHOT_TYPE_STRING = 1,
+	SNAPSHOT_TYPE_BOOLEAN,
+	SNAPSHOT_TYPE_INT,
+	SNAPSHOT_TYPE_LONG,
+	SNAPSHOT_TYPE_FLOAT,
+	SNAPSHOT_TYPE_DOUBLE
+} SnapshotType;
+
+struct _EphyNodeDbSnapshot
+{
+	volatile int ref_count;
+
+	char *data;
+	gsize size;
+
+	/* Offsets of every node record and of every string's length. */
+	GArray *records;
+	GArray *strings;
+};
+
+typedef struct
+{
+	GString *data;
+	GHashTable *string_ids;
+	GPtrArray *strings;
+	GArray *parent_ids;
+	GArray *records;
+} SnapshotWriter;
+
+static inline void
+put_uint32 (GString *data, guint32 value)
+{
+	value = GUINT32_TO_LE (value);
+	g_string_append_len (data, (const char *)&value, 4);
+}
+
+static inline void
+put_uint64 (GString *data, guint64 value)
+{
+	value = GUINT64_TO_LE (value);
+	g_string_append_len (data, (const char *)&value, 8);
+}
+
+static inline guint32
+get_uint32 (const guint8 *p)
+{
+	guint32 value;
+
+	memcpy (&value, p, 4);
+	return GUINT32_FROM_LE (value);
+}
+
+static inline guint64
+get_uint64 (const guint8 *p)
+{
+	guint64 value;
+
+	memcpy (&value, p, 8);
+	return GUINT64_FROM_LE (value);
+}
+
+static inline guint64
+double_to_bits (double value)
+{
+	guint64 bits;
+
+	memcpy (&bits, &value, 8);
+	return bits;
+}
+
+static inline double
+bits_to_double (guint64 bits)
+{
+	double value;
+
+	memcpy (&value, &bits, 8);
+	return value;
+}
+
+static guint32
+snapshot_writer_intern (SnapshotWriter *writer,
+			const char *string)
+{
+	gpointer id;
+
+	if (g_hash_table_lookup_extended (writer->string_ids, string, NULL, &id))
+	{
+		return GPOINTER_TO_UINT (id);
+	}
+
+	g_ptr_array_add (writer->strings, (gpointer)string);
+	g_hash_table_insert (writer->string_ids, (gpointer)string,
+			     GUINT_TO_POINTER (writer->strings->len - 1));
+
+	return writer->strings->len - 1;
+}
+
+static int
+snapshot_writer_add_node (SnapshotWriter *writer,
+			  EphyNode *node)
+{
+	GString *data = writer->data;
+	guint32 record, n_properties = 0, n_properties_le;
+	guint i, len;
+
+	record = data->len;
+	g_array_append_val (writer->records, record);
+
+	put_uint32 (data, ephy_node_get_id (node));
+
+	/* Patched below, once we know how many are not empty. */
+	put_uint32 (data, 0);
+
+	g_array_set_size (writer->parent_ids, 0);
+	_ephy_node_get_parent_ids (node, writer->parent_ids);
+	put_uint32 (data, writer->parent_ids->len);
+
+	len = _ephy_node_get_n_properties (node);
+	for (i = 0; i < len; i++)
+	{
+		GValue _value = { 0, };
+		GValue *value = &_value;
+		SnapshotType type;
+		guint64 bits;
+
+		if (!_ephy_node_peek_property (node, i, value)) continue;
+
+		switch (G_VALUE_TYPE (value))
+		{
+		case G_TYPE_STRING:
+			if (g_value_get_string (value) == NULL) continue;
+			type = SNAPSHOT_TYPE_STRING;
+			bits = snapshot_writer_intern (writer, g_value_get_string (value));
+			break;
+		case G_TYPE_BOOLEAN:
+			type = SNAPSHOT_TYPE_BOOLEAN;
+			bits = g_value_get_boolean (value) ? 1 : 0;
+			break;
+		case G_TYPE_INT:
+			type = SNAPSHOT_TYPE_INT;
+			bits = (guint64)(gint64)g_value_get_int (value);
+			break;
+		case G_TYPE_LONG:
+			type = SNAPSHOT_TYPE_LONG;
+			bits = (guint64)(gint64)g_value_get_long (value);
+			break;
+		case G_TYPE_FLOAT:
+			type = SNAPSHOT_TYPE_FLOAT;
+			bits = double_to_bits (g_value_get_float (value));
+			break;
+		case G_TYPE_DOUBLE:
+			type = SNAPSHOT_TYPE_DOUBLE;
+			bits = double_to_bits (g_value_get_double (value));
+			break;
+		default:
+			g_warning ("Cannot write property %u of type %s to a snapshot",
+				   i, G_VALUE_TYPE_NAME (value));
+			return -1;
+		}
+
+		put_uint32 (data, i);
+		put_uint32 (data, type);
+		put_uint64 (data, bits);
+		n_properties++;
+	}
+
+	n_properties_le = GUINT32_TO_LE (n_properties);
+	memcpy (data->str + record + 4, &n_properties_le, 4);
+
+	for (i = 0; i < writer->parent_ids->len; i++)
+	{
+		put_uint32 (data, g_array_index (writer->parent_ids, guint, i));
+	}
+
+	return 0;
+}
+
+static EphyNodeDbSnapshot *
+ephy_node_db_take_snapshot_valist (EphyNodeDb *db,
+				   const char *version,
+				   EphyNode *first_node,
+				   va_list argptr)
+{
+	EphyNodeDbSnapshot *snapshot = NULL;
+	SnapshotWriter writer;
+	guint32 header[HEADER_LAST], version_string;
+	gsize strings_offset;
+	GArray *strings;
+	EphyNode *node;
+	guint i;
+	int ret = 0;
+
+	START_PROFILER ("Taking node db snapshot")
+
+	writer.data = g_string_sized_new (64 * 1024);
+	writer.string_ids = g_hash_table_new (g_str_hash, g_str_equal);
+	writer.strings = g_ptr_array_new ();
+	writer.parent_ids = g_array_new (FALSE, FALSE, sizeof (guint));
+	writer.records = g_array_new (FALSE, FALSE, sizeof (guint32));
+
+	/* Filled in once everything else has been written. */
+	g_string_set_size (writer.data, SNAPSHOT_HEADER_SIZE);
+
+	version_string = snapshot_writer_intern (&writer, version);
+
+	node = first_node;
+	while (node != NULL)
+	{
+		GPtrArray *children;
+		EphyNodeFilterFunc filter;
+		gpointer user_data;
+
+		filter = va_arg (argptr, EphyNodeFilterFunc);
+		user_data = va_arg (argptr, gpointer);
+
+		children = ephy_node_get_children (node);
+		for (i = 0; i < children->len; i++)
+		{
+			EphyNode *kid;
+
+			kid = g_ptr_array_index (children, i);
+
+			if (!filter || filter (kid, user_data))
+			{
+				ret = snapshot_writer_add_node (&writer, kid);
+				if (ret < 0) break;
+			}
+		}
+		if (ret < 0) goto out;
+
+		node = va_arg (argptr, EphyNode *);
+	}
+
+	strings = g_array_sized_new (FALSE, FALSE, sizeof (guint32), writer.strings->len);
+	strings_offset = writer.data->len;
+	for (i = 0; i < writer.strings->len; i++)
+	{
+		const char *string = g_ptr_array_index (writer.strings, i);
+		guint32 offset = writer.data->len;
+		guint32 len = strlen (string);
+
+		g_array_append_val (strings, offset);
+		put_uint32 (writer.data, len);
+		g_string_append_len (writer.data, string, len + 1);
+	}
+
+	header[HEADER_FORMAT_VERSION] = GUINT32_TO_LE (SNAPSHOT_FORMAT_VERSION);
+	header[HEADER_VERSION_STRING] = GUINT32_TO_LE (version_string);
+	header[HEADER_N_NODES] = GUINT32_TO_LE (writer.records->len);
+	header[HEADER_RECORDS_OFFSET] = GUINT32_TO_LE (SNAPSHOT_HEADER_SIZE);
+	header[HEADER_STRINGS_OFFSET] = GUINT32_TO_LE (strings_offset);
+	header[HEADER_N_STRINGS] = GUINT32_TO_LE (writer.strings->len);
+
+	memcpy (writer.data->str, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LEN);
+	memcpy (writer.data->str + SNAPSHOT_MAGIC_LEN, header, sizeof (header));
+
+	snapshot = g_slice_new (EphyNodeDbSnapshot);
+	snapshot->ref_count = 1;
+	snapshot->size = writer.data->len;
+	snapshot->data = g_string_free (writer.data, FALSE);
+	snapshot->records = writer.records;
+	snapshot->strings = strings;
+	writer.data = NULL;
+	writer.records = NULL;
+
+out:
+	if (writer.data != NULL)
+	{
+		g_string_free (writer.data, TRUE);
+	}
+	if (writer.records != NULL)
+	{
+		g_array_free (writer.records, TRUE);
+	}
+	g_hash_table_destroy (writer.string_ids);
+	g_ptr_array_free (writer.strings, TRUE);
+	g_array_free (writer.parent_ids, TRUE);
+
+	STOP_PROFILER ("Taking node db snapshot")
+
+	return snapshot;
+}
+
+/**
+ * ephy_node_db_take_snapshot:
+ * @db: an #EphyNodeDb
+ * @version: a version string, checked again when loading
+ * @node: the first node of data to include
+ * @Varargs: a filter function and its data, and more such
+ *	     #EphyNode - filter - data sequences, followed by %NULL
+ *
+ * Copies the children of the given nodes into a compact, immutable
+ * #EphyNodeDbSnapshot. This only copies memory, so it is cheap enough to
+ * be done on the main thread; the snapshot can then be read and written
+ * to disk from any thread while @db keeps changing.
+ *
+ * Return value: (transfer full): the new #EphyNodeDbSnapshot, or %NULL
+ * if some node could not be stored
+ **/
+EphyNodeDbSnapshot *
+ephy_node_db_take_snapshot (EphyNodeDb *db,
+			    const char *version,
+			    EphyNode *node, ...)
+{
+	EphyNodeDbSnapshot *snapshot;
+	va_list argptr;
+
+	g_return_val_if_fail (EPHY_IS_NODE_DB (db), NULL);
+	g_return_val_if_fail (version != NULL, NULL);
+
+	va_start (argptr, node);
+	snapshot = ephy_node_db_take_snapshot_valist (db, version, node, argptr);
+	va_end (argptr);
+
+	return snapshot;
+}
+
+EphyNodeDbSnapshot *
+ephy_node_db_snapshot_ref (EphyNodeDbSnapshot *snapshot)
+{
+	g_return_val_if_fail (snapshot != NULL, NULL);
+
+	g_atomic_int_inc (&snapshot->ref_count);
+
+	return snapshot;
+}
+
+void
+ephy_node_db_snapshot_unref (EphyNodeDbSnapshot *snapshot)
+{
+	g_return_if_fail (snapshot != NULL);
+
+	if (!g_atomic_int_dec_and_test (&snapshot->ref_count)) return;
+
+	g_free (snapshot->data);
+	g_array_free (snapshot->records, TRUE);
+	g_array_free (snapshot->strings, TRUE);
+	g_slice_free (EphyNodeDbSnapshot, snapshot);
+}
+
+/**
+ * ephy_node_db_snapshot_write:
+ * @snapshot: an #EphyNodeDbSnapshot
+ * @filename: the file in which @snapshot will be stored
+ *
+ * Atomically replaces @filename with @snapshot, in the format read by
+ * ephy_node_db_load_from_snapshot(). This can be called from any thread.
+ *
+ * Return value: %TRUE on success
+ **/
+gboolean
+ephy_node_db_snapshot_write (EphyNodeDbSnapshot *snapshot,
+			     const char *filename)
+{
+	GError *error = NULL;
+	GFile *tmp_file, *file;
+	char *tmp_file_path;
+	gboolean ret;
+
+	g_return_val_if_fail (snapshot != NULL, FALSE);
+	g_return_val_if_fail (filename != NULL, FALSE);
+
+	LOG ("Saving node db snapshot to %s", filename);
+
+	START_PROFILER ("Saving node db snapshot")
+
+	tmp_file_path = g_strconcat (filename, ".tmp", NULL);
+
+	ret = g_file_set_contents (tmp_file_path, snapshot->data, snapshot->size, &error);
+	if (ret)
+	{
+		tmp_file = g_file_new_for_path (tmp_file_path);
+		file = g_file_new_for_path (filename);
+
+		ret = ephy_file_switch_temp_file (file, tmp_file);
+
+		g_object_unref (file);
+		g_object_unref (tmp_file);
+	}
+	else
+	{
+		g_warning ("Failed to write snapshot %s: %s", tmp_file_path, error->message);
+		g_error_free (error);
+	}
+
+	g_free (tmp_file_path);
+
+	STOP_PROFILER ("Saving node db snapshot")
+
+	return ret;
+}
+
+/**
+ * ephy_node_db_snapshot_get_n_nodes:
+ * @snapshot: an #EphyNodeDbSnapshot
+ *
+ * Return value: the number of nodes in @snapshot. The nodes are indexed
+ * from 0, in the order in which they were added to the snapshot.
+ **/
+guint
+ephy_node_db_snapshot_get_n_nodes (EphyNodeDbSnapshot *snapshot)
+{
+	g_return_val_if_fail (snapshot != NULL, 0);
+
+	return snapshot->records->len;
+}
+
+static inline const guint8 *
+snapshot_get_record (EphyNodeDbSnapshot *snapshot,
+		     guint index)
+{
+	return (const guint8 *)snapshot->data +
+		g_array_index (snapshot->records, guint32, index);
+}
+
+static const guint8 *
+snapshot_find_property (EphyNodeDbSnapshot *snapshot,
+			guint index,
+			guint property_id)
+{
+	const guint8 *record, *p;
+	guint32 n_properties, i;
+
+	record = snapshot_get_record (snapshot, index);
+	n_properties = get_uint32 (record + 4);
+
+	p = record + SNAPSHOT_NODE_SIZE;
+	for (i = 0; i < n_properties; i++, p += SNAPSHOT_PROPERTY_SIZE)
+	{
+		if (get_uint32 (p) == property_id) return p;
+	}
+
+	return NULL;
+}
+
+/**
+ * ephy_node_db_snapshot_get_id:
+ * @snapshot: an #EphyNodeDbSnapshot
+ * @index: the index of a node in @snapshot
+ *
+ * Return value: the id the node had in its #EphyNodeDb
+ **/
+guint
+ephy_node_db_snapshot_get_id (EphyNodeDbSnapshot *snapshot,
+			      guint index)
+{
+	g_return_val_if_fail (snapshot != NULL, 0);
+	g_return_val_if_fail (index < snapshot->records->len, 0);
+
+	return get_uint32 (snapshot_get_record (snapshot, index));
+}
+
+/**
+ * ephy_node_db_snapshot_get_property_string:
+ * @snapshot: an #EphyNodeDbSnapshot
+ * @index: the index of a node in @snapshot
+ * @property_id: the identifier for the property
+ *
+ * Return value: the string value of the property, like
+ * ephy_node_get_property_string(), or %NULL
+ **/
+const char *
+ephy_node_db_snapshot_get_property_string (EphyNodeDbSnapshot *snapshot,
+					   guint index,
+					   guint property_id)
+{
+	const guint8 *property;
+	guint64 string;
+
+	g_return_val_if_fail (snapshot != NULL, NULL);
+	g_return_val_if_fail (index < snapshot->records->len, NULL);
+
+	property = snapshot_find_property (snapshot, index, property_id);
+	if (property == NULL || get_uint32 (property + 4) != SNAPSHOT_TYPE_STRING)
+	{
+		return NULL;
+	}
+
+	string = get_uint64 (property + 8);
+
+	return snapshot->data + g_array_index (snapshot->strings, guint32, string) + 4;
+}
+
+/**
+ * ephy_node_db_snapshot_get_property_int:
+ * @snapshot: an #EphyNodeDbSnapshot
+ * @index: the index of a node in @snapshot
+ * @property_id: the identifier for the property
+ *
+ * Return value: the integer value of the property, like
+ * ephy_node_get_property_int(), or -1
+ **/
+int
+ephy_node_db_snapshot_get_property_int (EphyNodeDbSnapshot *snapshot,
+					guint index,
+					guint property_id)
+{
+	const guint8 *property;
+
+	g_return_val_if_fail (snapshot != NULL, -1);
+	g_return_val_if_fail (index < snapshot->records->len, -1);
+
+	property = snapshot_find_property (snapshot, index, property_id);
+	if (property == NULL || get_uint32 (property + 4) != SNAPSHOT_TYPE_INT)
+	{
+		return -1;
+	}
+
+	return (gint64)get_uint64 (property + 8);
+}
+
+/**
+ * ephy_node_db_snapshot_get_n_parents:
+ * @snapshot: an #EphyNodeDbSnapshot
+ * @index: the index of a node in @snapshot
+ *
+ * Return value: the number of parents the node had
+ **/
+guint
+ephy_node_db_snapshot_get_n_parents (EphyNodeDbSnapshot *snapshot,
+				     guint index)
+{
+	g_return_val_if_fail (snapshot != NULL, 0);
+	g_return_val_if_fail (index < snapshot->records->len, 0);
+
+	return get_uint32 (snapshot_get_record (snapshot, index) + 8);
+}
+
+/**
+ * ephy_node_db_snapshot_get_parent_id:
+ * @snapshot: an #EphyNodeDbSnapshot
+ * @index: the index of a node in @snapshot
+ * @n: which parent, below ephy_node_db_snapshot_get_n_parents()
+ *
+ * Return value: the id of the @n-th parent of the node, in no
+ * particular order
+ **/
+guint
+ephy_node_db_snapshot_get_parent_id (EphyNodeDbSnapshot *snapshot,
+				     guint index,
+				     guint n)
+{
+	const guint8 *record;
+
+	g_return_val_if_fail (snapshot != NULL, 0);
+	g_return_val_if_fail (index < snapshot->records->len, 0);
+
+	record = snapshot_get_record (snapshot, index);
+	g_return_val_if_fail (n < get_uint32 (record + 8), 0);
+
+	return get_uint32 (record + SNAPSHOT_NODE_SIZE +
+			   get_uint32 (record + 4) * SNAPSHOT_PROPERTY_SIZE +
+			   n * 4);
+}
+
+/**
+ * ephy_node_db_snapshot_has_parent:
+ * @snapshot: an #EphyNodeDbSnapshot
+ * @index: the index of a node in @snapshot
+ * @parent_id: the id of a node
+ *
+ * Return value: %TRUE if the node was a child of the node with id
+ * @parent_id, like ephy_node_has_child()
+ **/
+gboolean
+ephy_node_db_snapshot_has_parent (EphyNodeDbSnapshot *snapshot,
+				  guint index,
+				  guint parent_id)
+{
+	guint i, n_parents;
+
+	n_parents = ephy_node_db_snapshot_get_n_parents (snapshot, index);
+	for (i = 0; i < n_parents; i++)
+	{
+		if (ephy_node_db_snapshot_get_parent_id (snapshot, index, i) == parent_id)
+		{
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+/**
+ * ephy_node_db_write_to_snapshot_safe:
+ * @db: an #EphyNodeDb
+ * @filename: the file in which @db's data will be stored
+ * @version: a version string, checked again when loading
+ * @node: the first node of data to write
+ * @Varargs: a filter function and its data, and more such
+ *	     #EphyNode - filter - data sequences, followed by %NULL
+ *
+ * Like ephy_node_db_write_to_xml_safe(), but writes a binary snapshot that
+ * ephy_node_db_load_from_snapshot() can load much faster than the XML.
+ * The snapshot is only meant for @db's own use; keep writing the XML file
+ * from time to time as the portable and recovery copy.
+ *
+ * Return value: %0 on success or a negative number on failure
+ **/
+int
+ephy_node_db_write_to_snapshot_safe (EphyNodeDb *db,
+				     const char *filename,
+				     const char *version,
+				     EphyNode *node, ...)
+{
+	EphyNodeDbSnapshot *snapshot;
+	va_list argptr;
+	int ret = -1;
+
+	va_start (argptr, node);
+	snapshot = ephy_node_db_take_snapshot_valist (db, version, node, argptr);
+	va_end (argptr);
+
+	if (snapshot != NULL)
+	{
+		ret = ephy_node_db_snapshot_write (snapshot, filename) ? 0 : -1;
+		ephy_node_db_snapshot_unref (snapshot);
+	}
+
+	return ret;
+}
+
+/* Checks the whole snapshot before anything is added to the db, so that a
+ * truncated or otherwise broken file leaves the db untouched and the
+ * caller can fall back to the XML file. */
+static gboolean
+snapshot_validate (EphyNodeDb *db,
+		   const guint8 *data,
+		   gsize size,
+		   const char *version,
+		   const char ***strings_out)
+{
+	const char **strings;
+	GHashTable *ids = NULL;
+	const guint8 *p, *end;
+	guint32 n_nodes, records_offset, strings_offset, n_strings, version_string;
+	guint i;
+
+	if (size < SNAPSHOT_HEADER_SIZE ||
+	    memcmp (data, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LEN) != 0)
+	{
+		return FALSE;
+	}
+
+	p = data + SNAPSHOT_MAGIC_LEN;
+	if (get_uint32 (p + HEADER_FORMAT_VERSION * 4) != SNAPSHOT_FORMAT_VERSION)
+	{
+		return FALSE;
+	}
+
+	version_string = get_uint32 (p + HEADER_VERSION_STRING * 4);
+	n_nodes = get_uint32 (p + HEADER_N_NODES * 4);
+	records_offset = get_uint32 (p + HEADER_RECORDS_OFFSET * 4);
+	strings_offset = get_uint32 (p + HEADER_STRINGS_OFFSET * 4);
+	n_strings = get_uint32 (p + HEADER_N_STRINGS * 4);
+
+	if (records_offset < SNAPSHOT_HEADER_SIZE ||
+	    records_offset > strings_offset ||
+	    strings_offset > size ||
+	    n_strings > (size - strings_offset) / 5 ||
+	    version_string >= n_strings)
+	{
+		return FALSE;
+	}
+
+	/* The string table. */
+	strings = g_new (const char *, n_strings);
+	p = data + strings_offset;
+	end = data + size;
+	for (i = 0; i < n_strings; i++)
+	{
+		guint32 len;
+
+		if ((gsize)(end - p) < 4) goto failed;
+		len = get_uint32 (p);
+		p += 4;
+
+		if ((gsize)(end - p) <= len || p[len] != '\0') goto failed;
+		strings[i] = (const char *)p;
+		p += len + 1;
+	}
+	if (p != end) goto failed;
+
+	if (strcmp (strings[version_string], version) != 0) goto failed;
+
+	/* The node records. Every id must be new to the db and appear once. */
+	ids = g_hash_table_new (g_direct_hash, g_direct_equal);
+	p = data + records_offset;
+	end = data + strings_offset;
+	for (i = 0; i < n_nodes; i++)
+	{
+		guint32 id, n_properties, n_parents, j;
+
+		if ((gsize)(end - p) < SNAPSHOT_NODE_SIZE) goto failed;
+		id = get_uint32 (p);
+		if (id > SNAPSHOT_MAX_NODE_ID ||
+		    ephy_node_db_get_node_from_id (db, id) != NULL ||
+		    g_hash_table_lookup (ids, GUINT_TO_POINTER (id)) != NULL)
+		{
+			goto failed;
+		}
+		g_hash_table_insert (ids, GUINT_TO_POINTER (id), GUINT_TO_POINTER (TRUE));
+
+		n_properties = get_uint32 (p + 4);
+		n_parents = get_uint32 (p + 8);
+		p += SNAPSHOT_NODE_SIZE;
+
+		if (n_properties > (gsize)(end - p) / SNAPSHOT_PROPERTY_SIZE) goto failed;
+		for (j = 0; j < n_properties; j++)
+		{
+			guint32 type = get_uint32 (p + 4);
+
+			if (get_uint32 (p) > SNAPSHOT_MAX_PROPERTY_ID) goto failed;
+			if (type < SNAPSHOT_TYPE_STRING || type > SNAPSHOT_TYPE_DOUBLE) goto failed;
+			if (type == SNAPSHOT_TYPE_STRING && get_uint64 (p + 8) >= n_strings) goto failed;
+
+			p += SNAPSHOT_PROPERTY_SIZE;
+		}
+
+		if (n_parents > (gsize)(end - p) / 4) goto failed;
+		p += n_parents * 4;
+	}
+	if (p != end) goto failed;
+
+	g_hash_table_destroy (ids);
+	*strings_out = strings;
+
+	return TRUE;
+
+failed:
+	if (ids != NULL) g_hash_table_destroy (ids);
+	g_free (strings);
+
+	return FALSE;
+}
+
+static gboolean
+ephy_node_db_load_snapshot (EphyNodeDb *db,
+			    const char *filename,
+			    const char *version)
+{
+	GMappedFile *mapped;
+	const guint8 *data, *p;
+	const char **strings;
+	GError *error = NULL;
+	gboolean was_immutable;
+	guint32 n_nodes;
+	guint i;
+
+	LOG ("ephy_node_db_load_snapshot %s", filename);
+
+	mapped = g_mapped_file_new (filename, FALSE, &error);
+	if (mapped == NULL)
+	{
+		LOG ("Could not map snapshot %s: %s", filename, error->message);
+		g_error_free (error);
+		return FALSE;
+	}
+
+	START_PROFILER ("loading node db snapshot")
+
+	data = (const guint8 *)g_mapped_file_get_contents (mapped);
+
+	if (data == NULL ||
+	    !snapshot_validate (db, data, g_mapped_file_get_length (mapped), version, &strings))
+	{
+		g_warning ("Snapshot %s is invalid or out of date", filename);
+		g_mapped_file_unref (mapped);
+		return FALSE;
+	}
+
+	was_immutable = db->priv->immutable;
+	db->priv->immutable = FALSE;
+
+	n_nodes = get_uint32 (data + SNAPSHOT_MAGIC_LEN + HEADER_N_NODES * 4);
+	p = data + get_uint32 (data + SNAPSHOT_MAGIC_LEN + HEADER_RECORDS_OFFSET * 4);
+
+	for (i = 0; i < n_nodes; i++)
+	{
+		EphyNode *node;
+		guint32 n_properties, n_parents, j;
+
+		node = ephy_node_new_with_id (db, get_uint32 (p));
+		n_properties = get_uint32 (p + 4);
+		n_parents = get_uint32 (p + 8);
+		p += SNAPSHOT_NODE_SIZE;
+
+		for (j = 0; j < n_properties; j++)
+		{
+			GValue _value = { 0, };
+			GValue *value = &_value;
+			guint64 bits = get_uint64 (p + 8);
+
+			switch (get_uint32 (p + 4))
+			{
+			case SNAPSHOT_TYPE_STRING:
+				g_value_init (value, G_TYPE_STRING);
+				g_value_set_static_string (value, strings[bits]);
+				break;
+			case SNAPSHOT_TYPE_BOOLEAN:
+				g_value_init (value, G_TYPE_BOOLEAN);
+				g_value_set_boolean (value, bits != 0);
+				break;
+			case SNAPSHOT_TYPE_INT:
+				g_value_init (value, G_TYPE_INT);
+				g_value_set_int (value, (gint64)bits);
+				break;
+			case SNAPSHOT_TYPE_LONG:
+				g_value_init (value, G_TYPE_LONG);
+				g_value_set_long (value, (gint64)bits);
+				break;
+			case SNAPSHOT_TYPE_FLOAT:
+				g_value_init (value, G_TYPE_FLOAT);
+				g_value_set_float (value, bits_to_double (bits));
+				break;
+			case SNAPSHOT_TYPE_DOUBLE:
+				g_value_init (value, G_TYPE_DOUBLE);
+				g_value_set_double (value, bits_to_double (bits));
+				break;
+			default:
+				/* Rejected by snapshot_validate(). */
+				p += SNAPSHOT_PROPERTY_SIZE;
+				continue;
+			}
+
+			_ephy_node_restore_property (node, get_uint32 (p), value);
+			g_value_unset (value);
+			p += SNAPSHOT_PROPERTY_SIZE;
+		}
+
+		for (j = 0; j < n_parents; j++)
+		{
+			EphyNode *parent;
+
+			parent = ephy_node_db_get_node_from_id (db, get_uint32 (p));
+			if (parent != NULL)
+			{
+				_ephy_node_restore_parent (node, parent);
+			}
+			p += 4;
+		}
+
+		_ephy_node_restored (node);
+	}
+
+	db->priv->immutable = was_immutable;
+
+	g_free (strings);
+	g_mapped_file_unref (mapped);
+
+	STOP_PROFILER ("loading node db snapshot")
+
+	return TRUE;
+}
+
+/*
+ * The change journal.
+ *
+ * Instead of writing the whole database after every change, the changes
+ * made through the EphyNode API can be appended to a journal that lives
+ * next to a snapshot, and the snapshot only rewritten every now and then.
+ * The journal starts with JOURNAL_MAGIC and a 32 bit format version, and
+ * is followed by records made of the length of their payload, an FNV-1a
+ * hash of the payload, and the payload itself: a JournalOp followed by
+ * its arguments. All integers are little endian.
+ *
+ * When the snapshot is rewritten, the journal is first moved aside to
+ * JOURNAL_OLD_SUFFIX and a fresh one started, so that the old snapshot
+ * plus both journals is always a complete copy of the database until
+ * the new snapshot is safely on disk.
+ */
+
+#define JOURNAL_SUFFIX ".journal"
+#define JOURNAL_OLD_SUFFIX ".journal.old"
+#define JOURNAL_MAGIC "EPHYJNL\n"
+#define JOURNAL_MAGIC_LEN 8
+#define JOURNAL_FORMAT_VERSION 1
+#define JOURNAL_HEADER_SIZE (JOURNAL_MAGIC_LEN + 4)
+#define JOURNAL_RECORD_HEADER_SIZE 8
+
+/* Changes are kept in memory until flushed, or until there are this many
+ * bytes of them. */
+#define JOURNAL_BUFFER_SIZE (64 * 1024)
+
+typedef enum
+{
+	JOURNAL_OP_NEW = 1,
+	JOURNAL_OP_DESTROY,
+	JOURNAL_OP_SET_PROPERTY,
+	JOURNAL_OP_ADD_CHILD,
+	JOURNAL_OP_REMOVE_CHILD,
+	JOURNAL_OP_REORDER
+} JournalOp;
+
+#define JOURNAL_NULL_STRING G_MAXUINT32
+
+static guint32
+journal_hash (const guint8 *data,
+	      gsize len)
+{
+	guint32 hash = 2166136261U;
+	gsize i;
+
+	for (i = 0; i < len; i++)
+	{
+		hash ^= data[i];
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+static gboolean
+write_all (int fd,
+	   const char *data,
+	   gsize len)
+{
+	while (len > 0)
+	{
+		gssize written;
+
+		written = write (fd, data, len);
+		if (written < 0)
+		{
+			if (errno == EINTR) continue;
+			return FALSE;
+		}
+
+		data += written;
+		len -= written;
+	}
+
+	return TRUE;
+}
+
+static void
+journal_close (EphyNodeDb *db)
+{
+	EphyNodeDbPrivate *priv = db->priv;
+
+	if (priv->journal_fd >= 0)
+	{
+		close (priv->journal_fd);
+		priv->journal_fd = -1;
+	}
+
+	g_string_truncate (priv->journal_buffer, 0);
+}
+
+static gboolean
+journal_write_buffer (EphyNodeDb *db,
+		      gboolean sync)
+{
+	EphyNodeDbPrivate *priv = db->priv;
+	GString *buffer = priv->journal_buffer;
+
+	if (priv->journal_fd < 0) return FALSE;
+
+	if (!write_all (priv->journal_fd, buffer->str, buffer->len) ||
+	    (sync && fsync (priv->journal_fd) != 0))
+	{
+		g_warning ("Could not write to journal %s: %s",
+			   priv->journal_file, g_strerror (errno));
+
+		/* The journal no longer matches the db, only a new snapshot
+		 * can fix that. */
+		journal_close (db);
+		return FALSE;
+	}
+
+	priv->journal_size += buffer->len;
+	g_string_truncate (buffer, 0);
+
+	return TRUE;
+}
+
+static gsize
+journal_begin (EphyNodeDb *db,
+	       JournalOp op)
+{
+	GString *buffer = db->priv->journal_buffer;
+	gsize start = buffer->len;
+
+	/* The record header is filled in by journal_end(). */
+	put_uint32 (buffer, 0);
+	put_uint32 (buffer, 0);
+	put_uint32 (buffer, op);
+
+	return start;
+}
+
+static void
+journal_end (EphyNodeDb *db,
+	     gsize start)
+{
+	GString *buffer = db->priv->journal_buffer;
+	const guint8 *payload;
+	guint32 len, hash;
+
+	payload = (const guint8 *)buffer->str + start + JOURNAL_RECORD_HEADER_SIZE;
+	len = buffer->len - start - JOURNAL_RECORD_HEADER_SIZE;
+
+	hash = GUINT32_TO_LE (journal_hash (payload, len));
+	len = GUINT32_TO_LE (len);
+	memcpy (buffer->str + start, &len, 4);
+	memcpy (buffer->str + start + 4, &hash, 4);
+
+	if (buffer->len >= JOURNAL_BUFFER_SIZE)
+	{
+		journal_write_buffer (db, FALSE);
+	}
+}
+
+static void
+journal_log_ids (EphyNodeDb *db,
+		 JournalOp op,
+		 guint id,
+		 guint other_id)
+{
+	gsize start;
+
+	start = journal_begin (db, op);
+	put_uint32 (db->priv->journal_buffer, id);
+	if (other_id != G_MAXUINT)
+	{
+		put_uint32 (db->priv->journal_buffer, other_id);
+	}
+	journal_end (db, start);
+}
+
+void
+_ephy_node_db_journal_new_node (EphyNodeDb *db,
+				guint id)
+{
+	if (db->priv->journal_fd < 0) return;
+
+	journal_log_ids (db, JOURNAL_OP_NEW, id, G_MAXUINT);
+}
+
+void
+_ephy_node_db_journal_destroy_node (EphyNodeDb *db,
+				    guint id)
+{
+	if (db->priv->journal_fd < 0) return;
+
+	journal_log_ids (db, JOURNAL_OP_DESTROY, id, G_MAXUINT);
+}
+
+void
+_ephy_node_db_journal_add_child (EphyNodeDb *db,
+				 guint parent_id,
+				 guint child_id)
+{
+	if (db->priv->journal_fd < 0) return;
+
+	journal_log_ids (db, JOURNAL_OP_ADD_CHILD, parent_id, child_id);
+}
+
+void
+_ephy_node_db_journal_remove_child (EphyNodeDb *db,
+				    guint parent_id,
+				    guint child_id)
+{
+	if (db->priv->journal_fd < 0) return;
+
+	journal_log_ids (db, JOURNAL_OP_REMOVE_CHILD, parent_id, child_id);
+}
+
+void
+_ephy_node_db_journal_reorder (EphyNodeDb *db,
+			       guint parent_id,
+			       GPtrArray *children)
+{
+	GString *buffer = db->priv->journal_buffer;
+	gsize start;
+	guint i;
+
+	if (db->priv->journal_fd < 0) return;
+
+	start = journal_begin (db, JOURNAL_OP_REORDER);
+	put_uint32 (buffer, parent_id);
+	put_uint32 (buffer, children->len);
+	for (i = 0; i < children->len; i++)
+	{
+		put_uint32 (buffer, ephy_node_get_id (g_ptr_array_index (children, i)));
+	}
+	journal_end (db, start);
+}
+
+void
+_ephy_node_db_journal_set_property (EphyNodeDb *db,
+				    guint id,
+				    guint property_id,
+				    const GValue *value)
+{
+	GString *buffer = db->priv->journal_buffer;
+	const char *string;
+	SnapshotType type;
+	guint64 bits = 0;
+	gsize start;
+
+	if (db->priv->journal_fd < 0) return;
+
+	switch (G_VALUE_TYPE (value))
+	{
+	case G_TYPE_STRING:
+		type = SNAPSHOT_TYPE_STRING;
+		break;
+	case G_TYPE_BOOLEAN:
+		type = SNAPSHOT_TYPE_BOOLEAN;
+		bits = g_value_get_boolean (value) ? 1 : 0;
+		break;
+	case G_TYPE_INT:
+		type = SNAPSHOT_TYPE_INT;
+		bits = (guint64)(gint64)g_value_get_int (value);
+		break;
+	case G_TYPE_LONG:
+		type = SNAPSHOT_TYPE_LONG;
+		bits = (guint64)(gint64)g_value_get_long (value);
+		break;
+	case G_TYPE_FLOAT:
+		type = SNAPSHOT_TYPE_FLOAT;
+		bits = double_to_bits (g_value_get_float (value));
+		break;
+	case G_TYPE_DOUBLE:
+		type = SNAPSHOT_TYPE_DOUBLE;
+		bits = double_to_bits (g_value_get_double (value));
+		break;
+	default:
+		g_warning ("Cannot write property %u of type %s to a journal",
+			   property_id, G_VALUE_TYPE_NAME (value));
+		return;
+	}
+
+	start = journal_begin (db, JOURNAL_OP_SET_PROPERTY);
+	put_uint32 (buffer, id);
+	put_uint32 (buffer, property_id);
+	put_uint32 (buffer, type);
+
+	if (type == SNAPSHOT_TYPE_STRING)
+	{
+		string = g_value_get_string (value);
+		if (string == NULL)
+		{
+			put_uint32 (buffer, JOURNAL_NULL_STRING);
+		}
+		else
+		{
+			put_uint32 (buffer, strlen (string));
+			g_string_append (buffer, string);
+		}
+	}
+	else
+	{
+		put_uint64 (buffer, bits);
+	}
+
+	journal_end (db, start);
+}
+
+typedef struct
+{
+	const guint8 *p;
+	const guint8 *end;
+} JournalReader;
+
+static gboolean
+journal_read_uint32 (JournalReader *reader,
+		     guint32 *value)
+{
+	if ((gsize)(reader->end - reader->p) < 4) return FALSE;
+
+	*value = get_uint32 (reader->p);
+	reader->p += 4;
+
+	return TRUE;
+}
+
+static gboolean
+journal_read_value (JournalReader *reader,
+		    GValue *value)
+{
+	guint32 type, len;
+	guint64 bits;
+
+	if (!journal_read_uint32 (reader, &type)) return FALSE;
+
+	if (type == SNAPSHOT_TYPE_STRING)
+	{
+		char *string = NULL;
+
+		if (!journal_read_uint32 (reader, &len)) return FALSE;
+
+		if (len != JOURNAL_NULL_STRING)
+		{
+			if ((gsize)(reader->end - reader->p) < len) return FALSE;
+
+			string = g_strndup ((const char *)reader->p, len);
+			reader->p += len;
+		}
+
+		g_value_init (value, G_TYPE_STRING);
+		g_value_take_string (value, string);
+
+		return TRUE;
+	}
+
+	if ((gsize)(reader->end - reader->p) < 8) return FALSE;
+	bits = get_uint64 (reader->p);
+	reader->p += 8;
+
+	switch (type)
+	{
+	case SNAPSHOT_TYPE_BOOLEAN:
+		g_value_init (value, G_TYPE_BOOLEAN);
+		g_value_set_boolean (value, bits != 0);
+		break;
+	case SNAPSHOT_TYPE_INT:
+		g_value_init (value, G_TYPE_INT);
+		g_value_set_int (value, (gint64)bits);
+		break;
+	case SNAPSHOT_TYPE_LONG:
+		g_value_init (value, G_TYPE_LONG);
+		g_value_set_long (value, (gint64)bits);
+		break;
+	case SNAPSHOT_TYPE_FLOAT:
+		g_value_init (value, G_TYPE_FLOAT);
+		g_value_set_float (value, bits_to_double (bits));
+		break;
+	case SNAPSHOT_TYPE_DOUBLE:
+		g_value_init (value, G_TYPE_DOUBLE);
+		g_value_set_double (value, bits_to_double (bits));
+		break;
+	default:
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gboolean
+journal_replay_reorder (EphyNodeDb *db,
+			JournalReader *reader,
+			EphyNode *parent)
+{
+	GHashTable *positions;
+	GPtrArray *children;
+	guint32 n_children, id, i;
+	int *new_order;
+	gboolean valid = TRUE, unchanged;
+
+	if (!journal_read_uint32 (reader, &n_children)) return FALSE;
+	if ((gsize)(reader->end - reader->p) / 4 < n_children) return FALSE;
+
+	positions = g_hash_table_new (g_direct_hash, g_direct_equal);
+	for (i = 0; i < n_children; i++)
+	{
+		journal_read_uint32 (reader, &id);
+		g_hash_table_insert (positions, GUINT_TO_POINTER (id), GUINT_TO_POINTER (i + 1));
+	}
+
+	if (parent == NULL)
+	{
+		g_hash_table_destroy (positions);
+		return TRUE;
+	}
+
+	/* Only reorder if the children are still the same ones, and not
+	 * already in that order. */
+	children = ephy_node_get_children (parent);
+	new_order = g_new (int, children->len);
+
+	valid = children->len == n_children;
+	unchanged = TRUE;
+	for (i = 0; valid && i < children->len; i++)
+	{
+		guint position;
+
+		id = ephy_node_get_id (g_ptr_array_index (children, i));
+		position = GPOINTER_TO_UINT (g_hash_table_lookup (positions, GUINT_TO_POINTER (id)));
+
+		valid = position != 0;
+		new_order[i] = position - 1;
+		unchanged = unchanged && new_order[i] == (int)i;
+	}
+
+	if (valid && !unchanged)
+	{
+		ephy_node_reorder_children (parent, new_order);
+	}
+
+	g_free (new_order);
+	g_hash_table_destroy (positions);
+
+	return TRUE;
+}
+
+static gboolean
+property_has_value (EphyNode *node,
+		    guint property_id,
+		    const GValue *value)
+{
+	GValue current = { 0, };
+	gboolean equal;
+
+	if (!ephy_node_get_property (node, property_id, &current))
+	{
+		return FALSE;
+	}
+
+	if (G_VALUE_TYPE (&current) != G_VALUE_TYPE (value))
+	{
+		g_value_unset (&current);
+		return FALSE;
+	}
+
+	switch (G_VALUE_TYPE (value))
+	{
+	case G_TYPE_STRING:
+		equal = g_strcmp0 (g_value_get_string (&current),
+				   g_value_get_string (value)) == 0;
+		break;
+	case G_TYPE_BOOLEAN:
+		equal = g_value_get_boolean (&current) == g_value_get_boolean (value);
+		break;
+	case G_TYPE_INT:
+		equal = g_value_get_int (&current) == g_value_get_int (value);
+		break;
+	case G_TYPE_LONG:
+		equal = g_value_get_long (&current) == g_value_get_long (value);
+		break;
+	case G_TYPE_FLOAT:
+		equal = g_value_get_float (&current) == g_value_get_float (value);
+		break;
+	case G_TYPE_DOUBLE:
+		equal = g_value_get_double (&current) == g_value_get_double (value);
+		break;
+	default:
+		equal = FALSE;
+	}
+
+	g_value_unset (&current);
+
+	return equal;
+}
+
+/* Applies one record. Replaying a change that is already in the db, as
+ * happens when the db was saved but the journal not yet discarded, is
+ * skipped, so that it leaves the db unchanged and emits no signals. */
+static gboolean
+journal_replay_record (EphyNodeDb *db,
+		       const guint8 *payload,
+		       gsize len)
+{
+	JournalReader reader = { payload, payload + len };
+	EphyNode *node, *child;
+	guint32 op, id, other_id;
+
+	if (!journal_read_uint32 (&reader, &op) ||
+	    !journal_read_uint32 (&reader, &id))
+	{
+		return FALSE;
+	}
+
+	node = ephy_node_db_get_node_from_id (db, id);
+
+	switch (op)
+	{
+	case JOURNAL_OP_NEW:
+		if (node == NULL)
+		{
+			ephy_node_new_with_id (db, id);
+		}
+		break;
+	case JOURNAL_OP_DESTROY:
+		if (node != NULL)
+		{
+			ephy_node_unref (node);
+		}
+		break;
+	case JOURNAL_OP_SET_PROPERTY:
+		{
+			GValue value = { 0, };
+
+			if (!journal_read_uint32 (&reader, &other_id) ||
+			    !journal_read_value (&reader, &value))
+			{
+				return FALSE;
+			}
+
+			if (node != NULL && !property_has_value (node, other_id, &value))
+			{
+				ephy_node_set_property (node, other_id, &value);
+			}
+			g_value_unset (&value);
+		}
+		break;
+	case JOURNAL_OP_ADD_CHILD:
+	case JOURNAL_OP_REMOVE_CHILD:
+		if (!journal_read_uint32 (&reader, &other_id)) return FALSE;
+
+		child = ephy_node_db_get_node_from_id (db, other_id);
+		if (node == NULL || child == NULL) break;
+
+		if (op == JOURNAL_OP_ADD_CHILD)
+		{
+			if (!ephy_node_has_child (node, child))
+			{
+				ephy_node_add_child (node, child);
+			}
+		}
+		else if (ephy_node_has_child (node, child))
+		{
+			ephy_node_remove_child (node, child);
+		}
+		break;
+	case JOURNAL_OP_REORDER:
+		return journal_replay_reorder (db, &reader, node);
+	default:
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Replays the changes in @filename, stopping at the first one that was
+ * not completely written. Returns the size of the part of the file that
+ * was replayed, or 0 if it is missing or could not be read at all; in the
+ * latter case @invalid is set. */
+static gsize
+journal_replay_file (EphyNodeDb *db,
+		     const char *filename,
+		     gboolean *invalid)
+{
+	GMappedFile *mapped;
+	const guint8 *data, *p, *end;
+	gsize length;
+	guint n_records = 0;
+
+	mapped = g_mapped_file_new (filename, FALSE, NULL);
+	if (mapped == NULL)
+	{
+		if (g_file_test (filename, G_FILE_TEST_EXISTS)) *invalid = TRUE;
+		return 0;
+	}
+
+	data = (const guint8 *)g_mapped_file_get_contents (mapped);
+	length = g_mapped_file_get_length (mapped);
+
+	if (data == NULL || length < JOURNAL_HEADER_SIZE ||
+	    memcmp (data, JOURNAL_MAGIC, JOURNAL_MAGIC_LEN) != 0 ||
+	    get_uint32 (data + JOURNAL_MAGIC_LEN) != JOURNAL_FORMAT_VERSION)
+	{
+		g_warning ("Journal %s is invalid, ignoring it", filename);
+		g_mapped_file_unref (mapped);
+		*invalid = TRUE;
+		return 0;
+	}
+
+	p = data + JOURNAL_HEADER_SIZE;
+	end = data + length;
+
+	while ((gsize)(end - p) >= JOURNAL_RECORD_HEADER_SIZE)
+	{
+		guint32 len = get_uint32 (p);
+
+		if ((gsize)(end - p) - JOURNAL_RECORD_HEADER_SIZE < len ||
+		    journal_hash (p + JOURNAL_RECORD_HEADER_SIZE, len) != get_uint32 (p + 4) ||
+		    !journal_replay_record (db, p + JOURNAL_RECORD_HEADER_SIZE, len))
+		{
+			break;
+		}
+
+		p += JOURNAL_RECORD_HEADER_SIZE + len;
+		n_records++;
+	}
+
+	if (p != end)
+	{
+		g_warning ("Journal %s has %" G_GSIZE_FORMAT " bytes of incomplete changes, dropping them",
+			   filename, (gsize)(end - p));
+	}
+
+	LOG ("Replayed %u changes from %s", n_records, filename);
+
+	length = p - data;
+	g_mapped_file_unref (mapped);
+
+	return length;
+}
+
+static void
+ephy_node_db_replay_journal (EphyNodeDb *db,
+			     const char *snapshot_file)
+{
+	EphyNodeDbPrivate *priv = db->priv;
+	gboolean was_immutable;
+	char *old_file;
+
+	START_PROFILER ("replaying node db journal")
+
+	g_free (priv->journal_file);
+	priv->journal_file = g_strconcat (snapshot_file, JOURNAL_SUFFIX, NULL);
+	old_file = g_strconcat (snapshot_file, JOURNAL_OLD_SUFFIX, NULL);
+
+	was_immutable = priv->immutable;
+	priv->immutable = FALSE;
+
+	priv->journal_invalid = FALSE;
+	priv->journal_old_valid_size = journal_replay_file (db, old_file,
+							    &priv->journal_invalid);
+	priv->journal_valid_size = journal_replay_file (db, priv->journal_file,
+							&priv->journal_invalid);
+	priv->journal_replayed = TRUE;
+
+	priv->immutable = was_immutable;
+
+	g_free (old_file);
+
+	STOP_PROFILER ("replaying node db journal")
+}
+
+static int
+journal_create (const char *filename)
+{
+	guint32 version = GUINT32_TO_LE (JOURNAL_FORMAT_VERSION);
+	int fd;
+
+	fd = g_open (filename, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) return -1;
+
+	if (!write_all (fd, JOURNAL_MAGIC, JOURNAL_MAGIC_LEN) ||
+	    !write_all (fd, (const char *)&version, 4))
+	{
+		close (fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/* Drops whatever follows the last complete record of @filename. */
+static void
+journal_trim (const char *filename,
+	      gsize valid_size)
+{
+	if (valid_size <= JOURNAL_HEADER_SIZE)
+	{
+		g_unlink (filename);
+	}
+	else if (truncate (filename, valid_size) != 0)
+	{
+		g_warning ("Could not truncate journal %s: %s",
+			   filename, g_strerror (errno));
+	}
+}
+
+/**
+ * ephy_node_db_enable_journal:
+ * @db: an #EphyNodeDb
+ * @snapshot_file: the snapshot @db is saved to
+ *
+ * From now on, appends every change made to @db to a journal next to
+ * @snapshot_file instead of requiring a new snapshot. The journal is
+ * written by ephy_node_db_journal_flush(), and replayed by
+ * ephy_node_db_load_from_snapshot() on top of the snapshot.
+ *
+ * A journal left over from another session only matches @db if @db was
+ * populated from @snapshot_file and the journal could be read, in which
+ * case it is kept and appended to. Otherwise it is discarded, and a new
+ * snapshot should be written as soon as possible.
+ *
+ * Return value: %TRUE if @snapshot_file and the journal match @db
+ **/
+gboolean
+ephy_node_db_enable_journal (EphyNodeDb *db,
+			     const char *snapshot_file)
+{
+	EphyNodeDbPrivate *priv;
+	char *journal_file, *old_file;
+	gboolean in_sync;
+
+	g_return_val_if_fail (EPHY_IS_NODE_DB (db), FALSE);
+	g_return_val_if_fail (snapshot_file != NULL, FALSE);
+
+	priv = db->priv;
+	g_return_val_if_fail (priv->journal_fd < 0, FALSE);
+
+	journal_file = g_strconcat (snapshot_file, JOURNAL_SUFFIX, NULL);
+	old_file = g_strconcat (snapshot_file, JOURNAL_OLD_SUFFIX, NULL);
+
+	in_sync = priv->journal_replayed && !priv->journal_invalid &&
+		  g_strcmp0 (priv->journal_file, journal_file) == 0;
+
+	if (in_sync && priv->journal_valid_size > 0)
+	{
+		journal_trim (old_file, priv->journal_old_valid_size);
+
+		if (truncate (journal_file, priv->journal_valid_size) == 0)
+		{
+			priv->journal_fd = g_open (journal_file, O_WRONLY | O_APPEND, 0);
+		}
+		priv->journal_size = priv->journal_valid_size;
+	}
+	else
+	{
+		if (!in_sync)
+		{
+			g_unlink (old_file);
+		}
+		else
+		{
+			journal_trim (old_file, priv->journal_old_valid_size);
+		}
+
+		priv->journal_fd = journal_create (journal_file);
+		priv->journal_size = JOURNAL_HEADER_SIZE;
+	}
+
+	g_free (priv->journal_file);
+	priv->journal_file = journal_file;
+	priv->journal_replayed = FALSE;
+
+	g_free (old_file);
+
+	if (priv->journal_fd < 0)
+	{
+		g_warning ("Could not open journal %s: %s",
+			   journal_file, g_strerror (errno));
+		return FALSE;
+	}
+
+	return in_sync;
+}
+
+/**
+ * ephy_node_db_disable_journal:
+ * @db: an #EphyNodeDb
+ *
+ * Writes the pending changes to the journal and stops journaling.
+ **/
+void
+ephy_node_db_disable_journal (EphyNodeDb *db)
+{
+	g_return_if_fail (EPHY_IS_NODE_DB (db));
+
+	journal_write_buffer (db, TRUE);
+	journal_close (db);
+
+	g_free (db->priv->journal_file);
+	db->priv->journal_file = NULL;
+}
+
+/**
+ * ephy_node_db_get_journal_size:
+ * @db: an #EphyNodeDb
+ *
+ * Return value: the size of the journal in bytes, counting the changes
+ * that were not written yet
+ **/
+gsize
+ephy_node_db_get_journal_size (EphyNodeDb *db)
+{
+	g_return_val_if_fail (EPHY_IS_NODE_DB (db), 0);
+
+	return db->priv->journal_size + db->priv->journal_buffer->len;
+}
+
+/**
+ * ephy_node_db_journal_flush:
+ * @db: an #EphyNodeDb
+ *
+ * Writes the pending changes to the journal and waits for them to reach
+ * the disk.
+ *
+ * Return value: %TRUE if every change made to @db since the journal was
+ * enabled is now on disk, %FALSE if a new snapshot is needed for that
+ **/
+gboolean
+ephy_node_db_journal_flush (EphyNodeDb *db)
+{
+	g_return_val_if_fail (EPHY_IS_NODE_DB (db), FALSE);
+
+	if (db->priv->journal_fd >= 0 && db->priv->journal_buffer->len == 0)
+	{
+		return TRUE;
+	}
+
+	return journal_write_buffer (db, TRUE);
+}
+
+/**
+ * ephy_node_db_journal_rotate:
+ * @db: an #EphyNodeDb
+ *
+ * Starts a new journal, keeping the changes in the current one aside
+ * until ephy_node_db_journal_compacted() is called. This has to be called
+ * right after taking the snapshot that will replace the current one, so
+ * that the journal continues from that snapshot.
+ **/
+void
+ephy_node_db_journal_rotate (EphyNodeDb *db)
+{
+	EphyNodeDbPrivate *priv;
+	char *old_file;
+
+	g_return_if_fail (EPHY_IS_NODE_DB (db));
+
+	priv = db->priv;
+	if (priv->journal_file == NULL) return;
+
+	journal_write_buffer (db, TRUE);
+	journal_close (db);
+
+	old_file = g_strconcat (priv->journal_file, ".old", NULL);
+
+	/* If the last snapshot could not be written, the changes it was
+	 * missing are still in the old journal and the current one goes
+	 * after them. */
+	if (g_file_test (old_file, G_FILE_TEST_EXISTS))
+	{
+		char *contents;
+		gsize length;
+		int fd = -1;
+
+		if (g_file_get_contents (priv->journal_file, &contents, &length, NULL))
+		{
+			fd = g_open (old_file, O_WRONLY | O_APPEND, 0);
+			if (fd >= 0 && length > JOURNAL_HEADER_SIZE)
+			{
+				if (!write_all (fd, contents + JOURNAL_HEADER_SIZE,
+						length - JOURNAL_HEADER_SIZE) ||
+				    fsync (fd) != 0)
+				{
+					g_warning ("Could not write to journal %s: %s",
+						   old_file, g_strerror (errno));
+				}
+			}
+			if (fd >= 0) close (fd);
+			g_free (contents);
+		}
+	}
+	else if (g_rename (priv->journal_file, old_file) != 0)
+	{
+		g_warning ("Could not rename journal %s: %s",
+			   priv->journal_file, g_strerror (errno));
+	}
+
+	priv->journal_fd = journal_create (priv->journal_file);
+	priv->journal_size = JOURNAL_HEADER_SIZE;
+
+	if (priv->journal_fd < 0)
+	{
+		g_warning ("Could not open journal %s: %s",
+			   priv->journal_file, g_strerror (errno));
+	}
+
+	g_free (old_file);
+}
+
+/**
+ * ephy_node_db_journal_compacted:
+ * @db: an #EphyNodeDb
+ *
+ * Discards the changes put aside by ephy_node_db_journal_rotate(), once
+ * the snapshot taken with them is on disk.
+ **/
+void
+ephy_node_db_journal_compacted (EphyNodeDb *db)
+{
+	char *old_file;
+
+	g_return_if_fail (EPHY_IS_NODE_DB (db));
+
+	if (db->priv->journal_file == NULL) return;
+
+	old_file = g_strconcat (db->priv->journal_file, ".old", NULL);
+	g_unlink (old_file);
+	g_free (old_file);
+}
+
+static gboolean
+get_modification_time (const char *filename,
+		       GTimeVal *mtime)
+{
+	GFile *file;
+	GFileInfo *info;
+
+	file = g_file_new_for_path (filename);
+	info = g_file_query_info (file,
+				  G_FILE_ATTRIBUTE_TIME_MODIFIED ","
+				  G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC,
+				  G_FILE_QUERY_INFO_NONE, NULL, NULL);
+	g_object_unref (file);
+
+	if (info == NULL) return FALSE;
+
+	g_file_info_get_modification_time (info, mtime);
+	g_object_unref (info);
+
+	return TRUE;
+}
+
+/* Whether @file was written after @other. Both are usually written on
+ * exit, so compare to the microsecond, and when in doubt prefer @other. */
+static gboolean
+file_is_newer (const char *file,
+	       const char *other)
+{
+	GTimeVal file_time, other_time;
+
+	if (!get_modification_time (other, &other_time)) return TRUE;
+	if (!get_modification_time (file, &file_time)) return FALSE;
+
+	if (file_time.tv_sec != other_time.tv_sec)
+		return file_time.tv_sec > other_time.tv_sec;
+
+	return file_time.tv_usec > other_time.tv_usec;
+}
+
+/**
+ * ephy_node_db_load_from_snapshot:
+ * @db: a new #EphyNodeDb
+ * @snapshot_file: the snapshot from which @db will be populated
+ * @xml_file: (allow-none): the XML file to fall back to
+ * @xml_root: the root element in @xml_file
+ * @xml_version: the version of both @snapshot_file and @xml_file
+ *
+ * Populates @db from @snapshot_file, as written by
+ * ephy_node_db_write_to_snapshot_safe(). The snapshot is not used if it
+ * is missing, broken, was written for another version, or is not newer
+ * than @xml_file, which is then loaded with ephy_node_db_load_from_file()
+ * instead.
+ *
+ * The changes journaled since @snapshot_file was written, see
+ * ephy_node_db_enable_journal(), are replayed on top of it.
+ *
+ * Return value: %TRUE if @db was populated from either file
+ **/
+gboolean
+ephy_node_db_load_from_snapshot (EphyNodeDb *db,
+				 const char *snapshot_file,
+				 const char *xml_file,
+				 const xmlChar *xml_root,
+				 const xmlChar *xml_version)
+{
+	g_return_val_if_fail (EPHY_IS_NODE_DB (db), FALSE);
+	g_return_val_if_fail (snapshot_file != NULL, FALSE);
+
+	if ((xml_file == NULL || file_is_newer (snapshot_file, xml_file)) &&
+	    ephy_node_db_load_snapshot (db, snapshot_file, (const char *)xml_version))
+	{
+		ephy_node_db_replay_journal (db, snapshot_file);
+		return TRUE;
+	}
+
+	if (xml_file == NULL) return FALSE;
+
+	return ephy_node_db_load_from_file (db, xml_file, xml_root, xml_version);
+}
+
 static void
 ephy_node_db_class_init (EphyNodeDbClass *klass)
 {
@@ -39,6 +39,10 @@ G_BEGIN_DECLS
 
 typedef struct _EphyNodeDb EphyNodeDb;
 typedef struct _EphyNodeDbPrivate EphyNodeDbPrivate;
+typedef struct _EphyNodeDbSnapshot EphyNodeDbSnapshot;
+typedef struct _EphyNodeIndex EphyNodeIndex;
+
+typedef char * (* EphyNodeIndexKeyFunc) (const char *value);
 
 struct _EphyNodeDb
 {
@@ -72,6 +76,75 @@ int           ephy_node_db_write_to_xml_safe	(EphyNodeDb *db,
 						 const xmlChar *comment,
 						 EphyNode *node, ...);
 
+gboolean      ephy_node_db_load_from_snapshot	(EphyNodeDb *db,
+						 const char *snapshot_file,
+						 const char *xml_file,
+						 const xmlChar *xml_root,
+						 const xmlChar *xml_version);
+
+int           ephy_node_db_write_to_snapshot_safe	(EphyNodeDb *db,
+						 const char *filename,
+						 const char *version,
+						 EphyNode *node, ...);
+
+EphyNodeDbSnapshot *ephy_node_db_take_snapshot	(EphyNodeDb *db,
+						 const char *version,
+						 EphyNode *node, ...);
+
+EphyNodeDbSnapshot *ephy_node_db_snapshot_ref	(EphyNodeDbSnapshot *snapshot);
+
+void          ephy_node_db_snapshot_unref	(EphyNodeDbSnapshot *snapshot);
+
+gboolean      ephy_node_db_snapshot_write	(EphyNodeDbSnapshot *snapshot,
+						 const char *filename);
+
+guint         ephy_node_db_snapshot_get_n_nodes	(EphyNodeDbSnapshot *snapshot);
+
+guint         ephy_node_db_snapshot_get_id	(EphyNodeDbSnapshot *snapshot,
+						 guint index);
+
+const char   *ephy_node_db_snapshot_get_property_string (EphyNodeDbSnapshot *snapshot,
+						 guint index,
+						 guint property_id);
+
+int           ephy_node_db_snapshot_get_property_int (EphyNodeDbSnapshot *snapshot,
+						 guint index,
+						 guint property_id);
+
+guint         ephy_node_db_snapshot_get_n_parents (EphyNodeDbSnapshot *snapshot,
+						 guint index);
+
+guint         ephy_node_db_snapshot_get_parent_id (EphyNodeDbSnapshot *snapshot,
+						 guint index,
+						 guint n);
+
+gboolean      ephy_node_db_snapshot_has_parent	(EphyNodeDbSnapshot *snapshot,
+						 guint index,
+						 guint parent_id);
+
+gboolean      ephy_node_db_enable_journal	(EphyNodeDb *db,
+						 const char *snapshot_file);
+
+void          ephy_node_db_disable_journal	(EphyNodeDb *db);
+
+gsize         ephy_node_db_get_journal_size	(EphyNodeDb *db);
+
+gboolean      ephy_node_db_journal_flush	(EphyNodeDb *db);
+
+void          ephy_node_db_journal_rotate	(EphyNodeDb *db);
+
+void          ephy_node_db_journal_compacted	(EphyNodeDb *db);
+
+EphyNodeIndex *ephy_node_db_add_index		(EphyNodeDb *db,
+						 EphyNode *parent,
+						 guint property_id,
+						 EphyNodeIndexKeyFunc key_func,
+						 gboolean ordered);
+
+void          ephy_node_db_begin_batch		(EphyNodeDb *db);
+
+void          ephy_node_db_end_batch		(EphyNodeDb *db);
+
 const char   *ephy_node_db_get_name		(EphyNodeDb *db);
 
 gboolean      ephy_node_db_is_immutable		(EphyNodeDb *db);
@@ -82,6 +155,8 @@ void	      ephy_node_db_set_immutable	(EphyNodeDb *db,
 EphyNode     *ephy_node_db_get_node_from_id	(EphyNodeDb *db,
 						 guint id);
 
+void	      ephy_node_db_compact_ids		(EphyNodeDb *db);
+
 guint	      _ephy_node_db_new_id		(EphyNodeDb *db);
 
 void	      _ephy_node_db_add_id		(EphyNodeDb *db,
@@ -91,6 +166,45 @@ void	      _ephy_node_db_add_id		(EphyNodeDb *db,
 void	      _ephy_node_db_remove_id		(EphyNodeDb *db,
 						 guint id);
 
+const char   *_ephy_node_db_intern_string	(EphyNodeDb *db,
+						 const char *string);
+
+void	      _ephy_node_db_release_string	(EphyNodeDb *db,
+						 const char *string);
+
+EphyNodeBatch *_ephy_node_db_get_batch		(EphyNodeDb *db);
+
+GSList	     *_ephy_node_db_get_indexes		(EphyNodeDb *db,
+						 guint parent_id);
+
+gboolean      _ephy_node_db_has_indexes		(EphyNodeDb *db);
+
+void	      _ephy_node_db_remove_indexes	(EphyNodeDb *db,
+						 guint parent_id);
+
+void	      _ephy_node_db_journal_new_node	(EphyNodeDb *db,
+						 guint id);
+
+void	      _ephy_node_db_journal_destroy_node (EphyNodeDb *db,
+						 guint id);
+
+void	      _ephy_node_db_journal_set_property (EphyNodeDb *db,
+						 guint id,
+						 guint property_id,
+						 const GValue *value);
+
+void	      _ephy_node_db_journal_add_child	(EphyNodeDb *db,
+						 guint parent_id,
+						 guint child_id);
+
+void	      _ephy_node_db_journal_remove_child (EphyNodeDb *db,
+						 guint parent_id,
+						 guint child_id);
+
+void	      _ephy_node_db_journal_reorder	(EphyNodeDb *db,
+						 guint parent_id,
+						 GPtrArray *children);
+
 G_END_DECLS
 
 #endif /* __EPHY_NODE_DB_H */
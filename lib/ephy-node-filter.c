@@ -29,8 +29,6 @@
 static void ephy_node_filter_class_init (EphyNodeFilterClass *klass);
 static void ephy_node_filter_init (EphyNodeFilter *node);
 static void ephy_node_filter_finalize (GObject *object);
-static gboolean ephy_node_filter_expression_evaluate (EphyNodeFilterExpression *expression,
-						      EphyNode *node);
 
 enum
 {
@@ -40,9 +38,58 @@ enum
 
 #define EPHY_NODE_FILTER_GET_PRIVATE(object)(G_TYPE_INSTANCE_GET_PRIVATE ((object), EPHY_TYPE_NODE_FILTER, EphyNodeFilterPrivate))
 
+/*
+ * The levels are flattened into a program, one instruction per
+ * expression, where each instruction knows where its level ends.
+ *
+ * Results are cached per node along with the node's stamp and the
+ * serial of the program they were computed with, so evaluating the same
+ * filter again only evaluates the nodes that changed. The case folded
+ * strings the string expressions compare against only depend on the
+ * node, so they are kept across filter changes too: typing in a search
+ * entry folds every title once, not once per keystroke. The entries of
+ * nodes that were destroyed meanwhile are dropped when the filter is
+ * emptied.
+ */
+
+typedef struct
+{
+	EphyNodeFilterExpression *expression;
+	guint level_end;
+} FilterInstruction;
+
+typedef struct
+{
+	int prop_id;
+	char *folded;
+} FoldedProperty;
+
+typedef struct
+{
+	guint stamp;
+	guint serial;
+	gboolean result;
+
+	guint n_folded;
+	FoldedProperty *folded;
+} FilterCacheEntry;
+
 struct _EphyNodeFilterPrivate
 {
 	GPtrArray *levels;
+
+	GArray *program;
+	gboolean compiled;
+
+	/* Whether results only depend on the node itself. */
+	gboolean cacheable;
+
+	/* Changes with every change to the expressions, never 0. */
+	guint serial;
+
+	/* Node id to FilterCacheEntry, for the nodes of db. */
+	GPtrArray *cache;
+	EphyNodeDb *db;
 };
 
 struct _EphyNodeFilterExpression
@@ -75,6 +122,22 @@ static GObjectClass *parent_class = NULL;
 
 static guint ephy_node_filter_signals[LAST_SIGNAL] = { 0 };
 
+static void
+cache_entry_free (FilterCacheEntry *entry)
+{
+	guint i;
+
+	if (entry == NULL) return;
+
+	for (i = 0; i < entry->n_folded; i++)
+	{
+		g_free (entry->folded[i].folded);
+	}
+	g_free (entry->folded);
+
+	g_slice_free (FilterCacheEntry, entry);
+}
+
 GType
 ephy_node_filter_get_type (void)
 {
@@ -131,6 +194,9 @@ ephy_node_filter_init (EphyNodeFilter *filter)
 	filter->priv = EPHY_NODE_FILTER_GET_PRIVATE (filter);
 
 	filter->priv->levels = g_ptr_array_new ();
+	filter->priv->program = g_array_new (FALSE, FALSE, sizeof (FilterInstruction));
+	filter->priv->serial = 1;
+	filter->priv->cache = g_ptr_array_new_with_free_func ((GDestroyNotify) cache_entry_free);
 }
 
 static void
@@ -141,6 +207,14 @@ ephy_node_filter_finalize (GObject *object)
 	ephy_node_filter_empty (filter);
 
 	g_ptr_array_free (filter->priv->levels, TRUE);
+	g_array_free (filter->priv->program, TRUE);
+	g_ptr_array_free (filter->priv->cache, TRUE);
+
+	if (filter->priv->db != NULL)
+	{
+		g_object_remove_weak_pointer (G_OBJECT (filter->priv->db),
+					      (gpointer *) &filter->priv->db);
+	}
 
 	G_OBJECT_CLASS (parent_class)->finalize (object);
 }
@@ -151,6 +225,19 @@ ephy_node_filter_new (void)
 	return EPHY_NODE_FILTER (g_object_new (EPHY_TYPE_NODE_FILTER, NULL));
 }
 
+static void
+invalidate (EphyNodeFilter *filter)
+{
+	filter->priv->compiled = FALSE;
+
+	if (++filter->priv->serial == 0)
+	{
+		/* Wrapped around, cached results could look current. */
+		g_ptr_array_set_size (filter->priv->cache, 0);
+		filter->priv->serial = 1;
+	}
+}
+
 void
 ephy_node_filter_add_expression (EphyNodeFilter *filter,
 			         EphyNodeFilterExpression *exp,
@@ -162,6 +249,32 @@ ephy_node_filter_add_expression (EphyNodeFilter *filter,
 	/* FIXME bogosity! This only works because g_list_append (x, data) == x */
 	g_ptr_array_index (filter->priv->levels, level) =
 		g_list_append (g_ptr_array_index (filter->priv->levels, level), exp);
+
+	invalidate (filter);
+}
+
+static void
+prune_cache (EphyNodeFilter *filter)
+{
+	EphyNodeFilterPrivate *priv = filter->priv;
+	guint id;
+
+	if (priv->db == NULL)
+	{
+		g_ptr_array_set_size (priv->cache, 0);
+		return;
+	}
+
+	for (id = 0; id < priv->cache->len; id++)
+	{
+		FilterCacheEntry *entry = g_ptr_array_index (priv->cache, id);
+
+		if (entry != NULL && ephy_node_db_get_node_from_id (priv->db, id) == NULL)
+		{
+			cache_entry_free (entry);
+			g_ptr_array_index (priv->cache, id) = NULL;
+		}
+	}
 }
 
 void
@@ -188,14 +301,129 @@ ephy_node_filter_empty (EphyNodeFilter *filter)
 
 		g_ptr_array_remove_index (filter->priv->levels, i);
 	}
+
+	prune_cache (filter);
+	invalidate (filter);
 }
 
 void
 ephy_node_filter_done_changing (EphyNodeFilter *filter)
 {
+	invalidate (filter);
+
 	g_signal_emit (G_OBJECT (filter), ephy_node_filter_signals[CHANGED], 0);
 }
 
+static void
+compile (EphyNodeFilter *filter)
+{
+	EphyNodeFilterPrivate *priv = filter->priv;
+	guint i;
+
+	g_array_set_size (priv->program, 0);
+	priv->cacheable = TRUE;
+
+	for (i = 0; i < priv->levels->len; i++)
+	{
+		GList *l;
+		guint level_start = priv->program->len, j;
+
+		for (l = g_ptr_array_index (priv->levels, i); l != NULL; l = l->next)
+		{
+			FilterInstruction instruction;
+			EphyNodeFilterExpression *exp = l->data;
+
+			instruction.expression = exp;
+			g_array_append_val (priv->program, instruction);
+
+			/* The children can change without the node's stamp
+			 * changing. */
+			if (exp->type == EPHY_NODE_FILTER_EXPRESSION_CHILD_PROP_EQUALS)
+				priv->cacheable = FALSE;
+		}
+
+		for (j = level_start; j < priv->program->len; j++)
+		{
+			g_array_index (priv->program, FilterInstruction, j).level_end = priv->program->len;
+		}
+	}
+
+	priv->compiled = TRUE;
+}
+
+static FilterCacheEntry *
+get_cache_entry (EphyNodeFilter *filter,
+		 EphyNode *node)
+{
+	GPtrArray *cache = filter->priv->cache;
+	FilterCacheEntry *entry;
+	guint id, stamp, i;
+
+	id = ephy_node_get_id (node);
+	stamp = ephy_node_get_stamp (node);
+
+	if (filter->priv->db == NULL)
+	{
+		filter->priv->db = ephy_node_get_db (node);
+		g_object_add_weak_pointer (G_OBJECT (filter->priv->db),
+					   (gpointer *) &filter->priv->db);
+	}
+
+	if (id >= cache->len)
+		g_ptr_array_set_size (cache, id + 1);
+
+	entry = g_ptr_array_index (cache, id);
+	if (entry == NULL)
+	{
+		entry = g_slice_new0 (FilterCacheEntry);
+		g_ptr_array_index (cache, id) = entry;
+	}
+	else if (entry->stamp != stamp)
+	{
+		/* The node changed, or this is another node with the same id. */
+		for (i = 0; i < entry->n_folded; i++)
+		{
+			g_free (entry->folded[i].folded);
+		}
+		g_free (entry->folded);
+		entry->folded = NULL;
+		entry->n_folded = 0;
+		entry->serial = 0;
+	}
+
+	entry->stamp = stamp;
+
+	return entry;
+}
+
+static const char *
+get_folded_property (FilterCacheEntry *entry,
+		     EphyNode *node,
+		     int prop_id)
+{
+	const char *prop;
+	guint i;
+
+	for (i = 0; i < entry->n_folded; i++)
+	{
+		if (entry->folded[i].prop_id == prop_id)
+			return entry->folded[i].folded;
+	}
+
+	prop = ephy_node_get_property_string (node, prop_id);
+
+	entry->folded = g_renew (FoldedProperty, entry->folded, entry->n_folded + 1);
+	entry->folded[entry->n_folded].prop_id = prop_id;
+	entry->folded[entry->n_folded].folded = prop ? g_utf8_casefold (prop, -1) : NULL;
+
+	return entry->folded[entry->n_folded++].folded;
+}
+
+static gboolean
+ephy_node_filter_expression_evaluate (EphyNodeFilterExpression *exp,
+				      EphyNode *node,
+				      FilterCacheEntry *entry);
+
 /*
  * We go through each level evaluating the filter expressions. 
  * Every time we get a match we immediately do a break and jump
@@ -206,28 +434,44 @@ gboolean
 ephy_node_filter_evaluate (EphyNodeFilter *filter,
 			   EphyNode *node)
 {
-	int i;
+	EphyNodeFilterPrivate *priv = filter->priv;
+	FilterCacheEntry *entry;
+	FilterInstruction *program;
+	gboolean result = TRUE;
+	guint i;
 
-	for (i = 0; i < filter->priv->levels->len; i++) {
-		GList *l, *list;
-		gboolean handled;
+	if (!priv->compiled)
+		compile (filter);
 
-		handled = FALSE;
+	if (priv->program->len == 0)
+		return TRUE;
 
-		list = g_ptr_array_index (filter->priv->levels, i);
+	entry = get_cache_entry (filter, node);
+	if (priv->cacheable && entry->serial == priv->serial)
+		return entry->result;
+
+	program = (FilterInstruction *) priv->program->data;
+
+	for (i = 0; i < priv->program->len; ) {
+		guint level_end = program[i].level_end;
 
-		for (l = list; l != NULL; l = g_list_next (l)) {
-			if (ephy_node_filter_expression_evaluate (l->data, node) == TRUE) {
-				handled = TRUE;
+		for (; i < level_end; i++) {
+			if (ephy_node_filter_expression_evaluate (program[i].expression, node, entry))
 				break;
-			}
 		}
 
-		if (list != NULL && handled == FALSE)
-			return FALSE;
+		if (i == level_end) {
+			result = FALSE;
+			break;
+		}
+
+		i = level_end;
 	}
-	
-	return TRUE;
+
+	entry->serial = priv->serial;
+	entry->result = result;
+
+	return result;
 }
 
 EphyNodeFilterExpression *
@@ -311,7 +555,8 @@ ephy_node_filter_expression_free (EphyNodeFilterExpression *exp)
 
 static gboolean
 ephy_node_filter_expression_evaluate (EphyNodeFilterExpression *exp,
-				      EphyNode *node)
+				      EphyNode *node,
+				      FilterCacheEntry *entry)
 {
 	switch (exp->type)
 	{
@@ -359,38 +604,26 @@ ephy_node_filter_expression_evaluate (EphyNodeFilterExpression *exp,
 	}
 	case EPHY_NODE_FILTER_EXPRESSION_STRING_PROP_CONTAINS:
 	{
-		const char *prop;
-		char *folded_case;
-		gboolean ret;
+		const char *folded_case;
 
-		prop = ephy_node_get_property_string (node,
-						    exp->args.prop_args.prop_id);
-		if (prop == NULL)
+		folded_case = get_folded_property (entry, node,
+						   exp->args.prop_args.prop_id);
+		if (folded_case == NULL)
 			return FALSE;
 
-		folded_case = g_utf8_casefold (prop, -1);
-		ret = (strstr (folded_case, exp->args.prop_args.second_arg.string) != NULL);
-		g_free (folded_case);
-
-		return ret;
+		return (strstr (folded_case, exp->args.prop_args.second_arg.string) != NULL);
 	}
 	case EPHY_NODE_FILTER_EXPRESSION_STRING_PROP_EQUALS:
 	{
-		const char *prop;
-		char *folded_case;
-		gboolean ret;
+		const char *folded_case;
 
-		prop = ephy_node_get_property_string (node,
-						    exp->args.prop_args.prop_id);
+		folded_case = get_folded_property (entry, node,
+						   exp->args.prop_args.prop_id);
 
-		if (prop == NULL)
+		if (folded_case == NULL)
 			return FALSE;
 
-		folded_case = g_utf8_casefold (prop, -1);
-		ret = (strcmp (folded_case, exp->args.prop_args.second_arg.string) == 0);
-		g_free (folded_case);
-
-		return ret;
+		return (strcmp (folded_case, exp->args.prop_args.second_arg.string) == 0);
 	}
 	case EPHY_NODE_FILTER_EXPRESSION_KEY_PROP_CONTAINS:
 	{
@@ -0,0 +1,437 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2012 Igalia S.L.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include "config.h"
+#include "ephy-node-index.h"
+
+#include <string.h>
+
+/**
+ * SECTION:ephy-node-index
+ * @short_description: Property keyed lookups of the children of an #EphyNode
+ *
+ * An #EphyNodeIndex maps the value of a string property of the children
+ * of a parent node, optionally passed through an #EphyNodeIndexKeyFunc,
+ * to those children. Indexes are declared with ephy_node_db_add_index()
+ * and kept up to date by #EphyNode itself as properties are set and
+ * children added or removed, so lookups never have to walk the children.
+ *
+ * Every index has a hash table for exact lookups. Ordered indexes also
+ * keep the children sorted by key, for prefix lookups.
+ */
+
+struct _EphyNodeIndex {
+  EphyNode *parent;
+  guint property_id;
+  EphyNodeIndexKeyFunc key_func;
+
+  /* Key to the GQueue of nodes with that key, in indexing order. */
+  GHashTable *by_key;
+
+  /* Node to its key. */
+  GHashTable *keys;
+
+  /* Nodes sorted by key, only for ordered indexes. */
+  GPtrArray *sorted;
+};
+
+static char *
+index_make_key (EphyNodeIndex *index, const char *value)
+{
+  if (value == NULL)
+    return NULL;
+
+  if (index->key_func)
+    return index->key_func (value);
+
+  return g_strdup (value);
+}
+
+static char *
+index_get_node_key (EphyNodeIndex *index, EphyNode *node)
+{
+  GValue value = { 0, };
+
+  if (!_ephy_node_peek_property (node, index->property_id, &value))
+    return NULL;
+
+  if (!G_VALUE_HOLDS_STRING (&value))
+    return NULL;
+
+  return index_make_key (index, g_value_get_string (&value));
+}
+
+/* Returns the position of the first node whose key is not lower than
+ * @key, or, if @after is set, of the first one whose key is higher. */
+static guint
+index_sorted_bound (EphyNodeIndex *index, const char *key, gboolean after)
+{
+  guint low = 0, high = index->sorted->len;
+
+  while (low < high) {
+    guint middle = (low + high) / 2;
+    const char *middle_key;
+    int cmp;
+
+    middle_key = g_hash_table_lookup (index->keys,
+                                      g_ptr_array_index (index->sorted, middle));
+    cmp = strcmp (middle_key, key);
+
+    if (cmp < 0 || (after && cmp == 0))
+      low = middle + 1;
+    else
+      high = middle;
+  }
+
+  return low;
+}
+
+static void
+index_sorted_insert (EphyNodeIndex *index, EphyNode *node, const char *key)
+{
+  GPtrArray *sorted = index->sorted;
+  guint position;
+
+  position = index_sorted_bound (index, key, TRUE);
+
+  g_ptr_array_add (sorted, NULL);
+  memmove (sorted->pdata + position + 1, sorted->pdata + position,
+           (sorted->len - position - 1) * sizeof (gpointer));
+  sorted->pdata[position] = node;
+}
+
+static void
+index_sorted_remove (EphyNodeIndex *index, EphyNode *node, const char *key)
+{
+  guint position;
+
+  for (position = index_sorted_bound (index, key, FALSE);
+       position < index->sorted->len;
+       position++) {
+    if (g_ptr_array_index (index->sorted, position) == node) {
+      g_ptr_array_remove_index (index->sorted, position);
+      return;
+    }
+  }
+}
+
+static void
+index_remove (EphyNodeIndex *index, EphyNode *node)
+{
+  const char *key;
+  GQueue *nodes;
+
+  key = g_hash_table_lookup (index->keys, node);
+  if (key == NULL)
+    return;
+
+  nodes = g_hash_table_lookup (index->by_key, key);
+  g_queue_remove (nodes, node);
+
+  if (g_queue_is_empty (nodes))
+    g_hash_table_remove (index->by_key, key);
+
+  if (index->sorted)
+    index_sorted_remove (index, node, key);
+
+  g_hash_table_remove (index->keys, node);
+}
+
+static void
+index_add (EphyNodeIndex *index, EphyNode *node)
+{
+  GQueue *nodes;
+  char *key;
+
+  index_remove (index, node);
+
+  key = index_get_node_key (index, node);
+  if (key == NULL)
+    return;
+
+  g_hash_table_insert (index->keys, node, key);
+
+  nodes = g_hash_table_lookup (index->by_key, key);
+  if (nodes == NULL) {
+    nodes = g_queue_new ();
+    g_hash_table_insert (index->by_key, g_strdup (key), nodes);
+  }
+  g_queue_push_tail (nodes, node);
+
+  if (index->sorted)
+    index_sorted_insert (index, node, key);
+}
+
+EphyNodeIndex *
+_ephy_node_index_new (EphyNode *parent,
+                      guint property_id,
+                      EphyNodeIndexKeyFunc key_func,
+                      gboolean ordered)
+{
+  EphyNodeIndex *index;
+  GPtrArray *children;
+  guint i;
+
+  index = g_slice_new0 (EphyNodeIndex);
+  index->parent = parent;
+  index->property_id = property_id;
+  index->key_func = key_func;
+  index->by_key = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                         g_free, (GDestroyNotify)g_queue_free);
+  index->keys = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+
+  if (ordered)
+    index->sorted = g_ptr_array_new ();
+
+  children = ephy_node_get_children (parent);
+  for (i = 0; i < children->len; i++)
+    index_add (index, g_ptr_array_index (children, i));
+
+  return index;
+}
+
+void
+_ephy_node_index_free (EphyNodeIndex *index)
+{
+  g_hash_table_destroy (index->by_key);
+  g_hash_table_destroy (index->keys);
+
+  if (index->sorted)
+    g_ptr_array_free (index->sorted, TRUE);
+
+  g_slice_free (EphyNodeIndex, index);
+}
+
+void
+_ephy_node_index_child_added (EphyNodeIndex *index,
+                              EphyNode *child)
+{
+  index_add (index, child);
+}
+
+void
+_ephy_node_index_child_removed (EphyNodeIndex *index,
+                                EphyNode *child)
+{
+  index_remove (index, child);
+}
+
+void
+_ephy_node_index_child_changed (EphyNodeIndex *index,
+                                EphyNode *child,
+                                guint property_id)
+{
+  if (property_id == index->property_id)
+    index_add (index, child);
+}
+
+/**
+ * ephy_node_index_lookup:
+ * @index: an #EphyNodeIndex
+ * @value: the property value to look for
+ *
+ * Looks for a child whose indexed property has @value, or, if @index
+ * has a key function, the same key as @value.
+ *
+ * Return value: (transfer none): the first matching child to be indexed,
+ * or %NULL
+ **/
+EphyNode *
+ephy_node_index_lookup (EphyNodeIndex *index,
+                        const char *value)
+{
+  GQueue *nodes;
+  char *key;
+
+  g_return_val_if_fail (index != NULL, NULL);
+  g_return_val_if_fail (value != NULL, NULL);
+
+  key = index_make_key (index, value);
+  if (key == NULL)
+    return NULL;
+
+  nodes = g_hash_table_lookup (index->by_key, key);
+  g_free (key);
+
+  return nodes ? g_queue_peek_head (nodes) : NULL;
+}
+
+/**
+ * ephy_node_index_lookup_last:
+ * @index: an #EphyNodeIndex
+ * @value: the property value to look for
+ *
+ * Like ephy_node_index_lookup(), but finds the last matching child to be
+ * indexed. Unless their key changed since, this is the last matching one
+ * to be added to the parent.
+ *
+ * Return value: (transfer none): the last matching child to be indexed,
+ * or %NULL
+ **/
+EphyNode *
+ephy_node_index_lookup_last (EphyNodeIndex *index,
+                             const char *value)
+{
+  GQueue *nodes;
+  char *key;
+
+  g_return_val_if_fail (index != NULL, NULL);
+  g_return_val_if_fail (value != NULL, NULL);
+
+  key = index_make_key (index, value);
+  if (key == NULL)
+    return NULL;
+
+  nodes = g_hash_table_lookup (index->by_key, key);
+  g_free (key);
+
+  return nodes ? g_queue_peek_tail (nodes) : NULL;
+}
+
+/**
+ * ephy_node_index_lookup_all:
+ * @index: an #EphyNodeIndex
+ * @value: the property value to look for
+ * @nodes: (element-type EphyNode): the array the matching children are
+ * appended to
+ *
+ * Like ephy_node_index_lookup(), but finds every matching child.
+ *
+ * Return value: the number of children appended to @nodes
+ **/
+guint
+ephy_node_index_lookup_all (EphyNodeIndex *index,
+                            const char *value,
+                            GPtrArray *nodes)
+{
+  GQueue *queue;
+  GList *l;
+  char *key;
+  guint n_nodes = 0;
+
+  g_return_val_if_fail (index != NULL, 0);
+  g_return_val_if_fail (value != NULL, 0);
+  g_return_val_if_fail (nodes != NULL, 0);
+
+  key = index_make_key (index, value);
+  if (key == NULL)
+    return 0;
+
+  queue = g_hash_table_lookup (index->by_key, key);
+  for (l = queue ? queue->head : NULL; l; l = l->next) {
+    g_ptr_array_add (nodes, l->data);
+    n_nodes++;
+  }
+
+  g_free (key);
+
+  return n_nodes;
+}
+
+/**
+ * ephy_node_index_lookup_prefix:
+ * @index: an ordered #EphyNodeIndex
+ * @prefix: the key prefix to look for
+ *
+ * Return value: (transfer none): the child with the lowest sorting key
+ * that starts with @prefix, or %NULL
+ **/
+EphyNode *
+ephy_node_index_lookup_prefix (EphyNodeIndex *index,
+                               const char *prefix)
+{
+  EphyNode *node;
+  guint position;
+
+  g_return_val_if_fail (index != NULL, NULL);
+  g_return_val_if_fail (index->sorted != NULL, NULL);
+  g_return_val_if_fail (prefix != NULL, NULL);
+
+  position = index_sorted_bound (index, prefix, FALSE);
+  if (position == index->sorted->len)
+    return NULL;
+
+  node = g_ptr_array_index (index->sorted, position);
+  if (!g_str_has_prefix (g_hash_table_lookup (index->keys, node), prefix))
+    return NULL;
+
+  return node;
+}
+
+/**
+ * ephy_node_index_lookup_prefix_all:
+ * @index: an ordered #EphyNodeIndex
+ * @prefix: the key prefix to look for
+ * @nodes: (element-type EphyNode): the array the matching children are
+ * appended to
+ *
+ * Like ephy_node_index_lookup_prefix(), but finds every child whose key
+ * starts with @prefix, appending them sorted by key. Finding the first
+ * one takes a binary search, so this costs time proportional to the
+ * number of matches, not to the number of children.
+ *
+ * Return value: the number of children appended to @nodes
+ **/
+guint
+ephy_node_index_lookup_prefix_all (EphyNodeIndex *index,
+                                   const char *prefix,
+                                   GPtrArray *nodes)
+{
+  guint position, n_nodes = 0;
+
+  g_return_val_if_fail (index != NULL, 0);
+  g_return_val_if_fail (index->sorted != NULL, 0);
+  g_return_val_if_fail (prefix != NULL, 0);
+  g_return_val_if_fail (nodes != NULL, 0);
+
+  for (position = index_sorted_bound (index, prefix, FALSE);
+       position < index->sorted->len;
+       position++) {
+    EphyNode *node = g_ptr_array_index (index->sorted, position);
+
+    if (!g_str_has_prefix (g_hash_table_lookup (index->keys, node), prefix))
+      break;
+
+    g_ptr_array_add (nodes, node);
+    n_nodes++;
+  }
+
+  return n_nodes;
+}
+
+/**
+ * ephy_node_index_get_key:
+ * @index: an #EphyNodeIndex
+ * @node: a child of the indexed parent
+ *
+ * Returns the key @node is indexed by, so callers comparing keys do not
+ * have to compute them again.
+ *
+ * Return value: the key, owned by @index and valid until @node is
+ * removed or its indexed property changes, or %NULL
+ **/
+const char *
+ephy_node_index_get_key (EphyNodeIndex *index,
+                         EphyNode *node)
+{
+  g_return_val_if_fail (index != NULL, NULL);
+
+  return g_hash_table_lookup (index->keys, node);
+}
@@ -0,0 +1,73 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2012 Igalia S.L.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#if !defined (__EPHY_EPIPHANY_H_INSIDE__) && !defined (EPIPHANY_COMPILATION)
+#error "Only <epiphany/epiphany.h> can be included directly."
+#endif
+
+#ifndef EPHY_NODE_INDEX_H
+#define EPHY_NODE_INDEX_H
+
+#include <glib-object.h>
+
+#include "ephy-node-db.h"
+
+G_BEGIN_DECLS
+
+EphyNode      *ephy_node_index_lookup         (EphyNodeIndex *index,
+                                               const char *value);
+
+EphyNode      *ephy_node_index_lookup_last    (EphyNodeIndex *index,
+                                               const char *value);
+
+guint          ephy_node_index_lookup_all     (EphyNodeIndex *index,
+                                               const char *value,
+                                               GPtrArray *nodes);
+
+EphyNode      *ephy_node_index_lookup_prefix  (EphyNodeIndex *index,
+                                               const char *prefix);
+
+guint          ephy_node_index_lookup_prefix_all (EphyNodeIndex *index,
+                                                  const char *prefix,
+                                                  GPtrArray *nodes);
+
+const char    *ephy_node_index_get_key        (EphyNodeIndex *index,
+                                               EphyNode *node);
+
+EphyNodeIndex *_ephy_node_index_new           (EphyNode *parent,
+                                               guint property_id,
+                                               EphyNodeIndexKeyFunc key_func,
+                                               gboolean ordered);
+
+void           _ephy_node_index_free          (EphyNodeIndex *index);
+
+void           _ephy_node_index_child_added   (EphyNodeIndex *index,
+                                               EphyNode *child);
+
+void           _ephy_node_index_child_removed (EphyNodeIndex *index,
+                                               EphyNode *child);
+
+void           _ephy_node_index_child_changed (EphyNodeIndex *index,
+                                               EphyNode *child,
+                                               guint property_id);
+
+G_END_DECLS
+
+#endif /* EPHY_NODE_INDEX_H */
@@ -30,6 +30,7 @@
 #include <time.h>
 
 #include "ephy-node.h"
+#include "ephy-node-index.h"
 
 typedef struct
 {
@@ -47,23 +48,63 @@ typedef struct
 	guint index;
 } EphyNodeParent;
 
+/* A property slot. Unset slots have type G_TYPE_INVALID, strings are
+ * interned in the node's db. */
+typedef struct
+{
+	GType type;
+	union
+	{
+		const char *string;
+		gboolean boolean;
+		int integer;
+		long long_integer;
+		float single;
+		double real;
+		gpointer pointer;
+	} v;
+} EphyNodeProperty;
+
 typedef struct
 {
 	EphyNode *node;
 	guint property_id;
 } EphyNodeChange;
 
+struct _EphyNodeBatch
+{
+	gboolean flushing;
+
+	/* Parent to the set of children whose CHILD_ADDED is held back. */
+	GHashTable *added;
+
+	/* Node to the GArray of ids of its changed properties, and the
+	 * nodes in the order in which they first changed. */
+	GHashTable *changed;
+	GPtrArray *changed_nodes;
+};
+
 struct _EphyNode
 {
 	int ref_count;
 
 	guint id;
 
-	GPtrArray *properties;
+	/* See ephy_node_get_stamp(). */
+	guint stamp;
+
+	EphyNodeProperty *properties;
+	guint n_properties;
+
+	/* Most nodes have a single parent, so the first one is kept inline
+	 * and only the others are allocated. */
+	guint n_parents;
+	EphyNodeParent parent;
+	EphyNodeParent *more_parents;
 
-	GHashTable *parents;
 	GPtrArray *children;
 
+	/* Created when the first callback is connected. */
 	GHashTable *signals;
 	int signal_id;
 	guint emissions;
@@ -80,6 +121,15 @@ typedef struct
 	va_list valist;
 } ENESCData;
 
+/* Every change takes a new value, so no two nodes ever share a stamp. */
+static guint last_stamp;
+
+static inline void
+touch (EphyNode *node)
+{
+	node->stamp = ++last_stamp;
+}
+
 static gboolean
 int_equal (gconstpointer a,
 	   gconstpointer b)
@@ -93,6 +143,87 @@ int_hash (gconstpointer a)
 	return GPOINTER_TO_INT (a);
 }
 
+static inline EphyNodeParent *
+get_parent_nth (EphyNode *node,
+		guint n)
+{
+	return n == 0 ? &node->parent : &node->more_parents[n - 1];
+}
+
+static EphyNodeParent *
+lookup_parent (EphyNode *child,
+	       EphyNode *node)
+{
+	guint i;
+
+	for (i = 0; i < child->n_parents; i++) {
+		EphyNodeParent *node_info = get_parent_nth (child, i);
+
+		if (node_info->node == node) return node_info;
+	}
+
+	return NULL;
+}
+
+static EphyNodeParent *
+add_parent (EphyNode *child,
+	    EphyNode *node)
+{
+	EphyNodeParent *node_info;
+
+	if (child->n_parents > 0) {
+		child->more_parents = g_renew (EphyNodeParent,
+					       child->more_parents,
+					       child->n_parents);
+	}
+
+	node_info = get_parent_nth (child, child->n_parents);
+	node_info->node = node;
+	node_info->index = 0;
+	child->n_parents++;
+
+	return node_info;
+}
+
+static void
+remove_parent (EphyNode *child,
+	       EphyNode *node)
+{
+	guint i;
+
+	for (i = 0; i < child->n_parents; i++) {
+		if (get_parent_nth (child, i)->node == node) break;
+	}
+	if (i == child->n_parents) return;
+
+	/* Keep the other parents in the order they were added. */
+	for (; i + 1 < child->n_parents; i++) {
+		*get_parent_nth (child, i) = *get_parent_nth (child, i + 1);
+	}
+	child->n_parents--;
+
+	if (child->n_parents <= 1) {
+		g_free (child->more_parents);
+		child->more_parents = NULL;
+	}
+}
+
+/* Callers get the same arguments a GHashTable of parents keyed by id
+ * used to give them. */
+static void
+foreach_parent (EphyNode *node,
+		GHFunc func,
+		gpointer user_data)
+{
+	guint i;
+
+	for (i = 0; i < node->n_parents; i++) {
+		EphyNodeParent *node_info = get_parent_nth (node, i);
+
+		func (GINT_TO_POINTER (node_info->node->id), node_info, user_data);
+	}
+}
+
 static void
 callback (long id, EphyNodeSignalData *data, gpointer *dummy)
 {
@@ -179,6 +310,8 @@ ephy_node_emit_signal (EphyNode *node, EphyNodeSignalType type, ...)
 {
 	ENESCData data;
 
+	if (node->signals == NULL) return;
+
 	++node->emissions;
 
 	va_start (data.valist, type);
@@ -205,6 +338,223 @@ ephy_node_emit_signal (EphyNode *node, EphyNodeSignalType type, ...)
 	}
 }
 
+static void
+child_changed (guint id,
+	       EphyNodeParent *node_info,
+	       EphyNodeChange *change)
+{
+	ephy_node_emit_signal (node_info->node, EPHY_NODE_CHILD_CHANGED,
+			       change->node, change->property_id);
+}
+
+static int
+ephy_node_real_get_child_index (EphyNode *node,
+				EphyNode *child);
+
+static void
+property_clear (EphyNode *node,
+		EphyNodeProperty *property);
+
+/* Batched notifications.
+ *
+ * While a batch is open on the db, CHILD_ADDED is held back per parent
+ * and CHANGED/CHILD_CHANGED are coalesced per node and property. They
+ * are emitted when the batch ends, additions first and in child order,
+ * so that listeners see the children in the order they ended up in.
+ * Removing or reordering children of a parent with held back additions,
+ * or destroying one of those children, emits that parent's additions
+ * first, so listeners never see an index they were not told about.
+ */
+
+static inline EphyNodeBatch *
+get_batch (EphyNode *node)
+{
+	EphyNodeBatch *batch = _ephy_node_db_get_batch (node->db);
+
+	return (batch != NULL && !batch->flushing) ? batch : NULL;
+}
+
+static int
+compare_child_index (EphyNode **a,
+		     EphyNode **b,
+		     EphyNode *parent)
+{
+	return ephy_node_real_get_child_index (parent, *a) -
+	       ephy_node_real_get_child_index (parent, *b);
+}
+
+static void
+batch_flush_added (EphyNodeBatch *batch,
+		   EphyNode *parent)
+{
+	GHashTable *children;
+	GHashTableIter iter;
+	GPtrArray *sorted;
+	gpointer child;
+	guint i;
+
+	children = g_hash_table_lookup (batch->added, parent);
+	if (children == NULL) return;
+
+	sorted = g_ptr_array_sized_new (g_hash_table_size (children));
+	g_hash_table_iter_init (&iter, children);
+	while (g_hash_table_iter_next (&iter, &child, NULL)) {
+		g_ptr_array_add (sorted, child);
+	}
+	g_ptr_array_sort_with_data (sorted, (GCompareDataFunc) compare_child_index, parent);
+
+	g_hash_table_remove (batch->added, parent);
+
+	ephy_node_ref (parent);
+	for (i = 0; i < sorted->len; i++) {
+		ephy_node_emit_signal (parent, EPHY_NODE_CHILD_ADDED,
+				       g_ptr_array_index (sorted, i));
+	}
+	ephy_node_unref (parent);
+
+	g_ptr_array_free (sorted, TRUE);
+}
+
+static void
+flush_added_to_parent (gpointer id,
+		       EphyNodeParent *node_info,
+		       EphyNodeBatch *batch)
+{
+	batch_flush_added (batch, node_info->node);
+}
+
+static void
+batch_changed (EphyNodeBatch *batch,
+	       EphyNode *node,
+	       guint property_id)
+{
+	GArray *property_ids;
+	guint i;
+
+	property_ids = g_hash_table_lookup (batch->changed, node);
+	if (property_ids == NULL) {
+		property_ids = g_array_new (FALSE, FALSE, sizeof (guint));
+		g_hash_table_insert (batch->changed, node, property_ids);
+		g_ptr_array_add (batch->changed_nodes, node);
+	}
+
+	for (i = 0; i < property_ids->len; i++) {
+		if (g_array_index (property_ids, guint, i) == property_id) return;
+	}
+
+	g_array_append_val (property_ids, property_id);
+}
+
+static void
+child_added (EphyNode *node,
+	     EphyNode *child)
+{
+	EphyNodeBatch *batch = get_batch (node);
+	GHashTable *children;
+
+	if (batch == NULL) {
+		ephy_node_emit_signal (node, EPHY_NODE_CHILD_ADDED, child);
+		return;
+	}
+
+	children = g_hash_table_lookup (batch->added, node);
+	if (children == NULL) {
+		children = g_hash_table_new (g_direct_hash, g_direct_equal);
+		g_hash_table_insert (batch->added, node, children);
+	}
+	g_hash_table_insert (children, child, child);
+}
+
+EphyNodeBatch *
+_ephy_node_batch_new (void)
+{
+	EphyNodeBatch *batch;
+
+	batch = g_slice_new0 (EphyNodeBatch);
+	batch->added = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+					      NULL, (GDestroyNotify) g_hash_table_destroy);
+	batch->changed = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+						NULL, (GDestroyNotify) g_array_unref);
+	batch->changed_nodes = g_ptr_array_new ();
+
+	return batch;
+}
+
+void
+_ephy_node_batch_flush (EphyNodeBatch *batch)
+{
+	guint i;
+
+	batch->flushing = TRUE;
+
+	while (g_hash_table_size (batch->added) > 0) {
+		GHashTableIter iter;
+		gpointer parent;
+
+		g_hash_table_iter_init (&iter, batch->added);
+		g_hash_table_iter_next (&iter, &parent, NULL);
+
+		batch_flush_added (batch, parent);
+	}
+
+	for (i = 0; i < batch->changed_nodes->len; i++) {
+		EphyNode *node;
+		GArray *property_ids;
+		guint j;
+
+		node = g_ptr_array_index (batch->changed_nodes, i);
+
+		/* Destroyed nodes are not in the table anymore. */
+		property_ids = g_hash_table_lookup (batch->changed, node);
+		if (property_ids == NULL) continue;
+
+		g_array_ref (property_ids);
+		g_hash_table_remove (batch->changed, node);
+
+		ephy_node_ref (node);
+		for (j = 0; j < property_ids->len; j++) {
+			EphyNodeChange change;
+
+			change.node = node;
+			change.property_id = g_array_index (property_ids, guint, j);
+			foreach_parent (node, (GHFunc) child_changed, &change);
+
+			ephy_node_emit_signal (node, EPHY_NODE_CHANGED, change.property_id);
+		}
+		ephy_node_unref (node);
+
+		g_array_unref (property_ids);
+	}
+}
+
+gboolean
+_ephy_node_batch_is_flushing (EphyNodeBatch *batch)
+{
+	return batch->flushing;
+}
+
+void
+_ephy_node_batch_free (EphyNodeBatch *batch)
+{
+	g_hash_table_destroy (batch->added);
+	g_hash_table_destroy (batch->changed);
+	g_ptr_array_free (batch->changed_nodes, TRUE);
+
+	g_slice_free (EphyNodeBatch, batch);
+}
+
+static void
+index_child_changed (gpointer id,
+		     EphyNodeParent *node_info,
+		     EphyNodeChange *change)
+{
+	GSList *l;
+
+	for (l = _ephy_node_db_get_indexes (change->node->db, node_info->node->id); l != NULL; l = l->next) {
+		_ephy_node_index_child_changed (l->data, change->node, change->property_id);
+	}
+}
+
 static inline void
 real_remove_child (EphyNode *node,
 		   EphyNode *child,
@@ -213,17 +563,28 @@ real_remove_child (EphyNode *node,
 {
 	EphyNodeParent *node_info;
 
-	node_info = g_hash_table_lookup (child->parents,
-			                 GINT_TO_POINTER (node->id));
+	node_info = lookup_parent (child, node);
 
 	if (remove_from_parent) {
+		EphyNodeBatch *batch;
 		guint i;
 		guint old_index;
+		GSList *l;
+
+		batch = _ephy_node_db_get_batch (node->db);
+		if (batch != NULL) {
+			batch_flush_added (batch, node);
+		}
 
 		old_index = node_info->index;
 
 		g_ptr_array_remove_index (node->children,
 					  node_info->index);
+		touch (node);
+
+		for (l = _ephy_node_db_get_indexes (node->db, node->id); l != NULL; l = l->next) {
+			_ephy_node_index_child_removed (l->data, child);
+		}
 
 		/* correct indices on kids */
 		for (i = node_info->index; i < node->children->len; i++) {
@@ -233,8 +594,7 @@ real_remove_child (EphyNode *node,
 			borked_node = g_ptr_array_index (node->children, i);
 
 
-			borked_node_info = g_hash_table_lookup (borked_node->parents,
-						                GINT_TO_POINTER (node->id));
+			borked_node_info = lookup_parent (borked_node, node);
 			borked_node_info->index--;
 		}
 
@@ -242,8 +602,8 @@ real_remove_child (EphyNode *node,
 	}
 
 	if (remove_from_child) {
-		g_hash_table_remove (child->parents,
-				     GINT_TO_POINTER (node->id));
+		remove_parent (child, node);
+		touch (child);
 	}
 }
 
@@ -276,24 +636,28 @@ destroy_signal_data (EphyNodeSignalData *signal_data)
         g_slice_free (EphyNodeSignalData, signal_data);
 }
 
-static void
-node_parent_free (EphyNodeParent *parent)
-{
-	g_slice_free (EphyNodeParent, parent);
-}
-
 static void
 ephy_node_destroy (EphyNode *node)
 {
+	EphyNodeBatch *batch;
 	guint i;
 
+	_ephy_node_db_journal_destroy_node (node->db, node->id);
+
+	batch = _ephy_node_db_get_batch (node->db);
+	if (batch != NULL) {
+		foreach_parent (node, (GHFunc) flush_added_to_parent, batch);
+		g_hash_table_remove (batch->added, node);
+		g_hash_table_remove (batch->changed, node);
+	}
+
 	ephy_node_emit_signal (node, EPHY_NODE_DESTROY);
 
         /* Remove from parents. */
-	g_hash_table_foreach (node->parents,
-			      (GHFunc) remove_child,
-			      node);
-	g_hash_table_destroy (node->parents);
+	foreach_parent (node, (GHFunc) remove_child, node);
+	g_free (node->more_parents);
+
+	_ephy_node_db_remove_indexes (node->db, node->id);
 
         /* Remove children. */
 	for (i = 0; i < node->children->len; i++) {
@@ -306,23 +670,18 @@ ephy_node_destroy (EphyNode *node)
 	g_ptr_array_free (node->children, TRUE);
         
         /* Remove signals. */
-	g_hash_table_destroy (node->signals);
+	if (node->signals != NULL) {
+		g_hash_table_destroy (node->signals);
+	}
 
         /* Remove id. */
 	_ephy_node_db_remove_id (node->db, node->id);
 
         /* Remove properties. */
-	for (i = 0; i < node->properties->len; i++) {
-		GValue *val;
-
-		val = g_ptr_array_index (node->properties, i);
-
-		if (val != NULL) {
-			g_value_unset (val);
-			g_slice_free (GValue, val);
-		}
+	for (i = 0; i < node->n_properties; i++) {
+		property_clear (node, &node->properties[i]);
 	}
-	g_ptr_array_free (node->properties, TRUE);
+	g_free (node->properties);
 
 	g_slice_free (EphyNode, node);
 }
@@ -356,19 +715,12 @@ ephy_node_new_with_id (EphyNodeDb *db, guint reserved_id)
 
 	node->id = reserved_id;
 
-	node->db = db;
+	touch (node);
 
-	node->properties = g_ptr_array_new ();
+	node->db = db;
 
 	node->children = g_ptr_array_new ();
 
-	node->parents = g_hash_table_new_full
-          (int_hash, int_equal, NULL, (GDestroyNotify) node_parent_free);
-
-	node->signals = g_hash_table_new_full
-          (int_hash, int_equal, NULL,
-           (GDestroyNotify)destroy_signal_data);
-
 	node->signal_id = 0;
 	node->emissions = 0;
 	node->invalidated_signals = 0;
@@ -377,6 +729,8 @@ ephy_node_new_with_id (EphyNodeDb *db, guint reserved_id)
 
 	_ephy_node_db_add_id (db, reserved_id, node);
 
+	_ephy_node_db_journal_new_node (db, reserved_id);
+
 	return node;
 }
 
@@ -393,6 +747,25 @@ ephy_node_get_db (EphyNode *node)
 	return node->db;
 }
 
+/**
+ * ephy_node_get_stamp:
+ * @node: an #EphyNode
+ *
+ * Returns a value that changes whenever a property of @node is set or
+ * @node gains or loses a parent or a child. Stamps are never reused,
+ * not even by other nodes, so they can be used to tell whether
+ * something cached about @node is still valid.
+ *
+ * Return value: the current stamp of @node
+ **/
+guint
+ephy_node_get_stamp (EphyNode *node)
+{
+	g_return_val_if_fail (EPHY_IS_NODE (node), 0);
+
+	return node->stamp;
+}
+
 guint
 ephy_node_get_id (EphyNode *node)
 {
@@ -426,48 +799,166 @@ ephy_node_unref (EphyNode *node)
 }
 
 static void
-child_changed (guint id,
-	       EphyNodeParent *node_info,
-	       EphyNodeChange *change)
+property_clear (EphyNode *node,
+		EphyNodeProperty *property)
 {
-	ephy_node_emit_signal (node_info->node, EPHY_NODE_CHILD_CHANGED,
-			       change->node, change->property_id);
+	if (property->type == G_TYPE_STRING) {
+		_ephy_node_db_release_string (node->db, property->v.string);
+	}
+
+	property->type = G_TYPE_INVALID;
 }
 
-static inline void
-real_set_property (EphyNode *node,
-		   guint property_id,
-		   GValue *value)
+static void
+property_set_value (EphyNode *node,
+		    EphyNodeProperty *property,
+		    const GValue *value)
 {
-	GValue *old;
+	const char *string = NULL;
 
-	if (property_id >= node->properties->len) {
-		g_ptr_array_set_size (node->properties, property_id + 1);
+	/* Intern first, @value may hold the string being replaced. */
+	if (G_VALUE_HOLDS_STRING (value)) {
+		string = _ephy_node_db_intern_string (node->db,
+						      g_value_get_string (value));
 	}
 
-	old = g_ptr_array_index (node->properties, property_id);
-	if (old != NULL) {
-		g_value_unset (old);
-		g_slice_free (GValue, old);
+	property_clear (node, property);
+
+	switch (G_VALUE_TYPE (value))
+	{
+	case G_TYPE_STRING:
+		property->v.string = string;
+		break;
+	case G_TYPE_BOOLEAN:
+		property->v.boolean = g_value_get_boolean (value);
+		break;
+	case G_TYPE_INT:
+		property->v.integer = g_value_get_int (value);
+		break;
+	case G_TYPE_LONG:
+		property->v.long_integer = g_value_get_long (value);
+		break;
+	case G_TYPE_FLOAT:
+		property->v.single = g_value_get_float (value);
+		break;
+	case G_TYPE_DOUBLE:
+		property->v.real = g_value_get_double (value);
+		break;
+	case G_TYPE_POINTER:
+		property->v.pointer = g_value_get_pointer (value);
+		break;
+	default:
+		g_warning ("Cannot store a property of type %s in an EphyNode",
+			   G_VALUE_TYPE_NAME (value));
+		return;
 	}
 
-	g_ptr_array_index (node->properties, property_id) = value;
+	property->type = G_VALUE_TYPE (value);
+}
+
+/* Fills @value without copying, so that it need not be unset. Strings
+ * stay valid until the property changes. */
+static void
+property_get_value (EphyNodeProperty *property,
+		    GValue *value)
+{
+	g_value_init (value, property->type);
+
+	switch (property->type)
+	{
+	case G_TYPE_STRING:
+		g_value_set_static_string (value, property->v.string);
+		break;
+	case G_TYPE_BOOLEAN:
+		g_value_set_boolean (value, property->v.boolean);
+		break;
+	case G_TYPE_INT:
+		g_value_set_int (value, property->v.integer);
+		break;
+	case G_TYPE_LONG:
+		g_value_set_long (value, property->v.long_integer);
+		break;
+	case G_TYPE_FLOAT:
+		g_value_set_float (value, property->v.single);
+		break;
+	case G_TYPE_DOUBLE:
+		g_value_set_double (value, property->v.real);
+		break;
+	case G_TYPE_POINTER:
+		g_value_set_pointer (value, property->v.pointer);
+		break;
+	default:
+		g_assert_not_reached ();
+	}
+}
+
+static inline EphyNodeProperty *
+get_property (EphyNode *node,
+	      guint property_id,
+	      GType type)
+{
+	EphyNodeProperty *property;
+
+	if (property_id >= node->n_properties) {
+		return NULL;
+	}
+
+	property = &node->properties[property_id];
+	if (property->type == G_TYPE_INVALID) {
+		return NULL;
+	}
+
+	g_return_val_if_fail (property->type == type, NULL);
+
+	return property;
+}
+
+static inline void
+real_set_property (EphyNode *node,
+		   guint property_id,
+		   const GValue *value)
+{
+	if (property_id >= node->n_properties) {
+		node->properties = g_renew (EphyNodeProperty, node->properties,
+					    property_id + 1);
+		memset (node->properties + node->n_properties, 0,
+			(property_id + 1 - node->n_properties) * sizeof (EphyNodeProperty));
+		node->n_properties = property_id + 1;
+	}
+
+	property_set_value (node, &node->properties[property_id], value);
+	touch (node);
+
+	if (_ephy_node_db_has_indexes (node->db)) {
+		EphyNodeChange change;
+
+		change.node = node;
+		change.property_id = property_id;
+		foreach_parent (node, (GHFunc) index_child_changed, &change);
+	}
 }
 
 static inline void
 ephy_node_set_property_internal (EphyNode *node,
 		        	 guint property_id,
-		        	 GValue *value)
+		        	 const GValue *value)
 {
 	EphyNodeChange change;
+	EphyNodeBatch *batch;
 
 	real_set_property (node, property_id, value);
 
+	_ephy_node_db_journal_set_property (node->db, node->id, property_id, value);
+
+	batch = get_batch (node);
+	if (batch != NULL) {
+		batch_changed (batch, node, property_id);
+		return;
+	}
+
 	change.node = node;
 	change.property_id = property_id;
-	g_hash_table_foreach (node->parents,
-			      (GHFunc) child_changed,
-			      &change);
+	foreach_parent (node, (GHFunc) child_changed, &change);
     
 	ephy_node_emit_signal (node, EPHY_NODE_CHANGED, property_id);
 
@@ -478,18 +969,12 @@ ephy_node_set_property (EphyNode *node,
 		        guint property_id,
 		        const GValue *value)
 {
-	GValue *new;
-
 	g_return_if_fail (EPHY_IS_NODE (node));
 	g_return_if_fail (value != NULL);
 
 	if (ephy_node_db_is_immutable (node->db)) return;
 
-	new = g_slice_new0 (GValue);
-	g_value_init (new, G_VALUE_TYPE (value));
-	g_value_copy (value, new);
-
-	ephy_node_set_property_internal (node, property_id, new);
+	ephy_node_set_property_internal (node, property_id, value);
 }
 
 /**
@@ -502,22 +987,27 @@ ephy_node_get_property (EphyNode *node,
 		        guint property_id,
 		        GValue *value)
 {
-	GValue *ret;
+	EphyNodeProperty *property;
 
 	g_return_val_if_fail (EPHY_IS_NODE (node), FALSE);
 	g_return_val_if_fail (value != NULL, FALSE);
 
-	if (property_id >= node->properties->len) {
+	if (property_id >= node->n_properties) {
 		return FALSE;
 	}
 
-	ret = g_ptr_array_index (node->properties, property_id);
-	if (ret == NULL) {
+	property = &node->properties[property_id];
+	if (property->type == G_TYPE_INVALID) {
 		return FALSE;
 	}
 
-	g_value_init (value, G_VALUE_TYPE (ret));
-	g_value_copy (ret, value);
+	property_get_value (property, value);
+
+	/* Unlike the other types, strings have to be copied for the caller
+	 * to own @value. */
+	if (property->type == G_TYPE_STRING) {
+		g_value_set_string (value, property->v.string);
+	}
 
 	return TRUE;
 }
@@ -527,40 +1017,32 @@ ephy_node_set_property_string (EphyNode *node,
 			       guint property_id,
 			       const char *value)
 {
-	GValue *new;
+	GValue new = { 0, };
 
 	g_return_if_fail (EPHY_IS_NODE (node));
 
 	if (ephy_node_db_is_immutable (node->db)) return;
 
-	new = g_slice_new0 (GValue);
-	g_value_init (new, G_TYPE_STRING);
-	g_value_set_string (new, value);
+	g_value_init (&new, G_TYPE_STRING);
+	g_value_set_static_string (&new, value);
 
-	ephy_node_set_property_internal (node, property_id, new);
+	ephy_node_set_property_internal (node, property_id, &new);
 }
 
 const char *
 ephy_node_get_property_string (EphyNode *node,
 			       guint property_id)
 {
-	GValue *ret;
-	const char *retval;
+	EphyNodeProperty *property;
 
 	g_return_val_if_fail (EPHY_IS_NODE (node), NULL);
 
-	if (property_id >= node->properties->len) {
+	property = get_property (node, property_id, G_TYPE_STRING);
+	if (property == NULL) {
 		return NULL;
 	}
 
-	ret = g_ptr_array_index (node->properties, property_id);
-	if (ret == NULL) {
-		return NULL;
-	}
-
-	retval = g_value_get_string (ret);
-
-	return retval;
+	return property->v.string;
 }
 
 void
@@ -568,40 +1050,32 @@ ephy_node_set_property_boolean (EphyNode *node,
 			        guint property_id,
 			        gboolean value)
 {
-	GValue *new;
+	GValue new = { 0, };
 
 	g_return_if_fail (EPHY_IS_NODE (node));
 
 	if (ephy_node_db_is_immutable (node->db)) return;
 
-	new = g_slice_new0 (GValue);
-	g_value_init (new, G_TYPE_BOOLEAN);
-	g_value_set_boolean (new, value);
+	g_value_init (&new, G_TYPE_BOOLEAN);
+	g_value_set_boolean (&new, value);
 
-	ephy_node_set_property_internal (node, property_id, new);
+	ephy_node_set_property_internal (node, property_id, &new);
 }
 
 gboolean
 ephy_node_get_property_boolean (EphyNode *node,
 			        guint property_id)
 {
-	GValue *ret;
-	gboolean retval;
+	EphyNodeProperty *property;
 
 	g_return_val_if_fail (EPHY_IS_NODE (node), FALSE);
 
-	if (property_id >= node->properties->len) {
-		return FALSE;
-	}
-
-	ret = g_ptr_array_index (node->properties, property_id);
-	if (ret == NULL) {
+	property = get_property (node, property_id, G_TYPE_BOOLEAN);
+	if (property == NULL) {
 		return FALSE;
 	}
 
-	retval = g_value_get_boolean (ret);
-
-	return retval;
+	return property->v.boolean;
 }
 
 void
@@ -609,40 +1083,32 @@ ephy_node_set_property_long (EphyNode *node,
 			     guint property_id,
 			     long value)
 {
-	GValue *new;
+	GValue new = { 0, };
 
 	g_return_if_fail (EPHY_IS_NODE (node));
 
 	if (ephy_node_db_is_immutable (node->db)) return;
 
-	new = g_slice_new0 (GValue);
-	g_value_init (new, G_TYPE_LONG);
-	g_value_set_long (new, value);
+	g_value_init (&new, G_TYPE_LONG);
+	g_value_set_long (&new, value);
 
-	ephy_node_set_property_internal (node, property_id, new);
+	ephy_node_set_property_internal (node, property_id, &new);
 }
 
 long
 ephy_node_get_property_long (EphyNode *node,
 			     guint property_id)
 {
-	GValue *ret;
-	long retval;
+	EphyNodeProperty *property;
 
 	g_return_val_if_fail (EPHY_IS_NODE (node), -1);
 
-	if (property_id >= node->properties->len) {
-		return -1;
-	}
-
-	ret = g_ptr_array_index (node->properties, property_id);
-	if (ret == NULL) {
+	property = get_property (node, property_id, G_TYPE_LONG);
+	if (property == NULL) {
 		return -1;
 	}
 
-	retval = g_value_get_long (ret);
-
-	return retval;
+	return property->v.long_integer;
 }
 
 void
@@ -650,40 +1116,32 @@ ephy_node_set_property_int (EphyNode *node,
 			    guint property_id,
 			    int value)
 {
-	GValue *new;
+	GValue new = { 0, };
 
 	g_return_if_fail (EPHY_IS_NODE (node));
 
 	if (ephy_node_db_is_immutable (node->db)) return;
 
-	new = g_slice_new0 (GValue);
-	g_value_init (new, G_TYPE_INT);
-	g_value_set_int (new, value);
+	g_value_init (&new, G_TYPE_INT);
+	g_value_set_int (&new, value);
 
-	ephy_node_set_property_internal (node, property_id, new);
+	ephy_node_set_property_internal (node, property_id, &new);
 }
 
 int
 ephy_node_get_property_int (EphyNode *node,
 			    guint property_id)
 {
-	GValue *ret;
-	int retval;
+	EphyNodeProperty *property;
 
 	g_return_val_if_fail (EPHY_IS_NODE (node), -1);
 
-	if (property_id >= node->properties->len) {
-		return -1;
-	}
-
-	ret = g_ptr_array_index (node->properties, property_id);
-	if (ret == NULL) {
+	property = get_property (node, property_id, G_TYPE_INT);
+	if (property == NULL) {
 		return -1;
 	}
 
-	retval = g_value_get_int (ret);
-
-	return retval;
+	return property->v.integer;
 }
 
 void
@@ -691,40 +1149,32 @@ ephy_node_set_property_double (EphyNode *node,
 			       guint property_id,
 			       double value)
 {
-	GValue *new;
+	GValue new = { 0, };
 
 	g_return_if_fail (EPHY_IS_NODE (node));
 
 	if (ephy_node_db_is_immutable (node->db)) return;
 
-	new = g_slice_new0 (GValue);
-	g_value_init (new, G_TYPE_DOUBLE);
-	g_value_set_double (new, value);
+	g_value_init (&new, G_TYPE_DOUBLE);
+	g_value_set_double (&new, value);
 
-	ephy_node_set_property_internal (node, property_id, new);
+	ephy_node_set_property_internal (node, property_id, &new);
 }
 
 double
 ephy_node_get_property_double (EphyNode *node,
 			       guint property_id)
 {
-	GValue *ret;
-	double retval;
+	EphyNodeProperty *property;
 
 	g_return_val_if_fail (EPHY_IS_NODE (node), -1);
 
-	if (property_id >= node->properties->len) {
+	property = get_property (node, property_id, G_TYPE_DOUBLE);
+	if (property == NULL) {
 		return -1;
 	}
 
-	ret = g_ptr_array_index (node->properties, property_id);
-	if (ret == NULL) {
-		return -1;
-	}
-
-	retval = g_value_get_double (ret);
-
-	return retval;
+	return property->v.real;
 }
 
 void
@@ -732,40 +1182,32 @@ ephy_node_set_property_float (EphyNode *node,
 			      guint property_id,
 			      float value)
 {
-	GValue *new;
+	GValue new = { 0, };
 
 	g_return_if_fail (EPHY_IS_NODE (node));
 
 	if (ephy_node_db_is_immutable (node->db)) return;
 
-	new = g_slice_new0 (GValue);
-	g_value_init (new, G_TYPE_FLOAT);
-	g_value_set_float (new, value);
+	g_value_init (&new, G_TYPE_FLOAT);
+	g_value_set_float (&new, value);
 
-	ephy_node_set_property_internal (node, property_id, new);
+	ephy_node_set_property_internal (node, property_id, &new);
 }
 
 float
 ephy_node_get_property_float (EphyNode *node,
 			      guint property_id)
 {
-	GValue *ret;
-	float retval;
+	EphyNodeProperty *property;
 
 	g_return_val_if_fail (EPHY_IS_NODE (node), -1);
 
-	if (property_id >= node->properties->len) {
-		return -1;
-	}
-
-	ret = g_ptr_array_index (node->properties, property_id);
-	if (ret == NULL) {
+	property = get_property (node, property_id, G_TYPE_FLOAT);
+	if (property == NULL) {
 		return -1;
 	}
 
-	retval = g_value_get_float (ret);
-
-	return retval;
+	return property->v.single;
 }
 
 /**
@@ -777,23 +1219,16 @@ EphyNode *
 ephy_node_get_property_node (EphyNode *node,
 			     guint property_id)
 {
-	GValue *ret;
-	EphyNode *retval;
+	EphyNodeProperty *property;
 
 	g_return_val_if_fail (EPHY_IS_NODE (node), NULL);
 
-	if (property_id >= node->properties->len) {
+	property = get_property (node, property_id, G_TYPE_POINTER);
+	if (property == NULL) {
 		return NULL;
 	}
 
-	ret = g_ptr_array_index (node->properties, property_id);
-	if (ret == NULL) {
-		return NULL;
-	}
-
-	retval = g_value_get_pointer (ret);
-
-	return retval;
+	return property->v.pointer;
 }
 
 typedef struct
@@ -878,13 +1313,14 @@ ephy_node_write_to_xml(EphyNode *node,
 	if (ret < 0) goto out;
 
 	/* write node properties */
-	for (i = 0; i < node->properties->len; i++)
+	for (i = 0; i < node->n_properties; i++)
 	{
-		GValue *value;
+		GValue _value = { 0, };
+		GValue *value = &_value;
 
-		value = g_ptr_array_index (node->properties, i);
+		if (node->properties[i].type == G_TYPE_INVALID) continue;
+		property_get_value (&node->properties[i], value);
 
-		if (value == NULL) continue;
 		if (G_VALUE_TYPE (value) == G_TYPE_STRING &&
 		    g_value_get_string (value) == NULL) continue;
 
@@ -942,9 +1378,7 @@ ephy_node_write_to_xml(EphyNode *node,
 	data.writer = writer;
 	data.ret = 0;
 
-	g_hash_table_foreach (node->parents,
-			      (GHFunc) write_parent,
-			      &data);
+	foreach_parent (node, (GHFunc) write_parent, &data);
 	ret = data.ret;
 	if (ret < 0) goto out;
 
@@ -960,76 +1394,88 @@ real_add_child (EphyNode *node,
 		EphyNode *child)
 {
 	EphyNodeParent *node_info;
+	GSList *l;
 
-	if (g_hash_table_lookup (child->parents,
-				 GINT_TO_POINTER (node->id)) != NULL) {
+	if (lookup_parent (child, node) != NULL) {
 		return;
 	}
 
 	g_ptr_array_add (node->children, child);
 
-	node_info = g_slice_new0 (EphyNodeParent);
-	node_info->node  = node;
+	node_info = add_parent (child, node);
 	node_info->index = node->children->len - 1;
 
-	g_hash_table_insert (child->parents,
-			     GINT_TO_POINTER (node->id),
-			     node_info);
+	touch (node);
+	touch (child);
+
+	for (l = _ephy_node_db_get_indexes (node->db, node->id); l != NULL; l = l->next) {
+		_ephy_node_index_child_added (l->data, child);
+	}
 }
 
-EphyNode *
-ephy_node_new_from_xml (EphyNodeDb *db, xmlNodePtr xml_node)
+typedef struct
 {
-	EphyNode *node;
+	gboolean is_parent;
+	guint id;
+	GValue value;
+} XmlRecordItem;
+
+struct _EphyNodeXmlRecord
+{
+	long id;
+	GArray *items;
+};
+
+/**
+ * _ephy_node_xml_record_new:
+ * @xml_node: a &lt;node&gt; element written by ephy_node_write_to_xml()
+ *
+ * Parses @xml_node into its id and the list of its properties and
+ * parents, in document order. This does not touch any #EphyNode or
+ * #EphyNodeDb, so it can be done from any thread.
+ *
+ * Return value: the parsed record, or %NULL if @xml_node has no id
+ **/
+EphyNodeXmlRecord *
+_ephy_node_xml_record_new (xmlNodePtr xml_node)
+{
+	EphyNodeXmlRecord *record;
 	xmlNodePtr xml_child;
 	xmlChar *xml;
-	long id;
 
-	g_return_val_if_fail (EPHY_IS_NODE_DB (db), NULL);
 	g_return_val_if_fail (xml_node != NULL, NULL);
 
-	if (ephy_node_db_is_immutable (db)) return NULL; 
-
 	xml = xmlGetProp (xml_node, (const xmlChar *)"id");
 	if (xml == NULL)
 		return NULL;
-	id = atol ((const char *)xml);
-	xmlFree (xml);
 
-	node = ephy_node_new_with_id (db, id);
+	record = g_slice_new (EphyNodeXmlRecord);
+	record->id = atol ((const char *)xml);
+	record->items = g_array_new (FALSE, FALSE, sizeof (XmlRecordItem));
+	xmlFree (xml);
 
 	for (xml_child = xml_node->children; xml_child != NULL; xml_child = xml_child->next) {
-		if (strcmp ((const char *)xml_child->name, "parent") == 0) {
-			EphyNode *parent;
-			long parent_id;
+		XmlRecordItem item = { 0, };
 
+		if (strcmp ((const char *)xml_child->name, "parent") == 0) {
 			xml = xmlGetProp (xml_child, (const xmlChar *)"id");
 			g_assert (xml != NULL);
-			parent_id = atol ((const char *)xml);
+			item.is_parent = TRUE;
+			item.id = atol ((const char *)xml);
 			xmlFree (xml);
 
-			parent = ephy_node_db_get_node_from_id (db, parent_id);
-
-			if (parent != NULL)
-			{
-				real_add_child (parent, node);
-
-				ephy_node_emit_signal (parent, EPHY_NODE_CHILD_ADDED, node);
-			}
+			g_array_append_val (record->items, item);
 		} else if (strcmp ((const char *)xml_child->name, "property") == 0) {
-			GValue *value;
+			GValue *value = &item.value;
 			xmlChar *xmlType, *xmlValue;
-			int property_id;
 
 			xml = xmlGetProp (xml_child, (const xmlChar *)"id");
-			property_id = atoi ((const char *)xml);
+			item.id = atoi ((const char *)xml);
 			xmlFree (xml);
 
 			xmlType = xmlGetProp (xml_child, (const xmlChar *)"value_type");
 			xmlValue = xmlNodeGetContent (xml_child);
 
-			value = g_slice_new0 (GValue);
-
 			if (xmlStrEqual (xmlType, (const xmlChar *) "gchararray"))
 			{
 				g_value_init (value, G_TYPE_STRING);
@@ -1062,11 +1508,10 @@ ephy_node_new_from_xml (EphyNodeDb *db, xmlNodePtr xml_node)
 			}
 			else if (xmlStrEqual (xmlType, (const xmlChar *) "gpointer"))
 			{
-				EphyNode *property_node;
-
-				property_node = ephy_node_db_get_node_from_id (db, atol ((const char *)xmlValue));
-
-				g_value_set_pointer (value, property_node);
+				/* These were never restored, and neither was
+				 * anything after them. */
+				xmlFree (xmlValue);
+				xmlFree (xmlType);
 				break;
 			}
 			else
@@ -1074,18 +1519,178 @@ ephy_node_new_from_xml (EphyNodeDb *db, xmlNodePtr xml_node)
 				g_assert_not_reached ();
 			}
 
-			real_set_property (node, property_id, value);
+
+			g_array_append_val (record->items, item);
 
 			xmlFree (xmlValue);
 			xmlFree (xmlType);
 		}
 	}
 
+	return record;
+}
+
+void
+_ephy_node_xml_record_free (EphyNodeXmlRecord *record)
+{
+	guint i;
+
+	for (i = 0; i < record->items->len; i++) {
+		XmlRecordItem *item = &g_array_index (record->items, XmlRecordItem, i);
+
+		if (!item->is_parent) {
+			g_value_unset (&item->value);
+		}
+	}
+	g_array_free (record->items, TRUE);
+
+	g_slice_free (EphyNodeXmlRecord, record);
+}
+
+/**
+ * _ephy_node_new_from_xml_record:
+ * @db: an #EphyNodeDb
+ * @record: a record from _ephy_node_xml_record_new()
+ *
+ * Creates the node described by @record. Properties are set without
+ * notification, each parent that already exists gets CHILD_ADDED, in
+ * the order in which they appear in the file, and the node finally
+ * emits RESTORED.
+ *
+ * Return value: (transfer none): the new #EphyNode
+ **/
+EphyNode *
+_ephy_node_new_from_xml_record (EphyNodeDb *db,
+				EphyNodeXmlRecord *record)
+{
+	EphyNode *node;
+	guint i;
+
+	node = ephy_node_new_with_id (db, record->id);
+
+	for (i = 0; i < record->items->len; i++) {
+		XmlRecordItem *item = &g_array_index (record->items, XmlRecordItem, i);
+
+		if (item->is_parent) {
+			EphyNode *parent;
+
+			parent = ephy_node_db_get_node_from_id (db, item->id);
+
+			if (parent != NULL)
+			{
+				real_add_child (parent, node);
+
+				child_added (parent, node);
+			}
+		} else {
+			real_set_property (node, item->id, &item->value);
+		}
+	}
+
 	ephy_node_emit_signal (node, EPHY_NODE_RESTORED);
 
 	return node;
 }
 
+EphyNode *
+ephy_node_new_from_xml (EphyNodeDb *db, xmlNodePtr xml_node)
+{
+	EphyNodeXmlRecord *record;
+	EphyNode *node;
+
+	g_return_val_if_fail (EPHY_IS_NODE_DB (db), NULL);
+	g_return_val_if_fail (xml_node != NULL, NULL);
+
+	if (ephy_node_db_is_immutable (db)) return NULL; 
+
+	record = _ephy_node_xml_record_new (xml_node);
+	if (record == NULL)
+		return NULL;
+
+	node = _ephy_node_new_from_xml_record (db, record);
+	_ephy_node_xml_record_free (record);
+
+	return node;
+}
+
+/* The following are used by EphyNodeDb to write and restore binary
+ * snapshots. Restoring mirrors ephy_node_new_from_xml(): properties are
+ * set without notification, each parent link emits CHILD_ADDED on the
+ * parent and the node finally emits RESTORED. */
+
+guint
+_ephy_node_get_n_properties (EphyNode *node)
+{
+	g_return_val_if_fail (EPHY_IS_NODE (node), 0);
+
+	return node->n_properties;
+}
+
+/* Fills @value without copying it, see property_get_value(). */
+gboolean
+_ephy_node_peek_property (EphyNode *node,
+			  guint property_id,
+			  GValue *value)
+{
+	g_return_val_if_fail (EPHY_IS_NODE (node), FALSE);
+
+	if (property_id >= node->n_properties ||
+	    node->properties[property_id].type == G_TYPE_INVALID) return FALSE;
+
+	property_get_value (&node->properties[property_id], value);
+
+	return TRUE;
+}
+
+static void
+append_parent_id (gpointer key,
+		  EphyNodeParent *node_info,
+		  GArray *ids)
+{
+	g_array_append_val (ids, node_info->node->id);
+}
+
+void
+_ephy_node_get_parent_ids (EphyNode *node,
+			   GArray *ids)
+{
+	g_return_if_fail (EPHY_IS_NODE (node));
+	g_return_if_fail (ids != NULL);
+
+	foreach_parent (node, (GHFunc) append_parent_id, ids);
+}
+
+void
+_ephy_node_restore_property (EphyNode *node,
+			     guint property_id,
+			     const GValue *value)
+{
+	g_return_if_fail (EPHY_IS_NODE (node));
+	g_return_if_fail (value != NULL);
+
+	real_set_property (node, property_id, value);
+}
+
+void
+_ephy_node_restore_parent (EphyNode *node,
+			   EphyNode *parent)
+{
+	g_return_if_fail (EPHY_IS_NODE (node));
+	g_return_if_fail (EPHY_IS_NODE (parent));
+
+	real_add_child (parent, node);
+
+	child_added (parent, node);
+}
+
+void
+_ephy_node_restored (EphyNode *node)
+{
+	g_return_if_fail (EPHY_IS_NODE (node));
+
+	ephy_node_emit_signal (node, EPHY_NODE_RESTORED);
+}
+
 void
 ephy_node_add_child (EphyNode *node,
 		     EphyNode *child)
@@ -1096,7 +1701,9 @@ ephy_node_add_child (EphyNode *node,
 	
 	real_add_child (node, child);
 
-	ephy_node_emit_signal (node, EPHY_NODE_CHILD_ADDED, child);
+	_ephy_node_db_journal_add_child (node->db, node->id, child->id);
+
+	child_added (node, child);
 }
 
 void
@@ -1107,6 +1714,8 @@ ephy_node_remove_child (EphyNode *node,
 
 	if (ephy_node_db_is_immutable (node->db)) return;
 
+	_ephy_node_db_journal_remove_child (node->db, node->id, child->id);
+
 	real_remove_child (node, child, TRUE, TRUE);
 }
 
@@ -1118,8 +1727,7 @@ ephy_node_has_child (EphyNode *node,
 
 	g_return_val_if_fail (EPHY_IS_NODE (node), FALSE);
 	
-	ret = (g_hash_table_lookup (child->parents,
-				    GINT_TO_POINTER (node->id)) != NULL);
+	ret = (lookup_parent (child, node) != NULL);
 
 	return ret;
 }
@@ -1131,8 +1739,7 @@ ephy_node_real_get_child_index (EphyNode *node,
 	EphyNodeParent *node_info;
 	int ret;
 
-	node_info = g_hash_table_lookup (child->parents,
-					 GINT_TO_POINTER (node->id));
+	node_info = lookup_parent (child, node);
 
 	if (node_info == NULL)
 		return -1;
@@ -1154,6 +1761,7 @@ void
 ephy_node_sort_children (EphyNode *node,
 			 GCompareFunc compare_func)
 {
+	EphyNodeBatch *batch;
 	GPtrArray *newkids;
 	int i, *new_order;
 
@@ -1162,6 +1770,11 @@ ephy_node_sort_children (EphyNode *node,
 	g_return_if_fail (EPHY_IS_NODE (node));
 	g_return_if_fail (compare_func != NULL);
 
+	batch = _ephy_node_db_get_batch (node->db);
+	if (batch != NULL) {
+		batch_flush_added (batch, node);
+	}
+
 	newkids = g_ptr_array_new ();
 	g_ptr_array_set_size (newkids, node->children->len);
 
@@ -1183,14 +1796,15 @@ ephy_node_sort_children (EphyNode *node,
 
 		child = g_ptr_array_index (newkids, i);
 		new_order[ephy_node_real_get_child_index (node, child)] = i;
-		node_info = g_hash_table_lookup (child->parents,
-					         GINT_TO_POINTER (node->id));
+		node_info = lookup_parent (child, node);
 		node_info->index = i;
 	}
 
 	g_ptr_array_free (node->children, FALSE);
 	node->children = newkids;
 
+	_ephy_node_db_journal_reorder (node->db, node->id, node->children);
+
 	ephy_node_emit_signal (node, EPHY_NODE_CHILDREN_REORDERED, new_order);
 
 	g_free (new_order);
@@ -1200,6 +1814,7 @@ void
 ephy_node_reorder_children (EphyNode *node,
 			    int *new_order)
 {
+	EphyNodeBatch *batch;
 	GPtrArray *newkids;
 	int i;
 
@@ -1208,6 +1823,11 @@ ephy_node_reorder_children (EphyNode *node,
 
 	if (ephy_node_db_is_immutable (node->db)) return;
 
+	batch = _ephy_node_db_get_batch (node->db);
+	if (batch != NULL) {
+		batch_flush_added (batch, node);
+	}
+
 	newkids = g_ptr_array_new ();
 	g_ptr_array_set_size (newkids, node->children->len);
 
@@ -1219,14 +1839,15 @@ ephy_node_reorder_children (EphyNode *node,
 
 		g_ptr_array_index (newkids, new_order[i]) = child;
 
-		node_info = g_hash_table_lookup (child->parents,
-					         GINT_TO_POINTER (node->id));
+		node_info = lookup_parent (child, node);
 		node_info->index = new_order[i];
 	}
 
 	g_ptr_array_free (node->children, FALSE);
 	node->children = newkids;
 
+	_ephy_node_db_journal_reorder (node->db, node->id, node->children);
+
 	ephy_node_emit_signal (node, EPHY_NODE_CHILDREN_REORDERED, new_order);
 }
 
@@ -1277,14 +1898,40 @@ ephy_node_get_nth_child (EphyNode *node,
 	return ret;
 }
 
+int
+ephy_node_get_n_parents (EphyNode *node)
+{
+	g_return_val_if_fail (EPHY_IS_NODE (node), -1);
+
+	return node->n_parents;
+}
+
+/**
+ * ephy_node_get_nth_parent:
+ *
+ * Parents are kept in the order in which @node was added to them.
+ *
+ * Return value: (transfer none):
+ **/
+EphyNode *
+ephy_node_get_nth_parent (EphyNode *node,
+			  guint n)
+{
+	g_return_val_if_fail (EPHY_IS_NODE (node), NULL);
+
+	if (n >= node->n_parents)
+		return NULL;
+
+	return get_parent_nth (node, n)->node;
+}
+
 static inline int
 get_child_index_real (EphyNode *node,
 		      EphyNode *child)
 {
 	EphyNodeParent *node_info;
 
-	node_info = g_hash_table_lookup (child->parents,
-					 GINT_TO_POINTER (node->id));
+	node_info = lookup_parent (child, node);
 
 	if (node_info == NULL)
 		return -1;
@@ -1390,6 +2037,12 @@ ephy_node_signal_connect_object (EphyNode *node,
 	signal_data->type = type;
 	signal_data->data = object;
 
+	if (node->signals == NULL) {
+		node->signals = g_hash_table_new_full
+			(int_hash, int_equal, NULL,
+			 (GDestroyNotify)destroy_signal_data);
+	}
+
 	g_hash_table_insert (node->signals,
 			     GINT_TO_POINTER (node->signal_id),
 			     signal_data);
@@ -1453,6 +2106,8 @@ ephy_node_signal_disconnect_object (EphyNode *node,
 
 	g_return_val_if_fail (EPHY_IS_NODE (node), 0);
 
+	if (node->signals == NULL) return 0;
+
 	user_data.callback = callback;
 	user_data.type = type;
 	user_data.data = object;
@@ -1478,6 +2133,7 @@ ephy_node_signal_disconnect (EphyNode *node,
 {
 	g_return_if_fail (EPHY_IS_NODE (node));
 	g_return_if_fail (signal_id != -1);
+	g_return_if_fail (node->signals != NULL);
 
 	if (G_LIKELY (node->emissions == 0))
 	{
@@ -64,6 +64,8 @@ EphyNodeDb *ephy_node_get_db		    (EphyNode *node);
 /* unique node ID */
 guint       ephy_node_get_id                (EphyNode *node);
 
+guint       ephy_node_get_stamp             (EphyNode *node);
+
 /* refcounting */
 void        ephy_node_ref                   (EphyNode *node);
 void        ephy_node_unref                 (EphyNode *node);
@@ -129,6 +131,36 @@ int           ephy_node_write_to_xml	    (EphyNode *node,
 EphyNode     *ephy_node_new_from_xml        (EphyNodeDb *db,
 					     xmlNodePtr xml_node);
 
+/* parallel xml loading, for EphyNodeDb only */
+typedef struct _EphyNodeXmlRecord EphyNodeXmlRecord;
+
+EphyNodeXmlRecord *_ephy_node_xml_record_new (xmlNodePtr xml_node);
+void          _ephy_node_xml_record_free    (EphyNodeXmlRecord *record);
+EphyNode     *_ephy_node_new_from_xml_record (EphyNodeDb *db,
+					      EphyNodeXmlRecord *record);
+
+/* snapshot storage, for EphyNodeDb only */
+guint         _ephy_node_get_n_properties   (EphyNode *node);
+gboolean      _ephy_node_peek_property      (EphyNode *node,
+					     guint property_id,
+					     GValue *value);
+void          _ephy_node_get_parent_ids     (EphyNode *node,
+					     GArray *ids);
+void          _ephy_node_restore_property   (EphyNode *node,
+					     guint property_id,
+					     const GValue *value);
+void          _ephy_node_restore_parent     (EphyNode *node,
+					     EphyNode *parent);
+void          _ephy_node_restored           (EphyNode *node);
+
+/* batched notifications, for EphyNodeDb only */
+typedef struct _EphyNodeBatch EphyNodeBatch;
+
+EphyNodeBatch *_ephy_node_batch_new         (void);
+void          _ephy_node_batch_flush        (EphyNodeBatch *batch);
+gboolean      _ephy_node_batch_is_flushing  (EphyNodeBatch *batch);
+void          _ephy_node_batch_free         (EphyNodeBatch *batch);
+
 /* DAG structure */
 void          ephy_node_add_child           (EphyNode *node,
 					     EphyNode *child);
@@ -144,6 +176,9 @@ GPtrArray    *ephy_node_get_children        (EphyNode *node);
 int           ephy_node_get_n_children      (EphyNode *node);
 EphyNode     *ephy_node_get_nth_child       (EphyNode *node,
 					     guint n);
+int           ephy_node_get_n_parents       (EphyNode *node);
+EphyNode     *ephy_node_get_nth_parent      (EphyNode *node,
+					     guint n);
 int           ephy_node_get_child_index     (EphyNode *node,
 					     EphyNode *child);
 EphyNode     *ephy_node_get_next_child      (EphyNode *node,
@@ -123,6 +123,9 @@ typedef enum
 #define EPHY_PREFS_ENABLED_EXTENSIONS             "enabled-extensions"
 #define EPHY_PREFS_INTERNAL_VIEW_SOURCE           "internal-view-source"
 #define EPHY_PREFS_RESTORE_SESSION_POLICY         "restore-session-policy"
+#define EPHY_PREFS_RESTORE_SESSION_DELAYING_LOADS "restore-session-delaying-loads"
+#define EPHY_PREFS_RESTORE_SESSION_MAX_LOADS      "restore-session-max-loads"
+#define EPHY_PREFS_TAB_DISCARD_MEMORY_LIMIT       "tab-discard-memory-limit"
 
 #define EPHY_PREFS_LOCKDOWN_SCHEMA            "org.gnome.Epiphany.lockdown"
 #define EPHY_PREFS_LOCKDOWN_FULLSCREEN        "disable-fullscreen"
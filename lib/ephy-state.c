@@ -27,11 +27,13 @@
 #include "ephy-file-helpers.h"
 #include "ephy-node-db.h"
 #include "ephy-node-common.h"
+#include "ephy-node-index.h"
 
 #include <string.h>
 #include <gtk/gtk.h>
 
 #define EPHY_STATES_XML_FILE	"states.xml"
+#define EPHY_STATES_SNAPSHOT_FILE	"states.snapshot"
 #define EPHY_STATES_XML_ROOT    (const xmlChar *)"ephy_states"
 #define EPHY_STATES_XML_VERSION (const xmlChar *)"1.0"
 
@@ -50,16 +52,21 @@ enum
 
 static EphyNode *states = NULL;
 static EphyNodeDb *states_db = NULL;
+static EphyNodeIndex *states_index = NULL;
 
 static void
 ephy_states_save (void)
 {
-	char *xml_file;
+	char *xml_file, *snapshot_file;
 
 	xml_file = g_build_filename (ephy_dot_dir (),
 				     EPHY_STATES_XML_FILE,
                                      NULL);
+	snapshot_file = g_build_filename (ephy_dot_dir (),
+					  EPHY_STATES_SNAPSHOT_FILE,
+					  NULL);
 
+	/* Write the XML first so that the snapshot is not older than it. */
 	ephy_node_db_write_to_xml_safe
 		(states_db, 
 		 (const xmlChar *)xml_file,
@@ -69,33 +76,23 @@ ephy_states_save (void)
 		 states, NULL, NULL,
 		 NULL);
 
+	ephy_node_db_write_to_snapshot_safe
+		(states_db,
+		 snapshot_file,
+		 (const char *)EPHY_STATES_XML_VERSION,
+		 states, NULL, NULL,
+		 NULL);
+
 	g_free (xml_file);	
+	g_free (snapshot_file);
 }
 
+/* Like the walk over the children it replaces, prefers the last state
+ * saved under @name. */
 static EphyNode *
 find_by_name (const char *name)
 {
-	EphyNode *result = NULL;
-	GPtrArray *children;
-	int i;
-
-	children = ephy_node_get_children (states);
-	for (i = 0; i < children->len; i++)
-	{
-		EphyNode *kid;
-		const char *node_name;
-
-		kid = g_ptr_array_index (children, i);
-
-		node_name = ephy_node_get_property_string
-			(kid, EPHY_NODE_STATE_PROP_NAME);
-		if (strcmp (node_name, name) == 0)
-		{
-			result = kid;
-		}
-	}
-
-	return result;
+	return ephy_node_index_lookup_last (states_index, name);
 }
 
 static void
@@ -103,19 +100,26 @@ ensure_states (void)
 {
 	if (states == NULL)
 	{
-		char *xml_file;
+		char *xml_file, *snapshot_file;
 
 		xml_file = g_build_filename (ephy_dot_dir (),
 					     EPHY_STATES_XML_FILE,
 					     NULL);
+		snapshot_file = g_build_filename (ephy_dot_dir (),
+						  EPHY_STATES_SNAPSHOT_FILE,
+						  NULL);
 
 		states_db = ephy_node_db_new (EPHY_NODE_DB_STATES);
 		states = ephy_node_new_with_id (states_db, STATES_NODE_ID);
-		ephy_node_db_load_from_file (states_db, xml_file,
-					     EPHY_STATES_XML_ROOT,
-					     EPHY_STATES_XML_VERSION);
+		states_index = ephy_node_db_add_index (states_db, states,
+						       EPHY_NODE_STATE_PROP_NAME,
+						       NULL, FALSE);
+		ephy_node_db_load_from_snapshot (states_db, snapshot_file, xml_file,
+						 EPHY_STATES_XML_ROOT,
+						 EPHY_STATES_XML_VERSION);
 	
 		g_free (xml_file);
+		g_free (snapshot_file);
 	}
 }
 
@@ -482,5 +486,6 @@ ephy_state_save (void)
 		g_object_unref (states_db);
 		states = NULL;
 		states_db = NULL;
+		states_index = NULL;
 	}
 }
@@ -22,6 +22,7 @@
 #include "ephy-history-service-private.h"
 #include "ephy-history-types.h"
 #include "ephy-history-type-builtins.h"
+#include "ephy-latency-tracker.h"
 #include "ephy-sqlite-connection.h"
 
 typedef gboolean (*EphyHistoryServiceMethod)                              (EphyHistoryService *self, gpointer data, gpointer *result);
@@ -964,10 +965,18 @@ ephy_history_service_process_message (EphyHistoryService *self,
     return;
   }
 
+  /* Only URL queries take part in a location entry completion cycle,
+   * the tracker ignores them when no cycle is waiting on one. */
+  if (message->type == QUERY_URLS)
+    ephy_latency_tracker_mark (EPHY_LATENCY_STAGE_HISTORY_START);
+
   method = methods[message->type];
   message->result = NULL;
   message->success = method (message->service, message->method_argument, &message->result);
 
+  if (message->type == QUERY_URLS)
+    ephy_latency_tracker_mark (EPHY_LATENCY_STAGE_HISTORY_END);
+
   if (message->callback)
     g_idle_add ((GSourceFunc)ephy_history_service_execute_job_callback, message);
   else
@@ -29,6 +29,7 @@
 #include "ephy-debug.h"
 #include "ephy-gui.h"
 #include "ephy-about-handler.h"
+#include "ephy-latency-tracker.h"
 
 #include <glib/gi18n.h>
 #include <gdk/gdkkeysyms.h>
@@ -406,6 +407,8 @@ editable_changed_cb (GtkEditable *editable,
 		priv->can_redo = FALSE;
 	}	
 	
+	ephy_latency_tracker_mark (EPHY_LATENCY_STAGE_KEYSTROKE);
+
 	g_signal_emit (entry, signals[USER_CHANGED], 0);
 }
 
@@ -27,22 +27,196 @@
 #include "ephy-link.h"
 #include "ephy-node.h"
 #include "ephy-node-common.h"
+#include "ephy-node-db.h"
 #include "ephy-debug.h"
 
 #include <gtk/gtk.h>
 #include <string.h>
 
+/* Bookmark actions are only created when something looks them up by name,
+ * which is what the UI manager does when it builds a menu or toolbar item.
+ * Actions nothing shows anymore are dropped again after a while. */
+#define PRUNE_TIMEOUT 60 /* seconds */
+
+#define ACCEL_PATH_PREFIX "<Actions>/BA/"
+
+typedef struct
+{
+	EphyLinkActionGroup parent_instance;
+
+	EphyNode *node;
+	guint prune_id;
+	gboolean creating;
+} EphyBookmarkActionGroup;
+
+typedef struct
+{
+	EphyLinkActionGroupClass parent_class;
+} EphyBookmarkActionGroupClass;
+
+static GType ephy_bookmark_action_group_get_type (void);
+
+G_DEFINE_TYPE (EphyBookmarkActionGroup, ephy_bookmark_action_group, EPHY_TYPE_LINK_ACTION_GROUP)
+
+#define EPHY_BOOKMARK_ACTION_GROUP(o) (G_TYPE_CHECK_INSTANCE_CAST ((o), ephy_bookmark_action_group_get_type (), EphyBookmarkActionGroup))
+
+/* Looks up an action without creating it. */
+static GtkAction *
+lookup_action (GtkActionGroup *action_group,
+	       EphyNode *bookmark)
+{
+	char name[EPHY_BOOKMARK_ACTION_NAME_BUFFER_SIZE];
+
+	EPHY_BOOKMARK_ACTION_NAME_PRINTF (name, bookmark);
+
+	return GTK_ACTION_GROUP_CLASS (ephy_bookmark_action_group_parent_class)->get_action
+		(action_group, name);
+}
+
+static gboolean
+has_accel (GtkAction *action)
+{
+	const char *path;
+	GtkAccelKey key;
+
+	path = gtk_action_get_accel_path (action);
+
+	return path != NULL &&
+	       gtk_accel_map_lookup_entry (path, &key) &&
+	       key.accel_key != 0;
+}
+
+static gboolean
+prune_actions_cb (EphyBookmarkActionGroup *group)
+{
+	GtkActionGroup *action_group = GTK_ACTION_GROUP (group);
+	GList *actions, *l;
+
+	actions = gtk_action_group_list_actions (action_group);
+	for (l = actions; l != NULL; l = l->next)
+	{
+		GtkAction *action = l->data;
+
+		if (gtk_action_get_proxies (action) == NULL && !has_accel (action))
+		{
+			gtk_action_group_remove_action (action_group, action);
+		}
+	}
+	g_list_free (actions);
+
+	group->prune_id = 0;
+
+	return FALSE;
+}
+
+static GtkAction *
+create_action (EphyBookmarkActionGroup *group,
+	       EphyNode *bookmark,
+	       const char *name)
+{
+	GtkActionGroup *action_group = GTK_ACTION_GROUP (group);
+	GtkAction *action;
+	char accel[256];
+
+	action = ephy_bookmark_action_new (bookmark, name);
+
+	g_signal_connect_swapped (action, "open-link",
+				  G_CALLBACK (ephy_link_open), action_group);
+
+	g_snprintf (accel, sizeof (accel), "<Actions>/%s/%s",
+		    gtk_action_group_get_name (action_group),
+		    name);
+	gtk_action_set_accel_path (action, accel);
+
+	/* gtk_action_group_add_action() checks that the name is unique
+	 * by looking it up, don't create the action again from there. */
+	group->creating = TRUE;
+	gtk_action_group_add_action (action_group, action);
+	group->creating = FALSE;
+	g_object_unref (action);
+
+	if (group->prune_id == 0)
+	{
+		group->prune_id = g_timeout_add_seconds
+			(PRUNE_TIMEOUT, (GSourceFunc) prune_actions_cb, group);
+	}
+
+	return action;
+}
+
+static GtkAction *
+ephy_bookmark_action_group_get_action (GtkActionGroup *action_group,
+				       const gchar *name)
+{
+	EphyBookmarkActionGroup *group = EPHY_BOOKMARK_ACTION_GROUP (action_group);
+	GtkAction *action;
+	EphyNode *bookmark;
+	guint64 id;
+	char *end;
+
+	action = GTK_ACTION_GROUP_CLASS (ephy_bookmark_action_group_parent_class)->get_action
+		(action_group, name);
+	if (action != NULL || group->creating || group->node == NULL)
+	{
+		return action;
+	}
+
+	if (!g_str_has_prefix (name, "Bmk") || !g_ascii_isdigit (name[3]))
+	{
+		return NULL;
+	}
+
+	id = g_ascii_strtoull (name + 3, &end, 10);
+	if (*end != '\0' || id > G_MAXUINT)
+	{
+		return NULL;
+	}
+
+	bookmark = ephy_node_db_get_node_from_id (ephy_node_get_db (group->node), (guint) id);
+	if (bookmark == NULL || !ephy_node_has_child (group->node, bookmark))
+	{
+		return NULL;
+	}
+
+	return create_action (group, bookmark, name);
+}
+
+static void
+ephy_bookmark_action_group_finalize (GObject *object)
+{
+	EphyBookmarkActionGroup *group = EPHY_BOOKMARK_ACTION_GROUP (object);
+
+	if (group->prune_id != 0)
+	{
+		g_source_remove (group->prune_id);
+	}
+
+	G_OBJECT_CLASS (ephy_bookmark_action_group_parent_class)->finalize (object);
+}
+
+static void
+ephy_bookmark_action_group_init (EphyBookmarkActionGroup *group)
+{
+}
+
+static void
+ephy_bookmark_action_group_class_init (EphyBookmarkActionGroupClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	GtkActionGroupClass *action_group_class = GTK_ACTION_GROUP_CLASS (klass);
+
+	object_class->finalize = ephy_bookmark_action_group_finalize;
+	action_group_class->get_action = ephy_bookmark_action_group_get_action;
+}
+
 static void
 smart_added_cb (EphyNode *parent, 
 		EphyNode *child,
 		GtkActionGroup *action_group)
 {
 	GtkAction *action;
-	char name[EPHY_BOOKMARK_ACTION_NAME_BUFFER_SIZE];
-
-	EPHY_BOOKMARK_ACTION_NAME_PRINTF (name, child);
 
-	action = gtk_action_group_get_action (action_group, name);
+	action = lookup_action (action_group, child);
 	
 	if (action != NULL)
 	{
@@ -57,11 +231,8 @@ smart_removed_cb (EphyNode *parent,
 		  GtkActionGroup *action_group)
 {
 	GtkAction *action;
-	char name[EPHY_BOOKMARK_ACTION_NAME_BUFFER_SIZE];
-
-	EPHY_BOOKMARK_ACTION_NAME_PRINTF (name, child);
 
-	action = gtk_action_group_get_action (action_group, name);
+	action = lookup_action (action_group, child);
 	
 	if (action != NULL)
 	{
@@ -76,11 +247,8 @@ node_changed_cb (EphyNode *parent,
 		 GtkActionGroup *action_group)
 {
 	GtkAction *action;
-	char name[EPHY_BOOKMARK_ACTION_NAME_BUFFER_SIZE];
 
-	EPHY_BOOKMARK_ACTION_NAME_PRINTF (name, child);
-
-	action = gtk_action_group_get_action (action_group, name);
+	action = lookup_action (action_group, child);
 	
 	if (action != NULL)
 	{
@@ -88,30 +256,6 @@ node_changed_cb (EphyNode *parent,
 	}
 }
 
-static void
-node_added_cb (EphyNode *parent,
-	       EphyNode *child,
-	       GtkActionGroup *action_group)
-{
-	GtkAction *action;
-	char name[EPHY_BOOKMARK_ACTION_NAME_BUFFER_SIZE];
-	char accel[256];
-
-	EPHY_BOOKMARK_ACTION_NAME_PRINTF (name, child);
-
-	action = ephy_bookmark_action_new (child, name);
-
-	g_signal_connect_swapped (action, "open-link",
-				  G_CALLBACK (ephy_link_open), action_group);
-
-	g_snprintf (accel, sizeof (accel), "<Actions>/%s/%s",
-		    gtk_action_group_get_name (action_group),
-		    name);
-	gtk_action_set_accel_path (action, accel);
-	gtk_action_group_add_action (action_group, action);
-	g_object_unref (action);
-}
-
 static void
 node_removed_cb (EphyNode *parent,
 		 EphyNode *child,
@@ -119,11 +263,8 @@ node_removed_cb (EphyNode *parent,
 		 GtkActionGroup *action_group)
 {
 	GtkAction *action;
-	char name[EPHY_BOOKMARK_ACTION_NAME_BUFFER_SIZE];
 
-	EPHY_BOOKMARK_ACTION_NAME_PRINTF (name, child);
-
-	action = gtk_action_group_get_action (action_group, name);
+	action = lookup_action (action_group, child);
 	
 	if (action != NULL)
 	{
@@ -131,30 +272,48 @@ node_removed_cb (EphyNode *parent,
 	}
 }
 
+static void
+collect_accel_names (gpointer data,
+		     const gchar *accel_path,
+		     guint accel_key,
+		     GdkModifierType accel_mods,
+		     gboolean changed)
+{
+	GSList **names = data;
+
+	if (accel_key != 0 && g_str_has_prefix (accel_path, ACCEL_PATH_PREFIX))
+	{
+		*names = g_slist_prepend
+			(*names, g_strdup (accel_path + strlen (ACCEL_PATH_PREFIX)));
+	}
+}
+
 GtkActionGroup *
 ephy_bookmark_group_new (EphyNode *node)
 {
 	EphyBookmarks *bookmarks;
 	EphyNode *smart;
-	GPtrArray *children;
 	GtkActionGroup *action_group;
-	guint i;
+	GSList *names = NULL, *l;
 	
 	bookmarks = ephy_shell_get_bookmarks (ephy_shell);
 	smart = ephy_bookmarks_get_smart_bookmarks (bookmarks);
 
-	action_group = (GtkActionGroup *) ephy_link_action_group_new ("BA");
+	action_group = g_object_new (ephy_bookmark_action_group_get_type (),
+				     "name", "BA",
+				     NULL);
+	EPHY_BOOKMARK_ACTION_GROUP (action_group)->node = node;
 
-	children = ephy_node_get_children (node);
-	for (i = 0; i < children->len; i++)
+	/* Bookmarks the user gave a keyboard shortcut to need their action
+	 * right away, or the shortcut would not work until the bookmark
+	 * shows up in a menu. */
+	gtk_accel_map_foreach (&names, collect_accel_names);
+	for (l = names; l != NULL; l = l->next)
 	{
-		node_added_cb (node, g_ptr_array_index (children, i),
-			       action_group);
+		gtk_action_group_get_action (action_group, l->data);
 	}
+	g_slist_free_full (names, g_free);
 	
-	ephy_node_signal_connect_object (node, EPHY_NODE_CHILD_ADDED,
-					 (EphyNodeCallback) node_added_cb,
-					 (GObject *) action_group);
 	ephy_node_signal_connect_object (node, EPHY_NODE_CHILD_REMOVED,
 					 (EphyNodeCallback) node_removed_cb,
 					 (GObject *) action_group);
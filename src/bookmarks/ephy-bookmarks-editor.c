@@ -699,6 +699,138 @@ export_format_combo_changed_cb (GtkComboBox *combo,
 	g_free (newname);
 }
 
+typedef struct
+{
+	EphyBookmarksEditor *editor;
+	GtkWidget *dialog;
+	GtkWidget *progress_bar;
+	GCancellable *cancellable;
+	char *filename;
+} ExportData;
+
+static void
+export_progress_response_cb (GtkWidget *dialog,
+			     int response,
+			     ExportData *data)
+{
+	/* The dialog goes away once the export thread notices. */
+	gtk_dialog_set_response_sensitive (GTK_DIALOG (dialog),
+					   GTK_RESPONSE_CANCEL, FALSE);
+	g_cancellable_cancel (data->cancellable);
+}
+
+static void
+export_progress_cb (guint n_exported,
+		    guint n_total,
+		    ExportData *data)
+{
+	if (data->dialog == NULL || n_total == 0) return;
+
+	gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR (data->progress_bar),
+				       (double) n_exported / n_total);
+}
+
+static void
+export_finished_cb (EphyBookmarks *bookmarks,
+		    gboolean success,
+		    ExportData *data)
+{
+	EphyBookmarksEditor *editor = data->editor;
+
+	if (data->dialog != NULL)
+	{
+		g_object_remove_weak_pointer (G_OBJECT (data->dialog),
+					      (gpointer *) &data->dialog);
+		gtk_widget_destroy (data->dialog);
+
+		if (!success && !g_cancellable_is_cancelled (data->cancellable))
+		{
+			GtkWidget *dialog;
+			char *basename;
+
+			basename = g_filename_display_basename (data->filename);
+			dialog = gtk_message_dialog_new (GTK_WINDOW (editor),
+							 GTK_DIALOG_DESTROY_WITH_PARENT,
+							 GTK_MESSAGE_ERROR,
+							 GTK_BUTTONS_OK,
+							 _("Export failed"));
+
+			gtk_window_set_title (GTK_WINDOW (dialog), _("Export Failed"));
+			gtk_message_dialog_format_secondary_text
+				(GTK_MESSAGE_DIALOG (dialog),
+				 _("The bookmarks could not be written to “%s”."),
+				 basename);
+
+			gtk_window_group_add_window (gtk_window_get_group (GTK_WINDOW (editor)),
+						     GTK_WINDOW (dialog));
+
+			g_signal_connect (dialog, "response",
+					  G_CALLBACK (gtk_widget_destroy), NULL);
+			gtk_widget_show (dialog);
+
+			g_free (basename);
+		}
+	}
+
+	g_object_unref (data->cancellable);
+	g_object_unref (editor);
+	g_free (data->filename);
+	g_slice_free (ExportData, data);
+}
+
+/* Shows the progress of the export in a dialog that can cancel it, and
+ * any error once it is done. */
+static void
+export_bookmarks (EphyBookmarksEditor *editor,
+		  const char *filename,
+		  EphyBookmarksExportFormat format)
+{
+	ExportData *data;
+	GtkWidget *content_area, *vbox, *label;
+
+	data = g_slice_new0 (ExportData);
+	data->editor = g_object_ref (editor);
+	data->cancellable = g_cancellable_new ();
+	data->filename = g_strdup (filename);
+
+	data->dialog = gtk_dialog_new_with_buttons (_("Exporting Bookmarks"),
+						    GTK_WINDOW (editor),
+						    GTK_DIALOG_DESTROY_WITH_PARENT,
+						    GTK_STOCK_CANCEL,
+						    GTK_RESPONSE_CANCEL,
+						    NULL);
+	gtk_window_set_resizable (GTK_WINDOW (data->dialog), FALSE);
+	g_object_add_weak_pointer (G_OBJECT (data->dialog),
+				   (gpointer *) &data->dialog);
+
+	vbox = gtk_box_new (GTK_ORIENTATION_VERTICAL, 6);
+	gtk_container_set_border_width (GTK_CONTAINER (vbox), 5);
+
+	label = gtk_label_new (_("Exporting bookmarks…"));
+	gtk_misc_set_alignment (GTK_MISC (label), 0, 0.5);
+	gtk_box_pack_start (GTK_BOX (vbox), label, FALSE, FALSE, 0);
+
+	data->progress_bar = gtk_progress_bar_new ();
+	gtk_box_pack_start (GTK_BOX (vbox), data->progress_bar, FALSE, FALSE, 0);
+
+	content_area = gtk_dialog_get_content_area (GTK_DIALOG (data->dialog));
+	gtk_box_pack_start (GTK_BOX (content_area), vbox, TRUE, TRUE, 0);
+	gtk_widget_show_all (vbox);
+
+	gtk_window_group_add_window (gtk_window_get_group (GTK_WINDOW (editor)),
+				     GTK_WINDOW (data->dialog));
+
+	g_signal_connect (data->dialog, "response",
+			  G_CALLBACK (export_progress_response_cb), data);
+	gtk_widget_show (data->dialog);
+
+	ephy_bookmarks_export (editor->priv->bookmarks, filename, format,
+			       data->cancellable,
+			       (EphyBookmarksExportProgressFunc) export_progress_cb,
+			       (EphyBookmarksExportCallback) export_finished_cb,
+			       data);
+}
+
 static void
 export_dialog_response_cb (GtkWidget *dialog,
 			   int response,
@@ -732,14 +864,8 @@ export_dialog_response_cb (GtkWidget *dialog,
 	gtk_widget_destroy (dialog);
 
 	/* 0 for ephy RDF format, 1 for mozilla HTML format */
-	if (format == 0)
-	{
-		ephy_bookmarks_export_rdf (editor->priv->bookmarks, filename);
-	}
-	else if (format == 1)
-	{
-		ephy_bookmarks_export_mozilla (editor->priv->bookmarks, filename);
-	}
+	export_bookmarks (editor, filename,
+			  format == 0 ? EPHY_BOOKMARKS_EXPORT_RDF : EPHY_BOOKMARKS_EXPORT_MOZILLA);
 
 	g_free (filename);
 }
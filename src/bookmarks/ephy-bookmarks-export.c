@@ -26,12 +26,17 @@
 #include "ephy-string.h"
 #include "ephy-debug.h"
 
+#include <glib/gstdio.h>
 #include <libxml/globals.h>
 #include <libxml/tree.h>
 #include <libxml/xmlwriter.h>
-#include <libxslt/xslt.h>
-#include <libxslt/transform.h>
-#include <libxslt/xsltutils.h>
+#include <string.h>
+
+/* How many bookmarks are written between progress reports. */
+#define PROGRESS_INTERVAL 256
+
+/* How much Mozilla output is buffered before it is written out. */
+#define WRITE_BUFFER_SIZE 65536
 
 static inline xmlChar *
 sanitise_string (const xmlChar *string)
@@ -60,42 +65,179 @@ sanitise_string (const xmlChar *string)
 	return copy;
 }
 
-static int
-write_topics_list (EphyNode *topics,
-		   EphyNode *bmk,
-		   xmlTextWriterPtr writer)
+
+typedef struct
 {
-	GPtrArray *children;
-	GList *keywords = NULL, *l;
-	int i;
-	int ret = 0;
+	GCancellable *cancellable;
+	EphyBookmarksExportProgressFunc progress_func;
+	gpointer progress_data;
+	guint n_done;
+	guint n_total;
+} ExportContext;
+
+/* Counts one more bookmark as written. Returns FALSE if the export was
+ * cancelled meanwhile. */
+static gboolean
+export_context_step (ExportContext *context)
+{
+	context->n_done++;
 
-	children = ephy_node_get_children (topics);
-	for (i = 0; i < children->len; i++)
+	if (context->progress_func != NULL &&
+	    (context->n_done % PROGRESS_INTERVAL == 0 ||
+	     context->n_done == context->n_total))
 	{
-		EphyNode *kid;
-		EphyNodePriority priority;
+		context->progress_func (context->n_done, context->n_total,
+					context->progress_data);
+	}
+
+	return !g_cancellable_is_cancelled (context->cancellable);
+}
 
-		kid = g_ptr_array_index (children, i);
+/* The normal topics, mapped from their ids to their snapshot index, and
+ * the snapshot indices of the bookmarks, as exported. */
+typedef struct
+{
+	GHashTable *topics;
+	GArray *bmks;
+} ExportNodes;
+
+static void
+export_nodes_init (ExportNodes *nodes,
+		   EphyNodeDbSnapshot *snapshot)
+{
+	guint i, n_nodes;
 
-		priority = ephy_node_get_property_int (kid, EPHY_NODE_KEYWORD_PROP_PRIORITY);
-		if (priority == -1) priority = EPHY_NODE_NORMAL_PRIORITY;
+	nodes->topics = g_hash_table_new (g_direct_hash, g_direct_equal);
+	nodes->bmks = g_array_new (FALSE, FALSE, sizeof (guint));
 
-		if (priority == EPHY_NODE_NORMAL_PRIORITY &&
-		    ephy_node_has_child (kid, bmk))
+	n_nodes = ephy_node_db_snapshot_get_n_nodes (snapshot);
+	for (i = 0; i < n_nodes; i++)
+	{
+		if (ephy_node_db_snapshot_has_parent (snapshot, i, KEYWORDS_NODE_ID))
+		{
+			EphyNodePriority priority;
+
+			priority = ephy_node_db_snapshot_get_property_int
+				(snapshot, i, EPHY_NODE_KEYWORD_PROP_PRIORITY);
+			if (priority == -1) priority = EPHY_NODE_NORMAL_PRIORITY;
+
+			if (priority == EPHY_NODE_NORMAL_PRIORITY)
+			{
+				g_hash_table_insert
+					(nodes->topics,
+					 GUINT_TO_POINTER (ephy_node_db_snapshot_get_id (snapshot, i)),
+					 GUINT_TO_POINTER (i));
+			}
+		}
+		else if (ephy_node_db_snapshot_has_parent (snapshot, i, BOOKMARKS_NODE_ID))
 		{
-			keywords = g_list_prepend (keywords, kid);
+			g_array_append_val (nodes->bmks, i);
 		}
 	}
+}
+
+static void
+export_nodes_clear (ExportNodes *nodes)
+{
+	g_hash_table_destroy (nodes->topics);
+	g_array_free (nodes->bmks, TRUE);
+}
+
+static int
+compare_topic_indices (gconstpointer a,
+		       gconstpointer b)
+{
+	guint index_a = *(const guint *)a;
+	guint index_b = *(const guint *)b;
+
+	return index_a < index_b ? 1 : (index_a > index_b ? -1 : 0);
+}
+
+/* Returns the snapshot indices of the normal topics of @bmk, in the order
+ * they are exported: the reverse of the topics list. */
+static GArray *
+get_topics (EphyNodeDbSnapshot *snapshot,
+	    GHashTable *topics,
+	    guint bmk)
+{
+	GArray *keywords;
+	guint i, n_parents;
+
+	keywords = g_array_new (FALSE, FALSE, sizeof (guint));
+
+	n_parents = ephy_node_db_snapshot_get_n_parents (snapshot, bmk);
+	for (i = 0; i < n_parents; i++)
+	{
+		gpointer topic;
+
+		if (g_hash_table_lookup_extended
+			(topics,
+			 GUINT_TO_POINTER (ephy_node_db_snapshot_get_parent_id (snapshot, bmk, i)),
+			 NULL, &topic))
+		{
+			guint index = GPOINTER_TO_UINT (topic);
+
+			g_array_append_val (keywords, index);
+		}
+	}
+
+	g_array_sort (keywords, compare_topic_indices);
+
+	return keywords;
+}
+
+/* Returns the link to export for @bmk: its address, or just the site of
+ * smart bookmarks, whose full address is in @smart_url then. */
+static char *
+get_link (EphyNodeDbSnapshot *snapshot,
+	  guint bmk,
+	  const char **smart_url)
+{
+	const char *url;
+
+	url = ephy_node_db_snapshot_get_property_string
+		(snapshot, bmk, EPHY_NODE_BMK_PROP_LOCATION);
+	*smart_url = NULL;
+
+	if (url != NULL &&
+	    ephy_node_db_snapshot_has_parent (snapshot, bmk, SMARTBOOKMARKS_NODE_ID))
+	{
+		char *scheme, *host_name, *link;
+
+		scheme = g_uri_parse_scheme (url);
+		host_name = ephy_string_get_host_name (url);
+		link = g_strconcat (scheme, "://", host_name, NULL);
+		g_free (scheme);
+		g_free (host_name);
+
+		*smart_url = url;
+
+		return link;
+	}
+
+	return g_strdup (url);
+}
 
-	for (l = keywords; l != NULL; l = l->next)
+static int
+write_topics_list (EphyNodeDbSnapshot *snapshot,
+		   GHashTable *topics,
+		   guint bmk,
+		   xmlTextWriterPtr writer)
+{
+	GArray *keywords;
+	guint i;
+	int ret = 0;
+
+	keywords = get_topics (snapshot, topics, bmk);
+
+	for (i = 0; i < keywords->len; i++)
 	{
-		EphyNode *node = l->data;
 		const char *name;
 		xmlChar *safeName;
 
-		name = ephy_node_get_property_string
-			(node, EPHY_NODE_KEYWORD_PROP_NAME);
+		name = ephy_node_db_snapshot_get_property_string
+			(snapshot, g_array_index (keywords, guint, i),
+			 EPHY_NODE_KEYWORD_PROP_NAME);
 		safeName = sanitise_string ((const xmlChar *) name);
 
 		ret = xmlTextWriterWriteElementNS
@@ -109,27 +251,30 @@ write_topics_list (EphyNode *topics,
 		if (ret < 0) break;
 	}
 
-	g_list_free (keywords);
+	g_array_free (keywords, TRUE);
 
 	return ret >= 0 ? 0 : -1;
 }
 
+/* The snapshot holds the topics and the bookmarks to export, as taken by
+ * ephy_bookmarks_take_snapshot(). */
 static int
-write_rdf (EphyBookmarks *bookmarks,
+write_rdf (EphyNodeDbSnapshot *snapshot,
 	   GFile *file,
-	   xmlTextWriterPtr writer)
+	   xmlTextWriterPtr writer,
+	   ExportContext *context)
 {
-	EphyNode *bmks, *topics, *smart_bmks;
-	GPtrArray *children;
+	ExportNodes nodes;
 	char *file_uri;
-	int i, ret;
+	guint i;
+	int ret;
 	xmlChar *safeString;
-#ifdef ENABLE_ZEROCONF
-	EphyNode *local;
-#endif
 
 	START_PROFILER ("Writing RDF")
 
+	export_nodes_init (&nodes, snapshot);
+	context->n_total = nodes.bmks->len;
+
 	ret = xmlTextWriterStartDocument (writer, "1.0", NULL, NULL);
 	if (ret < 0) goto out;
 
@@ -201,49 +346,14 @@ write_rdf (EphyBookmarks *bookmarks,
 		 NULL);
 	if (ret < 0) goto out;
 
-	bmks = ephy_bookmarks_get_bookmarks (bookmarks);
-	topics = ephy_bookmarks_get_keywords (bookmarks);
-	smart_bmks = ephy_bookmarks_get_smart_bookmarks (bookmarks);
-#ifdef ENABLE_ZEROCONF
-	local = ephy_bookmarks_get_local (bookmarks);
-#endif
-
-	children = ephy_node_get_children (bmks);
-	for (i=0; i < children->len; i++)
+	for (i = 0; i < nodes.bmks->len; i++)
 	{
-		EphyNode *kid;
-		const char *url;
-		char *link = NULL;
-		gboolean smart_url;
+		const char *smart_url;
+		char *link;
 		xmlChar *safeLink;
 
-		kid = g_ptr_array_index (children, i);
-
-#ifdef ENABLE_ZEROCONF
-		/* Don't export the local bookmarks */
-		if (ephy_node_has_child (local, kid)) continue;
-#endif
-
-		smart_url = ephy_node_has_child (smart_bmks, kid);
-		url = ephy_node_get_property_string
-			(kid, EPHY_NODE_BMK_PROP_LOCATION);
-		if (smart_url && url)
-		{
-			char *scheme;
-			char *host_name;
-			
-			scheme = g_uri_parse_scheme (url);
-			host_name = ephy_string_get_host_name (url);
-			link = g_strconcat (scheme,
-					    "://",
-					    host_name,
-					    NULL);
-
-			g_free (scheme);
-			g_free (host_name);
-		}
-
-		safeLink = sanitise_string (link ? (const xmlChar *) link : (const xmlChar *) url);
+		link = get_link (snapshot, g_array_index (nodes.bmks, guint, i), &smart_url);
+		safeLink = sanitise_string ((const xmlChar *) link);
 		g_free (link);
 
 		ret = xmlTextWriterStartElementNS
@@ -251,7 +361,11 @@ write_rdf (EphyBookmarks *bookmarks,
 			 (xmlChar *) "rdf",
 			 (xmlChar *) "li",
 			 NULL);
-		if (ret < 0) break;
+		if (ret < 0)
+		{
+			xmlFree (safeLink);
+			break;
+		}
 
 		ret = xmlTextWriterWriteAttributeNS
 			(writer,
@@ -276,52 +390,26 @@ write_rdf (EphyBookmarks *bookmarks,
 	ret = xmlTextWriterEndElement (writer); /* channel */
 	if (ret < 0) goto out;
 	
-	children = ephy_node_get_children (bmks);
-	for (i=0; i < children->len; i++)
+	for (i = 0; i < nodes.bmks->len; i++)
 	{
-		EphyNode *kid;
-		const char *url, *title;
-		char *link = NULL;
-		gboolean smart_url;
+		guint kid;
+		const char *title, *smart_url;
+		char *link;
 		xmlChar *safeLink, *safeTitle;
 
-		kid = g_ptr_array_index (children, i);
-
-#ifdef ENABLE_ZEROCONF
-		/* Don't export the local bookmarks */
-		if (ephy_node_has_child (local, kid)) continue;
-#endif
-
-		smart_url = ephy_node_has_child (smart_bmks, kid);
-		url = ephy_node_get_property_string
-			(kid, EPHY_NODE_BMK_PROP_LOCATION);
-		title = ephy_node_get_property_string
-			(kid, EPHY_NODE_BMK_PROP_TITLE);
+		kid = g_array_index (nodes.bmks, guint, i);
 
-		if (smart_url && url)
-		{
-			char *scheme;
-			char *host_name;
-
-			scheme = g_uri_parse_scheme (url);
-			host_name = ephy_string_get_host_name (url);
-
-			link = g_strconcat (scheme,
-					    "://",
-					    host_name,
-					    NULL);
-			g_free (scheme);
-			g_free (host_name);
-		}
+		link = get_link (snapshot, kid, &smart_url);
+		title = ephy_node_db_snapshot_get_property_string
+			(snapshot, kid, EPHY_NODE_BMK_PROP_TITLE);
 
-		if (link == NULL)
+		ret = xmlTextWriterStartElement (writer, (xmlChar *) "item");
+		if (ret < 0)
 		{
-			link = g_strdup (url);
+			g_free (link);
+			break;
 		}
 
-		ret = xmlTextWriterStartElement (writer, (xmlChar *) "item");
-		if (ret < 0) break;
-
 		safeLink = sanitise_string ((const xmlChar *) link);
 		g_free (link);
 
@@ -343,7 +431,11 @@ write_rdf (EphyBookmarks *bookmarks,
 			 (xmlChar *) "title",
 			 safeTitle);
 		xmlFree (safeTitle);
-		if (ret < 0) break;
+		if (ret < 0)
+		{
+			xmlFree (safeLink);
+			break;
+		}
 
 		ret = xmlTextWriterWriteElement
 			(writer,
@@ -356,7 +448,7 @@ write_rdf (EphyBookmarks *bookmarks,
 		{
 			xmlChar *safeSmartLink;
 
-			safeSmartLink = sanitise_string ((const xmlChar *) url);
+			safeSmartLink = sanitise_string ((const xmlChar *) smart_url);
 			ret = xmlTextWriterWriteElementNS
 				(writer,
 				 (xmlChar *) "ephy",
@@ -367,10 +459,17 @@ write_rdf (EphyBookmarks *bookmarks,
 			if (ret < 0) break;
 		}
 
-		ret = write_topics_list (topics, kid, writer);
+		ret = write_topics_list (snapshot, nodes.topics, kid, writer);
 		if (ret < 0) break;
 
 		ret = xmlTextWriterEndElement (writer); /* item */
+		if (ret < 0) break;
+
+		if (!export_context_step (context))
+		{
+			ret = -1;
+			break;
+		}
 	}
 	if (ret < 0) goto out;
 
@@ -380,14 +479,17 @@ write_rdf (EphyBookmarks *bookmarks,
 	ret = xmlTextWriterEndDocument (writer);
 
 out:
+	export_nodes_clear (&nodes);
+
 	STOP_PROFILER ("Writing RDF")
 
 	return ret;
 }
 
-void
-ephy_bookmarks_export_rdf (EphyBookmarks *bookmarks,
-			   const char *file_path)
+static gboolean
+export_rdf (EphyNodeDbSnapshot *snapshot,
+	    const char *file_path,
+	    ExportContext *context)
 {
 	xmlTextWriterPtr writer;
 	GFile *file, *tmp_file;
@@ -406,23 +508,22 @@ ephy_bookmarks_export_rdf (EphyBookmarks *bookmarks,
 	writer = xmlNewTextWriterFilename (tmp_file_path, 0);
 	if (writer == NULL)
 	{
-		g_object_unref (file);
-		g_object_unref (tmp_file);
-		g_free (tmp_file);
-		return;
+		ret = -1;
+		goto out;
 	}
 
 	ret = xmlTextWriterSetIndent (writer, 1);
-	if (ret < 0) goto out;
-
-	ret = xmlTextWriterSetIndentString (writer, (xmlChar *) "  ");
-	if (ret < 0) goto out;
-	
-	ret = write_rdf (bookmarks, file, writer);
-	if (ret < 0) goto out;
+	if (ret >= 0)
+	{
+		ret = xmlTextWriterSetIndentString (writer, (xmlChar *) "  ");
+	}
+	if (ret >= 0)
+	{
+		ret = write_rdf (snapshot, file, writer, context);
+	}
 
 	xmlFreeTextWriter (writer);
-out:
+
 	if (ret >= 0)
 	{
 		if (ephy_file_switch_temp_file (file, tmp_file) == FALSE)
@@ -430,7 +531,13 @@ out:
 			ret = -1;
 		}
 	}
+	else
+	{
+		/* Leave the previous export alone. */
+		g_unlink (tmp_file_path);
+	}
 
+out:
 	g_object_unref (file);
 	g_object_unref (tmp_file);
 	g_free (tmp_file_path);
@@ -438,70 +545,597 @@ out:
 	STOP_PROFILER ("Exporting as RDF")
 
 	LOG ("Exporting as RDF %s.", ret >= 0 ? "succeeded" : "FAILED");
+
+	return ret >= 0;
 }
 
-void
-ephy_bookmarks_export_mozilla (EphyBookmarks *bookmarks,
-			       const char *filename)
+typedef struct
 {
-	xsltStylesheetPtr cur = NULL;
-	xmlTextWriterPtr writer;
-	xmlDocPtr doc = NULL, res;
-	char *tmp_file_path, *template;
-	GFile *tmp_file;
-	int ret = -1;
-	
-	LOG ("Exporting as Mozilla to %s", filename);
+	guint index;
+	guint id;
+	const char *key;
+} SortItem;
+
+static int
+compare_sort_items (gconstpointer a,
+		    gconstpointer b)
+{
+	const SortItem *item_a = a;
+	const SortItem *item_b = b;
+
+	int cmp;
+
+	cmp = strcmp (item_a->key, item_b->key);
+	if (cmp != 0) return cmp;
+
+	/* g_array_sort() is not stable; keep the output the same from one
+	 * export to the next. */
+	return item_a->id < item_b->id ? -1 : item_a->id > item_b->id;
+}
+
+static void
+append_sort_item (GArray *items,
+		  EphyNodeDbSnapshot *snapshot,
+		  guint index,
+		  guint property_id)
+{
+	SortItem item;
+
+	item.index = index;
+	item.id = ephy_node_db_snapshot_get_id (snapshot, index);
+	item.key = ephy_node_db_snapshot_get_property_string (snapshot, index, property_id);
+	if (item.key == NULL) item.key = "";
+
+	g_array_append_val (items, item);
+}
+
+static gboolean
+flush_buffer (GOutputStream *stream,
+	      GString *buffer,
+	      GCancellable *cancellable)
+{
+	gboolean ret;
 
-	template = g_build_filename (g_get_tmp_dir (),
-				     "export-bookmarks-XXXXXX", NULL);
-	tmp_file_path = ephy_file_tmp_filename (template, "rdf");
-	g_free (template);
-	if (tmp_file_path == NULL) return;
+	ret = g_output_stream_write_all (stream, buffer->str, buffer->len,
+					 NULL, cancellable, NULL);
+	g_string_truncate (buffer, 0);
 
-	writer = xmlNewTextWriterDoc (&doc, 0);
-	if (writer == NULL || doc == NULL)
+	return ret;
+}
+
+static void
+append_escaped (GString *buffer,
+		const char *text)
+{
+	xmlChar *safe;
+	char *escaped;
+
+	safe = sanitise_string ((const xmlChar *) text);
+	escaped = g_markup_escape_text ((const char *) safe, -1);
+	g_string_append (buffer, escaped);
+	g_free (escaped);
+	xmlFree (safe);
+}
+
+/* Appends the entries for the bookmarks in @items, which is sorted by
+ * title. Returns FALSE on errors or if the export was cancelled. */
+static gboolean
+write_mozilla_bookmarks (EphyNodeDbSnapshot *snapshot,
+			 GArray *items,
+			 GOutputStream *stream,
+			 GString *buffer,
+			 ExportContext *context)
+{
+	guint i;
+
+	for (i = 0; i < items->len; i++)
 	{
-		g_free (tmp_file_path);
-		return;
+		SortItem *item = &g_array_index (items, SortItem, i);
+		const char *smart_url;
+		char *link;
+
+		/* Use smart link URIs if they exist, see bug #534565 */
+		link = get_link (snapshot, item->index, &smart_url);
+
+		g_string_append (buffer, "<dt><a href=\"");
+		append_escaped (buffer, smart_url ? smart_url : link);
+		g_string_append (buffer, "\">");
+		append_escaped (buffer, item->key);
+		g_string_append (buffer, "</a></dt>\n");
+		g_free (link);
+
+		if (buffer->len >= WRITE_BUFFER_SIZE &&
+		    !flush_buffer (stream, buffer, context->cancellable))
+		{
+			return FALSE;
+		}
+
+		if (!export_context_step (context)) return FALSE;
 	}
 
-	START_PROFILER ("Exporting as Mozilla");
-	
-	tmp_file = g_file_new_for_path (tmp_file_path);
-	ret = write_rdf (bookmarks, tmp_file, writer);
-	g_object_unref (tmp_file);
+	return TRUE;
+}
 
-	if (ret < 0) goto out;
+/* Writes the same Netscape bookmarks file the epiphany-bookmarks-html.xsl
+ * stylesheet used to produce from the RDF export: a folder per topic,
+ * sorted by name, followed by the bookmarks without a topic. */
+static gboolean
+write_mozilla (EphyNodeDbSnapshot *snapshot,
+	       GOutputStream *stream,
+	       ExportContext *context)
+{
+	ExportNodes nodes;
+	GHashTable *topic_items;
+	GArray *topics, *uncategorized;
+	GString *buffer;
+	GHashTableIter iter;
+	gpointer key, value;
+	gboolean ret = FALSE;
+	guint i, j;
+
+	START_PROFILER ("Writing Mozilla bookmarks")
+
+	export_nodes_init (&nodes, snapshot);
+
+	/* Sort the bookmarks into their topics. */
+	topic_items = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+					     NULL, (GDestroyNotify) g_array_unref);
+	uncategorized = g_array_new (FALSE, FALSE, sizeof (SortItem));
+	context->n_total = 0;
+
+	for (i = 0; i < nodes.bmks->len; i++)
+	{
+		guint kid = g_array_index (nodes.bmks, guint, i);
+		GArray *keywords;
 
-	/* Set up libxml stuff */
-	xmlLoadExtDtdDefaultValue = 1;
-	xmlSubstituteEntitiesDefault (1);
-	
-	cur = xsltParseStylesheetFile ((const xmlChar *) ephy_file ("epiphany-bookmarks-html.xsl"));
-	if (cur == NULL) goto out;
+		keywords = get_topics (snapshot, nodes.topics, kid);
+
+		for (j = 0; j < keywords->len; j++)
+		{
+			gpointer topic = GUINT_TO_POINTER (g_array_index (keywords, guint, j));
+			GArray *items;
+
+			items = g_hash_table_lookup (topic_items, topic);
+			if (items == NULL)
+			{
+				items = g_array_new (FALSE, FALSE, sizeof (SortItem));
+				g_hash_table_insert (topic_items, topic, items);
+			}
+
+			append_sort_item (items, snapshot, kid, EPHY_NODE_BMK_PROP_TITLE);
+		}
+
+		if (keywords->len == 0)
+		{
+			append_sort_item (uncategorized, snapshot, kid, EPHY_NODE_BMK_PROP_TITLE);
+		}
+
+		context->n_total += MAX (keywords->len, 1);
+		g_array_free (keywords, TRUE);
+	}
 
-	res = xsltApplyStylesheet (cur, doc, NULL);
-	if (res == NULL)
+	topics = g_array_new (FALSE, FALSE, sizeof (SortItem));
+	g_hash_table_iter_init (&iter, topic_items);
+	while (g_hash_table_iter_next (&iter, &key, &value))
 	{
-		xsltFreeStylesheet (cur);
-		goto out;
+		append_sort_item (topics, snapshot, GPOINTER_TO_UINT (key),
+				  EPHY_NODE_KEYWORD_PROP_NAME);
+		g_array_sort ((GArray *) value, compare_sort_items);
 	}
+	g_array_sort (topics, compare_sort_items);
+	g_array_sort (uncategorized, compare_sort_items);
+
+	buffer = g_string_sized_new (WRITE_BUFFER_SIZE + 4096);
+	g_string_append (buffer,
+			 "<!DOCTYPE NETSCAPE-Bookmark-file-1>\n"
+			 "<meta http-equiv=\"Content-Type\" content=\"text/html; charset=UTF-8\">\n"
+			 "<title>Bookmarks</title>\n"
+			 "<h1>Bookmarks</h1>\n"
+			 "<dl>\n");
+
+	for (i = 0; i < topics->len; i++)
+	{
+		SortItem *topic = &g_array_index (topics, SortItem, i);
 
-	ret = xsltSaveResultToFilename (filename, res, cur, FALSE);
+		g_string_append (buffer, "<dt>\n<h3>");
+		append_escaped (buffer, topic->key);
+		g_string_append (buffer, "</h3>\n<dl>\n");
+
+		if (!write_mozilla_bookmarks
+			(snapshot,
+			 g_hash_table_lookup (topic_items, GUINT_TO_POINTER (topic->index)),
+			 stream, buffer, context))
+		{
+			goto out;
+		}
 
-	xsltFreeStylesheet (cur);
-	xmlFreeDoc (res);
+		g_string_append (buffer, "</dl>\n</dt>\n");
+	}
 
-	/* Clean up libxslt stuff */
-	xsltCleanupGlobals ();
+	if (!write_mozilla_bookmarks (snapshot, uncategorized, stream, buffer, context))
+	{
+		goto out;
+	}
+
+	g_string_append (buffer, "</dl>\n");
+
+	ret = flush_buffer (stream, buffer, context->cancellable);
 
 out:
-	xmlFreeTextWriter (writer);
-	xmlFreeDoc (doc);
+	g_string_free (buffer, TRUE);
+	g_array_free (topics, TRUE);
+	g_array_free (uncategorized, TRUE);
+	g_hash_table_destroy (topic_items);
+	export_nodes_clear (&nodes);
+
+	STOP_PROFILER ("Writing Mozilla bookmarks")
+
+	return ret;
+}
+
+static gboolean
+export_mozilla (EphyNodeDbSnapshot *snapshot,
+		const char *filename,
+		ExportContext *context)
+{
+	GFile *file, *tmp_file;
+	GFileOutputStream *stream;
+	char *tmp_file_path;
+	gboolean ret = FALSE;
+
+	LOG ("Exporting as Mozilla to %s", filename);
+
+	START_PROFILER ("Exporting as Mozilla")
+
+	tmp_file_path = g_strconcat (filename, ".tmp", NULL);
+	file = g_file_new_for_path (filename);
+	tmp_file = g_file_new_for_path (tmp_file_path);
+
+	stream = g_file_replace (tmp_file, NULL, FALSE, G_FILE_CREATE_NONE,
+				 context->cancellable, NULL);
+	if (stream != NULL)
+	{
+		ret = write_mozilla (snapshot, G_OUTPUT_STREAM (stream), context);
+		ret = g_output_stream_close (G_OUTPUT_STREAM (stream), NULL, NULL) && ret;
+		g_object_unref (stream);
+
+		if (ret)
+		{
+			ret = ephy_file_switch_temp_file (file, tmp_file);
+		}
+		else
+		{
+			g_unlink (tmp_file_path);
+		}
+	}
+
+	g_object_unref (file);
+	g_object_unref (tmp_file);
 	g_free (tmp_file_path);
 
 	STOP_PROFILER ("Exporting as Mozilla")
-	
-	LOG ("Exporting as Mozilla %s.", ret >= 0 ? "succeeded" : "FAILED");
+
+	LOG ("Exporting as Mozilla %s.", ret ? "succeeded" : "FAILED");
+
+	return ret;
+}
+
+/**
+ * ephy_bookmarks_export_snapshot:
+ * @snapshot: an #EphyNodeDbSnapshot from ephy_bookmarks_take_snapshot()
+ * @filename: the file to write
+ * @format: the #EphyBookmarksExportFormat to write
+ * @cancellable: (allow-none): a #GCancellable, or %NULL
+ * @progress_func: (allow-none): called every now and then with the
+ * number of bookmarks written so far
+ * @progress_data: data for @progress_func
+ *
+ * Streams the bookmarks in @snapshot to a temporary file and, if that
+ * succeeds, atomically replaces @filename with it. This does not touch
+ * the live bookmarks, so it can be called from any thread; @progress_func
+ * is called in that thread.
+ *
+ * Return value: %TRUE on success, %FALSE on errors or if @cancellable
+ * was cancelled
+ **/
+gboolean
+ephy_bookmarks_export_snapshot (EphyNodeDbSnapshot *snapshot,
+				const char *filename,
+				EphyBookmarksExportFormat format,
+				GCancellable *cancellable,
+				EphyBookmarksExportProgressFunc progress_func,
+				gpointer progress_data)
+{
+	ExportContext context = { 0, };
+
+	g_return_val_if_fail (snapshot != NULL, FALSE);
+	g_return_val_if_fail (filename != NULL, FALSE);
+
+	context.cancellable = cancellable;
+	context.progress_func = progress_func;
+	context.progress_data = progress_data;
+
+	switch (format)
+	{
+		case EPHY_BOOKMARKS_EXPORT_RDF:
+			return export_rdf (snapshot, filename, &context);
+		case EPHY_BOOKMARKS_EXPORT_MOZILLA:
+			return export_mozilla (snapshot, filename, &context);
+		default:
+			g_return_val_if_reached (FALSE);
+	}
+}
+
+/**
+ * ephy_bookmarks_export_rdf_snapshot:
+ * @snapshot: an #EphyNodeDbSnapshot from ephy_bookmarks_take_snapshot()
+ * @file_path: the file to write
+ *
+ * Atomically replaces @file_path with an RDF export of the bookmarks in
+ * @snapshot. This does not touch the live bookmarks, so it can be called
+ * from any thread.
+ *
+ * Return value: %TRUE on success
+ **/
+gboolean
+ephy_bookmarks_export_rdf_snapshot (EphyNodeDbSnapshot *snapshot,
+				    const char *file_path)
+{
+	return ephy_bookmarks_export_snapshot
+		(snapshot, file_path, EPHY_BOOKMARKS_EXPORT_RDF, NULL, NULL, NULL);
+}
+
+static void
+checksum_add_string (GChecksum *checksum,
+		     const char *string)
+{
+	/* Keep NULL apart from the empty string. */
+	if (string == NULL)
+	{
+		g_checksum_update (checksum, (const guchar *) "\1", 1);
+	}
+	else
+	{
+		g_checksum_update (checksum, (const guchar *) string, strlen (string) + 1);
+	}
+}
+
+/**
+ * ephy_bookmarks_export_get_rdf_checksum:
+ * @snapshot: an #EphyNodeDbSnapshot from ephy_bookmarks_take_snapshot()
+ * @file_path: the file the RDF export would be written to
+ *
+ * Computes a checksum of everything the RDF export of @snapshot to
+ * @file_path would contain, without generating it. Two snapshots with
+ * the same checksum export to the same file. This can be called from
+ * any thread.
+ *
+ * Return value: a newly allocated checksum string
+ **/
+char *
+ephy_bookmarks_export_get_rdf_checksum (EphyNodeDbSnapshot *snapshot,
+					const char *file_path)
+{
+	ExportNodes nodes;
+	GChecksum *checksum;
+	char *ret;
+	guint i, j;
+
+	g_return_val_if_fail (snapshot != NULL, NULL);
+	g_return_val_if_fail (file_path != NULL, NULL);
+
+	export_nodes_init (&nodes, snapshot);
+	checksum = g_checksum_new (G_CHECKSUM_SHA1);
+
+	checksum_add_string (checksum, file_path);
+
+	for (i = 0; i < nodes.bmks->len; i++)
+	{
+		guint kid = g_array_index (nodes.bmks, guint, i);
+		const char *smart_url;
+		char *link;
+		GArray *keywords;
+
+		link = get_link (snapshot, kid, &smart_url);
+		checksum_add_string (checksum, link);
+		checksum_add_string (checksum, smart_url);
+		checksum_add_string (checksum, ephy_node_db_snapshot_get_property_string
+				     (snapshot, kid, EPHY_NODE_BMK_PROP_TITLE));
+		g_free (link);
+
+		keywords = get_topics (snapshot, nodes.topics, kid);
+		for (j = 0; j < keywords->len; j++)
+		{
+			checksum_add_string (checksum, ephy_node_db_snapshot_get_property_string
+					     (snapshot, g_array_index (keywords, guint, j),
+					      EPHY_NODE_KEYWORD_PROP_NAME));
+		}
+		g_array_free (keywords, TRUE);
+
+		/* End of the item. */
+		g_checksum_update (checksum, (const guchar *) "\2", 1);
+	}
+
+	ret = g_strdup (g_checksum_get_string (checksum));
+
+	g_checksum_free (checksum);
+	export_nodes_clear (&nodes);
+
+	return ret;
+}
+
+typedef struct
+{
+	volatile gint ref_count;
+	EphyBookmarks *bookmarks;
+	EphyNodeDbSnapshot *snapshot;
+	char *filename;
+	EphyBookmarksExportFormat format;
+	GCancellable *cancellable;
+	EphyBookmarksExportProgressFunc progress_func;
+	EphyBookmarksExportCallback callback;
+	gpointer user_data;
+	volatile gint n_done;
+	volatile gint n_total;
+	volatile gint progress_pending;
+	gboolean success;
+} ExportJob;
+
+static void
+export_job_unref (ExportJob *job)
+{
+	if (!g_atomic_int_dec_and_test (&job->ref_count)) return;
+
+	g_object_unref (job->bookmarks);
+	ephy_node_db_snapshot_unref (job->snapshot);
+	g_free (job->filename);
+	if (job->cancellable)
+	{
+		g_object_unref (job->cancellable);
+	}
+	g_slice_free (ExportJob, job);
+}
+
+static gboolean
+export_job_progress_cb (ExportJob *job)
+{
+	g_atomic_int_set (&job->progress_pending, 0);
+
+	if (!g_cancellable_is_cancelled (job->cancellable))
+	{
+		job->progress_func (g_atomic_int_get (&job->n_done),
+				    g_atomic_int_get (&job->n_total),
+				    job->user_data);
+	}
+
+	return FALSE;
+}
+
+/* Runs in the export thread. Only the latest numbers are reported, at
+ * most one report is queued at any time. */
+static void
+export_job_progress (guint n_done,
+		     guint n_total,
+		     ExportJob *job)
+{
+	g_atomic_int_set (&job->n_done, n_done);
+	g_atomic_int_set (&job->n_total, n_total);
+
+	if (g_atomic_int_compare_and_exchange (&job->progress_pending, 0, 1))
+	{
+		g_atomic_int_inc (&job->ref_count);
+		g_idle_add_full (G_PRIORITY_DEFAULT_IDLE,
+				 (GSourceFunc) export_job_progress_cb, job,
+				 (GDestroyNotify) export_job_unref);
+	}
+}
+
+static gboolean
+export_job_finished_cb (ExportJob *job)
+{
+	if (job->callback)
+	{
+		job->callback (job->bookmarks, job->success, job->user_data);
+	}
+
+	return FALSE;
+}
+
+static gpointer
+export_thread_func (ExportJob *job)
+{
+	job->success = ephy_bookmarks_export_snapshot
+		(job->snapshot, job->filename, job->format, job->cancellable,
+		 job->progress_func ? (EphyBookmarksExportProgressFunc) export_job_progress : NULL,
+		 job);
+
+	g_idle_add_full (G_PRIORITY_DEFAULT_IDLE,
+			 (GSourceFunc) export_job_finished_cb, job,
+			 (GDestroyNotify) export_job_unref);
+
+	return NULL;
+}
+
+/**
+ * ephy_bookmarks_export:
+ * @bookmarks: an #EphyBookmarks
+ * @filename: the file to write
+ * @format: the #EphyBookmarksExportFormat to write
+ * @cancellable: (allow-none): a #GCancellable, or %NULL
+ * @progress_func: (allow-none): called in the main loop every now and
+ * then with the number of bookmarks written so far
+ * @callback: (allow-none): called in the main loop when the export is done
+ * @user_data: data for @progress_func and @callback
+ *
+ * Exports @bookmarks as they are now to @filename. Only copying the
+ * bookmarks happens here, they are written from a thread.
+ **/
+void
+ephy_bookmarks_export (EphyBookmarks *bookmarks,
+		       const char *filename,
+		       EphyBookmarksExportFormat format,
+		       GCancellable *cancellable,
+		       EphyBookmarksExportProgressFunc progress_func,
+		       EphyBookmarksExportCallback callback,
+		       gpointer user_data)
+{
+	ExportJob *job;
+	EphyNodeDbSnapshot *snapshot;
+
+	g_return_if_fail (EPHY_IS_BOOKMARKS (bookmarks));
+	g_return_if_fail (filename != NULL);
+
+	snapshot = ephy_bookmarks_take_snapshot (bookmarks);
+	if (snapshot == NULL)
+	{
+		if (callback)
+		{
+			callback (bookmarks, FALSE, user_data);
+		}
+		return;
+	}
+
+	job = g_slice_new0 (ExportJob);
+	job->ref_count = 1;
+	job->bookmarks = g_object_ref (bookmarks);
+	job->snapshot = snapshot;
+	job->filename = g_strdup (filename);
+	job->format = format;
+	job->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
+	job->progress_func = progress_func;
+	job->callback = callback;
+	job->user_data = user_data;
+
+	g_thread_unref (g_thread_new ("EphyBookmarksExport",
+				      (GThreadFunc) export_thread_func, job));
+}
+
+void
+ephy_bookmarks_export_rdf (EphyBookmarks *bookmarks,
+			   const char *file_path)
+{
+	EphyNodeDbSnapshot *snapshot;
+
+	snapshot = ephy_bookmarks_take_snapshot (bookmarks);
+	if (snapshot == NULL) return;
+
+	ephy_bookmarks_export_snapshot
+		(snapshot, file_path, EPHY_BOOKMARKS_EXPORT_RDF, NULL, NULL, NULL);
+
+	ephy_node_db_snapshot_unref (snapshot);
+}
+
+void
+ephy_bookmarks_export_mozilla (EphyBookmarks *bookmarks,
+			       const char *filename)
+{
+	EphyNodeDbSnapshot *snapshot;
+
+	snapshot = ephy_bookmarks_take_snapshot (bookmarks);
+	if (snapshot == NULL) return;
+
+	ephy_bookmarks_export_snapshot
+		(snapshot, filename, EPHY_BOOKMARKS_EXPORT_MOZILLA, NULL, NULL, NULL);
+
+	ephy_node_db_snapshot_unref (snapshot);
 }
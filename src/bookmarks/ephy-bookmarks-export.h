@@ -26,11 +26,48 @@
 
 #include "ephy-bookmarks.h"
 
+#include <gio/gio.h>
+
 G_BEGIN_DECLS
 
+typedef enum
+{
+	EPHY_BOOKMARKS_EXPORT_RDF,
+	EPHY_BOOKMARKS_EXPORT_MOZILLA
+} EphyBookmarksExportFormat;
+
+typedef void (* EphyBookmarksExportProgressFunc) (guint n_exported,
+						  guint n_total,
+						  gpointer user_data);
+
+typedef void (* EphyBookmarksExportCallback) (EphyBookmarks *bookmarks,
+					      gboolean success,
+					      gpointer user_data);
+
+void ephy_bookmarks_export (EphyBookmarks *bookmarks,
+			    const char *filename,
+			    EphyBookmarksExportFormat format,
+			    GCancellable *cancellable,
+			    EphyBookmarksExportProgressFunc progress_func,
+			    EphyBookmarksExportCallback callback,
+			    gpointer user_data);
+
+gboolean ephy_bookmarks_export_snapshot (EphyNodeDbSnapshot *snapshot,
+					 const char *filename,
+					 EphyBookmarksExportFormat format,
+					 GCancellable *cancellable,
+					 EphyBookmarksExportProgressFunc progress_func,
+					 gpointer progress_data);
+
+char *ephy_bookmarks_export_get_rdf_checksum (EphyNodeDbSnapshot *snapshot,
+					      const char *filename);
+
 void ephy_bookmarks_export_rdf (EphyBookmarks *bookmarks,
 				const char *filename);
 
+gboolean ephy_bookmarks_export_rdf_snapshot (EphyNodeDbSnapshot *snapshot,
+					     const char *filename);
+
 void ephy_bookmarks_export_mozilla (EphyBookmarks *bookmarks,
 				    const char *filename);
 
@@ -47,19 +47,78 @@ typedef enum
 	NS_UNKNOWN
 } NSItemType;
 
-static EphyNode *
-bookmark_add (EphyBookmarks *bookmarks,
-	      const char *title,
-	      const char *address)
+/* Bookmarks are collected while a file is parsed, and added all at
+ * once with ephy_bookmarks_add_many() at the end. */
+typedef struct
 {
-	if (!ephy_bookmarks_find_bookmark (bookmarks, address))
+	GArray *records;
+	GStringChunk *strings;
+} ImportBatch;
+
+static void
+import_batch_init (ImportBatch *batch)
+{
+	batch->records = g_array_new (FALSE, FALSE, sizeof (EphyBookmarkRecord));
+	batch->strings = g_string_chunk_new (64 * 1024);
+}
+
+/* topics is a list of topic names, in which NULLs are skipped. */
+static void
+import_batch_add (ImportBatch *batch,
+		  const char *title,
+		  const char *address,
+		  GList *topics)
+{
+	EphyBookmarkRecord record;
+	GList *l;
+	guint i = 0;
+
+	record.title = title ? g_string_chunk_insert (batch->strings, title) : NULL;
+	record.address = g_string_chunk_insert (batch->strings, address);
+	record.topics = g_new (char *, g_list_length (topics) + 1);
+
+	for (l = topics; l != NULL; l = l->next)
 	{
-		return ephy_bookmarks_add (bookmarks, title, address);
+		if (l->data != NULL)
+		{
+			record.topics[i++] = g_string_chunk_insert_const (batch->strings, l->data);
+		}
 	}
-	else
+	record.topics[i] = NULL;
+
+	g_array_append_val (batch->records, record);
+}
+
+static gboolean
+import_batch_finish (ImportBatch *batch,
+		     EphyBookmarks *bookmarks)
+{
+	GPtrArray *nodes;
+	gboolean retval = TRUE;
+	guint i;
+
+	nodes = ephy_bookmarks_add_many (bookmarks,
+					 (EphyBookmarkRecord *) batch->records->data,
+					 batch->records->len);
+
+	for (i = 0; i < batch->records->len; i++)
 	{
-		return NULL;
+		EphyBookmarkRecord *record = &g_array_index (batch->records, EphyBookmarkRecord, i);
+
+		if (g_ptr_array_index (nodes, i) == NULL)
+		{
+			g_warning ("%s: could not add bookmark for %s", G_STRFUNC, record->address);
+			retval = FALSE;
+		}
+
+		g_free (record->topics);
 	}
+
+	g_ptr_array_free (nodes, TRUE);
+	g_array_free (batch->records, TRUE);
+	g_string_chunk_free (batch->strings);
+
+	return retval;
 }
 
 gboolean
@@ -154,10 +213,9 @@ typedef enum
 } EphyXBELImporterState;
 
 static int
-xbel_parse_bookmark (EphyBookmarks *eb, xmlTextReaderPtr reader, EphyNode **ret_node)
+xbel_parse_bookmark (ImportBatch *batch, xmlTextReaderPtr reader, GList *folders)
 {
 	EphyXBELImporterState state = STATE_BOOKMARK;
-	EphyNode *node;
 	xmlChar *title = NULL;
 	xmlChar *address = NULL;
 	int ret = 1;
@@ -271,23 +329,16 @@ xbel_parse_bookmark (EphyBookmarks *eb, xmlTextReaderPtr reader, EphyNode **ret_
 		title = xmlStrdup ((xmlChar *) _("Untitled"));
 	}
 
-	node = bookmark_add (eb, (const char *) title, (const char *) address);
-	if (node == NULL)
-	{
-		/* probably a duplicate */
-		node = ephy_bookmarks_find_bookmark (eb, (const char *) address);
-	}
+	import_batch_add (batch, (const char *) title, (const char *) address, folders);
 
 	xmlFree (title);
 	xmlFree (address);
 
-	*ret_node = node;
-
 	return ret;
 }
 
 static int
-xbel_parse_folder (EphyBookmarks *eb, xmlTextReaderPtr reader, GList *folders)
+xbel_parse_folder (ImportBatch *batch, xmlTextReaderPtr reader, GList *folders)
 {
 	EphyXBELImporterState state = STATE_FOLDER;
 	char *folder = NULL;
@@ -322,29 +373,7 @@ xbel_parse_folder (EphyBookmarks *eb, xmlTextReaderPtr reader, GList *folders)
 		}
 		else if (xmlStrEqual (tag, (xmlChar *) "bookmark") && type == 1 && state == STATE_FOLDER)
 		{
-			EphyNode *node = NULL, *keyword;
-			GList *l;
-
-			ret = xbel_parse_bookmark (eb, reader, &node);
-
-			for (l = folders; l != NULL; l=l->next)
-			{
-				char *title;
-				
-				title = l->data ? (char *) l->data : "";
-				
-				keyword = ephy_bookmarks_find_keyword (eb, title, FALSE);
-			
-				if (keyword == NULL && title[0] != '\0')
-				{
-					keyword = ephy_bookmarks_add_keyword (eb, title);
-				}
-
-				if (node != NULL && keyword != NULL)
-				{
-					ephy_bookmarks_set_keyword (eb, keyword, node);
-				}
-			}
+			ret = xbel_parse_bookmark (batch, reader, folders);
 
 			if (ret != 1) break;
 		}
@@ -353,7 +382,7 @@ xbel_parse_folder (EphyBookmarks *eb, xmlTextReaderPtr reader, GList *folders)
 		{
 			if (type == XML_READER_TYPE_ELEMENT)
 			{
-				ret = xbel_parse_folder (eb, reader, folders);
+				ret = xbel_parse_folder (batch, reader, folders);
 				
 				if (ret != 1) break;
 			}
@@ -416,7 +445,7 @@ xbel_parse_folder (EphyBookmarks *eb, xmlTextReaderPtr reader, GList *folders)
 }
 
 static int
-xbel_parse_xbel (EphyBookmarks *eb, xmlTextReaderPtr reader)
+xbel_parse_xbel (ImportBatch *batch, xmlTextReaderPtr reader)
 {
 	EphyXBELImporterState state = STATE_XBEL;
 	int ret;
@@ -438,10 +467,8 @@ xbel_parse_xbel (EphyBookmarks *eb, xmlTextReaderPtr reader)
 		else if (xmlStrEqual (tag, (xmlChar *) "bookmark") && type == XML_READER_TYPE_ELEMENT
 			 && state == STATE_XBEL)
 		{
-			EphyNode *node = NULL;
-
 			/* this will eat the </bookmark> too */
-			ret = xbel_parse_bookmark (eb, reader, &node);
+			ret = xbel_parse_bookmark (batch, reader, NULL);
 
 			if (ret != 1) break;
 		}
@@ -449,7 +476,7 @@ xbel_parse_xbel (EphyBookmarks *eb, xmlTextReaderPtr reader)
 			 && state == STATE_XBEL)
 		{
 			/* this will eat the </folder> too */
-			ret = xbel_parse_folder (eb, reader, NULL);
+			ret = xbel_parse_folder (batch, reader, NULL);
 
 			if (ret != 1) break;
 		}
@@ -506,113 +533,168 @@ xbel_parse_xbel (EphyBookmarks *eb, xmlTextReaderPtr reader)
 
 /* Mozilla/Netscape import */
 
-static gchar *
-gul_general_read_line_from_file (FILE *f)
+/* The file is mapped in memory and scanned once, looking only at the
+ * A, H3 and DL tags. Whatever else is in there is skipped. */
+typedef struct
+{
+	const char *p;
+	const char *end;
+} NSParser;
+
+static gboolean
+ns_has_prefix (const char *p, const char *end, const char *prefix)
+{
+	gsize len = strlen (prefix);
+
+	return (gsize)(end - p) >= len && g_ascii_strncasecmp (p, prefix, len) == 0;
+}
+
+/* Whether p starts the given tag, like "<a" or "</dl". */
+static gboolean
+ns_is_tag (const char *p, const char *end, const char *tag)
+{
+	gsize len = strlen (tag);
+
+	if (!ns_has_prefix (p, end, tag))
+		return FALSE;
+
+	return p + len == end || g_ascii_isspace (p[len]) ||
+	       p[len] == '>' || p[len] == '/';
+}
+
+static const char *
+ns_find_tag (const char *p, const char *end, const char *tag)
 {
-	gchar *line = g_strdup ("");
-	gchar *t;
-	gchar *buf = g_new0 (gchar, 256);
-	while ( ! ( strchr (buf, '\n') || feof (f) ) ) {
-		if (fgets(buf, 256, f))
+	while (p < end && (p = memchr (p, '<', end - p)) != NULL)
+	{
+		if (ns_is_tag (p, end, tag))
+			return p;
+		p++;
+	}
+
+	return NULL;
+}
+
+/* Returns the '>' closing the tag at p, skipping attribute values quoted
+ * with either kind of quote. */
+static const char *
+ns_find_tag_end (const char *p, const char *end)
+{
+	char quote = '\0';
+
+	for (; p < end; p++)
+	{
+		if (quote != '\0')
+		{
+			if (*p == quote)
+				quote = '\0';
+		}
+		else if (*p == '"' || *p == '\'')
+			quote = *p;
+		else if (*p == '>')
+			return p;
+	}
+
+	return NULL;
+}
+
+static gboolean
+ns_get_attribute (const char *p, const char *end, const char *attribute, GString *value)
+{
+	gsize len = strlen (attribute);
+
+	for (; p < end; p++)
+	{
+		const char *q, *start;
+		char quote = '\0';
+
+		if (!g_ascii_isspace (*p) || !ns_has_prefix (p + 1, end, attribute))
+			continue;
+
+		q = p + 1 + len;
+		while (q < end && g_ascii_isspace (*q)) q++;
+		if (q == end || *q != '=')
+			continue;
+
+		q++;
+		while (q < end && g_ascii_isspace (*q)) q++;
+		if (q < end && (*q == '"' || *q == '\''))
+			quote = *q++;
+
+		for (start = q; q < end; q++)
 		{
-			t = line;
-			line = g_strconcat (line, buf, NULL);
-			g_free (t);
+			if (quote ? *q == quote : g_ascii_isspace (*q))
+				break;
 		}
+
+		g_string_truncate (value, 0);
+		g_string_append_len (value, start, q - start);
+		return TRUE;
 	}
-	g_free (buf);
-	return line;
+
+	return FALSE;
+}
+
+static void
+ns_assign_stripped (GString *string, const char *start, const char *end)
+{
+	while (start < end && g_ascii_isspace (*start)) start++;
+	while (end > start && g_ascii_isspace (end[-1])) end--;
+
+	g_string_truncate (string, 0);
+	g_string_append_len (string, start, end - start);
 }
 
 /**
- * Parses a line of a mozilla/netscape bookmark file. File must be open.
+ * Returns the next item of a mozilla/netscape bookmark file, or
+ * NS_UNKNOWN once the end of the file is reached.
  */
-/* this has been tested fairly well */
 static NSItemType
-ns_get_bookmark_item (FILE *f, GString *name, GString *url)
+ns_get_bookmark_item (NSParser *parser, GString *name, GString *url)
 {
-	char *line = NULL;
-	GRegex *regex;
-	GMatchInfo *match_info;
-	int ret = NS_UNKNOWN;
-	char *match_url = NULL;
-	char *match_name = NULL;
-
-	line = gul_general_read_line_from_file (f);
-	
-	/*
-	 * Regex parsing of the html file:
-	 * 1. check if it's a bookmark, or a folder, or the end of a folder,
-	 * note that only ONE of this things is going to happen
-	 * 2. assign to the GStrings
-	 * 3. return the ret val to tell our caller what we found, by default 
-	 * we don't know (NS_UNKWOWN).
-	 */
-	
-	/* check if it's a bookmark */
-	regex = g_regex_new
-		 ("<a href=\"(?P<url>[^\"]*).*?>\\s*(?P<name>.*?)\\s*</a>",
-		 G_REGEX_CASELESS, G_REGEX_MATCH_NOTEMPTY, NULL);
-	g_regex_match (regex, line, 0, &match_info);
-	
-	if (g_match_info_matches (match_info))
-	{
-		match_url = g_match_info_fetch_named (match_info, "url");
-		match_name = g_match_info_fetch_named (match_info, "name");
-		ret = NS_SITE;
-		goto end;
-	}
-	g_match_info_free (match_info);
-	g_regex_unref (regex);
-	
-	/* check if it's a folder start */
-	regex = g_regex_new ("<h3.*>(?P<name>\\w.*)</h3>", 
-				G_REGEX_CASELESS, G_REGEX_MATCH_NOTEMPTY, NULL);
+	const char *p = parser->p, *end = parser->end;
 
-	g_regex_match (regex, line, 0, &match_info);
-	if (g_match_info_matches (match_info))
+	while (p < end && (p = memchr (p, '<', end - p)) != NULL)
 	{
-		match_name = g_match_info_fetch_named (match_info, "name");
-		ret = NS_FOLDER;
-		goto end;
-	}
-	g_match_info_free (match_info);
-	g_regex_unref (regex);
-	
-	/* check if it's a folder end */
-	regex = g_regex_new ("</dl>", 
-				G_REGEX_CASELESS, G_REGEX_MATCH_NOTEMPTY, NULL);
+		const char *tag_end, *close;
+		gboolean is_site;
 
-	g_regex_match (regex, line, 0, &match_info);
-	if (g_match_info_matches (match_info))
-	{
-		ret = NS_FOLDER_END;
-		goto end;
-	}
-	
-	/* now let's use the collected stuff */
-	end:
-		/* Due to the goto we'll always have an unfreed @match_info and 
-		 * @regex. Note that this two free/unrefs correspond to the last 
-		 * if() block too.
-		 */
-		g_match_info_free (match_info);
-		g_regex_unref (regex);
+		if (ns_is_tag (p, end, "</dl"))
+		{
+			parser->p = p + 1;
+			return NS_FOLDER_END;
+		}
 
-		if (match_name)
+		is_site = ns_is_tag (p, end, "<a");
+		if (!is_site && !ns_is_tag (p, end, "<h3"))
 		{
-			g_string_assign (name, match_name);
-			g_free (match_name);
+			p++;
+			continue;
 		}
 
-		if (match_url)
+		tag_end = ns_find_tag_end (p, end);
+		if (tag_end == NULL)
+			break;
+
+		/* Anchors without an address are not bookmarks. */
+		if (is_site && !ns_get_attribute (p, tag_end, "href", url))
 		{
-			g_string_assign (url, match_url);
-			g_free (match_url);
+			p = tag_end + 1;
+			continue;
 		}
 
-		g_free (line);
-		return ret;
+		close = ns_find_tag (tag_end + 1, end, is_site ? "</a" : "</h3");
+		if (close == NULL)
+			break;
+
+		ns_assign_stripped (name, tag_end + 1, close);
+		parser->p = close + 1;
+
+		return is_site ? NS_SITE : NS_FOLDER;
+	}
+
+	parser->p = end;
+	return NS_UNKNOWN;
 }
 
 /*
@@ -708,28 +790,35 @@ gboolean
 ephy_bookmarks_import_mozilla (EphyBookmarks *bookmarks,
 			       const char *filename)
 {
-	FILE *bf;  /* bookmark file */
+	GMappedFile *file;
+	GError *error = NULL;
+	NSParser parser;
 	GString *name, *url;
 	char *parsedname;
 	GList *folders = NULL;
-	gboolean retval = TRUE;
+	ImportBatch batch;
 
 	if (g_settings_get_boolean (EPHY_SETTINGS_LOCKDOWN,
 				    EPHY_PREFS_LOCKDOWN_BOOKMARK_EDITING))
 		return FALSE;
 
-	if (!(bf = fopen (filename, "r"))) {
-		g_warning ("Failed to open file: %s\n", filename);
+	file = g_mapped_file_new (filename, FALSE, &error);
+	if (file == NULL) {
+		g_warning ("Failed to open file: %s: %s\n", filename, error->message);
+		g_error_free (error);
 		return FALSE;
 	}
 
+	parser.p = g_mapped_file_get_contents (file);
+	parser.end = parser.p + g_mapped_file_get_length (file);
+
 	name = g_string_new (NULL);
 	url = g_string_new (NULL);
+	import_batch_init (&batch);
 
-	while (!feof (bf)) {
-		EphyNode *node;
+	while (parser.p < parser.end) {
 		NSItemType t;
-		t = ns_get_bookmark_item (bf, name, url);
+		t = ns_get_bookmark_item (&parser, name, url);
 		switch (t)
 		{
 		case NS_FOLDER:
@@ -748,34 +837,9 @@ ephy_bookmarks_import_mozilla (EphyBookmarks *bookmarks,
 		case NS_SITE:
 			parsedname = ns_parse_bookmark_item (name);
 
-			node = bookmark_add (bookmarks, parsedname, url->str);
-
-			if (node == NULL)
-			{
-				node = ephy_bookmarks_find_bookmark (bookmarks, url->str);
-				if (node == NULL) {
-					g_warning ("%s: `node' is NULL", G_STRFUNC);
-					retval = FALSE;
-					goto out;
-				}
-			}
-
-			if (folders != NULL)
-			{
-				EphyNode *keyword;
-				GList *l;
-
-				for (l = folders; l != NULL; l = l->next)
-				{
-					keyword = ephy_bookmarks_find_keyword (bookmarks, l->data, FALSE);
-					if (keyword == NULL)
-					{
-						keyword = ephy_bookmarks_add_keyword (bookmarks, l->data);
-					}
-
-					ephy_bookmarks_set_keyword (bookmarks, keyword, node);
-				}
-			}
+			/* Folders without a name still nest, but are not
+			 * made into topics. */
+			import_batch_add (&batch, parsedname, url->str, folders);
 
 			g_free (parsedname);
 
@@ -784,12 +848,13 @@ ephy_bookmarks_import_mozilla (EphyBookmarks *bookmarks,
 			break;
 		}
 	}
-out:
-	fclose (bf);
+
+	g_list_free_full (folders, g_free);
+	g_mapped_file_unref (file);
 	g_string_free (name, TRUE);
 	g_string_free (url, TRUE);
 
-	return retval;
+	return import_batch_finish (&batch, bookmarks);
 }
 
 gboolean
@@ -797,6 +862,7 @@ ephy_bookmarks_import_xbel (EphyBookmarks *bookmarks,
 			    const char *filename)
 {
 	xmlTextReaderPtr reader;
+	ImportBatch batch;
 	int ret;
 
 	if (g_settings_get_boolean (EPHY_SETTINGS_LOCKDOWN,
@@ -814,10 +880,17 @@ ephy_bookmarks_import_xbel (EphyBookmarks *bookmarks,
 		return FALSE;
 	}
 
-	ret = xbel_parse_xbel (bookmarks, reader);
+	import_batch_init (&batch);
+	ret = xbel_parse_xbel (&batch, reader);
 
 	xmlFreeTextReader (reader);
 
+	/* Whatever was read before an error is still imported. */
+	if (!import_batch_finish (&batch, bookmarks))
+	{
+		return FALSE;
+	}
+
 	return ret >= 0 ? TRUE : FALSE;
 }
 
@@ -883,7 +956,7 @@ parse_rdf_lang_tag (xmlNode  *child,
 }
 
 static void
-parse_rdf_item (EphyBookmarks *bookmarks,
+parse_rdf_item (ImportBatch *batch,
 		xmlNodePtr node)
 {
 	xmlChar *title = NULL;
@@ -894,9 +967,8 @@ parse_rdf_item (EphyBookmarks *bookmarks,
 	 * a localized link */
 	gboolean use_smartlink = FALSE;
 	xmlChar *subject = NULL;
-	GList *subjects = NULL, *l = NULL;
+	GList *subjects = NULL;
 	xmlNode *child;
-	EphyNode *bmk = NULL;
 
 	child = node->children;
 
@@ -938,30 +1010,7 @@ parse_rdf_item (EphyBookmarks *bookmarks,
 	}
 
 	if (link)
-		bmk = bookmark_add (bookmarks, (char *) title, (char *) link);
-
-	if (bmk)
-	{
-		l = subjects;
-	}
-
-	for (; l != NULL; l = l->next)
-	{
-		char *topic_name = l->data;
-		EphyNode *topic;
-
-		topic = ephy_bookmarks_find_keyword (bookmarks, topic_name, FALSE);
-
-		if (topic == NULL)
-		{
-			topic = ephy_bookmarks_add_keyword (bookmarks, topic_name);
-		}
-
-		if (topic != NULL)
-		{
-			ephy_bookmarks_set_keyword (bookmarks, topic, bmk);
-		}
-	}
+		import_batch_add (batch, (char *) title, (char *) link, subjects);
 
 	xmlFree (title);
 	xmlFree (link);
@@ -977,6 +1026,7 @@ ephy_bookmarks_import_rdf (EphyBookmarks *bookmarks,
 	xmlDocPtr doc;
 	xmlNodePtr child;
 	xmlNodePtr root;
+	ImportBatch batch;
 
 	if (g_settings_get_boolean (EPHY_SETTINGS_LOCKDOWN,
 				    EPHY_PREFS_LOCKDOWN_BOOKMARK_EDITING))
@@ -999,11 +1049,13 @@ ephy_bookmarks_import_rdf (EphyBookmarks *bookmarks,
 
 	child = root->children;
 
+	import_batch_init (&batch);
+
 	while (child != NULL)
 	{
 		if (xmlStrEqual (child->name, (xmlChar *) "item"))
 		{
-			parse_rdf_item (bookmarks, child);
+			parse_rdf_item (&batch, child);
 		}
 
 		child = child->next;
@@ -1011,5 +1063,5 @@ ephy_bookmarks_import_rdf (EphyBookmarks *bookmarks,
 
 	xmlFreeDoc (doc);
 
-	return TRUE;
+	return import_batch_finish (&batch, bookmarks);
 }
@@ -44,7 +44,9 @@ enum
     BUILD_SUBDIVIS       = 1 << 0,
     BUILD_SUBMENUS       = 1 << 1,
     BUILD_CHILD_SUBDIVIS = 1 << 2,
-    BUILD_CHILD_SUBMENUS = 1 << 3
+    BUILD_CHILD_SUBMENUS = 1 << 3,
+    /* Submenus are topic menu items whose menu is built on demand. */
+    BUILD_LAZY_SUBMENUS  = 1 << 4
 };
 
 /* Construct a block of bookmark actions. Note that no bookmark action appears
@@ -78,6 +80,7 @@ append_menu (GString *string, const GPtrArray *topics, const GPtrArray *bookmark
 	
 	gboolean use_subdivis = flags & BUILD_SUBDIVIS;
 	gboolean use_submenus = flags & BUILD_SUBMENUS;        
+	gboolean lazy_submenus = flags & BUILD_LAZY_SUBMENUS;
 
 	if (use_subdivis || use_submenus)
 	{
@@ -127,14 +130,26 @@ append_menu (GString *string, const GPtrArray *topics, const GPtrArray *bookmark
 		
 		if (flags & BUILD_CHILD_SUBDIVIS) flags |= BUILD_SUBDIVIS;
 		if (flags & BUILD_CHILD_SUBMENUS) flags |= BUILD_SUBMENUS;
+		flags &= ~BUILD_LAZY_SUBMENUS;
 		
 		/* Create each of the submenus. */
 		for (i = 0; i < submenus->len; i++)
 		{
 			topic = g_ptr_array_index (submenus, i);
-			ephy_nodes_get_covered (topic, bookmarks, subset);
 
 			EPHY_TOPIC_ACTION_NAME_PRINTF (name, topic);
+
+			if (lazy_submenus)
+			{
+				/* The topic action fills in the submenu the
+				 * first time it is selected. */
+				g_string_append_printf (string, "<menuitem action=\"%s\"/>",
+							name);
+				separate = TRUE;
+				continue;
+			}
+
+			ephy_nodes_get_covered (topic, bookmarks, subset);
 				
 			g_string_append_printf (string, "<menu action=\"%s\">",
 						name);
@@ -223,7 +238,10 @@ ephy_bookmarks_menu_build (GString *string, EphyNode *parent)
                 flags = 0;
                 break;
          case BOOKMARKS_NODE_ID:
-                flags = BUILD_SUBMENUS | BUILD_CHILD_SUBDIVIS;
+                /* Here a submenu holds every bookmark of its topic, which
+                 * is what the topic's own menu shows, so leave it to the
+                 * topic action. */
+                flags = BUILD_SUBMENUS | BUILD_CHILD_SUBDIVIS | BUILD_LAZY_SUBMENUS;
                 break;
          default:
                 flags = BUILD_SUBMENUS | BUILD_SUBDIVIS | BUILD_CHILD_SUBDIVIS;
@@ -0,0 +1,213 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2012 Igalia S.L.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include "config.h"
+#include "ephy-bookmarks-view.h"
+
+#include "ephy-bookmarks.h"
+
+/**
+ * SECTION:ephy-bookmarks-view
+ * @short_description: Read-only bookmark data for any thread
+ *
+ * An #EphyBookmarksView lays out the titles, locations and keywords of
+ * every bookmark as flat arrays, indexed by bookmark. The strings are not
+ * copied: they point into the #EphyNodeDbSnapshot the view was built
+ * from, which the view keeps alive.
+ *
+ * Views never change once built, so they can be read from several
+ * threads at once without locking while the main thread keeps editing
+ * the bookmarks. Get the current one with ephy_bookmarks_get_view(); its
+ * version tells whether the bookmarks changed since another was taken.
+ */
+
+struct _EphyBookmarksView {
+  volatile int ref_count;
+  guint version;
+
+  EphyNodeDbSnapshot *snapshot;
+  guint n_bookmarks;
+
+  guint *ids;
+  const char **titles;
+  const char **locations;
+  const char **keywords;
+};
+
+/**
+ * ephy_bookmarks_view_new:
+ * @snapshot: a snapshot of the children of the bookmarks node
+ * @version: the version of the bookmarks @snapshot was taken at
+ *
+ * Builds a view of the bookmarks in @snapshot. This walks @snapshot once,
+ * so it is best done once per version and the view shared.
+ *
+ * Return value: (transfer full): a new #EphyBookmarksView
+ **/
+EphyBookmarksView *
+ephy_bookmarks_view_new (EphyNodeDbSnapshot *snapshot,
+                         guint version)
+{
+  EphyBookmarksView *view;
+  guint i, n;
+
+  g_return_val_if_fail (snapshot != NULL, NULL);
+
+  n = ephy_node_db_snapshot_get_n_nodes (snapshot);
+
+  view = g_slice_new (EphyBookmarksView);
+  view->ref_count = 1;
+  view->version = version;
+  view->snapshot = ephy_node_db_snapshot_ref (snapshot);
+  view->n_bookmarks = n;
+
+  /* One block for all the arrays; every string array has a trailing
+   * NULL so it can be handed out as it is. */
+  view->titles = g_malloc (3 * (n + 1) * sizeof (char *) + n * sizeof (guint));
+  view->locations = view->titles + n + 1;
+  view->keywords = view->locations + n + 1;
+  view->ids = (guint *)(view->keywords + n + 1);
+
+  for (i = 0; i < n; i++) {
+    view->ids[i] = ephy_node_db_snapshot_get_id (snapshot, i);
+    view->titles[i] = ephy_node_db_snapshot_get_property_string (snapshot, i, EPHY_NODE_BMK_PROP_TITLE);
+    view->locations[i] = ephy_node_db_snapshot_get_property_string (snapshot, i, EPHY_NODE_BMK_PROP_LOCATION);
+    view->keywords[i] = ephy_node_db_snapshot_get_property_string (snapshot, i, EPHY_NODE_BMK_PROP_KEYWORDS);
+  }
+
+  view->titles[n] = view->locations[n] = view->keywords[n] = NULL;
+
+  return view;
+}
+
+EphyBookmarksView *
+ephy_bookmarks_view_ref (EphyBookmarksView *view)
+{
+  g_return_val_if_fail (view != NULL, NULL);
+
+  g_atomic_int_inc (&view->ref_count);
+
+  return view;
+}
+
+void
+ephy_bookmarks_view_unref (EphyBookmarksView *view)
+{
+  g_return_if_fail (view != NULL);
+
+  if (!g_atomic_int_dec_and_test (&view->ref_count))
+    return;
+
+  ephy_node_db_snapshot_unref (view->snapshot);
+  g_free (view->titles);
+  g_slice_free (EphyBookmarksView, view);
+}
+
+/**
+ * ephy_bookmarks_view_get_version:
+ * @view: an #EphyBookmarksView
+ *
+ * Return value: the version of the bookmarks @view shows. It grows every
+ * time a bookmark is added, removed or changed.
+ **/
+guint
+ephy_bookmarks_view_get_version (EphyBookmarksView *view)
+{
+  g_return_val_if_fail (view != NULL, 0);
+
+  return view->version;
+}
+
+/**
+ * ephy_bookmarks_view_get_n_bookmarks:
+ * @view: an #EphyBookmarksView
+ *
+ * Return value: the length of the arrays of @view
+ **/
+guint
+ephy_bookmarks_view_get_n_bookmarks (EphyBookmarksView *view)
+{
+  g_return_val_if_fail (view != NULL, 0);
+
+  return view->n_bookmarks;
+}
+
+/**
+ * ephy_bookmarks_view_get_id:
+ * @view: an #EphyBookmarksView
+ * @index: the index of a bookmark in @view
+ *
+ * Return value: the id of the bookmark node, to find it with
+ * ephy_bookmarks_get_from_id() if it still exists
+ **/
+guint
+ephy_bookmarks_view_get_id (EphyBookmarksView *view,
+                            guint index)
+{
+  g_return_val_if_fail (view != NULL, 0);
+  g_return_val_if_fail (index < view->n_bookmarks, 0);
+
+  return view->ids[index];
+}
+
+/**
+ * ephy_bookmarks_view_get_titles:
+ * @view: an #EphyBookmarksView
+ *
+ * Return value: (transfer none): the titles of the bookmarks, some of
+ * which may be %NULL, valid as long as @view is
+ **/
+const char * const *
+ephy_bookmarks_view_get_titles (EphyBookmarksView *view)
+{
+  g_return_val_if_fail (view != NULL, NULL);
+
+  return view->titles;
+}
+
+/**
+ * ephy_bookmarks_view_get_locations:
+ * @view: an #EphyBookmarksView
+ *
+ * Return value: (transfer none): the locations of the bookmarks, valid
+ * as long as @view is
+ **/
+const char * const *
+ephy_bookmarks_view_get_locations (EphyBookmarksView *view)
+{
+  g_return_val_if_fail (view != NULL, NULL);
+
+  return view->locations;
+}
+
+/**
+ * ephy_bookmarks_view_get_keywords:
+ * @view: an #EphyBookmarksView
+ *
+ * Return value: (transfer none): the keywords the bookmarks are searched
+ * by, some of which may be %NULL, valid as long as @view is
+ **/
+const char * const *
+ephy_bookmarks_view_get_keywords (EphyBookmarksView *view)
+{
+  g_return_val_if_fail (view != NULL, NULL);
+
+  return view->keywords;
+}
@@ -0,0 +1,58 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2012 Igalia S.L.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#if !defined (__EPHY_EPIPHANY_H_INSIDE__) && !defined (EPIPHANY_COMPILATION)
+#error "Only <epiphany/epiphany.h> can be included directly."
+#endif
+
+#ifndef EPHY_BOOKMARKS_VIEW_H
+#define EPHY_BOOKMARKS_VIEW_H
+
+#include <glib.h>
+
+#include "ephy-node-db.h"
+
+G_BEGIN_DECLS
+
+typedef struct _EphyBookmarksView EphyBookmarksView;
+
+EphyBookmarksView  *ephy_bookmarks_view_new             (EphyNodeDbSnapshot *snapshot,
+                                                         guint version);
+
+EphyBookmarksView  *ephy_bookmarks_view_ref             (EphyBookmarksView *view);
+
+void                ephy_bookmarks_view_unref           (EphyBookmarksView *view);
+
+guint               ephy_bookmarks_view_get_version     (EphyBookmarksView *view);
+
+guint               ephy_bookmarks_view_get_n_bookmarks (EphyBookmarksView *view);
+
+guint               ephy_bookmarks_view_get_id          (EphyBookmarksView *view,
+                                                         guint index);
+
+const char * const *ephy_bookmarks_view_get_titles      (EphyBookmarksView *view);
+
+const char * const *ephy_bookmarks_view_get_locations   (EphyBookmarksView *view);
+
+const char * const *ephy_bookmarks_view_get_keywords    (EphyBookmarksView *view);
+
+G_END_DECLS
+
+#endif /* EPHY_BOOKMARKS_VIEW_H */
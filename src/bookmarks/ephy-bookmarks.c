@@ -30,7 +30,9 @@
 #include "ephy-embed-shell.h"
 #include "ephy-file-helpers.h"
 #include "ephy-history-service.h"
+#include "ephy-keyword-index.h"
 #include "ephy-node-common.h"
+#include "ephy-node-index.h"
 #include "ephy-prefs.h"
 #include "ephy-settings.h"
 #include "ephy-shell.h"
@@ -52,6 +54,7 @@
 #define EPHY_BOOKMARKS_XML_ROOT    "ephy_bookmarks"
 #define EPHY_BOOKMARKS_XML_VERSION "1.03"
 #define BOOKMARKS_SAVE_DELAY 3 /* seconds */
+#define BOOKMARKS_JOURNAL_MAX_SIZE (512 * 1024) /* bytes */
 #define UPDATE_URI_DATA_KEY "updated-uri"
 
 #define EPHY_BOOKMARKS_GET_PRIVATE(object)(G_TYPE_INSTANCE_GET_PRIVATE ((object), EPHY_TYPE_BOOKMARKS, EphyBookmarksPrivate))
@@ -68,8 +71,14 @@ struct _EphyBookmarksPrivate
 	gboolean init_defaults;
 	gboolean dirty;
 	guint save_timeout_id;
+	GThread *save_thread;
+	struct _SaveJob *save_job;
+	gboolean save_pending;
+	gboolean needs_full_save;
 	char *xml_file;
+	char *snapshot_file;
 	char *rdf_file;
+	char *rdf_checksum;
 	EphyNodeDb *db;
 	EphyNode *bookmarks;
 	EphyNode *keywords;
@@ -77,6 +86,14 @@ struct _EphyBookmarksPrivate
 	EphyNode *smartbookmarks;
 	EphyNode *lower_fav;
 	double lower_score;
+	EphyNodeIndex *url_index;
+	EphyNodeIndex *address_index;
+	EphyNodeIndex *similar_index;
+	EphyNodeIndex *topic_index;
+	EphyNodeIndex *topic_key_index;
+	EphyKeywordIndex *smart_index;
+	EphyBookmarksView *view;
+	guint version;
 
 #ifdef ENABLE_ZEROCONF
 	/* Local sites */
@@ -190,11 +207,12 @@ save_filter_local (EphyNode *node,
 }
 #endif
 
+/* The XML file is only kept up to date on exit, as the recovery copy of
+ * the snapshot that is saved after every change. */
 static void
-ephy_bookmarks_save (EphyBookmarks *eb)
+ephy_bookmarks_save_xml (EphyBookmarks *eb)
 {
-
-	LOG ("Saving bookmarks");
+	LOG ("Saving bookmarks XML");
 
 	ephy_node_db_write_to_xml_safe
 		(eb->priv->db,
@@ -209,15 +227,300 @@ ephy_bookmarks_save (EphyBookmarks *eb)
 		 eb->priv->bookmarks, NULL, eb,
 #endif
 		 NULL);
+}
+
+/**
+ * ephy_bookmarks_take_snapshot:
+ * @eb: an #EphyBookmarks
+ *
+ * Takes an immutable copy of the topics and bookmarks that are saved to
+ * disk and exported to RDF, which can then be written from any thread.
+ *
+ * Return value: (transfer full): a new #EphyNodeDbSnapshot
+ **/
+EphyNodeDbSnapshot *
+ephy_bookmarks_take_snapshot (EphyBookmarks *eb)
+{
+	g_return_val_if_fail (EPHY_IS_BOOKMARKS (eb), NULL);
+
+	return ephy_node_db_take_snapshot
+		(eb->priv->db,
+		 EPHY_BOOKMARKS_XML_VERSION,
+		 eb->priv->keywords, (EphyNodeFilterFunc) save_filter, eb,
+#ifdef ENABLE_ZEROCONF
+		 eb->priv->bookmarks, (EphyNodeFilterFunc) save_filter_local, eb,
+#else
+		 eb->priv->bookmarks, NULL, eb,
+#endif
+		 NULL);
+}
+
+/**
+ * ephy_bookmarks_get_view:
+ * @eb: an #EphyBookmarks
+ *
+ * Returns a read-only view of the current bookmarks, local sites
+ * included, that can be handed to other threads. The view is only built
+ * again after the bookmarks change, so this is cheap to call often.
+ *
+ * Return value: (transfer full): an #EphyBookmarksView, or %NULL if the
+ * bookmarks could not be copied
+ **/
+EphyBookmarksView *
+ephy_bookmarks_get_view (EphyBookmarks *eb)
+{
+	EphyBookmarksPrivate *priv;
+	EphyNodeDbSnapshot *snapshot;
+
+	g_return_val_if_fail (EPHY_IS_BOOKMARKS (eb), NULL);
+
+	priv = eb->priv;
+
+	if (priv->view == NULL)
+	{
+		snapshot = ephy_node_db_take_snapshot (priv->db,
+						       EPHY_BOOKMARKS_XML_VERSION,
+						       priv->bookmarks, NULL, NULL,
+						       NULL);
+		if (snapshot == NULL) return NULL;
+
+		priv->view = ephy_bookmarks_view_new (snapshot, priv->version);
+		ephy_node_db_snapshot_unref (snapshot);
+	}
+
+	return ephy_bookmarks_view_ref (priv->view);
+}
+
+static void
+invalidate_view (EphyBookmarks *eb)
+{
+	EphyBookmarksPrivate *priv = eb->priv;
+
+	priv->version++;
+
+	if (priv->view != NULL)
+	{
+		ephy_bookmarks_view_unref (priv->view);
+		priv->view = NULL;
+	}
+}
+
+typedef struct _SaveJob
+{
+	EphyBookmarks *bookmarks;
+	EphyNodeDbSnapshot *snapshot;
+	char *snapshot_file;
+	char *rdf_file;
+	char *rdf_checksum;
+	gboolean snapshot_written;
+	gboolean rdf_exported;
+} SaveJob;
+
+static void
+save_job_free (SaveJob *job)
+{
+	ephy_node_db_snapshot_unref (job->snapshot);
+	g_free (job->snapshot_file);
+	g_free (job->rdf_file);
+	g_free (job->rdf_checksum);
+	g_slice_free (SaveJob, job);
+}
+
+/* Exports the bookmarks in rdf, unless nothing in the export changed
+ * since the one @checksum was computed for. @checksum is updated to
+ * match what is on disk, or cleared if that is not known. */
+static gboolean
+export_rdf_if_changed (EphyNodeDbSnapshot *snapshot,
+		       const char *rdf_file,
+		       char **checksum)
+{
+	char *new_checksum;
+	gboolean success;
+
+	new_checksum = ephy_bookmarks_export_get_rdf_checksum (snapshot, rdf_file);
+
+	if (*checksum != NULL && strcmp (*checksum, new_checksum) == 0 &&
+	    g_file_test (rdf_file, G_FILE_TEST_EXISTS))
+	{
+		LOG ("Bookmarks RDF export is up to date");
+		g_free (new_checksum);
+		return TRUE;
+	}
+
+	g_free (*checksum);
+	*checksum = NULL;
+
+	success = ephy_bookmarks_export_rdf_snapshot (snapshot, rdf_file);
+	if (success)
+	{
+		*checksum = new_checksum;
+	}
+	else
+	{
+		g_free (new_checksum);
+	}
+
+	return success;
+}
+
+static void
+save_job_write (SaveJob *job)
+{
+	job->snapshot_written = ephy_node_db_snapshot_write (job->snapshot, job->snapshot_file);
+	job->rdf_exported = export_rdf_if_changed (job->snapshot, job->rdf_file, &job->rdf_checksum);
+}
+
+/* The job's checksum is the one of the file it left on disk. */
+static void
+save_job_take_checksum (SaveJob *job)
+{
+	EphyBookmarksPrivate *priv = job->bookmarks->priv;
+
+	g_free (priv->rdf_checksum);
+	priv->rdf_checksum = job->rdf_checksum;
+	job->rdf_checksum = NULL;
+}
+
+static void ephy_bookmarks_save_async (EphyBookmarks *eb);
+
+static gboolean
+save_job_finished_cb (SaveJob *job)
+{
+	EphyBookmarks *eb = job->bookmarks;
+	EphyBookmarksPrivate *priv = eb->priv;
+
+	g_thread_join (priv->save_thread);
+	priv->save_thread = NULL;
+	priv->save_job = NULL;
+
+	LOG ("Saving bookmarks in the background %s",
+	     job->snapshot_written && job->rdf_exported ? "succeeded" : "FAILED");
+
+	save_job_take_checksum (job);
+
+	/* The journal only backs the snapshot, the RDF export is redone on
+	 * the next save anyway. */
+	if (job->snapshot_written)
+	{
+		ephy_node_db_journal_compacted (priv->db);
+	}
+
+	save_job_free (job);
+
+	/* Everything that changed while we were writing goes in one go. */
+	if (priv->save_pending)
+	{
+		priv->save_pending = FALSE;
+		ephy_bookmarks_save_async (eb);
+	}
+
+	return FALSE;
+}
+
+static gpointer
+save_thread_func (SaveJob *job)
+{
+	save_job_write (job);
+
+	g_idle_add ((GSourceFunc) save_job_finished_cb, job);
+
+	return NULL;
+}
+
+/* Only copying the nodes happens here, serializing and writing them is
+ * left to a thread. At most one save runs at a time; any number of saves
+ * requested meanwhile are coalesced into a single one when it is done. */
+static void
+ephy_bookmarks_save_async (EphyBookmarks *eb)
+{
+	EphyBookmarksPrivate *priv = eb->priv;
+	EphyNodeDbSnapshot *snapshot;
+	SaveJob *job;
+
+	if (priv->save_thread != NULL)
+	{
+		priv->save_pending = TRUE;
+		return;
+	}
+
+	LOG ("Saving bookmarks");
+
+	snapshot = ephy_bookmarks_take_snapshot (eb);
+	if (snapshot == NULL) return;
+
+	job = g_slice_new0 (SaveJob);
+	job->bookmarks = eb;
+	job->snapshot = snapshot;
+	job->snapshot_file = g_strdup (priv->snapshot_file);
+	job->rdf_file = g_strdup (priv->rdf_file);
+	job->rdf_checksum = g_strdup (priv->rdf_checksum);
+
+	/* Changes from now on go on top of the snapshot being written. */
+	ephy_node_db_journal_rotate (priv->db);
+	priv->needs_full_save = FALSE;
+	ephy_node_db_compact_ids (priv->db);
 
-	/* Export bookmarks in rdf */
-	ephy_bookmarks_export_rdf (eb, eb->priv->rdf_file);
+	priv->save_job = job;
+	priv->save_thread = g_thread_new ("EphyBookmarksSave",
+					  (GThreadFunc) save_thread_func, job);
 }
 
+static void
+ephy_bookmarks_save (EphyBookmarks *eb)
+{
+	EphyBookmarksPrivate *priv = eb->priv;
+	EphyNodeDbSnapshot *snapshot;
+
+	/* Wait for a background save so that it cannot overwrite this one. */
+	if (priv->save_thread != NULL)
+	{
+		g_thread_join (priv->save_thread);
+		g_idle_remove_by_data (priv->save_job);
+		save_job_take_checksum (priv->save_job);
+		save_job_free (priv->save_job);
+		priv->save_thread = NULL;
+		priv->save_job = NULL;
+	}
+	priv->save_pending = FALSE;
+
+	LOG ("Saving bookmarks");
+
+	snapshot = ephy_bookmarks_take_snapshot (eb);
+	if (snapshot == NULL) return;
+
+	ephy_node_db_journal_rotate (priv->db);
+	priv->needs_full_save = FALSE;
+	ephy_node_db_compact_ids (priv->db);
+
+	if (ephy_node_db_snapshot_write (snapshot, priv->snapshot_file))
+	{
+		ephy_node_db_journal_compacted (priv->db);
+	}
+
+	export_rdf_if_changed (snapshot, priv->rdf_file, &priv->rdf_checksum);
+
+	ephy_node_db_snapshot_unref (snapshot);
+}
+
+/* Small changes only need their journal entries to reach the disk; the
+ * snapshot, and the RDF export with it, are rewritten once the journal
+ * grows too big. */
 static gboolean
 save_bookmarks_delayed (EphyBookmarks *bookmarks)
 {
-	ephy_bookmarks_save (bookmarks);
+	EphyBookmarksPrivate *priv = bookmarks->priv;
+
+	if (priv->needs_full_save ||
+	    ephy_node_db_get_journal_size (priv->db) > BOOKMARKS_JOURNAL_MAX_SIZE ||
+	    !ephy_node_db_journal_flush (priv->db))
+	{
+		ephy_bookmarks_save_async (bookmarks);
+	}
+	else
+	{
+		LOG ("Bookmarks journal flushed");
+	}
+
 	bookmarks->priv->dirty = FALSE;
 	bookmarks->priv->save_timeout_id = 0;
 
@@ -277,10 +580,22 @@ ephy_setup_history_notifiers (EphyBookmarks *eb)
 #endif
 }
 
+/* Whether node is a topic bookmarks can be put in by the user, as
+ * opposed to the special ones. */
+static gboolean
+is_user_topic (EphyBookmarks *eb, EphyNode *node)
+{
+	return node != eb->priv->notcategorized &&
+	       node != eb->priv->bookmarks &&
+#ifdef ENABLE_ZEROCONF
+	       node != eb->priv->local &&
+#endif
+	       ephy_node_has_child (eb->priv->keywords, node);
+}
+
 static void
 update_bookmark_keywords (EphyBookmarks *eb, EphyNode *bookmark)
 {
-	GPtrArray *children;
 	int i;
 	GString *list;
 	const char *title;
@@ -288,19 +603,15 @@ update_bookmark_keywords (EphyBookmarks *eb, EphyNode *bookmark)
 
 	list = g_string_new (NULL);
 
-	children = ephy_node_get_children (eb->priv->keywords);
-	for (i = 0; i < children->len; i++)
+	/* A bookmark has few parents, so this is cheaper than looking
+	 * for it in every topic. */
+	for (i = 0; i < ephy_node_get_n_parents (bookmark); i++)
 	{
 		EphyNode *kid;
 
-		kid = g_ptr_array_index (children, i);
+		kid = ephy_node_get_nth_parent (bookmark, i);
 
-		if (kid != eb->priv->notcategorized && 
-		    kid != eb->priv->bookmarks &&
-#ifdef ENABLE_ZEROCONF
-		    kid != eb->priv->local &&
-#endif
-		    ephy_node_has_child (kid, bookmark))
+		if (is_user_topic (eb, kid))
 		{
 			const char *topic;
 			topic = ephy_node_get_property_string
@@ -337,37 +648,36 @@ bookmarks_changed_cb (EphyNode *node,
 		update_bookmark_keywords (eb, child);
 	}
 
+	invalidate_view (eb);
 	ephy_bookmarks_save_delayed (eb, BOOKMARKS_SAVE_DELAY);
 }
 
+static void
+bookmarks_added_cb (EphyNode *node,
+		    EphyNode *child,
+		    EphyBookmarks *eb)
+{
+	invalidate_view (eb);
+}
+
 static void
 bookmarks_removed_cb (EphyNode *node,
 		      EphyNode *child,
 		      guint old_index,
 		      EphyBookmarks *eb)
 {
+	invalidate_view (eb);
 	ephy_bookmarks_save_delayed (eb, BOOKMARKS_SAVE_DELAY);
 }
 
 static gboolean
 bookmark_is_categorized (EphyBookmarks *eb, EphyNode *bookmark)
 {
-	GPtrArray *children;
 	int i;
 
-	children = ephy_node_get_children (eb->priv->keywords);
-	for (i = 0; i < children->len; i++)
+	for (i = 0; i < ephy_node_get_n_parents (bookmark); i++)
 	{
-		EphyNode *kid;
-
-		kid = g_ptr_array_index (children, i);
-
-		if (kid != eb->priv->notcategorized && 
-		    kid != eb->priv->bookmarks &&
-#ifdef ENABLE_ZEROCONF
-		    kid != eb->priv->local &&
-#endif
-		    ephy_node_has_child (kid, bookmark))
+		if (is_user_topic (eb, ephy_node_get_nth_parent (bookmark, i)))
 		{
 			return TRUE;
 		}
@@ -403,6 +713,52 @@ topics_removed_cb (EphyNode *node,
 	}
 }
 
+static void
+smart_index_update (EphyBookmarks *eb,
+		    EphyNode *bookmark)
+{
+	const char *title;
+	char *key = NULL;
+
+	title = ephy_node_get_property_string (bookmark, EPHY_NODE_BMK_PROP_TITLE);
+	if (title != NULL)
+	{
+		key = g_utf8_casefold (title, -1);
+	}
+
+	ephy_keyword_index_add (eb->priv->smart_index, bookmark, key);
+
+	g_free (key);
+}
+
+static void
+smart_index_added_cb (EphyNode *node,
+		      EphyNode *child,
+		      EphyBookmarks *eb)
+{
+	smart_index_update (eb, child);
+}
+
+static void
+smart_index_changed_cb (EphyNode *node,
+			EphyNode *child,
+			guint property_id,
+			EphyBookmarks *eb)
+{
+	if (property_id != EPHY_NODE_BMK_PROP_TITLE) return;
+
+	smart_index_update (eb, child);
+}
+
+static void
+smart_index_removed_cb (EphyNode *node,
+			EphyNode *child,
+			guint old_index,
+			EphyBookmarks *eb)
+{
+	ephy_keyword_index_remove (eb->priv->smart_index, child);
+}
+
 static void
 fix_hierarchy_topic (EphyBookmarks *eb,
 		     EphyNode *topic)
@@ -444,6 +800,8 @@ fix_hierarchy (EphyBookmarks *eb)
 	const char *name;
 	int i;
 	
+	ephy_node_db_begin_batch (eb->priv->db);
+
 	topics = ephy_node_get_children (eb->priv->keywords);
 	for (i = (int)topics->len - 1; i >= 0; i--)
 	{
@@ -456,6 +814,8 @@ fix_hierarchy (EphyBookmarks *eb)
 			ephy_node_remove_child (eb->priv->keywords, topic);
 		}
 	}
+
+	ephy_node_db_end_batch (eb->priv->db);
 }
 
 static void
@@ -951,6 +1311,128 @@ ephy_local_bookmarks_stop (EphyBookmarks *bookmarks)
 
 #endif /* ENABLE_ZEROCONF */
 
+/* Folds the parts of @url that do not change what it points to: the case
+ * of the scheme and host, a default port and trailing slashes in the path.
+ * The fragment is dropped, and so is the query if @strip_query is set. */
+static char *
+normalize_address (const char *url,
+		   gboolean strip_query)
+{
+	const char *p, *end, *authority_end, *host, *port, *path_end, *path_stop;
+	GString *key;
+	gsize scheme_len;
+
+	end = url + strcspn (url, strip_query ? "#?" : "#");
+
+	scheme_len = strspn (url, "abcdefghijklmnopqrstuvwxyz"
+				  "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+				  "0123456789+-.");
+	if (scheme_len == 0 || url + scheme_len >= end || url[scheme_len] != ':')
+	{
+		return g_strndup (url, end - url);
+	}
+
+	key = g_string_sized_new (end - url);
+	for (p = url; p < url + scheme_len; p++)
+	{
+		g_string_append_c (key, g_ascii_tolower (*p));
+	}
+	g_string_append_c (key, ':');
+	p = url + scheme_len + 1;
+
+	if (end - p >= 2 && p[0] == '/' && p[1] == '/')
+	{
+		g_string_append (key, "//");
+		p += 2;
+
+		authority_end = p + strcspn (p, "/?#");
+		if (authority_end > end) authority_end = end;
+
+		/* Keep the user info as it is. */
+		for (host = authority_end; host > p && host[-1] != '@'; host--);
+		g_string_append_len (key, p, host - p);
+
+		/* The port follows the last colon, unless that is inside an
+		 * IPv6 address. */
+		for (port = authority_end; port > host && port[-1] != ':' && port[-1] != ']'; port--);
+		if (port == host || port[-1] != ':')
+		{
+			port = authority_end + 1;
+		}
+
+		for (p = host; p < port - 1; p++)
+		{
+			g_string_append_c (key, g_ascii_tolower (*p));
+		}
+
+		if (port <= authority_end)
+		{
+			char *scheme = g_ascii_strdown (url, scheme_len);
+			gsize port_len = authority_end - port;
+			const char *default_port = NULL;
+
+			if (strcmp (scheme, "http") == 0)
+				default_port = "80";
+			else if (strcmp (scheme, "https") == 0)
+				default_port = "443";
+			else if (strcmp (scheme, "ftp") == 0)
+				default_port = "21";
+
+			if (port_len > 0 &&
+			    (default_port == NULL ||
+			     strlen (default_port) != port_len ||
+			     strncmp (port, default_port, port_len) != 0))
+			{
+				g_string_append_c (key, ':');
+				g_string_append_len (key, port, port_len);
+			}
+
+			g_free (scheme);
+		}
+
+		p = authority_end;
+	}
+
+	path_end = p + strcspn (p, "?");
+	if (path_end > end) path_end = end;
+
+	for (path_stop = path_end; path_stop > p && path_stop[-1] == '/'; path_stop--);
+	g_string_append_len (key, p, path_stop - p);
+
+	g_string_append_len (key, path_end, end - path_end);
+
+	return g_string_free (key, FALSE);
+}
+
+/* Addresses are equivalent if they only differ in what
+ * normalize_address() folds. */
+static char *
+get_address_key (const char *url)
+{
+	return normalize_address (url, FALSE);
+}
+
+/* Addresses are similar if they are equivalent but for their query. */
+static char *
+get_similar_key (const char *url)
+{
+	return normalize_address (url, TRUE);
+}
+
+/* Topics are completed case insensitively, and without regard to how
+ * accented characters were composed. */
+static char *
+get_topic_key (const char *name)
+{
+	char *folded, *key;
+
+	folded = g_utf8_casefold (name, -1);
+	key = g_utf8_normalize (folded, -1, G_NORMALIZE_DEFAULT);
+	g_free (folded);
+
+	return key;
+}
+
 static void
 ephy_bookmarks_init (EphyBookmarks *eb)
 {
@@ -974,9 +1456,14 @@ ephy_bookmarks_init (EphyBookmarks *eb)
 	db = ephy_node_db_new (EPHY_NODE_DB_BOOKMARKS);
 	eb->priv->db = db;
 
+	eb->priv->smart_index = ephy_keyword_index_new ();
+
 	eb->priv->xml_file = g_build_filename (ephy_dot_dir (),
 					       "ephy-bookmarks.xml",
 					       NULL);
+	eb->priv->snapshot_file = g_build_filename (ephy_dot_dir (),
+						    "ephy-bookmarks.snapshot",
+						    NULL);
 	eb->priv->rdf_file = g_build_filename (ephy_dot_dir (),
 					       "bookmarks.rdf",
 					       NULL);
@@ -987,6 +1474,10 @@ ephy_bookmarks_init (EphyBookmarks *eb)
 	ephy_node_set_property_string (eb->priv->bookmarks,
 				       EPHY_NODE_KEYWORD_PROP_NAME,
 				       bk_all);
+	ephy_node_signal_connect_object (eb->priv->bookmarks,
+					 EPHY_NODE_CHILD_ADDED,
+					 (EphyNodeCallback) bookmarks_added_cb,
+					 G_OBJECT (eb));
 	ephy_node_signal_connect_object (eb->priv->bookmarks,
 					 EPHY_NODE_CHILD_REMOVED,
 					 (EphyNodeCallback) bookmarks_removed_cb,
@@ -996,6 +1487,18 @@ ephy_bookmarks_init (EphyBookmarks *eb)
 					 (EphyNodeCallback) bookmarks_changed_cb,
 					 G_OBJECT (eb));
 
+	eb->priv->url_index = ephy_node_db_add_index (db, eb->priv->bookmarks,
+						      EPHY_NODE_BMK_PROP_LOCATION,
+						      NULL, FALSE);
+	eb->priv->address_index = ephy_node_db_add_index (db, eb->priv->bookmarks,
+							  EPHY_NODE_BMK_PROP_LOCATION,
+							  (EphyNodeIndexKeyFunc) get_address_key,
+							  FALSE);
+	eb->priv->similar_index = ephy_node_db_add_index (db, eb->priv->bookmarks,
+							  EPHY_NODE_BMK_PROP_LOCATION,
+							  (EphyNodeIndexKeyFunc) get_similar_key,
+							  FALSE);
+
 	/* Keywords */
 	eb->priv->keywords = ephy_node_new_with_id (db, KEYWORDS_NODE_ID);
 	ephy_node_set_property_int (eb->priv->bookmarks,
@@ -1007,6 +1510,14 @@ ephy_bookmarks_init (EphyBookmarks *eb)
 					 (EphyNodeCallback) topics_removed_cb,
 					 G_OBJECT (eb));
 
+	eb->priv->topic_index = ephy_node_db_add_index (db, eb->priv->keywords,
+							EPHY_NODE_KEYWORD_PROP_NAME,
+							NULL, TRUE);
+	eb->priv->topic_key_index = ephy_node_db_add_index (db, eb->priv->keywords,
+							    EPHY_NODE_KEYWORD_PROP_NAME,
+							    (EphyNodeIndexKeyFunc) get_topic_key,
+							    TRUE);
+
 	ephy_node_add_child (eb->priv->keywords,
 			     eb->priv->bookmarks);
 
@@ -1046,14 +1557,30 @@ ephy_bookmarks_init (EphyBookmarks *eb)
 	/* Smart bookmarks */
 	eb->priv->smartbookmarks = ephy_node_new_with_id (db, SMARTBOOKMARKS_NODE_ID);
 
-	if (g_file_test (eb->priv->xml_file, G_FILE_TEST_EXISTS) == FALSE
+	ephy_node_signal_connect_object (eb->priv->smartbookmarks,
+					 EPHY_NODE_CHILD_ADDED,
+					 (EphyNodeCallback) smart_index_added_cb,
+					 G_OBJECT (eb));
+	ephy_node_signal_connect_object (eb->priv->smartbookmarks,
+					 EPHY_NODE_CHILD_CHANGED,
+					 (EphyNodeCallback) smart_index_changed_cb,
+					 G_OBJECT (eb));
+	ephy_node_signal_connect_object (eb->priv->smartbookmarks,
+					 EPHY_NODE_CHILD_REMOVED,
+					 (EphyNodeCallback) smart_index_removed_cb,
+					 G_OBJECT (eb));
+
+	if (g_file_test (eb->priv->snapshot_file, G_FILE_TEST_EXISTS) == FALSE
+	    && g_file_test (eb->priv->xml_file, G_FILE_TEST_EXISTS) == FALSE
 	    && g_file_test (eb->priv->rdf_file, G_FILE_TEST_EXISTS) == FALSE)
 	{
 		eb->priv->init_defaults = TRUE;
 	}
-	else if (ephy_node_db_load_from_file (eb->priv->db, eb->priv->xml_file,
-					      (xmlChar *) EPHY_BOOKMARKS_XML_ROOT,
-					      (xmlChar *) EPHY_BOOKMARKS_XML_VERSION) == FALSE)
+	else if (ephy_node_db_load_from_snapshot (eb->priv->db,
+						  eb->priv->snapshot_file,
+						  eb->priv->xml_file,
+						  (xmlChar *) EPHY_BOOKMARKS_XML_ROOT,
+						  (xmlChar *) EPHY_BOOKMARKS_XML_VERSION) == FALSE)
 	{
 		/* save the corrupted files so the user can late try to
 		 * manually recover them. See bug #128308.
@@ -1063,6 +1590,7 @@ ephy_bookmarks_init (EphyBookmarks *eb)
 			   "re-import bookmarks from \"%s\"\n",
 			   eb->priv->xml_file, eb->priv->rdf_file);
 
+		backup_file (eb->priv->snapshot_file, "snapshot");
 		backup_file (eb->priv->xml_file, "xml");
 
 		if (ephy_bookmarks_import_rdf (eb, eb->priv->rdf_file) == FALSE)
@@ -1080,6 +1608,20 @@ ephy_bookmarks_init (EphyBookmarks *eb)
 	
 	fix_hierarchy (eb);
 
+#ifdef ENABLE_ZEROCONF
+	/* Local sites are not saved, but may have been journaled. */
+	while (ephy_node_get_n_children (eb->priv->local) > 0)
+	{
+		ephy_node_unref (ephy_node_get_nth_child (eb->priv->local, 0));
+	}
+#endif
+
+	if (!ephy_node_db_enable_journal (eb->priv->db, eb->priv->snapshot_file))
+	{
+		eb->priv->needs_full_save = TRUE;
+		ephy_bookmarks_save_delayed (eb, 0);
+	}
+
 	g_settings_bind (EPHY_SETTINGS_LOCKDOWN,
 			 EPHY_PREFS_LOCKDOWN_BOOKMARK_EDITING,
 			 eb->priv->db, "immutable",
@@ -1099,7 +1641,10 @@ ephy_bookmarks_finalize (GObject *object)
 		g_source_remove (priv->save_timeout_id);
 	}
 
+	/* Write the XML first so that the snapshot is not older than it. */
+	ephy_bookmarks_save_xml (eb);
 	ephy_bookmarks_save (eb);
+	ephy_node_db_disable_journal (priv->db);
 
 #ifdef ENABLE_ZEROCONF
 	ephy_local_bookmarks_stop (eb);
@@ -1112,8 +1657,17 @@ ephy_bookmarks_finalize (GObject *object)
 
 	g_object_unref (priv->db);
 
+	ephy_keyword_index_free (priv->smart_index);
+
+	if (priv->view != NULL)
+	{
+		ephy_bookmarks_view_unref (priv->view);
+	}
+
 	g_free (priv->xml_file);
+	g_free (priv->snapshot_file);
 	g_free (priv->rdf_file);
+	g_free (priv->rdf_checksum);
 
 	LOG ("Bookmarks finalized");
 
@@ -1168,10 +1722,11 @@ update_has_smart_address (EphyBookmarks *bookmarks, EphyNode *bmk, const char *a
 	}
 }
 
-EphyNode *
-ephy_bookmarks_add (EphyBookmarks *eb,
-		    const char *title,
-		    const char *url)
+/* Creates a bookmark in the "All" topic only. */
+static EphyNode *
+create_bookmark (EphyBookmarks *eb,
+		 const char *title,
+		 const char *url)
 {
 	EphyNode *bm;
 #ifdef HAVE_WEBKIT2
@@ -1210,9 +1765,25 @@ ephy_bookmarks_add (EphyBookmarks *eb,
 #endif
 
 	update_has_smart_address (eb, bm, url);
-	update_bookmark_keywords (eb, bm);
 
 	ephy_node_add_child (eb->priv->bookmarks, bm);
+
+	return bm;
+}
+
+EphyNode *
+ephy_bookmarks_add (EphyBookmarks *eb,
+		    const char *title,
+		    const char *url)
+{
+	EphyNode *bm;
+
+	bm = create_bookmark (eb, title, url);
+
+	if (bm == NULL) return NULL;
+
+	update_bookmark_keywords (eb, bm);
+
 	ephy_node_add_child (eb->priv->notcategorized, bm);
 
 	ephy_bookmarks_save_delayed (eb, 0);
@@ -1220,6 +1791,126 @@ ephy_bookmarks_add (EphyBookmarks *eb,
 	return bm;
 }
 
+/**
+ * ephy_bookmarks_add_many:
+ * @eb: an #EphyBookmarks
+ * @records: (array length=n_records): the bookmarks to add
+ * @n_records: the number of @records
+ *
+ * Adds many bookmarks at once, as importers do. A record whose address
+ * is already bookmarked, before or by an earlier record, only adds its
+ * topics to the existing bookmark. Topics are looked up by name, and
+ * created if they do not exist yet.
+ *
+ * Unlike calling ephy_bookmarks_add() and ephy_bookmarks_set_keyword()
+ * for every record, the work done per record does not grow with the
+ * number of bookmarks and topics, and listeners are only notified once
+ * at the end.
+ *
+ * Return value: (transfer container) (element-type EphyNode): the
+ * bookmark of each record, %NULL for those without an address
+ **/
+GPtrArray *
+ephy_bookmarks_add_many (EphyBookmarks *eb,
+			 const EphyBookmarkRecord *records,
+			 guint n_records)
+{
+	GHashTable *topics, *seen;
+	GPtrArray *nodes, *touched;
+	guint i;
+
+	g_return_val_if_fail (EPHY_IS_BOOKMARKS (eb), NULL);
+	g_return_val_if_fail (records != NULL || n_records == 0, NULL);
+
+	nodes = g_ptr_array_sized_new (n_records);
+	touched = g_ptr_array_sized_new (n_records);
+	seen = g_hash_table_new (g_direct_hash, g_direct_equal);
+	topics = g_hash_table_new (g_str_hash, g_str_equal);
+
+	ephy_node_db_begin_batch (eb->priv->db);
+
+	for (i = 0; i < n_records; i++)
+	{
+		const EphyBookmarkRecord *record = &records[i];
+		EphyNode *bm = NULL;
+		char **name;
+
+		if (record->address != NULL)
+		{
+			bm = ephy_bookmarks_find_bookmark (eb, record->address);
+			if (bm == NULL)
+			{
+				bm = create_bookmark (eb, record->title, record->address);
+			}
+		}
+
+		g_ptr_array_add (nodes, bm);
+		if (bm == NULL) continue;
+
+		if (g_hash_table_lookup (seen, bm) == NULL)
+		{
+			g_hash_table_insert (seen, bm, bm);
+			g_ptr_array_add (touched, bm);
+		}
+
+		for (name = record->topics; name != NULL && *name != NULL; name++)
+		{
+			EphyNode *topic;
+
+			topic = g_hash_table_lookup (topics, *name);
+			if (topic == NULL)
+			{
+				topic = ephy_bookmarks_find_keyword (eb, *name, FALSE);
+				if (topic == NULL && (*name)[0] != '\0')
+				{
+					topic = ephy_bookmarks_add_keyword (eb, *name);
+				}
+				if (topic == NULL) continue;
+
+				g_hash_table_insert (topics, *name, topic);
+			}
+
+			if (!ephy_node_has_child (topic, bm))
+			{
+				ephy_node_add_child (topic, bm);
+			}
+		}
+	}
+
+	/* Now that all the topics are known, sort out what is not
+	 * categorized and what the keywords of each bookmark are. */
+	for (i = 0; i < touched->len; i++)
+	{
+		EphyNode *bm = g_ptr_array_index (touched, i);
+		gboolean categorized = bookmark_is_categorized (eb, bm);
+
+		if (categorized && ephy_node_has_child (eb->priv->notcategorized, bm))
+		{
+			ephy_node_remove_child (eb->priv->notcategorized, bm);
+		}
+		else if (!categorized && !ephy_node_has_child (eb->priv->notcategorized, bm))
+		{
+			ephy_node_add_child (eb->priv->notcategorized, bm);
+		}
+
+		update_bookmark_keywords (eb, bm);
+	}
+
+	ephy_node_db_end_batch (eb->priv->db);
+
+	if (touched->len > 0)
+	{
+		g_signal_emit (G_OBJECT (eb), ephy_bookmarks_signals[TREE_CHANGED], 0);
+		ephy_bookmarks_save_delayed (eb, 0);
+	}
+
+	g_hash_table_destroy (topics);
+	g_hash_table_destroy (seen);
+	g_ptr_array_free (touched, TRUE);
+
+	return nodes;
+}
+
 void
 ephy_bookmarks_set_address (EphyBookmarks *eb,
 			    EphyNode *bookmark,
@@ -1235,52 +1926,41 @@ EphyNode *
 ephy_bookmarks_find_bookmark (EphyBookmarks *eb,
 			      const char *url)
 {
-	GPtrArray *children;
-	int i;
-
 	g_return_val_if_fail (EPHY_IS_BOOKMARKS (eb), NULL);
 	g_return_val_if_fail (eb->priv->bookmarks != NULL, NULL);
 	g_return_val_if_fail (url != NULL, NULL);
 
-	children = ephy_node_get_children (eb->priv->bookmarks);
-	for (i = 0; i < children->len; i++)
-	{
-		EphyNode *kid;
-		const char *location;
+	return ephy_node_index_lookup (eb->priv->url_index, url);
+}
 
-		kid = g_ptr_array_index (children, i);
-		location = ephy_node_get_property_string
-			(kid, EPHY_NODE_BMK_PROP_LOCATION);
+/**
+ * ephy_bookmarks_find_equivalent_bookmark:
+ * @eb: an #EphyBookmarks
+ * @url: an address
+ *
+ * Finds a bookmark for @url, or for an address that only differs from it
+ * in the case of its scheme or host, a default port, trailing slashes or
+ * its fragment. A bookmark for exactly @url is preferred. This is a hash
+ * lookup, cheap enough to do on every navigation.
+ *
+ * Return value: (transfer none): the bookmark, or %NULL
+ **/
+EphyNode *
+ephy_bookmarks_find_equivalent_bookmark (EphyBookmarks *eb,
+					 const char *url)
+{
+	EphyNode *bookmark;
 
-		if (location != NULL && strcmp (url, location) == 0)
-		{
-			return kid;
-		}
-	}
+	g_return_val_if_fail (EPHY_IS_BOOKMARKS (eb), NULL);
+	g_return_val_if_fail (url != NULL, NULL);
 
-	return NULL;
-}
+	bookmark = ephy_node_index_lookup (eb->priv->url_index, url);
+	if (bookmark != NULL)
+	{
+		return bookmark;
+	}
 
-static gboolean
-is_similar (const char *url1, const char *url2)
-{
-	int i, j;
-	
-	for (i = 0; url1[i]; i++)
-	  if (url1[i] == '#' || url1[i] == '?')
-	    break;
-	while(i>0 && url1[i] == '/')
-	  i--;
-	
-	for (j = 0; url2[j]; j++)
-	  if (url2[j] == '#' || url2[j] == '?')
-	    break;
-	while(j>0 && url2[j] == '/') 
-	  j--;
-	
-	if (i != j) return FALSE;
-	if (strncmp (url1, url2, i) != 0) return FALSE;
-	return TRUE;
+	return ephy_node_index_lookup (eb->priv->address_index, url);
 }
 
 gint
@@ -1289,7 +1969,7 @@ ephy_bookmarks_get_similar (EphyBookmarks *eb,
 			    GPtrArray *identical,
 			    GPtrArray *similar)
 {
-	GPtrArray *children;
+	GPtrArray *candidates;
 	const char *url;
 	int i, result;
 
@@ -1303,14 +1983,16 @@ ephy_bookmarks_get_similar (EphyBookmarks *eb,
 	g_return_val_if_fail (url != NULL, -1);
 	
 	result = 0;
-	
-	children = ephy_node_get_children (eb->priv->bookmarks);
-	for (i = 0; i < children->len; i++)
+
+	candidates = g_ptr_array_new ();
+	ephy_node_index_lookup_all (eb->priv->similar_index, url, candidates);
+
+	for (i = 0; i < candidates->len; i++)
 	{
 		EphyNode *kid;
 		const char *location;
 
-		kid = g_ptr_array_index (children, i);
+		kid = g_ptr_array_index (candidates, i);
 		if (kid == bookmark)
 		{
 			continue;
@@ -1319,23 +2001,18 @@ ephy_bookmarks_get_similar (EphyBookmarks *eb,
 		location = ephy_node_get_property_string
 			(kid, EPHY_NODE_BMK_PROP_LOCATION);
 
-		if (location != NULL)
+		if(identical != NULL && strcmp (url, location) == 0)
 		{
-			if(identical != NULL && strcmp (url, location) == 0)
-			{
-				g_ptr_array_add (identical, kid);
-				result++;
-			}
-			else if(is_similar (url, location))
-			{
-				if (similar != NULL)
-				{
-					g_ptr_array_add (similar, kid);
-				}
-				result++;
-			}
+			g_ptr_array_add (identical, kid);
+		}
+		else if (similar != NULL)
+		{
+			g_ptr_array_add (similar, kid);
 		}
+		result++;
 	}
+
+	g_ptr_array_free (candidates, TRUE);
 	
 	return result;
 }
@@ -1571,9 +2248,6 @@ ephy_bookmarks_find_keyword (EphyBookmarks *eb,
 			     const char *name,
 			     gboolean partial_match)
 {
-	EphyNode *node;
-	GPtrArray *children;
-	int i;
 	const char *topic_name;
 
 	g_return_val_if_fail (name != NULL, NULL);
@@ -1605,21 +2279,166 @@ ephy_bookmarks_find_keyword (EphyBookmarks *eb,
 		topic_name += strlen ("topic://");
 	}
 
-	children = ephy_node_get_children (eb->priv->keywords);
-	node = NULL;
-	for (i = 0; i < children->len; i++)
+	if (partial_match)
 	{
-		 EphyNode *kid;
-		 const char *key;
+		return ephy_node_index_lookup_prefix (eb->priv->topic_index, topic_name);
+	}
+
+	return ephy_node_index_lookup (eb->priv->topic_index, topic_name);
+}
+
+/**
+ * ephy_bookmarks_lookup_topic:
+ * @eb: an #EphyBookmarks
+ * @name: a topic name, as typed by the user
+ *
+ * Finds the topic named @name, ignoring case.
+ *
+ * Return value: (transfer none): the topic, or %NULL
+ **/
+EphyNode *
+ephy_bookmarks_lookup_topic (EphyBookmarks *eb,
+			     const char *name)
+{
+	g_return_val_if_fail (EPHY_IS_BOOKMARKS (eb), NULL);
+	g_return_val_if_fail (name != NULL, NULL);
 
-		 kid = g_ptr_array_index (children, i);
-		 key = ephy_node_get_property_string (kid, EPHY_NODE_KEYWORD_PROP_NAME);
+	return ephy_node_index_lookup (eb->priv->topic_key_index, name);
+}
 
-		 if ((partial_match && g_str_has_prefix (key, topic_name) > 0) ||
-		     (!partial_match && strcmp (key, topic_name) == 0))
-		 {
-			 node = kid;
-		 }
+/**
+ * ephy_bookmarks_complete_topic:
+ * @eb: an #EphyBookmarks
+ * @prefix: the start of a topic name, as typed by the user
+ * @topics: (element-type EphyNode): the array the matching topics are
+ * appended to
+ *
+ * Finds the user topics whose names start with @prefix, ignoring case,
+ * and appends them to @topics sorted by their case folded names. Special
+ * topics like "All" are left out. An empty @prefix matches every topic.
+ *
+ * Return value: the number of topics appended to @topics
+ **/
+guint
+ephy_bookmarks_complete_topic (EphyBookmarks *eb,
+			       const char *prefix,
+			       GPtrArray *topics)
+{
+	char *key;
+	guint i, n_matches, n_topics;
+
+	g_return_val_if_fail (EPHY_IS_BOOKMARKS (eb), 0);
+	g_return_val_if_fail (prefix != NULL, 0);
+	g_return_val_if_fail (topics != NULL, 0);
+
+	key = get_topic_key (prefix);
+	n_matches = ephy_node_index_lookup_prefix_all (eb->priv->topic_key_index,
+						       key, topics);
+	g_free (key);
+
+	/* Special topics are few, so weed them out here. */
+	for (i = n_topics = topics->len - n_matches; i < topics->len; i++)
+	{
+		EphyNode *topic = g_ptr_array_index (topics, i);
+
+		if (ephy_node_get_property_int (topic, EPHY_NODE_KEYWORD_PROP_PRIORITY) ==
+		    EPHY_NODE_NORMAL_PRIORITY)
+		{
+			topics->pdata[n_topics++] = topic;
+		}
+	}
+	n_matches -= topics->len - n_topics;
+	g_ptr_array_set_size (topics, n_topics);
+
+	return n_matches;
+}
+
+/**
+ * ephy_bookmarks_get_topic_key:
+ * @eb: an #EphyBookmarks
+ * @topic: a topic
+ *
+ * Returns the case folded name @topic is completed by. Comparing it to
+ * the case folded input spares folding every topic name again.
+ *
+ * Return value: the key, valid until @topic is renamed or removed
+ **/
+const char *
+ephy_bookmarks_get_topic_key (EphyBookmarks *eb,
+			      EphyNode *topic)
+{
+	g_return_val_if_fail (EPHY_IS_BOOKMARKS (eb), NULL);
+	g_return_val_if_fail (EPHY_IS_NODE (topic), NULL);
+
+	return ephy_node_index_get_key (eb->priv->topic_key_index, topic);
+}
+
+/**
+ * ephy_bookmarks_fold_topic_name:
+ * @name: a topic name
+ *
+ * Return value: the key ephy_bookmarks_get_topic_key() would give a topic
+ * named @name; free it with g_free()
+ **/
+char *
+ephy_bookmarks_fold_topic_name (const char *name)
+{
+	g_return_val_if_fail (name != NULL, NULL);
+
+	return get_topic_key (name);
+}
+
+/**
+ * ephy_bookmarks_find_smart_bookmark:
+ * @eb: an #EphyBookmarks
+ * @input: text typed by the user, like "wp foo"
+ * @argument: (out) (allow-none): return location for the rest of @input
+ *
+ * Looks for the smart bookmark whose title, compared case insensitively,
+ * matches the longest run of leading words of @input. The remaining
+ * words are returned in @argument, pointing inside @input.
+ *
+ * Return value: (transfer none): the smart bookmark, or %NULL
+ **/
+EphyNode *
+ephy_bookmarks_find_smart_bookmark (EphyBookmarks *eb,
+				    const char *input,
+				    const char **argument)
+{
+	EphyNode *node;
+	char *folded;
+	gsize match_length, i;
+	guint n_spaces = 0;
+	const char *rest;
+
+	g_return_val_if_fail (EPHY_IS_BOOKMARKS (eb), NULL);
+	g_return_val_if_fail (input != NULL, NULL);
+
+	folded = g_utf8_casefold (input, -1);
+	node = ephy_keyword_index_lookup_words (eb->priv->smart_index, folded, &match_length);
+
+	/* Case folding does not add or remove spaces, so the match ends at
+	 * the same word in @input. */
+	for (i = 0; i < match_length; i++)
+	{
+		if (folded[i] == ' ') n_spaces++;
+	}
+	g_free (folded);
+
+	if (node == NULL) return NULL;
+
+	for (rest = input; *rest != '\0'; rest++)
+	{
+		if (*rest == ' ' && n_spaces-- == 0) break;
+	}
+	while (*rest == ' ')
+	{
+		rest++;
+	}
+
+	if (argument != NULL)
+	{
+		*argument = rest;
 	}
 
 	return node;
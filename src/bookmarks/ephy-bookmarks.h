@@ -28,6 +28,7 @@
 #include <glib-object.h>
 #include <gtk/gtk.h>
 
+#include "ephy-bookmarks-view.h"
 #include "ephy-node.h"
 
 G_BEGIN_DECLS
@@ -56,6 +57,15 @@ typedef enum
 	EPHY_NODE_BMK_PROP_IMMUTABLE	= 15
 } EphyBookmarkProperty;
 
+/* A bookmark to add with ephy_bookmarks_add_many(). */
+typedef struct
+{
+	const char *title;
+	const char *address;
+	/* Names of its topics, NULL terminated, or NULL. */
+	char **topics;
+} EphyBookmarkRecord;
+
 struct _EphyBookmarks
 {
 	GObject parent;
@@ -87,9 +97,16 @@ EphyNode	 *ephy_bookmarks_add			(EphyBookmarks *eb,
 							 const char *title,
 							 const char *url);
 
+GPtrArray	 *ephy_bookmarks_add_many		(EphyBookmarks *eb,
+							 const EphyBookmarkRecord *records,
+							 guint n_records);
+
 EphyNode*	  ephy_bookmarks_find_bookmark		(EphyBookmarks *eb,
 							 const char *url);
 
+EphyNode	 *ephy_bookmarks_find_equivalent_bookmark (EphyBookmarks *eb,
+							  const char *url);
+
 gint              ephy_bookmarks_get_similar		(EphyBookmarks *eb,
 							 EphyNode *bookmark,
 							 GPtrArray *identical,
@@ -113,6 +130,14 @@ char		 *ephy_bookmarks_resolve_address	(EphyBookmarks *eb,
 
 guint		ephy_bookmarks_get_smart_bookmark_width (EphyNode *bookmark);
 
+EphyNode	 *ephy_bookmarks_find_smart_bookmark	(EphyBookmarks *eb,
+							 const char *input,
+							 const char **argument);
+
+EphyNodeDbSnapshot *ephy_bookmarks_take_snapshot	(EphyBookmarks *eb);
+
+EphyBookmarksView *ephy_bookmarks_get_view		(EphyBookmarks *eb);
+
 
 /* Keywords */
 
@@ -123,6 +148,18 @@ EphyNode	 *ephy_bookmarks_find_keyword		(EphyBookmarks *eb,
 							 const char *name,
 							 gboolean partial_match);
 
+EphyNode	 *ephy_bookmarks_lookup_topic		(EphyBookmarks *eb,
+							 const char *name);
+
+guint		  ephy_bookmarks_complete_topic		(EphyBookmarks *eb,
+							 const char *prefix,
+							 GPtrArray *topics);
+
+const char	 *ephy_bookmarks_get_topic_key		(EphyBookmarks *eb,
+							 EphyNode *topic);
+
+char		 *ephy_bookmarks_fold_topic_name	(const char *name);
+
 void		  ephy_bookmarks_remove_keyword		(EphyBookmarks *eb,
 							 EphyNode *keyword);
 
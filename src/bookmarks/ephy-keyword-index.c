@@ -0,0 +1,293 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2012 Igalia S.L.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include "config.h"
+#include "ephy-keyword-index.h"
+
+#include <string.h>
+
+/**
+ * SECTION:ephy-keyword-index
+ * @short_description: String keyed lookups of #EphyNode<!-- -->s
+ *
+ * #EphyKeywordIndex maps string keys to nodes. Lookups walk a byte trie,
+ * so they cost time proportional to the length of the typed text and not
+ * to the number of indexed nodes. Several nodes can share a key; lookups
+ * return the one added last.
+ *
+ * The index remembers the key of every node, so a node can be removed
+ * or re-keyed after its properties have already changed.
+ */
+
+typedef struct _TrieNode TrieNode;
+
+struct _TrieNode {
+  guint8 *bytes;
+  TrieNode **children;
+  guint n_children;
+
+  /* Nodes whose key ends here, most recently added first. */
+  GSList *nodes;
+
+  /* Number of keys ending in this subtree. */
+  guint n_keys;
+};
+
+struct _EphyKeywordIndex {
+  GHashTable *keys;
+  TrieNode *root;
+};
+
+static void
+trie_node_free (TrieNode *trie)
+{
+  guint i;
+
+  for (i = 0; i < trie->n_children; i++)
+    trie_node_free (trie->children[i]);
+
+  g_free (trie->bytes);
+  g_free (trie->children);
+  g_slist_free (trie->nodes);
+  g_slice_free (TrieNode, trie);
+}
+
+static gboolean
+trie_node_find_child (TrieNode *trie, guint8 byte, guint *position)
+{
+  guint low = 0, high = trie->n_children;
+
+  while (low < high) {
+    guint middle = (low + high) / 2;
+
+    if (trie->bytes[middle] == byte) {
+      *position = middle;
+      return TRUE;
+    }
+
+    if (trie->bytes[middle] < byte)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+
+  *position = low;
+  return FALSE;
+}
+
+static TrieNode *
+trie_node_get_child (TrieNode *trie, guint8 byte)
+{
+  guint position;
+
+  if (!trie_node_find_child (trie, byte, &position))
+    return NULL;
+
+  return trie->children[position];
+}
+
+static void
+trie_insert (TrieNode *trie, const char *key, EphyNode *node)
+{
+  const guint8 *p;
+
+  for (p = (const guint8 *)key; *p; p++) {
+    guint position;
+
+    trie->n_keys++;
+
+    if (!trie_node_find_child (trie, *p, &position)) {
+      trie->bytes = g_renew (guint8, trie->bytes, trie->n_children + 1);
+      trie->children = g_renew (TrieNode *, trie->children, trie->n_children + 1);
+
+      memmove (trie->bytes + position + 1, trie->bytes + position,
+               trie->n_children - position);
+      memmove (trie->children + position + 1, trie->children + position,
+               (trie->n_children - position) * sizeof (TrieNode *));
+
+      trie->bytes[position] = *p;
+      trie->children[position] = g_slice_new0 (TrieNode);
+      trie->n_children++;
+    }
+
+    trie = trie->children[position];
+  }
+
+  trie->n_keys++;
+  trie->nodes = g_slist_prepend (trie->nodes, node);
+}
+
+static gboolean
+trie_remove (TrieNode *trie, const guint8 *key, EphyNode *node)
+{
+  TrieNode *child;
+  guint position;
+
+  if (*key == '\0') {
+    if (g_slist_find (trie->nodes, node) == NULL)
+      return FALSE;
+
+    trie->nodes = g_slist_remove (trie->nodes, node);
+    trie->n_keys--;
+
+    return TRUE;
+  }
+
+  if (!trie_node_find_child (trie, *key, &position))
+    return FALSE;
+
+  child = trie->children[position];
+  if (!trie_remove (child, key + 1, node))
+    return FALSE;
+
+  trie->n_keys--;
+
+  /* Prune the branch if nothing ends below it anymore. */
+  if (child->n_keys == 0) {
+    trie_node_free (child);
+
+    memmove (trie->bytes + position, trie->bytes + position + 1,
+             trie->n_children - position - 1);
+    memmove (trie->children + position, trie->children + position + 1,
+             (trie->n_children - position - 1) * sizeof (TrieNode *));
+    trie->n_children--;
+  }
+
+  return TRUE;
+}
+
+/**
+ * ephy_keyword_index_new:
+ *
+ * Returns: a new, empty #EphyKeywordIndex
+ **/
+EphyKeywordIndex *
+ephy_keyword_index_new (void)
+{
+  EphyKeywordIndex *index;
+
+  index = g_slice_new0 (EphyKeywordIndex);
+  index->keys = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+  index->root = g_slice_new0 (TrieNode);
+
+  return index;
+}
+
+void
+ephy_keyword_index_free (EphyKeywordIndex *index)
+{
+  g_return_if_fail (index != NULL);
+
+  g_hash_table_destroy (index->keys);
+  trie_node_free (index->root);
+
+  g_slice_free (EphyKeywordIndex, index);
+}
+
+/**
+ * ephy_keyword_index_add:
+ * @index: an #EphyKeywordIndex
+ * @node: the #EphyNode to index
+ * @key: the key for @node, or %NULL
+ *
+ * Indexes @node under @key, replacing any key @node had before. A %NULL
+ * or empty @key just removes @node from @index.
+ **/
+void
+ephy_keyword_index_add (EphyKeywordIndex *index,
+                        EphyNode *node,
+                        const char *key)
+{
+  g_return_if_fail (index != NULL);
+  g_return_if_fail (node != NULL);
+
+  ephy_keyword_index_remove (index, node);
+
+  if (key == NULL || key[0] == '\0')
+    return;
+
+  g_hash_table_insert (index->keys, node, g_strdup (key));
+  trie_insert (index->root, key, node);
+}
+
+/**
+ * ephy_keyword_index_remove:
+ * @index: an #EphyKeywordIndex
+ * @node: the #EphyNode to remove
+ *
+ * Removes @node from @index, if it was indexed.
+ **/
+void
+ephy_keyword_index_remove (EphyKeywordIndex *index,
+                           EphyNode *node)
+{
+  const char *key;
+
+  g_return_if_fail (index != NULL);
+
+  key = g_hash_table_lookup (index->keys, node);
+  if (key == NULL)
+    return;
+
+  trie_remove (index->root, (const guint8 *)key, node);
+  g_hash_table_remove (index->keys, node);
+}
+
+/**
+ * ephy_keyword_index_lookup_words:
+ * @index: an #EphyKeywordIndex
+ * @input: a string of space separated words
+ * @match_length: (out): return location for the length of the match
+ *
+ * Finds the longest key made of the leading whole words of @input, so
+ * that for "wp foo" a node indexed under "wp" is found. This walks
+ * @input once.
+ *
+ * Return value: (transfer none): the matching #EphyNode, or %NULL
+ **/
+EphyNode *
+ephy_keyword_index_lookup_words (EphyKeywordIndex *index,
+                                 const char *input,
+                                 gsize *match_length)
+{
+  TrieNode *trie;
+  EphyNode *match = NULL;
+  gsize i;
+
+  g_return_val_if_fail (index != NULL, NULL);
+  g_return_val_if_fail (input != NULL, NULL);
+  g_return_val_if_fail (match_length != NULL, NULL);
+
+  *match_length = 0;
+
+  for (i = 0, trie = index->root; trie != NULL; i++) {
+    if ((input[i] == ' ' || input[i] == '\0') && trie->nodes != NULL) {
+      match = trie->nodes->data;
+      *match_length = i;
+    }
+
+    if (input[i] == '\0')
+      break;
+
+    trie = trie_node_get_child (trie, (guint8)input[i]);
+  }
+
+  return match;
+}
@@ -0,0 +1,53 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2012 Igalia S.L.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#if !defined (__EPHY_EPIPHANY_H_INSIDE__) && !defined (EPIPHANY_COMPILATION)
+#error "Only <epiphany/epiphany.h> can be included directly."
+#endif
+
+#ifndef EPHY_KEYWORD_INDEX_H
+#define EPHY_KEYWORD_INDEX_H
+
+#include <glib-object.h>
+
+#include "ephy-node.h"
+
+G_BEGIN_DECLS
+
+typedef struct _EphyKeywordIndex EphyKeywordIndex;
+
+EphyKeywordIndex *ephy_keyword_index_new           (void);
+
+void              ephy_keyword_index_free          (EphyKeywordIndex *index);
+
+void              ephy_keyword_index_add           (EphyKeywordIndex *index,
+                                                    EphyNode *node,
+                                                    const char *key);
+
+void              ephy_keyword_index_remove        (EphyKeywordIndex *index,
+                                                    EphyNode *node);
+
+EphyNode         *ephy_keyword_index_lookup_words  (EphyKeywordIndex *index,
+                                                    const char *input,
+                                                    gsize *match_length);
+
+G_END_DECLS
+
+#endif /* EPHY_KEYWORD_INDEX_H */
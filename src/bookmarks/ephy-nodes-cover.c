@@ -21,17 +21,228 @@
 
 #include "ephy-nodes-cover.h"
 
+#include <string.h>
+
+/* Sets of nodes are kept as bitsets indexed by node id. Node ids are
+ * allocated densely by EphyNodeDb, so the bitsets stay small, and
+ * counting how many children two sets share is a few hundred AND and
+ * popcount operations instead of a hash lookup per child. */
+
+#define BITS_PER_WORD (sizeof (gulong) * 8)
+#define WORD_INDEX(id) ((id) / BITS_PER_WORD)
+#define WORD_MASK(id) (1UL << ((id) % BITS_PER_WORD))
+
+/* Only the words between the lowest and the highest id in the set are
+ * stored, so topics holding a few recent bookmarks stay small. */
+typedef struct
+{
+	gulong *words;
+	guint first_word;
+	guint n_words;
+} Bitset;
+
+/* The set of children of a parent, valid while the stamp of the parent
+ * does not change. Every db keeps an array of them, indexed by the id of
+ * the parent and freed along with the db. */
+typedef struct
+{
+	EphyNode *parent;
+	guint stamp;
+	Bitset children;
+} ChildrenSet;
+
+#define CHILDREN_SETS_KEY "ephy-nodes-cover-children-sets"
+
+static inline guint
+popcount (gulong word)
+{
+#if defined (__GNUC__) && (__GNUC__ > 3 || (__GNUC__ == 3 && __GNUC_MINOR__ >= 4))
+	return __builtin_popcountl (word);
+#else
+	guint count = 0;
+
+	for (; word; count++)
+	{
+		word &= word - 1;
+	}
+	return count;
+#endif
+}
+
+static void
+bitset_init (Bitset *set, guint first_word, guint n_words)
+{
+	set->words = g_new0 (gulong, n_words);
+	set->first_word = first_word;
+	set->n_words = n_words;
+}
+
+static void
+bitset_clear (Bitset *set)
+{
+	g_free (set->words);
+	set->words = NULL;
+	set->first_word = 0;
+	set->n_words = 0;
+}
+
+static inline gboolean
+bitset_contains (const Bitset *set, guint id)
+{
+	guint word = WORD_INDEX (id);
+
+	return word >= set->first_word &&
+	       word - set->first_word < set->n_words &&
+	       (set->words[word - set->first_word] & WORD_MASK (id)) != 0;
+}
+
+/* Finds the range of words stored by both a and b. */
+static gboolean
+bitset_overlap (const Bitset *a, const Bitset *b, guint *first, guint *last)
+{
+	*first = MAX (a->first_word, b->first_word);
+	*last = MIN (a->first_word + a->n_words, b->first_word + b->n_words);
+
+	return *first < *last;
+}
+
+/* Number of elements in both a and b. */
+static guint
+bitset_count_and (const Bitset *a, const Bitset *b)
+{
+	const gulong *wa, *wb;
+	guint i, first, last, count = 0;
+
+	if (!bitset_overlap (a, b, &first, &last))
+	{
+		return 0;
+	}
+
+	wa = a->words + (first - a->first_word);
+	wb = b->words + (first - b->first_word);
+	for (i = 0; i < last - first; i++)
+	{
+		count += popcount (wa[i] & wb[i]);
+	}
+	return count;
+}
+
+/* Removes from a the elements of b. */
+static void
+bitset_subtract (Bitset *a, const Bitset *b)
+{
+	gulong *wa;
+	const gulong *wb;
+	guint i, first, last;
+
+	if (!bitset_overlap (a, b, &first, &last))
+	{
+		return;
+	}
+
+	wa = a->words + (first - a->first_word);
+	wb = b->words + (first - b->first_word);
+	for (i = 0; i < last - first; i++)
+	{
+		wa[i] &= ~wb[i];
+	}
+}
+
+/* Builds the set of the given nodes. */
+static void
+bitset_init_from_nodes (Bitset *set, const GPtrArray *nodes)
+{
+	guint i, id, min_id = G_MAXUINT, max_id = 0;
+
+	if (nodes->len == 0)
+	{
+		bitset_init (set, 0, 0);
+		return;
+	}
+
+	for (i = 0; i < nodes->len; i++)
+	{
+		id = ephy_node_get_id (g_ptr_array_index (nodes, i));
+		min_id = MIN (min_id, id);
+		max_id = MAX (max_id, id);
+	}
+
+	bitset_init (set, WORD_INDEX (min_id),
+		     WORD_INDEX (max_id) - WORD_INDEX (min_id) + 1);
+
+	for (i = 0; i < nodes->len; i++)
+	{
+		id = ephy_node_get_id (g_ptr_array_index (nodes, i));
+		set->words[WORD_INDEX (id) - set->first_word] |= WORD_MASK (id);
+	}
+}
+
+static void
+children_set_free (ChildrenSet *cache)
+{
+	bitset_clear (&cache->children);
+	g_slice_free (ChildrenSet, cache);
+}
+
+/* Returns the set of children of parent. It is only rebuilt when the
+ * parent gained or lost children since the last call, so rebuilding a
+ * menu after editing a bookmark only recomputes the sets of its topics. */
+static const Bitset *
+get_children_set (EphyNode *parent)
+{
+	GObject *db = G_OBJECT (ephy_node_get_db (parent));
+	GPtrArray *children_sets;
+	ChildrenSet *cache;
+	guint id = ephy_node_get_id (parent);
+	guint stamp = ephy_node_get_stamp (parent);
+
+	children_sets = g_object_get_data (db, CHILDREN_SETS_KEY);
+	if (children_sets == NULL)
+	{
+		children_sets = g_ptr_array_new_with_free_func ((GDestroyNotify)children_set_free);
+		g_object_set_data_full (db, CHILDREN_SETS_KEY, children_sets,
+					(GDestroyNotify)g_ptr_array_unref);
+	}
+
+	if (id >= children_sets->len)
+	{
+		g_ptr_array_set_size (children_sets, id + 1);
+	}
+
+	cache = g_ptr_array_index (children_sets, id);
+	if (cache == NULL)
+	{
+		cache = g_slice_new0 (ChildrenSet);
+		g_ptr_array_index (children_sets, id) = cache;
+	}
+	else if (cache->parent == parent && cache->stamp == stamp)
+	{
+		return &cache->children;
+	}
+	else
+	{
+		bitset_clear (&cache->children);
+	}
+
+	cache->parent = parent;
+	cache->stamp = stamp;
+	bitset_init_from_nodes (&cache->children, ephy_node_get_children (parent));
+
+	return &cache->children;
+}
+
 /* Count the number of node entries which are children of parent. */
 gint
 ephy_nodes_count_covered (EphyNode *parent, const GPtrArray *children)
 {
+	const Bitset *set = get_children_set (parent);
 	guint i, len = 0;
 	EphyNode *child;
 	
 	for(i = 0; i < children->len; i++)
 	{
 		child = g_ptr_array_index (children, i);
-		if (ephy_node_has_child (parent, child))
+		if (bitset_contains (set, ephy_node_get_id (child)))
 		{
 			len++;
 		}
@@ -43,13 +254,14 @@ ephy_nodes_count_covered (EphyNode *parent, const GPtrArray *children)
 gint
 ephy_nodes_remove_covered (EphyNode *parent, GPtrArray *children)
 {
+	const Bitset *set = get_children_set (parent);
 	guint i, len = children->len;
 	EphyNode *child;
 	
 	for(i = 0; i < children->len; i++)
 	{
 		child = g_ptr_array_index (children, i);
-		if (ephy_node_has_child (parent, child))
+		if (bitset_contains (set, ephy_node_get_id (child)))
 		{
 			g_ptr_array_remove_index_fast (children, i);
 			i--;
@@ -62,13 +274,14 @@ ephy_nodes_remove_covered (EphyNode *parent, GPtrArray *children)
 gint
 ephy_nodes_remove_not_covered (EphyNode *parent, GPtrArray *children)
 {
+	const Bitset *set = get_children_set (parent);
 	guint i, len = children->len;
 	EphyNode *child;
 	
 	for(i = 0; i < children->len; i++)
 	{
 		child = g_ptr_array_index (children, i);
-		if (!ephy_node_has_child (parent, child))
+		if (!bitset_contains (set, ephy_node_get_id (child)))
 		{
 			g_ptr_array_remove_index_fast (children, i);
 			i--;
@@ -83,6 +296,7 @@ GPtrArray *
 ephy_nodes_get_covered (EphyNode *parent, const GPtrArray *children, GPtrArray *_covered)
 {
 	GPtrArray *covered = _covered?_covered:g_ptr_array_sized_new (children->len);
+	const Bitset *set = get_children_set (parent);
 	EphyNode *child;
 	guint i;
 
@@ -90,7 +304,7 @@ ephy_nodes_get_covered (EphyNode *parent, const GPtrArray *children, GPtrArray *
 	for (i = 0; i < children->len; i++)
 	{
 		child = g_ptr_array_index (children, i);
-		if (ephy_node_has_child (parent, child))
+		if (bitset_contains (set, ephy_node_get_id (child)))
 		{
 			g_ptr_array_add (covered, child);
 		}
@@ -103,13 +317,14 @@ ephy_nodes_get_covered (EphyNode *parent, const GPtrArray *children, GPtrArray *
 gboolean
 ephy_nodes_covered (EphyNode *parent, const GPtrArray *children)
 {
+	const Bitset *set = get_children_set (parent);
 	EphyNode *child;
 	guint i;
 
 	for (i = 0; i < children->len; i++)
 	{
 		child = g_ptr_array_index (children, i);
-		if (!ephy_node_has_child (parent, child))
+		if (!bitset_contains (set, ephy_node_get_id (child)))
 		{
 			return FALSE;
 		}
@@ -133,47 +348,48 @@ GPtrArray *
 ephy_nodes_get_covering (const GPtrArray *parents, const GPtrArray *children,
 			 GPtrArray *_covering, GPtrArray *_uncovered, GArray *_sizes)
 {
-	GPtrArray *uncovered = _uncovered?_uncovered:g_ptr_array_sized_new (children->len);
 	GPtrArray *covering = _covering?_covering:g_ptr_array_sized_new (parents->len);
 	GArray *chosen = g_array_sized_new (FALSE, FALSE, sizeof(guint), parents->len);
 	GArray *sizes = _sizes;
 
+	/* The sets of children of each parent, and of children not yet covered. */
+	const Bitset **sets = g_new (const Bitset *, parents->len);
+	Bitset uncovered;
+	guint n_children;
+
 	/* Create arrays to store the number of children each parent has which
 	 * are currently not covered, and the number of children it has total. */
 	guint *count_u = g_malloc (sizeof(guint) * parents->len);
 	guint *count_c = g_malloc (sizeof(guint) * parents->len);
 	
-	EphyNode *parent;
+	EphyNode *child;
 	guint i, p;
 
 	/* Empty all the returning arrays. */
-	uncovered->len = 0;
 	covering->len = 0;
+	if (_uncovered) _uncovered->len = 0;
 	if (sizes) sizes->len = 0;
 	
-	/* Initialise the array of uncovered bookmarks. */
-	for (i = 0; i < children->len; i++)
-	{
-		g_ptr_array_add (uncovered, g_ptr_array_index (children, i));
-	}
+	/* Initialise the set of uncovered bookmarks. */
+	bitset_init_from_nodes (&uncovered, children);
+	n_children = bitset_count_and (&uncovered, &uncovered);
 	
 	/* Initialise the count_u and count_c arrays.
 	 * NB: count_u[0] is set to 0 if the parent node
 	   covers the entire set of children. */
 	for (i = 0, p = 0; i < parents->len; i++)
 	{
-		parent = g_ptr_array_index (parents, i);
-		count_c[i] = ephy_nodes_count_covered (parent, children);
-		count_u[i] = (count_c[i]<children->len) ? count_c[i] : 0;
+		sets[i] = get_children_set (g_ptr_array_index (parents, i));
+		count_c[i] = bitset_count_and (sets[i], &uncovered);
+		count_u[i] = (count_c[i]<n_children) ? count_c[i] : 0;
 		if (count_u[i] > count_u[p]) p = i;
 	}
 	
 	/* While there are more suitable topics... */
 	while (p < parents->len && count_u[p])
 	{
-		/* Update the arrays of uncovered bookmarks and covering topics. */
-		parent = g_ptr_array_index (parents, p);
-		ephy_nodes_remove_covered (parent, uncovered);
+		/* Update the set of uncovered bookmarks and covering topics. */
+		bitset_subtract (&uncovered, sets[p]);
 		g_array_append_val (chosen, p);
 		
 		/* Find the next most suitable topic. */
@@ -183,8 +399,7 @@ ephy_nodes_get_covering (const GPtrArray *parents, const GPtrArray *children,
 			/* Lazy update the count_u[i] array. */
 			if (count_u[i] > count_u[p] || (count_u[i] == count_u[p] && count_c[i] < count_c[p]))
 			{
-				parent = g_ptr_array_index (parents, i);
-				count_u[i] = ephy_nodes_count_covered (parent, uncovered);
+				count_u[i] = bitset_count_and (sets[i], &uncovered);
 			}
 
 			if (count_u[i] > count_u[p] || (count_u[i] == count_u[p] && count_c[i] < count_c[p]))
@@ -203,8 +418,22 @@ ephy_nodes_get_covering (const GPtrArray *parents, const GPtrArray *children,
 		if (sizes) g_array_append_val (sizes, count_c[p]);
 	}
 
-	if (_uncovered != uncovered) g_ptr_array_free (uncovered, TRUE);
+	/* Report the children left uncovered in their original order. */
+	if (_uncovered)
+	{
+		for (i = 0; i < children->len; i++)
+		{
+			child = g_ptr_array_index (children, i);
+			if (bitset_contains (&uncovered, ephy_node_get_id (child)))
+			{
+				g_ptr_array_add (_uncovered, child);
+			}
+		}
+	}
+
+	bitset_clear (&uncovered);
 	g_array_free (chosen, TRUE);
+	g_free (sets);
 	g_free (count_u);
 	g_free (count_c);
 	
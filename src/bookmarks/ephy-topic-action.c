@@ -36,6 +36,11 @@
 #include <gtk/gtk.h>
 #include <string.h>
 
+/* How long a topic menu is kept around after it was last closed. */
+#define POPUP_TIMEOUT 60 /* seconds */
+
+#define PLACEHOLDER_KEY "ephy-topic-action-placeholder"
+
 #define EPHY_TOPIC_ACTION_GET_PRIVATE(object)(G_TYPE_INSTANCE_GET_PRIVATE ((object), EPHY_TYPE_TOPIC_ACTION, EphyTopicActionPrivate))
 
 struct _EphyTopicActionPrivate
@@ -43,6 +48,7 @@ struct _EphyTopicActionPrivate
 	EphyNode *node;
 	GtkUIManager *manager;
 	guint merge_id;
+	guint erase_id;
 };
 
 enum
@@ -88,10 +94,48 @@ ephy_topic_action_sync_label (GtkAction *action,
 	g_value_unset (&value);
 }
 
+static void erase_popup (EphyTopicAction *action);
+
+static gboolean
+erase_popup_timeout_cb (EphyTopicAction *action)
+{
+	action->priv->erase_id = 0;
+	erase_popup (action);
+
+	return FALSE;
+}
+
+static void
+popup_show_cb (GtkWidget *popup,
+	       EphyTopicAction *action)
+{
+	EphyTopicActionPrivate *priv = action->priv;
+
+	if (priv->erase_id != 0)
+	{
+		g_source_remove (priv->erase_id);
+		priv->erase_id = 0;
+	}
+}
+
+static void
+popup_hide_cb (GtkWidget *popup,
+	       EphyTopicAction *action)
+{
+	EphyTopicActionPrivate *priv = action->priv;
+
+	if (priv->erase_id == 0)
+	{
+		priv->erase_id = g_timeout_add_seconds
+			(POPUP_TIMEOUT, (GSourceFunc) erase_popup_timeout_cb, action);
+	}
+}
+
 static GtkWidget *
 get_popup (EphyTopicAction *action)
 {
 	EphyTopicActionPrivate *priv = action->priv;
+	GtkWidget *popup;
 	char path[40];
 
 	g_snprintf (path, sizeof (path), "/PopupTopic%ld",
@@ -112,20 +156,66 @@ get_popup (EphyTopicAction *action)
 			 popup_menu_string->len, 0);
 
 		g_string_free (popup_menu_string, TRUE);
+
+		popup = gtk_ui_manager_get_widget (priv->manager, path);
+		g_signal_connect_object (popup, "show",
+					 G_CALLBACK (popup_show_cb), action, 0);
+		g_signal_connect_object (popup, "hide",
+					 G_CALLBACK (popup_hide_cb), action, 0);
+
+		/* Start counting now, in case the menu never shows up. */
+		popup_hide_cb (popup, action);
+
+		return popup;
 	}
 
 	return gtk_ui_manager_get_widget (priv->manager, path);
 }
 
+/* Gives @menuitem an empty submenu, so that it shows up as a submenu
+ * without building the real one before it is needed. */
+static void
+attach_placeholder (GtkWidget *menuitem)
+{
+	GtkWidget *placeholder;
+
+	placeholder = gtk_menu_new ();
+	g_object_set_data (G_OBJECT (menuitem), PLACEHOLDER_KEY, placeholder);
+	gtk_menu_item_set_submenu (GTK_MENU_ITEM (menuitem), placeholder);
+}
+
 static void
 erase_popup (EphyTopicAction *action)
 {
 	EphyTopicActionPrivate *priv = action->priv;
 
+	GSList *proxies;
+
+	if (priv->erase_id != 0)
+	{
+		g_source_remove (priv->erase_id);
+		priv->erase_id = 0;
+	}
+
 	if (priv->merge_id != 0)
 	{
 		gtk_ui_manager_remove_ui (priv->manager, priv->merge_id);
 		priv->merge_id = 0;
+
+		/* Destroying the popup detached it from its menu items, put
+		 * placeholders back on the ones that are on screen. */
+		for (proxies = gtk_action_get_proxies (GTK_ACTION (action));
+		     proxies != NULL; proxies = proxies->next)
+		{
+			GtkWidget *proxy = proxies->data;
+
+			if (GTK_IS_MENU_ITEM (proxy) &&
+			    gtk_widget_get_mapped (proxy) &&
+			    gtk_menu_item_get_submenu (GTK_MENU_ITEM (proxy)) == NULL)
+			{
+				attach_placeholder (proxy);
+			}
+		}
 	}
 }
 
@@ -164,7 +254,10 @@ menu_destroy_cb (GtkWidget *menuitem,
 {
 	/* Save the submenu from similar destruction,
 	 * because it doesn't rightly belong to this menuitem. */
-	gtk_menu_item_set_submenu (GTK_MENU_ITEM (menuitem), NULL);
+	if (g_object_get_data (G_OBJECT (menuitem), PLACEHOLDER_KEY) == NULL)
+	{
+		gtk_menu_item_set_submenu (GTK_MENU_ITEM (menuitem), NULL);
+	}
 }
 
 static void
@@ -173,15 +266,34 @@ menu_init_cb (GtkWidget *menuitem,
 {
 	if (gtk_menu_item_get_submenu (GTK_MENU_ITEM (menuitem)) == NULL)
 	{
-		GtkWidget *popup;
-
-		popup = get_popup (action);
-		gtk_menu_item_set_submenu (GTK_MENU_ITEM (menuitem), popup);
-		g_signal_connect (menuitem, "destroy",
-				  G_CALLBACK (menu_destroy_cb), NULL);
+		if (action->priv->merge_id != 0)
+		{
+			gtk_menu_item_set_submenu (GTK_MENU_ITEM (menuitem),
+						   get_popup (action));
+		}
+		else
+		{
+			attach_placeholder (menuitem);
+		}
 	}
 }
 
+static void
+menu_select_cb (GtkWidget *menuitem,
+		EphyTopicAction *action)
+{
+	GtkWidget *placeholder;
+
+	placeholder = g_object_get_data (G_OBJECT (menuitem), PLACEHOLDER_KEY);
+	if (placeholder == NULL) return;
+
+	/* The item only just got selected, so the submenu has not popped
+	 * up yet and the real one will show instead. */
+	g_object_set_data (G_OBJECT (menuitem), PLACEHOLDER_KEY, NULL);
+	gtk_menu_item_set_submenu (GTK_MENU_ITEM (menuitem), get_popup (action));
+	gtk_widget_destroy (placeholder);
+}
+
 static void
 connect_proxy (GtkAction *action,
 	       GtkWidget *proxy)
@@ -196,6 +308,10 @@ connect_proxy (GtkAction *action,
 	{
 		g_signal_connect (proxy, "map",
 				  G_CALLBACK (menu_init_cb), action);
+		g_signal_connect (proxy, "select",
+				  G_CALLBACK (menu_select_cb), action);
+		g_signal_connect (proxy, "destroy",
+				  G_CALLBACK (menu_destroy_cb), NULL);
 	}
 }
 
@@ -321,6 +437,19 @@ ephy_topic_action_get_property (GObject *object,
 	}
 }
 
+static void
+ephy_topic_action_finalize (GObject *object)
+{
+	EphyTopicActionPrivate *priv = EPHY_TOPIC_ACTION (object)->priv;
+
+	if (priv->erase_id != 0)
+	{
+		g_source_remove (priv->erase_id);
+	}
+
+	G_OBJECT_CLASS (ephy_topic_action_parent_class)->finalize (object);
+}
+
 static void
 ephy_topic_action_init (EphyTopicAction *action)
 {
@@ -335,6 +464,7 @@ ephy_topic_action_class_init (EphyTopicActionClass *class)
 
 	action_class->connect_proxy = connect_proxy;
 
+	object_class->finalize = ephy_topic_action_finalize;
 	object_class->set_property = ephy_topic_action_set_property;
 	object_class->get_property = ephy_topic_action_get_property;
 
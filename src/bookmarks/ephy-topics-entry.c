@@ -66,31 +66,84 @@ static EphyNode *
 find_topic (EphyTopicsEntry *entry,
 	    const char *key)
 {
-	EphyNode *node = NULL;
-	GtkTreeModel *model;
-	GtkTreeIter iter;
-	GValue value = { 0, };
-	gboolean valid;
-	
-	/* Loop through our table and set/unset topics appropriately */
-	model = GTK_TREE_MODEL (entry->priv->store);
-	valid = gtk_tree_model_get_iter_first (model, &iter);
-	while (valid && node == NULL)
+	EphyNode *node;
+
+	node = ephy_bookmarks_lookup_topic (entry->priv->bookmarks, key);
+	if (node == NULL ||
+	    ephy_node_get_property_int (node, EPHY_NODE_KEYWORD_PROP_PRIORITY) !=
+	    EPHY_NODE_NORMAL_PRIORITY)
 	{
-		gtk_tree_model_get_value (model, &iter, COLUMN_KEY, &value);
-		if (strcmp(g_value_get_string (&value), key) == 0)
-		{
-			g_value_unset (&value);
-			gtk_tree_model_get_value (model, &iter, COLUMN_NODE, &value);
-			node = g_value_get_pointer (&value);
-		}
-		g_value_unset (&value);
-		valid = gtk_tree_model_iter_next (model, &iter);
+		return NULL;
 	}
 
 	return node;
 }
 
+/* Returns the user topics our bookmark is in, going through its parents
+ * rather than through every topic. */
+static GPtrArray *
+get_selected_topics (EphyTopicsEntry *entry)
+{
+	EphyTopicsEntryPrivate *priv = entry->priv;
+	EphyNode *keywords, *node;
+	GPtrArray *topics;
+	int i, n_parents;
+
+	keywords = ephy_bookmarks_get_keywords (priv->bookmarks);
+	n_parents = ephy_node_get_n_parents (priv->bookmark);
+	topics = g_ptr_array_sized_new (n_parents);
+
+	for (i = 0; i < n_parents; i++)
+	{
+		node = ephy_node_get_nth_parent (priv->bookmark, i);
+
+		if (!ephy_node_has_child (keywords, node) ||
+		    ephy_node_get_property_int (node, EPHY_NODE_KEYWORD_PROP_PRIORITY) !=
+		    EPHY_NODE_NORMAL_PRIORITY)
+			continue;
+
+		g_ptr_array_add (topics, node);
+	}
+
+	return topics;
+}
+
+/* Fills the completion model with the topics matching the search key.
+ * They come from the topic index already sorted, so typing costs as much
+ * as there are matches, not as there are topics. */
+static void
+update_completion (EphyTopicsEntry *entry)
+{
+	EphyTopicsEntryPrivate *priv = entry->priv;
+	EphyNode *node;
+	GPtrArray *topics;
+	GtkTreeIter iter;
+	guint i;
+
+	gtk_list_store_clear (priv->store);
+
+	if (priv->key == NULL)
+	{
+		return;
+	}
+
+	topics = g_ptr_array_new ();
+	ephy_bookmarks_complete_topic (priv->bookmarks, priv->key, topics);
+
+	for (i = 0; i < topics->len; i++)
+	{
+		node = g_ptr_array_index (topics, i);
+
+		gtk_list_store_append (priv->store, &iter);
+		gtk_list_store_set (priv->store, &iter, COLUMN_NODE, node,
+				    COLUMN_TITLE, ephy_node_get_property_string (node, EPHY_NODE_KEYWORD_PROP_NAME),
+				    COLUMN_KEY, ephy_bookmarks_get_topic_key (priv->bookmarks, node),
+				    -1);
+	}
+
+	g_ptr_array_free (topics, TRUE);
+}
+
 static void
 insert_text (EphyTopicsEntry *entry,
 	     const char *title)
@@ -132,70 +185,40 @@ update_widget (EphyTopicsEntry *entry)
 	GtkEditable *editable = GTK_EDITABLE (entry);
 	
 	EphyNode *node;
-	GPtrArray *children, *topics;
-	GtkTreeIter iter;
-	gint i, priority, pos;
+	GPtrArray *topics;
+	gint i, pos;
 	const char *title;
-	char *tmp1, *tmp2;
 	gboolean is_focus;
 	
 	/* Prevent any changes to the database */
 	if(priv->lock) return;
 	priv->lock = TRUE;
 	
-	node = ephy_bookmarks_get_keywords (priv->bookmarks);
-	children = ephy_node_get_children (node);
-	topics = g_ptr_array_sized_new (children->len);
-	
-	for (i = 0; i < children->len; i++)
-	{
-		node = g_ptr_array_index (children, i);
-
-		priority = ephy_node_get_property_int 
-		  (node, EPHY_NODE_KEYWORD_PROP_PRIORITY);
-		if (priority != EPHY_NODE_NORMAL_PRIORITY)
-		  continue;
-		
-		g_ptr_array_add (topics, node);
-	}
-	
-	g_ptr_array_sort (topics, ephy_bookmarks_compare_topic_pointers);
-	gtk_list_store_clear (priv->store);	
-
 	g_object_get (entry, "is-focus", &is_focus, NULL);
 	if (!is_focus)
 	{
+		topics = get_selected_topics (entry);
+		g_ptr_array_sort (topics, ephy_bookmarks_compare_topic_pointers);
+
 		gtk_editable_delete_text (editable, 0, -1);
-	}
-	
-	for (pos = 0, i = 0; i < topics->len; i++)
-	{
-		node = g_ptr_array_index (topics, i);
-		title = ephy_node_get_property_string (node, EPHY_NODE_KEYWORD_PROP_NAME);
-		  
-		if (!is_focus && ephy_node_has_child (node, priv->bookmark))
+
+		for (pos = 0, i = 0; i < topics->len; i++)
 		{
+			node = g_ptr_array_index (topics, i);
+			title = ephy_node_get_property_string (node, EPHY_NODE_KEYWORD_PROP_NAME);
+
 			if (pos > 0)
 				gtk_editable_insert_text (editable, ", ", -1, &pos);
 			gtk_editable_insert_text (editable, title, -1, &pos);
 		}
 
-		tmp1 = g_utf8_casefold (title, -1);
-		tmp2 = g_utf8_normalize (tmp1, -1, G_NORMALIZE_DEFAULT);
-		gtk_list_store_append (priv->store, &iter);
-		gtk_list_store_set (priv->store, &iter, COLUMN_NODE, node,
-				    COLUMN_TITLE, title, COLUMN_KEY, tmp2, -1);
-		g_free (tmp2);
-		g_free (tmp1);
-	}
-	
-	
-	if (!is_focus)
-	{
 		gtk_editable_set_position (editable, -1);
+
+		g_ptr_array_free (topics, TRUE);
 	}
 
-	g_ptr_array_free (topics, TRUE);
+	/* Topics may have been added, renamed or removed. */
+	update_completion (entry);
 
 	priv->lock = FALSE;
 }
@@ -207,15 +230,11 @@ update_database (EphyTopicsEntry *entry)
 	EphyTopicsEntryPrivate *priv = entry->priv;
 
 	EphyNode *node;
+	GPtrArray *topics;
 	const char *text;
 	char **split;
         char *tmp;
-	gint i;
-	
-	GtkTreeModel *model;
-	GtkTreeIter iter;
-	GValue value = { 0, };
-	gboolean valid;
+	gint i, j;
 
 	/* Prevent any changes to the text entry or completion model */
 	if(priv->lock) return;
@@ -228,45 +247,41 @@ update_database (EphyTopicsEntry *entry)
 	{
 		g_strstrip (split[i]);
 		
-		tmp = g_utf8_casefold (split[i], -1);
+		tmp = ephy_bookmarks_fold_topic_name (split[i]);
 		g_free (split[i]);
-		
-		split[i] = g_utf8_normalize (tmp, -1, G_NORMALIZE_DEFAULT);
-		g_free (tmp);
+		split[i] = tmp;
 	}
 
-	/* Loop through the completion model and set/unset topics appropriately */
-	model = GTK_TREE_MODEL (priv->store);
-	valid = gtk_tree_model_get_iter_first (model, &iter);
-	while (valid)
+	/* Set the topics the user typed... */
+	for (i=0; split[i]; i++)
 	{
-		gtk_tree_model_get_value (model, &iter, COLUMN_NODE, &value);
-		node = g_value_get_pointer (&value);
-		g_value_unset (&value);
-		
-		gtk_tree_model_get_value (model, &iter, COLUMN_KEY, &value);
-		text = g_value_get_string (&value);
-		
-		for (i=0; split[i]; i++)
-		  if (strcmp (text, split[i]) == 0)
-		    break;
-		
-		if (split[i])
+		node = find_topic (entry, split[i]);
+		if (node != NULL)
 		{
-			split[i][0] = 0;
 			ephy_bookmarks_set_keyword (priv->bookmarks, node,
 						    priv->bookmark);
 		}
-		else
+	}
+
+	/* ...and unset the ones they removed. */
+	topics = get_selected_topics (entry);
+	for (j = 0; j < topics->len; j++)
+	{
+		node = g_ptr_array_index (topics, j);
+		text = ephy_bookmarks_get_topic_key (priv->bookmarks, node);
+
+		for (i=0; split[i]; i++)
+		  if (strcmp (text, split[i]) == 0)
+		    break;
+
+		if (split[i] == NULL)
 		{
 			ephy_bookmarks_unset_keyword (priv->bookmarks, node,
 						      priv->bookmark);
 		}
-		
-		g_value_unset (&value);
-		valid = gtk_tree_model_iter_next (model, &iter);
 	}
 
+	g_ptr_array_free (topics, TRUE);
 	g_strfreev (split);
 
 	priv->lock = FALSE;
@@ -313,9 +328,7 @@ update_key (EphyTopicsEntry *entry)
 		g_strstrip (input);
 		priv->create = input;
 		
-		input = g_utf8_casefold (input, -1);
-		priv->key = g_utf8_normalize (input, -1, G_NORMALIZE_DEFAULT);
-		g_free (input);
+		priv->key = ephy_bookmarks_fold_topic_name (input);
 		
 		if (priv->create[0] == '\0' ||
 		    find_topic (entry, priv->key) != NULL)
@@ -332,6 +345,8 @@ update_key (EphyTopicsEntry *entry)
 			g_free (input);
 		}
 	}
+
+	update_completion (entry);
 }
 
 static gboolean
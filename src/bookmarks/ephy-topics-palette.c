@@ -122,22 +122,10 @@ update_list (EphyTopicsPalette *palette)
 	
 	if (palette->priv->mode == MODE_LIST)
 	{
-		/* Allocate and fill the suggestions array. */
-		node = ephy_bookmarks_get_keywords (palette->priv->bookmarks);
-		children = ephy_node_get_children (node);
-		topics = g_ptr_array_sized_new (children->len);
-		for (i = 0; i < children->len; i++)
-		{
-			node = g_ptr_array_index (children, i);
-			
-			priority = ephy_node_get_property_int (node, EPHY_NODE_KEYWORD_PROP_PRIORITY);
-			if (priority != EPHY_NODE_NORMAL_PRIORITY)
-			  continue;
-
-			g_ptr_array_add (topics, node);
-		}
-
-		g_ptr_array_sort (topics, ephy_bookmarks_compare_topic_pointers);		
+		/* Allocate and fill the suggestions array, which the topic
+		 * index hands out already sorted. */
+		topics = g_ptr_array_new ();
+		ephy_bookmarks_complete_topic (palette->priv->bookmarks, "", topics);
 		append_topics (palette, &iter, &valid, &first, topics);
 		g_ptr_array_free (topics, TRUE);
 	}
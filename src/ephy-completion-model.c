@@ -24,6 +24,7 @@
 #include "ephy-embed-prefs.h"
 #include "ephy-embed-shell.h"
 #include "ephy-history-service.h"
+#include "ephy-latency-tracker.h"
 #include "ephy-shell.h"
 
 #include <string.h>
@@ -32,14 +33,24 @@ G_DEFINE_TYPE (EphyCompletionModel, ephy_completion_model, GTK_TYPE_LIST_STORE)
 
 #define EPHY_COMPLETION_MODEL_GET_PRIVATE(object)(G_TYPE_INSTANCE_GET_PRIVATE ((object), EPHY_TYPE_COMPLETION_MODEL, EphyCompletionModelPrivate))
 
+typedef struct _BookmarksJob BookmarksJob;
+typedef struct _FindURLsData FindURLsData;
+
 struct _EphyCompletionModelPrivate {
   EphyHistoryService *history_service;
   GCancellable *cancellable;
 
-  EphyNode *bookmarks;
+  EphyBookmarks *bookmarks;
   GSList *search_terms;
+
+  /* The search in progress, if any. */
+  FindURLsData *find_urls_data;
+  BookmarksJob *bookmarks_job;
 };
 
+static void bookmarks_job_abandon (BookmarksJob *job);
+static void find_urls_data_free (FindURLsData *data);
+
 static void
 ephy_completion_model_constructed (GObject *object)
 {
@@ -73,11 +84,22 @@ ephy_completion_model_finalize (GObject *object)
     priv->search_terms = NULL;
   }
 
+  /* A cancelled history query never calls back, so its data goes now. */
   if (priv->cancellable) {
     g_cancellable_cancel (priv->cancellable);
     g_clear_object (&priv->cancellable);
   }
 
+  if (priv->find_urls_data) {
+    find_urls_data_free (priv->find_urls_data);
+    priv->find_urls_data = NULL;
+  }
+
+  if (priv->bookmarks_job) {
+    bookmarks_job_abandon (priv->bookmarks_job);
+    priv->bookmarks_job = NULL;
+  }
+
   G_OBJECT_CLASS (ephy_completion_model_parent_class)->finalize (object);
 }
 
@@ -96,14 +118,11 @@ static void
 ephy_completion_model_init (EphyCompletionModel *model)
 {
   EphyCompletionModelPrivate *priv;
-  EphyBookmarks *bookmarks_service;
 
   model->priv = priv = EPHY_COMPLETION_MODEL_GET_PRIVATE (model);
 
   priv->history_service = EPHY_HISTORY_SERVICE (ephy_embed_shell_get_global_history_service (embed_shell));
-
-  bookmarks_service = ephy_shell_get_bookmarks (ephy_shell);
-  priv->bookmarks = ephy_bookmarks_get_bookmarks (bookmarks_service);
+  priv->bookmarks = ephy_shell_get_bookmarks (ephy_shell);
 }
 
 static gboolean
@@ -265,20 +284,18 @@ replace_rows_in_model (EphyCompletionModel *model, GSList *new_rows)
 }
 
 static gboolean
-should_add_bookmark_to_model (EphyCompletionModel *model,
-                              const char *search_string,
+should_add_bookmark_to_model (GSList *search_terms,
                               const char *title,
                               const char *location,
                               const char *keywords)
 {
   gboolean ret = TRUE;
-  EphyCompletionModelPrivate *priv = model->priv;
 
-  if (priv->search_terms) {
+  if (search_terms) {
     GSList *iter;
     GRegex *current = NULL;
 
-    for (iter = priv->search_terms; iter != NULL; iter = iter->next) {
+    for (iter = search_terms; iter != NULL; iter = iter->next) {
       current = (GRegex*)iter->data;
       if ((!g_regex_match (current, title ? title : "", G_REGEX_MATCH_NOTEMPTY, NULL)) &&
           (!g_regex_match (current, location ? location : "", G_REGEX_MATCH_NOTEMPTY, NULL)) &&
@@ -292,12 +309,144 @@ should_add_bookmark_to_model (EphyCompletionModel *model,
   return ret;
 }
 
-typedef struct {
+/* Bookmarks are matched against the search terms in a pool thread, off a
+ * read-only view of them, while the history service looks for URLs. The
+ * results are merged once both are in. A job is owned by the main
+ * thread; the pool holds a reference until its done callback has run. A
+ * job that a newer search replaced is cancelled and loses its model, so
+ * its results are dropped. */
+struct _BookmarksJob {
+  int ref_count;
+  EphyCompletionModel *model;
+  EphyBookmarksView *view;
+  GSList *search_terms;
+  GCancellable *cancellable;
+  gboolean done;
+
+  /* Indexes of the matching bookmarks in the view. */
+  GArray *matches;
+};
+
+#define BOOKMARKS_JOB_CANCEL_INTERVAL 256
+
+static void find_urls_data_complete (FindURLsData *data);
+
+static void
+bookmarks_job_unref (BookmarksJob *job)
+{
+  if (--job->ref_count > 0)
+    return;
+
+  ephy_bookmarks_view_unref (job->view);
+  free_search_terms (job->search_terms);
+  g_object_unref (job->cancellable);
+  g_array_free (job->matches, TRUE);
+  g_slice_free (BookmarksJob, job);
+}
+
+static gboolean
+bookmarks_job_done_cb (BookmarksJob *job)
+{
+  EphyCompletionModel *model = job->model;
+
+  job->done = TRUE;
+
+  if (model && model->priv->find_urls_data)
+    find_urls_data_complete (model->priv->find_urls_data);
+
+  bookmarks_job_unref (job);
+
+  return FALSE;
+}
+
+static void
+bookmarks_job_run (BookmarksJob *job,
+                   gpointer user_data)
+{
+  const char * const *titles, * const *locations, * const *keywords;
+  guint i, n_bookmarks;
+
+  titles = ephy_bookmarks_view_get_titles (job->view);
+  locations = ephy_bookmarks_view_get_locations (job->view);
+  keywords = ephy_bookmarks_view_get_keywords (job->view);
+  n_bookmarks = ephy_bookmarks_view_get_n_bookmarks (job->view);
+
+  for (i = 0; i < n_bookmarks; i++) {
+    if (i % BOOKMARKS_JOB_CANCEL_INTERVAL == 0 &&
+        g_cancellable_is_cancelled (job->cancellable))
+      break;
+
+    if (should_add_bookmark_to_model (job->search_terms,
+                                      titles[i], locations[i], keywords[i]))
+      g_array_append_val (job->matches, i);
+  }
+
+  g_idle_add ((GSourceFunc) bookmarks_job_done_cb, job);
+}
+
+/* One thread is enough: stale jobs are cancelled and return right away. */
+static GThreadPool *
+get_bookmarks_pool (void)
+{
+  static GThreadPool *pool = NULL;
+
+  if (pool == NULL)
+    pool = g_thread_pool_new ((GFunc) bookmarks_job_run, NULL, 1, FALSE, NULL);
+
+  return pool;
+}
+
+static BookmarksJob *
+bookmarks_job_new (EphyCompletionModel *model,
+                   EphyBookmarksView *view,
+                   GSList *search_terms)
+{
+  BookmarksJob *job;
+  GSList *l;
+
+  job = g_slice_new0 (BookmarksJob);
+  job->ref_count = 2;
+  job->model = model;
+  job->view = view;
+  job->cancellable = g_cancellable_new ();
+  job->matches = g_array_new (FALSE, FALSE, sizeof (guint));
+
+  for (l = search_terms; l != NULL; l = l->next)
+    job->search_terms = g_slist_prepend (job->search_terms, g_regex_ref (l->data));
+  job->search_terms = g_slist_reverse (job->search_terms);
+
+  g_thread_pool_push (get_bookmarks_pool (), job, NULL);
+
+  return job;
+}
+
+static void
+bookmarks_job_abandon (BookmarksJob *job)
+{
+  job->model = NULL;
+  g_cancellable_cancel (job->cancellable);
+  bookmarks_job_unref (job);
+}
+
+struct _FindURLsData {
   EphyCompletionModel *model;
   char *search_string;
   EphyHistoryJobCallback callback;
   gpointer user_data;
-} FindURLsData;
+
+  /* The history results, once the query is done. */
+  gboolean history_done;
+  gboolean success;
+  GList *urls;
+};
+
+static void
+find_urls_data_free (FindURLsData *data)
+{
+  g_free (data->search_string);
+  g_list_free_full (data->urls, (GDestroyNotify)ephy_history_url_free);
+  g_slice_free (FindURLsData, data);
+}
 
 static int
 find_url (gconstpointer a,
@@ -379,43 +528,45 @@ sort_by_relevance (gconstpointer a, gconstpointer b)
     return 0;
 }
 
+/* Fills the model once both the history query and the bookmarks job
+ * are done, whichever finishes last. */
 static void
-query_completed_cb (EphyHistoryService *service,
-                    gboolean success,
-                    gpointer result_data,
-                    FindURLsData *user_data)
+find_urls_data_complete (FindURLsData *data)
 {
-  EphyCompletionModel *model = user_data->model;
+  EphyCompletionModel *model = data->model;
   EphyCompletionModelPrivate *priv = model->priv;
-  GList *p, *urls;
-  GPtrArray *children;
+  BookmarksJob *job = priv->bookmarks_job;
+  GList *p;
   GSList *list = NULL;
-  int i;
+  guint i;
+
+  if (!data->history_done || (job && !job->done))
+    return;
+
+  priv->find_urls_data = NULL;
+  priv->bookmarks_job = NULL;
 
   /* Bookmarks */
-  children = ephy_node_get_children (priv->bookmarks);
-
-  /* FIXME: perhaps this could be done in a service thread? There
-   * should never be a ton of bookmarks, but seems a bit cleaner and
-   * consistent with what we do for the history. */
-  for (i = 0; i < children->len; i++) {
-    EphyNode *kid;
-    const char *keywords, *location, *title;
-
-    kid = g_ptr_array_index (children, i);
-    location = ephy_node_get_property_string (kid, EPHY_NODE_BMK_PROP_LOCATION);
-    title = ephy_node_get_property_string (kid, EPHY_NODE_BMK_PROP_TITLE);
-    keywords = ephy_node_get_property_string (kid, EPHY_NODE_BMK_PROP_KEYWORDS);
-
-    if (should_add_bookmark_to_model (model, user_data->search_string,
-                                      title, location, keywords))
-      list = add_to_potential_rows (list, title, location, keywords, 0, TRUE, FALSE);
+  if (job) {
+    const char * const *titles, * const *locations, * const *keywords;
+
+    titles = ephy_bookmarks_view_get_titles (job->view);
+    locations = ephy_bookmarks_view_get_locations (job->view);
+    keywords = ephy_bookmarks_view_get_keywords (job->view);
+
+    for (i = 0; i < job->matches->len; i++) {
+      guint index = g_array_index (job->matches, guint, i);
+
+      list = add_to_potential_rows (list, titles[index], locations[index], keywords[index],
+                                    0, TRUE, FALSE);
+    }
+
+    job->model = NULL;
+    bookmarks_job_unref (job);
   }
 
   /* History */
-  urls = (GList*)result_data;
-
-  for (p = urls; p != NULL; p = p->next) {
+  for (p = data->urls; p != NULL; p = p->next) {
     EphyHistoryURL *url = (EphyHistoryURL*)p->data;
 
     list = add_to_potential_rows (list, url->title, url->url, NULL, url->visit_count, FALSE, TRUE);
@@ -428,15 +579,33 @@ query_completed_cb (EphyHistoryService *service,
    * in the current model one by one, sorted by relevance. */
   replace_rows_in_model (model, list);
 
+  ephy_latency_tracker_mark (EPHY_LATENCY_STAGE_MODEL_REPLACED);
+
   /* Notify */
-  if (user_data->callback)
-    user_data->callback (service, success, result_data, user_data->user_data);
+  if (data->callback)
+    data->callback (priv->history_service, data->success, data->urls, data->user_data);
 
-  g_free (user_data->search_string);
-  g_slice_free (FindURLsData, user_data);
-  g_list_free_full (urls, (GDestroyNotify)ephy_history_url_free);
+  find_urls_data_free (data);
   g_slist_free_full (list, (GDestroyNotify)free_potential_row);
+}
+
+static void
+query_completed_cb (EphyHistoryService *service,
+                    gboolean success,
+                    gpointer result_data,
+                    FindURLsData *data)
+{
+  EphyCompletionModelPrivate *priv = data->model->priv;
+
+  ephy_latency_tracker_mark (EPHY_LATENCY_STAGE_QUERY_COMPLETED);
+
+  data->history_done = TRUE;
+  data->success = success;
+  data->urls = (GList*)result_data;
+
   g_clear_object (&priv->cancellable);
+
+  find_urls_data_complete (data);
 }
 
 static void
@@ -533,12 +702,30 @@ ephy_completion_model_update_for_string (EphyCompletionModel *model,
   int i;
   GList *query = NULL;
   FindURLsData *user_data;
+  EphyBookmarksView *view;
 
   g_return_if_fail (EPHY_IS_COMPLETION_MODEL (model));
   g_return_if_fail (search_string != NULL);
 
   priv = model->priv;
 
+  /* The previous search is stale: stop matching bookmarks for it, and
+   * drop its history results, its cancelled query will not call back. */
+  if (priv->bookmarks_job) {
+    bookmarks_job_abandon (priv->bookmarks_job);
+    priv->bookmarks_job = NULL;
+  }
+
+  if (priv->cancellable) {
+    g_cancellable_cancel (priv->cancellable);
+    g_clear_object (&priv->cancellable);
+  }
+
+  if (priv->find_urls_data) {
+    find_urls_data_free (priv->find_urls_data);
+    priv->find_urls_data = NULL;
+  }
+
   /* Split the search string. */
   strings = g_strsplit (search_string, " ", -1);
   for (i = 0; strings[i]; i++)
@@ -547,18 +734,21 @@ ephy_completion_model_update_for_string (EphyCompletionModel *model,
 
   update_search_terms (model, search_string);
 
-  user_data = g_slice_new (FindURLsData);
+  user_data = g_slice_new0 (FindURLsData);
   user_data->model = model;
   user_data->search_string = g_strdup (search_string);
   user_data->callback = callback;
   user_data->user_data = data;
+  priv->find_urls_data = user_data;
 
-  if (priv->cancellable) {
-    g_cancellable_cancel (priv->cancellable);
-    g_object_unref (priv->cancellable);
-  }
   priv->cancellable = g_cancellable_new ();
 
+  view = ephy_bookmarks_get_view (priv->bookmarks);
+  if (view)
+    priv->bookmarks_job = bookmarks_job_new (model, view, priv->search_terms);
+
+  ephy_latency_tracker_mark (EPHY_LATENCY_STAGE_QUERY_DISPATCH);
+
   ephy_history_service_find_urls (priv->history_service,
                                   0, 0,
                                   MAX_COMPLETION_HISTORY_URLS, 0,
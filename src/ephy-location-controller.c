@@ -47,7 +47,7 @@ struct _EphyLocationControllerPrivate
 {
 	EphyWindow *window;
 	EphyLocationEntry *location_entry;
-	GList *actions;
+	GPtrArray *actions;
 	char *address;
 	EphyNode *smart_bmks;
 	EphyBookmarks *bookmarks;
@@ -118,7 +118,13 @@ action_activated_cb (GtkEntryCompletion *completion,
 		const char *smart_url;
 		char *url;
 
-		node = (EphyNode *)g_list_nth_data (controller->priv->actions, index);
+		if (index < 0 || index >= controller->priv->actions->len)
+		{
+			g_free (content);
+			return;
+		}
+
+		node = g_ptr_array_index (controller->priv->actions, index);
 		smart_url = ephy_node_get_property_string
 			(node, EPHY_NODE_BMK_PROP_LOCATION);
 		g_return_if_fail (smart_url != NULL);
@@ -140,8 +146,9 @@ entry_activate_cb (GtkEntry *entry,
 		   EphyLocationController *controller)
 {
 	EphyBookmarks *bookmarks;
-	const char *content;
-	char *address;
+	EphyNode *smart_bmk;
+	const char *content, *argument = NULL;
+	char *address = NULL;
 	EphyLocationControllerPrivate *priv;
 
 	priv = controller->priv;
@@ -157,7 +164,25 @@ entry_activate_cb (GtkEntry *entry,
 
 	bookmarks = ephy_shell_get_bookmarks (ephy_shell_get_default ());
 
-	address = ephy_bookmarks_resolve_address (bookmarks, content, NULL);
+	/* "keyword arguments" runs the smart bookmark named keyword. */
+	smart_bmk = ephy_bookmarks_find_smart_bookmark (bookmarks, content, &argument);
+	if (smart_bmk != NULL && argument[0] != '\0')
+	{
+		const char *smart_url;
+
+		smart_url = ephy_node_get_property_string
+			(smart_bmk, EPHY_NODE_BMK_PROP_LOCATION);
+		if (smart_url != NULL)
+		{
+			address = ephy_bookmarks_resolve_address
+				(bookmarks, smart_url, argument);
+		}
+	}
+
+	if (address == NULL)
+	{
+		address = ephy_bookmarks_resolve_address (bookmarks, content, NULL);
+	}
 	g_return_if_fail (address != NULL);
 
 	ephy_link_open (EPHY_LINK (controller), g_strstrip (address), NULL, 
@@ -252,11 +277,11 @@ remove_completion_actions (EphyLocationController *controller,
 			   EphyLocationEntry *lentry)
 {
 	GtkEntryCompletion *completion;
-	GList *l;
+	guint i;
 
 	completion = gtk_entry_get_completion (GTK_ENTRY (lentry));
 
-	for (l = controller->priv->actions; l != NULL; l = l->next)
+	for (i = 0; i < controller->priv->actions->len; i++)
 	{
 		gtk_entry_completion_delete_action (completion, 0);
 	}
@@ -270,20 +295,18 @@ add_completion_actions (EphyLocationController *controller,
 			EphyLocationEntry *lentry)
 {
 	GtkEntryCompletion *completion;
-	GList *l;
+	guint i;
 
 	completion = gtk_entry_get_completion (GTK_ENTRY (lentry));
 
-	for (l = controller->priv->actions; l != NULL; l = l->next)
+	for (i = 0; i < controller->priv->actions->len; i++)
 	{
-		EphyNode *bmk = l->data;
+		EphyNode *bmk = g_ptr_array_index (controller->priv->actions, i);
 		const char *title;
-		int index;
 
-		index = g_list_position (controller->priv->actions, l);
 		title = ephy_node_get_property_string
 			(bmk, EPHY_NODE_BMK_PROP_TITLE);
-		gtk_entry_completion_insert_action_text (completion, index, (char*)title);
+		gtk_entry_completion_insert_action_text (completion, i, (char*)title);
 	}
 
 	g_signal_connect (completion, "action_activated",
@@ -687,6 +710,13 @@ compare_actions (gconstpointer a,
 	return retval;
 }
 
+static int
+compare_actions_ptr (gconstpointer a,
+		     gconstpointer b)
+{
+	return compare_actions (*(EphyNode **)a, *(EphyNode **)b);
+}
+
 static void
 init_actions_list (EphyLocationController *controller)
 {
@@ -694,32 +724,81 @@ init_actions_list (EphyLocationController *controller)
 	int i;
 
 	children = ephy_node_get_children (controller->priv->smart_bmks);
+	controller->priv->actions = g_ptr_array_sized_new (children->len);
+
 	for (i = 0; i < children->len; i++)
 	{
-		EphyNode *kid;
+		g_ptr_array_add (controller->priv->actions,
+				 g_ptr_array_index (children, i));
+	}
+
+	g_ptr_array_sort (controller->priv->actions, compare_actions_ptr);
+}
 
-		kid = g_ptr_array_index (children, i);
+/* Keeps the sorted actions array and the completion actions in sync one
+ * smart bookmark at a time, instead of rebuilding both on every change. */
+static void
+insert_action (EphyLocationController *controller,
+	       EphyNode *bmk)
+{
+	EphyLocationControllerPrivate *priv = controller->priv;
+	GPtrArray *actions = priv->actions;
+	guint low = 0, high = actions->len;
 
-		controller->priv->actions = g_list_prepend
-			(controller->priv->actions, kid);
+	while (low < high)
+	{
+		guint middle = (low + high) / 2;
+
+		if (compare_actions (g_ptr_array_index (actions, middle), bmk) <= 0)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
 	}
 
-	controller->priv->actions =
-		g_list_sort (controller->priv->actions, (GCompareFunc) compare_actions);
+	g_ptr_array_add (actions, NULL);
+	memmove (actions->pdata + low + 1, actions->pdata + low,
+		 (actions->len - low - 1) * sizeof (gpointer));
+	actions->pdata[low] = bmk;
+
+	if (priv->location_entry != NULL)
+	{
+		GtkEntryCompletion *completion;
+		const char *title;
+
+		completion = gtk_entry_get_completion (GTK_ENTRY (priv->location_entry));
+		title = ephy_node_get_property_string (bmk, EPHY_NODE_BMK_PROP_TITLE);
+		gtk_entry_completion_insert_action_text (completion, low, (char*)title);
+	}
 }
 
 static void
-update_actions_list (EphyLocationController *la)
+remove_action (EphyLocationController *controller,
+	       EphyNode *bmk)
 {
-	EphyLocationControllerPrivate *priv = la->priv;
+	EphyLocationControllerPrivate *priv = controller->priv;
+	guint i;
+
+	/* The title may already have changed, so look the node up by
+	 * identity rather than by bisecting. */
+	for (i = 0; i < priv->actions->len; i++)
+	{
+		if (g_ptr_array_index (priv->actions, i) == bmk) break;
+	}
+	if (i == priv->actions->len) return;
 
-	remove_completion_actions (la, priv->location_entry);
+	g_ptr_array_remove_index (priv->actions, i);
 
-	g_list_free (la->priv->actions);
-	la->priv->actions = NULL;
-	init_actions_list (la);
+	if (priv->location_entry != NULL)
+	{
+		GtkEntryCompletion *completion;
 
-	add_completion_actions (la, priv->location_entry);
+		completion = gtk_entry_get_completion (GTK_ENTRY (priv->location_entry));
+		gtk_entry_completion_delete_action (completion, i);
+	}
 }
 
 static void
@@ -728,7 +807,7 @@ actions_child_removed_cb (EphyNode *node,
 			  guint old_index,
 			  EphyLocationController *controller)
 {
-	update_actions_list (controller);
+	remove_action (controller, child);
 }
 
 static void
@@ -736,7 +815,7 @@ actions_child_added_cb (EphyNode *node,
 			EphyNode *child,
 			EphyLocationController *controller)
 {
-	update_actions_list (controller);
+	insert_action (controller, child);
 }
 
 static void
@@ -745,7 +824,11 @@ actions_child_changed_cb (EphyNode *node,
 			  guint property_id,
 			  EphyLocationController *controller)
 {
-	update_actions_list (controller);
+	/* Only the title is shown, and it is also the sort key. */
+	if (property_id != EPHY_NODE_BMK_PROP_TITLE) return;
+
+	remove_action (controller, child);
+	insert_action (controller, child);
 }
 
 static void
@@ -789,7 +872,7 @@ ephy_location_controller_finalize (GObject *object)
 		g_object_unref (priv->icon);
 	}
 
-	g_list_free (priv->actions);
+	g_ptr_array_free (priv->actions, TRUE);
 	g_free (priv->address);
 	g_free (priv->lock_stock_id);
 
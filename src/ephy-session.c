@@ -41,7 +41,6 @@
 #include <glib/gi18n.h>
 #include <gtk/gtk.h>
 #include <libxml/tree.h>
-#include <libxml/xmlwriter.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -64,17 +63,43 @@ struct _EphySessionPrivate
 	GQueue *queue;
 	guint queue_idle_id;
 
+	/* The serialized <window> and <embed> elements of every window and
+	 * tab; those missing changed since the session was last saved. */
+	GHashTable *window_fragments;
+	GHashTable *tab_fragments;
+
+	guint save_timeout_id;
+	GThread *save_thread;
+	struct _SaveJob *save_job;
+
+	guint n_saves;
+	guint64 bytes_written;
+	GQueue *save_times;
+
+	/* Restored tabs waiting for a free slot to load, the active tab
+	 * of every window first, and those loading, with their start time. */
+	GQueue *restore_queue;
+	GHashTable *restore_loads;
+	guint max_restore_loads;
+	guint n_restore_loads_finished;
+	gint64 restore_load_time;
+
 	guint dont_save : 1;
+	guint save_pending : 1;
 };
 
 #define BOOKMARKS_EDITOR_ID	"BookmarksEditor"
 #define HISTORY_WINDOW_ID	"HistoryWindow"
 #define SESSION_STATE		"type:session_state"
+#define SESSION_SAVE_DELAY	1 /* seconds */
 
 static void ephy_session_class_init	(EphySessionClass *klass);
 static void ephy_session_iface_init	(EphyExtensionIface *iface);
 static void ephy_session_init		(EphySession *session);
 static void session_command_queue_next	(EphySession *session);
+static void session_save_async		(EphySession *session);
+static void session_save_delayed	(EphySession *session);
+static void session_wait_for_save	(EphySession *session);
 
 enum
 {
@@ -128,14 +153,145 @@ session_delete (EphySession *session,
 	g_object_unref (file);
 }
 
+static void
+session_window_changed (EphySession *session,
+			GtkWidget *window)
+{
+	g_hash_table_remove (session->priv->window_fragments, window);
+}
+
+static void
+session_tab_changed (EphySession *session,
+		     EphyEmbed *embed)
+{
+	GtkWidget *window;
+
+	g_hash_table_remove (session->priv->tab_fragments, embed);
+
+	window = gtk_widget_get_toplevel (GTK_WIDGET (embed));
+	if (EPHY_IS_WINDOW (window))
+	{
+		session_window_changed (session, window);
+	}
+}
+
+/* Restore scheduler */
+
+static void
+session_restore_next (EphySession *session)
+{
+	EphySessionPrivate *priv = session->priv;
+
+	while (g_hash_table_size (priv->restore_loads) < priv->max_restore_loads &&
+	       !g_queue_is_empty (priv->restore_queue))
+	{
+		EphyEmbed *embed;
+		EphyWebView *view;
+		gint64 *start;
+
+		embed = g_queue_pop_head (priv->restore_queue);
+		view = ephy_embed_get_web_view (embed);
+
+		/* Selected meanwhile, so it is loading already. */
+		if (!ephy_web_view_is_placeholder (view)) continue;
+
+		start = g_new (gint64, 1);
+		*start = g_get_monotonic_time ();
+		g_hash_table_insert (priv->restore_loads, embed, start);
+
+		ephy_web_view_load_placeholder (view);
+	}
+
+	LOG ("Restoring tabs: %u loading, %u queued",
+	     g_hash_table_size (priv->restore_loads),
+	     g_queue_get_length (priv->restore_queue));
+}
+
+static void
+session_restore_load_finished (EphySession *session,
+			       EphyEmbed *embed)
+{
+	EphySessionPrivate *priv = session->priv;
+	gint64 *start;
+
+	start = g_hash_table_lookup (priv->restore_loads, embed);
+	if (start == NULL) return;
+
+	priv->restore_load_time += g_get_monotonic_time () - *start;
+	priv->n_restore_loads_finished++;
+	g_hash_table_remove (priv->restore_loads, embed);
+
+	session_restore_next (session);
+}
+
+static void
+session_restore_forget_tab (EphySession *session,
+			    EphyEmbed *embed)
+{
+	EphySessionPrivate *priv = session->priv;
+
+	g_queue_remove (priv->restore_queue, embed);
+
+	if (g_hash_table_remove (priv->restore_loads, embed))
+	{
+		session_restore_next (session);
+	}
+}
+
+/* Queues the placeholders restored in @active_tabs and @background_tabs
+ * for loading, the first ahead of every other tab. */
+static void
+session_restore_tabs (EphySession *session,
+		      GQueue *active_tabs,
+		      GQueue *background_tabs)
+{
+	EphySessionPrivate *priv = session->priv;
+	GList *l;
+
+	for (l = active_tabs->tail; l != NULL; l = l->prev)
+	{
+		g_queue_push_head (priv->restore_queue, l->data);
+	}
+
+	for (l = background_tabs->head; l != NULL; l = l->next)
+	{
+		g_queue_push_tail (priv->restore_queue, l->data);
+	}
+
+	priv->max_restore_loads = MAX (1, g_settings_get_uint (EPHY_SETTINGS_MAIN,
+							       EPHY_PREFS_RESTORE_SESSION_MAX_LOADS));
+
+	session_restore_next (session);
+}
+
+static void
+session_restore_clear (EphySession *session)
+{
+	EphySessionPrivate *priv = session->priv;
+
+	g_queue_clear (priv->restore_queue);
+	g_hash_table_remove_all (priv->restore_loads);
+}
+
 #ifdef HAVE_WEBKIT2
 static void
 load_changed_cb (WebKitWebView *view,
 		 WebKitLoadEvent load_event,
 		 EphySession *session)
 {
+	EphyEmbed *embed = EPHY_GET_EMBED_FROM_EPHY_WEB_VIEW (view);
+
 	if (!ephy_web_view_load_failed (EPHY_WEB_VIEW (view)))
-		ephy_session_save (session, SESSION_STATE);
+	{
+		session_tab_changed (session, embed);
+		session_save_delayed (session);
+	}
+
+	/* Failed loads finish too. */
+	if (load_event == WEBKIT_LOAD_FINISHED)
+	{
+		session_restore_load_finished (session, embed);
+	}
 }
 #else
 static void
@@ -150,7 +306,16 @@ load_status_notify_cb (EphyWebView *view,
 	if (status == WEBKIT_LOAD_PROVISIONAL ||
 	    status == WEBKIT_LOAD_COMMITTED || 
 	    status == WEBKIT_LOAD_FINISHED)
-		ephy_session_save (session, SESSION_STATE);
+	{
+		session_tab_changed (session, EPHY_GET_EMBED_FROM_EPHY_WEB_VIEW (view));
+		session_save_delayed (session);
+	}
+
+	if (status == WEBKIT_LOAD_FINISHED ||
+	    status == WEBKIT_LOAD_FAILED)
+	{
+		session_restore_load_finished (session, EPHY_GET_EMBED_FROM_EPHY_WEB_VIEW (view));
+	}
 }
 #endif
 
@@ -160,6 +325,9 @@ notebook_page_added_cb (GtkWidget *notebook,
 			guint position,
 			EphySession *session)
 {
+	session_tab_changed (session, embed);
+	session_save_delayed (session);
+
 #ifdef HAVE_WEBKIT2
 	g_signal_connect (ephy_embed_get_web_view (embed), "load-changed",
 			  G_CALLBACK (load_changed_cb), session);
@@ -175,7 +343,11 @@ notebook_page_removed_cb (GtkWidget *notebook,
 			  guint position,
 			  EphySession *session)
 {
-	ephy_session_save (session, SESSION_STATE);
+	g_hash_table_remove (session->priv->tab_fragments, embed);
+	session_window_changed (session, gtk_widget_get_toplevel (notebook));
+	session_save_delayed (session);
+
+	session_restore_forget_tab (session, embed);
 
 #ifdef HAVE_WEBKIT2
 	g_signal_handlers_disconnect_by_func
@@ -194,7 +366,30 @@ notebook_page_reordered_cb (GtkWidget *notebook,
 			    guint position,
 			    EphySession *session)
 {
-	ephy_session_save (session, SESSION_STATE);
+	session_window_changed (session, gtk_widget_get_toplevel (notebook));
+	session_save_delayed (session);
+}
+
+static void
+notebook_switch_page_cb (GtkWidget *notebook,
+			 GtkWidget *tab,
+			 guint position,
+			 EphySession *session)
+{
+	session_window_changed (session, gtk_widget_get_toplevel (notebook));
+	session_save_delayed (session);
+}
+
+/* Moving or resizing a window alone is not worth a save, but the next
+ * one should have the new geometry. */
+static gboolean
+window_configure_event_cb (GtkWidget *window,
+			   GdkEventConfigure *event,
+			   EphySession *session)
+{
+	session_window_changed (session, window);
+
+	return FALSE;
 }
 
 static gboolean
@@ -508,10 +703,12 @@ impl_attach_window (EphyExtension *extension,
 	LOG ("impl_attach_window");
 
 	session->priv->windows = g_list_append (session->priv->windows, window);
-	ephy_session_save (session, SESSION_STATE);
+	session_save_delayed (session);
 
 	g_signal_connect (window, "focus-in-event",
 			  G_CALLBACK (window_focus_in_event_cb), session);
+	g_signal_connect (window, "configure-event",
+			  G_CALLBACK (window_configure_event_cb), session);
 
 	notebook = ephy_window_get_notebook (window);
 	g_signal_connect (notebook, "page-added",
@@ -520,6 +717,8 @@ impl_attach_window (EphyExtension *extension,
 			  G_CALLBACK (notebook_page_removed_cb), session);
 	g_signal_connect (notebook, "page-reordered",
 			  G_CALLBACK (notebook_page_reordered_cb), session);
+	g_signal_connect (notebook, "switch-page",
+			  G_CALLBACK (notebook_switch_page_cb), session);
 
 	/* Set unique identifier as role, so that on restore, the WM can
 	 * place the window on the right workspace
@@ -543,11 +742,21 @@ impl_detach_window (EphyExtension *extension,
 		    EphyWindow *window)
 {
 	EphySession *session = EPHY_SESSION (extension);
+	GList *tabs, *l;
 
 	LOG ("impl_detach_window");
 
 	session->priv->windows = g_list_remove (session->priv->windows, window);
-	ephy_session_save (session, SESSION_STATE);
+
+	tabs = ephy_embed_container_get_children (EPHY_EMBED_CONTAINER (window));
+	for (l = tabs; l != NULL; l = l->next)
+	{
+		g_hash_table_remove (session->priv->tab_fragments, l->data);
+	}
+	g_list_free (tabs);
+	g_hash_table_remove (session->priv->window_fragments, window);
+
+	session_save_delayed (session);
 
 	/* NOTE: since the window will be destroyed anyway, we don't need to
 	 * disconnect our signal handlers from its components.
@@ -566,6 +775,16 @@ ephy_session_init (EphySession *session)
 	priv = session->priv = EPHY_SESSION_GET_PRIVATE (session);
 
 	priv->queue = g_queue_new ();
+
+	priv->window_fragments = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+							NULL, g_free);
+	priv->tab_fragments = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+						     NULL, g_free);
+	priv->save_times = g_queue_new ();
+
+	priv->restore_queue = g_queue_new ();
+	priv->restore_loads = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+						     NULL, g_free);
 }
 
 static void
@@ -576,6 +795,14 @@ ephy_session_dispose (GObject *object)
 	LOG ("EphySession disposing");
 
 	session_command_queue_clear (session);
+	session_restore_clear (session);
+
+	/* Do not lose the last changes when quitting. */
+	if (session->priv->save_timeout_id != 0 || session->priv->save_pending)
+	{
+		ephy_session_save (session, SESSION_STATE);
+	}
+	session_wait_for_save (session);
 
 	G_OBJECT_CLASS (ephy_session_parent_class)->dispose (object);
 }
@@ -591,6 +818,12 @@ ephy_session_finalize (GObject *object)
 	g_list_free (session->priv->windows);
 	g_list_free (session->priv->tool_windows);
 
+	g_hash_table_destroy (session->priv->window_fragments);
+	g_hash_table_destroy (session->priv->tab_fragments);
+	g_queue_free (session->priv->save_times);
+	g_queue_free (session->priv->restore_queue);
+	g_hash_table_destroy (session->priv->restore_loads);
+
 	G_OBJECT_CLASS (ephy_session_parent_class)->finalize (object);
 }
 
@@ -666,6 +899,12 @@ ephy_session_close (EphySession *session)
 	{
 		EphySessionPrivate *priv = session->priv;
 
+		/* Write what is still due before the windows go away. */
+		if (priv->save_timeout_id != 0 || priv->save_pending)
+		{
+			ephy_session_save (session, SESSION_STATE);
+		}
+
 		priv->dont_save = TRUE;
 
 		session_command_queue_clear (session);
@@ -675,260 +914,501 @@ ephy_session_close (EphySession *session)
 	}
 }
 
-static int
-write_tab (xmlTextWriterPtr writer,
-	   EphyEmbed *embed)
+/* All the attribute values in the session file go through here, so
+ * they are escaped the same way wherever they come from. */
+static void
+append_attribute (GString *string,
+		  const char *name,
+		  const char *value)
 {
+	char *escaped;
+
+	escaped = g_markup_escape_text (value, -1);
+	g_string_append_printf (string, " %s=\"%s\"", name, escaped);
+	g_free (escaped);
+}
+
+static const char *
+get_tab_fragment (EphySession *session,
+		  EphyEmbed *embed)
+{
+	EphyWebView *view;
 	const char *address, *title;
 	char *new_address = NULL;
-	int ret;
+	GString *string;
+	char *fragment;
+
+	fragment = g_hash_table_lookup (session->priv->tab_fragments, embed);
+	if (fragment != NULL) return fragment;
 
-	ret = xmlTextWriterStartElement (writer, (xmlChar *) "embed");
-	if (ret < 0) return ret;
+	view = ephy_embed_get_web_view (embed);
 
-	address = ephy_web_view_get_address (ephy_embed_get_web_view (embed));
+	address = ephy_web_view_get_address (view);
 	/* Do not store ephy-about: URIs, they are not valid for
 	 * loading. */
 	if (g_str_has_prefix (address, EPHY_ABOUT_SCHEME))
 	{
 		new_address = g_strconcat ("about", address + EPHY_ABOUT_SCHEME_LEN, NULL);
+		address = new_address;
 	}
-	ret = xmlTextWriterWriteAttribute (writer, (xmlChar *) "url",
-					   (const xmlChar *) (new_address ? new_address : address));
-	g_free (new_address);
-	if (ret < 0) return ret;
-
-	title = ephy_web_view_get_title (ephy_embed_get_web_view (embed));
-	ret = xmlTextWriterWriteAttribute (writer, (xmlChar *) "title",
-					   (const xmlChar *) title);
-	if (ret < 0) return ret;
 
-	if (ephy_web_view_is_loading (ephy_embed_get_web_view (embed)))
+	title = ephy_web_view_get_title (view);
+	if (title == NULL)
 	{
-		ret = xmlTextWriterWriteAttribute (writer,
-						   (const xmlChar *) "loading",
-						   (const xmlChar *) "true");
-		if (ret < 0) return ret;
+		title = "";
 	}
 
-	ret = xmlTextWriterEndElement (writer); /* embed */
-	return ret;
-}
+	string = g_string_new ("\t \t <embed");
+	append_attribute (string, "url", address);
+	append_attribute (string, "title", title);
+	if (ephy_web_view_is_loading (view))
+	{
+		append_attribute (string, "loading", "true");
+	}
+	g_string_append (string, "/>\n");
+	g_free (new_address);
 
-static int
-write_active_tab (xmlTextWriterPtr writer,
-		  GtkWidget *notebook)
-{
-	int ret;
-	int current;
+	fragment = g_string_free (string, FALSE);
+	g_hash_table_insert (session->priv->tab_fragments, embed, fragment);
 
-	current = gtk_notebook_get_current_page (GTK_NOTEBOOK (notebook));
-    
-	ret = xmlTextWriterWriteFormatAttribute (writer, (const xmlChar *) "active-tab", "%d", current);
-	return ret;
+	return fragment;
 }
-    
 
-static int
-write_window_geometry (xmlTextWriterPtr writer,
-		       GtkWindow *window)
+static void
+append_window_geometry (GString *string,
+			GtkWindow *window)
 {
 	int x = 0, y = 0, width = -1, height = -1;
-	int ret;
 
 	/* get window geometry */
 	gtk_window_get_size (window, &width, &height);
 	gtk_window_get_position (window, &x, &y);
 
-	/* set window properties */
-	ret = xmlTextWriterWriteFormatAttribute (writer, (const xmlChar *) "x", "%d", x);
-	if (ret < 0) return ret;
-
-	ret = xmlTextWriterWriteFormatAttribute (writer, (const xmlChar *) "y", "%d", y);
-	if (ret < 0) return ret;
-
-	ret = xmlTextWriterWriteFormatAttribute (writer, (const xmlChar *) "width", "%d", width);
-	if (ret < 0) return ret;
-
-	ret = xmlTextWriterWriteFormatAttribute (writer, (const xmlChar *) "height", "%d", height);
-	return ret;
+	g_string_append_printf (string, " x=\"%d\" y=\"%d\" width=\"%d\" height=\"%d\"",
+				x, y, width, height);
 }
 
-static int
-write_tool_window (xmlTextWriterPtr writer,
-		   GtkWindow *window)
+static void
+append_tool_window (GString *string,
+		    GtkWindow *window)
 {
-	const xmlChar *id;
-	int ret;
+	const char *id;
 
 	if (EPHY_IS_BOOKMARKS_EDITOR (window))
 	{
-		id = (const xmlChar *) BOOKMARKS_EDITOR_ID;
+		id = BOOKMARKS_EDITOR_ID;
 	}
 	else if (EPHY_IS_HISTORY_WINDOW (window))
 	{
-		id = (const xmlChar *) HISTORY_WINDOW_ID;
+		id = HISTORY_WINDOW_ID;
 	}
 	else
 	{
-		g_return_val_if_reached (-1);
+		g_return_if_reached ();
 	}
 
-	ret = xmlTextWriterStartElement (writer, (const xmlChar *) "toolwindow");
-	if (ret < 0) return ret;
-
-	ret = xmlTextWriterWriteAttribute (writer, (const xmlChar *) "id", id);
-	if (ret < 0) return ret;
-
-	ret = write_window_geometry (writer, window);
-	if (ret < 0) return ret;
-
-	ret = xmlTextWriterEndElement (writer); /* toolwindow */
-	return ret;
+	g_string_append (string, "\t <toolwindow");
+	append_attribute (string, "id", id);
+	append_window_geometry (string, window);
+	g_string_append (string, "/>\n");
 }
 
-static int
-write_ephy_window (xmlTextWriterPtr writer,
-		   EphyWindow *window)
+static const char *
+get_window_fragment (EphySession *session,
+		     EphyWindow *window)
 {
 	GList *tabs, *l;
 	GtkWidget *notebook;
 	const char *role;
-	int ret;
+	GString *fragment;
+	char *cached;
+
+	cached = g_hash_table_lookup (session->priv->window_fragments, window);
+	if (cached != NULL) return cached;
 
 	tabs = ephy_embed_container_get_children (EPHY_EMBED_CONTAINER (window));
 	notebook = ephy_window_get_notebook (window);
 
+	fragment = g_string_new (NULL);
+
 	/* Do not save an empty EphyWindow.
 	 * This only happens when the window was newly opened.
 	 */
-	if (tabs == NULL) return 0;
+	if (tabs != NULL)
+	{
+		g_string_append (fragment, "\t <window");
+		append_window_geometry (fragment, GTK_WINDOW (window));
+		g_string_append_printf (fragment, " active-tab=\"%d\"",
+					gtk_notebook_get_current_page (GTK_NOTEBOOK (notebook)));
 
-	ret = xmlTextWriterStartElement (writer, (xmlChar *) "window");
-	if (ret < 0) return ret;
+		role = gtk_window_get_role (GTK_WINDOW (window));
+		if (role != NULL)
+		{
+			append_attribute (fragment, "role", role);
+		}
+		g_string_append (fragment, ">\n");
 
-	ret = write_window_geometry (writer, GTK_WINDOW (window));
-	if (ret < 0) return ret;
+		for (l = tabs; l != NULL; l = l->next)
+		{
+			g_string_append (fragment,
+					 get_tab_fragment (session, EPHY_EMBED (l->data)));
+		}
+		g_list_free (tabs);
 
-	ret = write_active_tab (writer, notebook);
-	if (ret < 0) return ret;
+		g_string_append (fragment, "\t </window>\n");
+	}
 
-	role = gtk_window_get_role (GTK_WINDOW (window));
-	if (role != NULL)
+	cached = g_string_free (fragment, FALSE);
+	g_hash_table_insert (session->priv->window_fragments, window, cached);
+
+	return cached;
+}
+
+/* Reassembles the session file from the cached fragments, so only the
+ * windows and tabs that changed since the last save are serialized. */
+static char *
+session_build_document (EphySession *session,
+			gsize *length)
+{
+	GString *data;
+	GList *w;
+
+	START_PROFILER ("Serializing session")
+
+	data = g_string_new ("<?xml version=\"1.0\"?>\n<session>\n");
+
+	for (w = session->priv->windows; w != NULL; w = w->next)
 	{
-		ret = xmlTextWriterWriteAttribute (writer, 
-						   (const xmlChar *)"role", 
-						   (const xmlChar *)role);
-		if (ret < 0) return ret;
+		g_string_append (data, get_window_fragment (session, EPHY_WINDOW (w->data)));
 	}
 
-	for (l = tabs; l != NULL; l = l->next)
+	for (w = session->priv->tool_windows; w != NULL; w = w->next)
 	{
-		EphyEmbed *embed = EPHY_EMBED (l->data);
-		ret = write_tab (writer, embed);
-		if (ret < 0) break;
+		append_tool_window (data, GTK_WINDOW (w->data));
 	}
-	g_list_free (tabs);
-	if (ret < 0) return ret;
 
-	ret = xmlTextWriterEndElement (writer); /* window */
-	return ret;
+	g_string_append (data, "</session>\n");
+
+	STOP_PROFILER ("Serializing session")
+
+	*length = data->len;
+
+	return g_string_free (data, FALSE);
 }
 
-gboolean
-ephy_session_save (EphySession *session,
-		   const char *filename)
+/* Writes @data to @path. g_file_set_contents() already replaces the
+ * file atomically, so the previous session stays intact if the write
+ * fails. A %NULL @data deletes the session instead. Safe to call from
+ * any thread. */
+static gboolean
+session_write_file (const char *path,
+		    const char *data,
+		    gsize length)
 {
-	EphySessionPrivate *priv;
-	xmlTextWriterPtr writer;
-	GList *w;
-	GFile *save_to_file, *tmp_file;
-	char *tmp_file_path, *save_to_file_path;
-	int ret;
+	GError *error = NULL;
 
-	g_return_val_if_fail (EPHY_IS_SESSION (session), FALSE);
+	if (data == NULL)
+	{
+		GFile *file;
 
-	priv = session->priv;
+		file = g_file_new_for_path (path);
+		g_file_delete (file, NULL, NULL);
+		g_object_unref (file);
 
-	if (priv->dont_save)
-	{
 		return TRUE;
 	}
 
-	LOG ("ephy_sesion_save %s", filename);
+	if (!g_file_set_contents (path, data, length, &error))
+	{
+		g_warning ("Failed to write session to %s: %s", path, error->message);
+		g_error_free (error);
 
-	if (priv->windows == NULL && priv->tool_windows == NULL)
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void
+prune_save_times (EphySessionPrivate *priv)
+{
+	guint now;
+
+	now = g_get_monotonic_time () / G_USEC_PER_SEC;
+
+	while (!g_queue_is_empty (priv->save_times) &&
+	       now - GPOINTER_TO_UINT (g_queue_peek_head (priv->save_times)) >= 60)
 	{
-		session_delete (session, filename);
-		return TRUE;
+		g_queue_pop_head (priv->save_times);
 	}
+}
 
-	save_to_file = get_session_file (filename);
-	save_to_file_path = g_file_get_path (save_to_file);
-	tmp_file_path = g_strconcat (save_to_file_path, ".tmp", NULL);
-	g_free (save_to_file_path);
-	tmp_file = g_file_new_for_path (tmp_file_path);
+static void
+session_record_save (EphySession *session,
+		     gsize length)
+{
+	EphySessionPrivate *priv = session->priv;
+
+	priv->n_saves++;
+	priv->bytes_written += length;
+
+	g_queue_push_tail (priv->save_times,
+			   GUINT_TO_POINTER ((guint) (g_get_monotonic_time () / G_USEC_PER_SEC)));
+	prune_save_times (priv);
+
+	LOG ("Saved session: %" G_GSIZE_FORMAT " bytes, %u saves in the last minute",
+	     length, g_queue_get_length (priv->save_times));
+}
+
+typedef struct _SaveJob
+{
+	EphySession *session;
+	char *path;
+	char *data;
+	gsize length;
+	gboolean success;
+} SaveJob;
+
+static void
+save_job_free (SaveJob *job)
+{
+	g_free (job->path);
+	g_free (job->data);
+	g_slice_free (SaveJob, job);
+}
+
+static gboolean
+save_job_finished_cb (SaveJob *job)
+{
+	EphySession *session = job->session;
+	EphySessionPrivate *priv = session->priv;
+
+	g_thread_join (priv->save_thread);
+	priv->save_thread = NULL;
+	priv->save_job = NULL;
 
-	/* FIXME: do we want to turn on compression? */
-	writer = xmlNewTextWriterFilename (tmp_file_path, 0);
-	if (writer == NULL)
+	if (job->success)
 	{
-		g_free (tmp_file_path);
+		session_record_save (session, job->length);
+	}
 
-		return FALSE;
+	save_job_free (job);
+
+	/* Everything that changed while we were writing goes in one go. */
+	if (priv->save_pending)
+	{
+		priv->save_pending = FALSE;
+		session_save_async (session);
 	}
 
-	ret = xmlTextWriterSetIndent (writer, 1);
-	if (ret < 0) goto out;
+	return FALSE;
+}
 
-	ret = xmlTextWriterSetIndentString (writer, (const xmlChar *) "	 ");
-	if (ret < 0) goto out;
+static gpointer
+save_thread_func (SaveJob *job)
+{
+	job->success = session_write_file (job->path, job->data, job->length);
 
-	START_PROFILER ("Saving session")
+	g_idle_add ((GSourceFunc) save_job_finished_cb, job);
 
-	ret = xmlTextWriterStartDocument (writer, "1.0", NULL, NULL);
-	if (ret < 0) goto out;
+	return NULL;
+}
 
-	/* create and set the root node for the session */
-	ret = xmlTextWriterStartElement (writer, (const xmlChar *) "session");
-	if (ret < 0) goto out;
+static void
+session_wait_for_save (EphySession *session)
+{
+	EphySessionPrivate *priv = session->priv;
+
+	if (priv->save_thread == NULL) return;
+
+	g_thread_join (priv->save_thread);
+	g_idle_remove_by_data (priv->save_job);
 
-	/* iterate through all the windows */	
-	for (w = session->priv->windows; w != NULL && ret >= 0; w = w->next)
+	if (priv->save_job->success)
 	{
-		ret = write_ephy_window (writer, EPHY_WINDOW (w->data));
+		session_record_save (session, priv->save_job->length);
 	}
-	if (ret < 0) goto out;
 
-	for (w = session->priv->tool_windows; w != NULL && ret >= 0; w = w->next)
+	save_job_free (priv->save_job);
+	priv->save_thread = NULL;
+	priv->save_job = NULL;
+}
+
+/* Only serializing what changed happens here, writing it is left to a
+ * thread. At most one write runs at a time; any number of saves
+ * requested meanwhile are coalesced into a single one when it is done. */
+static void
+session_save_async (EphySession *session)
+{
+	EphySessionPrivate *priv = session->priv;
+	SaveJob *job;
+	GFile *file;
+
+	if (priv->dont_save) return;
+
+	if (priv->save_thread != NULL)
 	{
-		ret = write_tool_window (writer, GTK_WINDOW (w->data));
+		priv->save_pending = TRUE;
+		return;
 	}
-	if (ret < 0) goto out;
 
-	ret = xmlTextWriterEndElement (writer); /* session */
-	if (ret < 0) goto out;
+	LOG ("Saving session in the background");
 
-	ret = xmlTextWriterEndDocument (writer);
+	job = g_slice_new0 (SaveJob);
+	job->session = session;
 
-out:
-	xmlFreeTextWriter (writer);
+	file = get_session_file (SESSION_STATE);
+	job->path = g_file_get_path (file);
+	g_object_unref (file);
 
-	if (ret >= 0)
+	if (priv->windows != NULL || priv->tool_windows != NULL)
 	{
-		if (ephy_file_switch_temp_file (save_to_file, tmp_file) == FALSE)
+		job->data = session_build_document (session, &job->length);
+	}
+
+	priv->save_job = job;
+	priv->save_thread = g_thread_new ("EphySessionSave",
+					  (GThreadFunc) save_thread_func, job);
+}
+
+static gboolean
+save_session_delayed_cb (EphySession *session)
+{
+	session->priv->save_timeout_id = 0;
+
+	session_save_async (session);
+
+	return FALSE;
+}
+
+static void
+session_save_delayed (EphySession *session)
+{
+	EphySessionPrivate *priv = session->priv;
+
+	if (priv->dont_save) return;
+
+	/* Forgetting the session cannot wait, we may be about to quit. */
+	if (priv->windows == NULL && priv->tool_windows == NULL)
+	{
+		ephy_session_save (session, SESSION_STATE);
+		return;
+	}
+
+	if (priv->save_timeout_id == 0)
+	{
+		priv->save_timeout_id =
+			g_timeout_add_seconds (SESSION_SAVE_DELAY,
+					       (GSourceFunc) save_session_delayed_cb,
+					       session);
+	}
+}
+
+/**
+ * ephy_session_save:
+ * @session: an #EphySession
+ * @filename: the path of the destination file
+ *
+ * Saves the session to @filename right away. Changes to the session
+ * are otherwise saved in the background shortly after they happen;
+ * this waits for such a save to finish, and takes over any that is
+ * due, so that it cannot overwrite this one.
+ *
+ * Return value: %TRUE if the session was saved
+ **/
+gboolean
+ephy_session_save (EphySession *session,
+		   const char *filename)
+{
+	EphySessionPrivate *priv;
+	GFile *save_to_file;
+	char *save_to_file_path;
+	char *data = NULL;
+	gsize length = 0;
+	gboolean ret;
+
+	g_return_val_if_fail (EPHY_IS_SESSION (session), FALSE);
+
+	priv = session->priv;
+
+	if (strcmp (filename, SESSION_STATE) == 0)
+	{
+		if (priv->save_timeout_id != 0)
 		{
-			ret = -1;
+			g_source_remove (priv->save_timeout_id);
+			priv->save_timeout_id = 0;
 		}
+		priv->save_pending = FALSE;
 	}
 
-	g_free (tmp_file_path);
+	session_wait_for_save (session);
+
+	if (priv->dont_save)
+	{
+		return TRUE;
+	}
+
+	LOG ("ephy_sesion_save %s", filename);
+
+	if (priv->windows != NULL || priv->tool_windows != NULL)
+	{
+		data = session_build_document (session, &length);
+	}
+
+	save_to_file = get_session_file (filename);
+	save_to_file_path = g_file_get_path (save_to_file);
+
+	ret = session_write_file (save_to_file_path, data, length);
+	if (ret)
+	{
+		session_record_save (session, length);
+	}
+
+	g_free (data);
+	g_free (save_to_file_path);
 	g_object_unref (save_to_file);
-	g_object_unref (tmp_file);
 
-	STOP_PROFILER ("Saving session")
+	return ret;
+}
+
+/**
+ * ephy_session_get_save_statistics:
+ * @session: an #EphySession
+ * @n_saves: (out) (allow-none): return location for the number of saves
+ * @n_saves_last_minute: (out) (allow-none): return location for the
+ * number of saves in the last minute
+ * @bytes_written: (out) (allow-none): return location for the number of
+ * bytes all saves wrote
+ *
+ * Tells how often, and how much, @session has been written to disk since
+ * it was created, whether in the background or by ephy_session_save().
+ **/
+void
+ephy_session_get_save_statistics (EphySession *session,
+				  guint *n_saves,
+				  guint *n_saves_last_minute,
+				  guint64 *bytes_written)
+{
+	EphySessionPrivate *priv;
+
+	g_return_if_fail (EPHY_IS_SESSION (session));
+
+	priv = session->priv;
+
+	prune_save_times (priv);
 
-	return ret >= 0 ? TRUE : FALSE;
+	if (n_saves != NULL)
+	{
+		*n_saves = priv->n_saves;
+	}
+	if (n_saves_last_minute != NULL)
+	{
+		*n_saves_last_minute = g_queue_get_length (priv->save_times);
+	}
+	if (bytes_written != NULL)
+	{
+		*bytes_written = priv->bytes_written;
+	}
 }
 
 static void
@@ -938,7 +1418,8 @@ confirm_before_recover (EphyWindow* window, char* url, char* title)
 
 	embed = ephy_shell_new_tab (ephy_shell, window, NULL, NULL,
 				    EPHY_NEW_TAB_IN_EXISTING_WINDOW |
-				    EPHY_NEW_TAB_APPEND_LAST);
+				    EPHY_NEW_TAB_APPEND_LAST |
+				    EPHY_NEW_TAB_RESTORE);
 
 	ephy_web_view_load_error_page (ephy_embed_get_web_view (embed), url,
 			               EPHY_WEB_VIEW_ERROR_PAGE_CRASH, NULL);
@@ -947,12 +1428,19 @@ confirm_before_recover (EphyWindow* window, char* url, char* title)
 static void 
 parse_embed (xmlNodePtr child,
 	     EphyWindow *window,
-	     EphySession *session)
+	     EphySession *session,
+	     int active_tab,
+	     GQueue *active_tabs,
+	     GQueue *background_tabs)
 {
 	EphySessionPrivate *priv = session->priv;
 	gboolean is_first_window;
+	gboolean delay_loads;
+	int position = 0;
 
 	is_first_window = window == EPHY_WINDOW (priv->resume_window);
+	delay_loads = g_settings_get_boolean (EPHY_SETTINGS_MAIN,
+					      EPHY_PREFS_RESTORE_SESSION_DELAYING_LOADS);
 
 	while (child != NULL)
 	{
@@ -997,10 +1485,38 @@ parse_embed (xmlNodePtr child,
 				}
 				else
 				{
-					ephy_shell_new_tab (ephy_shell, window, NULL, recover_url,
-							    EPHY_NEW_TAB_IN_EXISTING_WINDOW |
-							    EPHY_NEW_TAB_OPEN_PAGE |
-							    EPHY_NEW_TAB_APPEND_LAST);
+					EphyEmbed *embed;
+					GtkWidget *notebook;
+					xmlChar *title;
+
+					title = xmlGetProp (child, (const xmlChar *) "title");
+
+					embed = ephy_shell_new_tab (ephy_shell, window, NULL, NULL,
+								    EPHY_NEW_TAB_IN_EXISTING_WINDOW |
+								    EPHY_NEW_TAB_APPEND_LAST |
+								    EPHY_NEW_TAB_RESTORE);
+
+					/* Tabs load when the restore scheduler gets to
+					 * them, or when they are selected; with delayed
+					 * loads, only the active one is queued. It is
+					 * selected before it becomes a placeholder so that
+					 * it does not jump the queue. */
+					if (position == active_tab)
+					{
+						notebook = ephy_window_get_notebook (window);
+						gtk_notebook_set_current_page (GTK_NOTEBOOK (notebook),
+									       gtk_notebook_page_num (GTK_NOTEBOOK (notebook),
+												      GTK_WIDGET (embed)));
+						g_queue_push_tail (active_tabs, embed);
+					}
+					else if (!delay_loads)
+					{
+						g_queue_push_tail (background_tabs, embed);
+					}
+
+					ephy_web_view_set_placeholder (ephy_embed_get_web_view (embed),
+								       recover_url, (const char *) title);
+					xmlFree (title);
 				}
 			}
 			else if (was_loading && url != NULL &&
@@ -1015,6 +1531,7 @@ parse_embed (xmlNodePtr child,
 			}
 
 			xmlFree (url);
+			position++;
 		}
 
 		child = child->next;
@@ -1105,6 +1622,8 @@ ephy_session_load_from_string (EphySession *session,
 	EphyWindow *window;
 	GtkWidget *widget = NULL;
 	gboolean first_window_created = FALSE;
+	GQueue active_tabs = G_QUEUE_INIT;
+	GQueue background_tabs = G_QUEUE_INIT;
 	
 	g_return_val_if_fail (EPHY_IS_SESSION (session), FALSE);
 	g_return_val_if_fail (session_data, FALSE);
@@ -1138,6 +1657,8 @@ ephy_session_load_from_string (EphySession *session,
 		{
 			xmlChar *tmp;
 			EphyEmbed *active_child;
+			GtkWidget *notebook;
+			int active_tab = 0;
 		    
 			if (first_window_created == FALSE && priv->resume_window != NULL)
 			{
@@ -1152,25 +1673,20 @@ ephy_session_load_from_string (EphySession *session,
 
 			ephy_gui_window_update_user_time (widget, user_time);
 
-			/* Now add the tabs */
-			parse_embed (child->children, window, session);
-
-			/* Set focus to something sane */
 			tmp = xmlGetProp (child, (xmlChar *) "active-tab");
-			if (tmp != NULL)
+			if (!int_from_string ((char *) tmp, &active_tab))
 			{
-				gboolean success;
-				int active_tab;
-
-				success = int_from_string ((char *) tmp, &active_tab);
-				xmlFree (tmp);
-				if (success)
-				{
-					GtkWidget *notebook;
-					notebook = ephy_window_get_notebook (window);
-					gtk_notebook_set_current_page (GTK_NOTEBOOK (notebook), active_tab);
-				}
+				active_tab = 0;
 			}
+			xmlFree (tmp);
+
+			/* Now add the tabs */
+			parse_embed (child->children, window, session, active_tab,
+				     &active_tabs, &background_tabs);
+
+			/* Set focus to something sane */
+			notebook = ephy_window_get_notebook (window);
+			gtk_notebook_set_current_page (GTK_NOTEBOOK (notebook), active_tab);
 
 			if (ephy_embed_shell_get_mode (embed_shell) != EPHY_EMBED_SHELL_MODE_TEST)
 			{
@@ -1216,10 +1732,14 @@ ephy_session_load_from_string (EphySession *session,
 
 	xmlFreeDoc (doc);
 
+	session_restore_tabs (session, &active_tabs, &background_tabs);
+	g_queue_clear (&active_tabs);
+	g_queue_clear (&background_tabs);
+
 	priv->dont_save = FALSE;
 	priv->resume_window = NULL;
 
-	ephy_session_save (session, SESSION_STATE);
+	session_save_delayed (session);
 
 	g_object_unref (ephy_shell_get_default ());
 
@@ -1274,6 +1794,67 @@ ephy_session_load (EphySession *session,
 	return ret_value;
 }
 
+/**
+ * ephy_session_get_restore_status:
+ * @session: an #EphySession
+ * @n_queued: (out) (allow-none): return location for the number of
+ * restored tabs waiting to load
+ * @n_loading: (out) (allow-none): return location for the number of
+ * restored tabs loading
+ * @eta: (out) (allow-none): return location for an estimate of the
+ * seconds until all of them are loaded, or -1 if there is none yet
+ *
+ * Tells how far restoring tabs went. At most as many as the
+ * restore-session-max-loads setting says load at the same time,
+ * starting with the active tab of every window.
+ **/
+void
+ephy_session_get_restore_status (EphySession *session,
+				 guint *n_queued,
+				 guint *n_loading,
+				 int *eta)
+{
+	EphySessionPrivate *priv;
+	guint queued, loading;
+
+	g_return_if_fail (EPHY_IS_SESSION (session));
+
+	priv = session->priv;
+
+	queued = g_queue_get_length (priv->restore_queue);
+	loading = g_hash_table_size (priv->restore_loads);
+
+	if (n_queued != NULL)
+	{
+		*n_queued = queued;
+	}
+	if (n_loading != NULL)
+	{
+		*n_loading = loading;
+	}
+	if (eta != NULL)
+	{
+		if (queued + loading == 0)
+		{
+			*eta = 0;
+		}
+		else if (priv->n_restore_loads_finished == 0)
+		{
+			*eta = -1;
+		}
+		else
+		{
+			gint64 average;
+			guint max_loads;
+
+			/* Loads go in rounds of as many as run at once. */
+			average = priv->restore_load_time / priv->n_restore_loads_finished;
+			max_loads = MAX (priv->max_restore_loads, 1);
+			*eta = average * ((queued + loading + max_loads - 1) / max_loads) / G_USEC_PER_SEC;
+		}
+	}
+}
+
 /**
  * ephy_session_get_windows:
  * @session: the #EphySession
@@ -1307,7 +1888,7 @@ ephy_session_add_window (EphySession *session,
 		g_list_append (session->priv->tool_windows, window);
 	gtk_application_add_window (GTK_APPLICATION (ephy_shell_get_default ()), window);
 
-	ephy_session_save (session, SESSION_STATE);
+	session_save_delayed (session);
 }
 
 /**
@@ -1328,7 +1909,7 @@ ephy_session_remove_window (EphySession *session,
 		g_list_remove (session->priv->tool_windows, window);
 	gtk_application_remove_window (GTK_APPLICATION (ephy_shell_get_default ()), window);
 
-	ephy_session_save (session, SESSION_STATE);
+	session_save_delayed (session);
 }
 
 /**
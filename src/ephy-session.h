@@ -86,6 +86,16 @@ gboolean	 ephy_session_load_from_string	(EphySession *session,
 
 void		 ephy_session_close		(EphySession *session);
 
+void		 ephy_session_get_save_statistics (EphySession *session,
+						   guint *n_saves,
+						   guint *n_saves_last_minute,
+						   guint64 *bytes_written);
+
+void		 ephy_session_get_restore_status (EphySession *session,
+						  guint *n_queued,
+						  guint *n_loading,
+						  int *eta);
+
 GList		*ephy_session_get_windows	(EphySession *session);
 
 void		 ephy_session_add_window	(EphySession *session,
@@ -39,6 +39,7 @@
 #include "ephy-private.h"
 #include "ephy-session.h"
 #include "ephy-settings.h"
+#include "ephy-tab-discarder.h"
 #include "ephy-type-builtins.h"
 #include "ephy-web-view.h"
 #include "ephy-window.h"
@@ -51,9 +52,17 @@
 
 #define EPHY_SHELL_GET_PRIVATE(object)(G_TYPE_INSTANCE_GET_PRIVATE ((object), EPHY_TYPE_SHELL, EphyShellPrivate))
 
+/* Blank embeds are kept ready for new tabs. The pool grows while tabs
+ * are opened in quick succession, and shrinks back once they stop. */
+#define EMBED_POOL_MIN_SIZE       1
+#define EMBED_POOL_MAX_SIZE       4
+#define EMBED_POOL_BURST_INTERVAL (2 * G_USEC_PER_SEC)
+#define EMBED_POOL_IDLE_INTERVAL  60 /* seconds */
+
 struct _EphyShellPrivate {
   EphySession *session;
   GObject *lockdown;
+  GObject *tab_discarder;
   EphyBookmarks *bookmarks;
   EphyExtensionsManager *extensions_manager;
   GNetworkMonitor *network_monitor;
@@ -63,6 +72,13 @@ struct _EphyShellPrivate {
   GObject *prefs_dialog;
   GList *del_on_exit;
   EphyShellStartupContext *startup_context;
+  GQueue embed_pool;
+  guint embed_pool_size;
+  guint embed_pool_refill_id;
+  guint embed_pool_shrink_id;
+  guint embed_pool_hits;
+  guint embed_pool_misses;
+  gint64 last_new_tab_time;
   guint embed_single_connected : 1;
 };
 
@@ -569,12 +585,113 @@ download_started_cb (WebKitWebContext *web_context,
 }
 #endif
 
+static void
+destroy_pooled_embed (EphyEmbed *embed)
+{
+  gtk_widget_destroy (GTK_WIDGET (embed));
+  g_object_unref (embed);
+}
+
+static EphyEmbed *
+create_pooled_embed (void)
+{
+  EphyEmbed *embed;
+
+  embed = EPHY_EMBED (g_object_new (EPHY_TYPE_EMBED, NULL));
+  g_object_ref_sink (embed);
+  gtk_widget_show (GTK_WIDGET (embed));
+
+  return embed;
+}
+
+static gboolean
+embed_pool_refill_cb (EphyShell *shell)
+{
+  EphyShellPrivate *priv = shell->priv;
+
+  while (g_queue_get_length (&priv->embed_pool) > priv->embed_pool_size)
+    destroy_pooled_embed (g_queue_pop_tail (&priv->embed_pool));
+
+  if (g_queue_get_length (&priv->embed_pool) == priv->embed_pool_size) {
+    priv->embed_pool_refill_id = 0;
+    return FALSE;
+  }
+
+  /* One embed per iteration, so that input never waits for long. */
+  g_queue_push_tail (&priv->embed_pool, create_pooled_embed ());
+
+  return TRUE;
+}
+
+static gboolean
+embed_pool_shrink_cb (EphyShell *shell)
+{
+  EphyShellPrivate *priv = shell->priv;
+
+  priv->embed_pool_shrink_id = 0;
+  priv->embed_pool_size = EMBED_POOL_MIN_SIZE;
+
+  while (g_queue_get_length (&priv->embed_pool) > priv->embed_pool_size)
+    destroy_pooled_embed (g_queue_pop_tail (&priv->embed_pool));
+
+  LOG ("Embed pool: no new tabs for a while, size %u", priv->embed_pool_size);
+
+  return FALSE;
+}
+
+/* Returns a new reference to a blank, shown embed. Tabs the user did
+ * not open one by one, like restored ones, do not resize the pool. */
+static EphyEmbed *
+embed_pool_take (EphyShell *shell,
+                 gboolean user_action)
+{
+  EphyShellPrivate *priv = shell->priv;
+  EphyEmbed *embed;
+  gint64 now;
+
+  if (user_action) {
+    now = g_get_monotonic_time ();
+    if (priv->last_new_tab_time != 0 &&
+        now - priv->last_new_tab_time < EMBED_POOL_BURST_INTERVAL)
+      priv->embed_pool_size = MIN (priv->embed_pool_size + 1, EMBED_POOL_MAX_SIZE);
+    priv->last_new_tab_time = now;
+
+    /* Give the extra embeds back once the burst is over. */
+    if (priv->embed_pool_shrink_id != 0)
+      g_source_remove (priv->embed_pool_shrink_id);
+    priv->embed_pool_shrink_id = 0;
+    if (priv->embed_pool_size > EMBED_POOL_MIN_SIZE)
+      priv->embed_pool_shrink_id = g_timeout_add_seconds (EMBED_POOL_IDLE_INTERVAL,
+                                                          (GSourceFunc) embed_pool_shrink_cb,
+                                                          shell);
+  }
+
+  embed = g_queue_pop_head (&priv->embed_pool);
+  if (embed != NULL)
+    priv->embed_pool_hits++;
+  else {
+    priv->embed_pool_misses++;
+    embed = create_pooled_embed ();
+  }
+
+  LOG ("Embed pool: %u hits, %u misses, size %u",
+       priv->embed_pool_hits, priv->embed_pool_misses, priv->embed_pool_size);
+
+  if (priv->embed_pool_refill_id == 0)
+    priv->embed_pool_refill_id = g_idle_add_full (G_PRIORITY_LOW,
+                                                  (GSourceFunc) embed_pool_refill_cb,
+                                                  shell, NULL);
+
+  return embed;
+}
+
 static void
 ephy_shell_init (EphyShell *shell)
 {
   EphyShell **ptr = &ephy_shell;
 
   shell->priv = EPHY_SHELL_GET_PRIVATE (shell);
+  shell->priv->embed_pool_size = EMBED_POOL_MIN_SIZE;
 
   /* globally accessible singleton */
   g_assert (ephy_shell == NULL);
@@ -597,6 +714,19 @@ ephy_shell_dispose (GObject *object)
 
   LOG ("EphyShell disposing");
 
+  if (priv->embed_pool_refill_id != 0) {
+    g_source_remove (priv->embed_pool_refill_id);
+    priv->embed_pool_refill_id = 0;
+  }
+
+  if (priv->embed_pool_shrink_id != 0) {
+    g_source_remove (priv->embed_pool_shrink_id);
+    priv->embed_pool_shrink_id = 0;
+  }
+
+  while (!g_queue_is_empty (&priv->embed_pool))
+    destroy_pooled_embed (g_queue_pop_head (&priv->embed_pool));
+
   if (shell->priv->extensions_manager != NULL) {
     LOG ("Unref extension manager");
     /* this will unload the extensions */
@@ -616,6 +746,12 @@ ephy_shell_dispose (GObject *object)
     priv->lockdown = NULL;
   }
 
+  if (priv->tab_discarder != NULL) {
+    LOG ("Unref tab discarder");
+    g_object_unref (priv->tab_discarder);
+    priv->tab_discarder = NULL;
+  }
+
   if (priv->bme != NULL) {
     LOG ("Unref Bookmarks Editor");
     gtk_widget_destroy (GTK_WIDGET (priv->bme));
@@ -762,11 +898,9 @@ ephy_shell_new_tab_full (EphyShell *shell,
   }
 
   if (active_is_blank == FALSE) {
-    embed = EPHY_EMBED (g_object_new (EPHY_TYPE_EMBED, NULL));
-    g_assert (embed != NULL);
-    gtk_widget_show (GTK_WIDGET (embed));
-
+    embed = embed_pool_take (shell, (flags & EPHY_NEW_TAB_RESTORE) == 0);
     ephy_embed_container_add_child (EPHY_EMBED_CONTAINER (window), embed, position, jump_to);
+    g_object_unref (embed);
   }
 
   if (copy_history && previous_embed != NULL) {
@@ -859,6 +993,35 @@ ephy_shell_new_tab (EphyShell *shell,
   return embed;
 }
 
+/**
+ * ephy_shell_get_embed_pool_statistics:
+ * @shell: the #EphyShell
+ * @n_hits: (out) (allow-none): return location for the number of new
+ * tabs that got a ready embed
+ * @n_misses: (out) (allow-none): return location for the number of new
+ * tabs that had to wait for one to be built
+ * @size: (out) (allow-none): return location for the number of embeds
+ * the shell tries to keep ready now
+ *
+ * Tells how well the embeds kept ready for new tabs keep up with the
+ * tabs being opened.
+ **/
+void
+ephy_shell_get_embed_pool_statistics (EphyShell *shell,
+                                      guint *n_hits,
+                                      guint *n_misses,
+                                      guint *size)
+{
+  g_return_if_fail (EPHY_IS_SHELL (shell));
+
+  if (n_hits != NULL)
+    *n_hits = shell->priv->embed_pool_hits;
+  if (n_misses != NULL)
+    *n_misses = shell->priv->embed_pool_misses;
+  if (size != NULL)
+    *size = shell->priv->embed_pool_size;
+}
+
 /**
  * ephy_shell_get_session:
  * @shell: the #EphyShell
@@ -913,6 +1076,40 @@ ephy_shell_get_lockdown (EphyShell *shell)
   return G_OBJECT (shell->priv->session);
 }
 
+/**
+ * ephy_shell_get_tab_discarder:
+ * @shell: the #EphyShell
+ *
+ * Returns the #EphyTabDiscarder, which unloads background tabs when
+ * memory runs short. There is none with WebKit2, where an unloaded tab
+ * would lose its back history and scroll position, and the pages live
+ * in the web process anyway.
+ *
+ * Return value: (transfer none): the tab discarder, or %NULL
+ **/
+GObject *
+ephy_shell_get_tab_discarder (EphyShell *shell)
+{
+  g_return_val_if_fail (EPHY_IS_SHELL (shell), NULL);
+
+#ifdef HAVE_WEBKIT2
+  return NULL;
+#else
+  if (shell->priv->tab_discarder == NULL) {
+    EphyExtensionsManager *manager;
+
+    shell->priv->tab_discarder = g_object_new (EPHY_TYPE_TAB_DISCARDER, NULL);
+
+    manager = EPHY_EXTENSIONS_MANAGER
+      (ephy_shell_get_extensions_manager (shell));
+    ephy_extensions_manager_register (manager,
+                                      G_OBJECT (shell->priv->tab_discarder));
+  }
+
+  return shell->priv->tab_discarder;
+#endif
+}
+
 /**
  * ephy_shell_get_bookmarks:
  *
@@ -947,6 +1144,9 @@ ephy_shell_get_extensions_manager (EphyShell *es)
 
     /* FIXME */
     ephy_shell_get_lockdown (es);
+#ifndef HAVE_WEBKIT2
+    ephy_shell_get_tab_discarder (es);
+#endif
     ephy_embed_shell_get_adblock_manager (embed_shell);
   }
 
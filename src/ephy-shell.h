@@ -77,6 +77,9 @@ extern EphyShell *ephy_shell;
  *        blank.
  * @EPHY_NEW_TAB_DONT_COPY_HISTORY: do not copy the back-forward history
  *        from the current active tab to the new one.
+ * @EPHY_NEW_TAB_RESTORE: the new tab restores a saved or unloaded one,
+ *        not a tab the user asked for, so it does not make more blank
+ *        tabs be kept ready.
  *
  * Controls how new tabs/windows are created and handled.
  */
@@ -102,7 +105,7 @@ typedef enum {
   /* The way to load */
   EPHY_NEW_TAB_FROM_EXTERNAL      = 1 << 12,
   EPHY_NEW_TAB_DONT_COPY_HISTORY  = 1 << 13,
-  
+  EPHY_NEW_TAB_RESTORE            = 1 << 14,
 } EphyNewTabFlags;
 
 typedef enum {
@@ -159,8 +162,15 @@ EphyEmbed      *ephy_shell_new_tab_full                 (EphyShell *shell,
                                                          gboolean is_popup,
                                                          guint32 user_time);
 
+void            ephy_shell_get_embed_pool_statistics    (EphyShell *shell,
+                                                         guint *n_hits,
+                                                         guint *n_misses,
+                                                         guint *size);
+
 GObject        *ephy_shell_get_session                  (EphyShell *shell);
 
+GObject        *ephy_shell_get_tab_discarder            (EphyShell *shell);
+
 GObject        *ephy_shell_get_net_monitor              (EphyShell *shell);
 
 EphyBookmarks  *ephy_shell_get_bookmarks                (EphyShell *shell);
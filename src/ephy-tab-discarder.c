@@ -0,0 +1,481 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2012 Igalia S.L.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include "config.h"
+#include "ephy-tab-discarder.h"
+
+#include "ephy-debug.h"
+#include "ephy-embed-container.h"
+#include "ephy-embed.h"
+#include "ephy-extension.h"
+#include "ephy-prefs.h"
+#include "ephy-settings.h"
+#include "ephy-shell.h"
+#include "ephy-smaps.h"
+#include "ephy-web-view.h"
+#include "ephy-window.h"
+
+#include <gtk/gtk.h>
+#include <string.h>
+
+/**
+ * SECTION:ephy-tab-discarder
+ * @short_description: Unloads background tabs when memory runs short
+ *
+ * #EphyTabDiscarder samples the memory the browser uses every few
+ * seconds. When it goes over the budget set in the
+ * tab-discard-memory-limit setting, or the kernel tells the system is
+ * short of memory, the background tab that was used least recently is
+ * replaced by a placeholder that keeps its title, address, icon, back
+ * history and scroll position, and loads the page again once selected.
+ */
+
+/* Seconds between memory samples. After unloading a tab, the next sample
+ * comes sooner, as one tab may not be enough. */
+#define CHECK_INTERVAL 10
+#define DISCARD_INTERVAL 2
+
+/* Percentage of the time since the last sample in which some task
+ * waited for memory, from which the system counts as short of it. The
+ * kernel's own averages are not used: they take seconds to fall, so
+ * they would keep reporting the pressure a discard already relieved. */
+#define PRESSURE_THRESHOLD 10.0
+
+#define EPHY_TAB_DISCARDER_GET_PRIVATE(object) (G_TYPE_INSTANCE_GET_PRIVATE ((object), EPHY_TYPE_TAB_DISCARDER, EphyTabDiscarderPrivate))
+
+struct _EphyTabDiscarderPrivate {
+  /* EphyEmbed -> the value of use_count when last selected. */
+  GHashTable *last_used;
+  guint use_count;
+
+  guint n_windows;
+  guint check_id;
+
+  EphySMaps *smaps;
+  guint64 pressure_total;
+  gint64 pressure_time;
+  EphyTabDiscarderMemoryFunc memory_func;
+  gpointer memory_data;
+  GDestroyNotify memory_destroy;
+
+  guint usage_before_discard;
+  guint n_discarded;
+  guint64 reclaimed;
+  guint discard_pending : 1;
+};
+
+static void ephy_tab_discarder_iface_init (EphyExtensionIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (EphyTabDiscarder, ephy_tab_discarder, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (EPHY_TYPE_EXTENSION,
+                                                ephy_tab_discarder_iface_init))
+
+static gboolean
+system_under_pressure (EphyTabDiscarder *discarder)
+{
+  EphyTabDiscarderPrivate *priv = discarder->priv;
+  char *contents, *line_end, *total;
+  guint64 stalled;
+  gint64 now;
+  gboolean under_pressure = FALSE;
+
+  /* Only in Linux 4.20 and later. */
+  if (!g_file_get_contents ("/proc/pressure/memory", &contents, NULL, NULL))
+    return FALSE;
+
+  /* The "some" line comes first; total is the time stalled, in us. */
+  line_end = strchr (contents, '\n');
+  if (line_end != NULL)
+    *line_end = '\0';
+
+  total = g_str_has_prefix (contents, "some ") ? strstr (contents, "total=") : NULL;
+  if (total == NULL) {
+    g_free (contents);
+    return FALSE;
+  }
+
+  stalled = g_ascii_strtoull (total + strlen ("total="), NULL, 10);
+  now = g_get_monotonic_time ();
+
+  if (priv->pressure_time != 0 && now > priv->pressure_time && stalled >= priv->pressure_total)
+    under_pressure = (stalled - priv->pressure_total) * 100.0 / (now - priv->pressure_time) >= PRESSURE_THRESHOLD;
+
+  priv->pressure_total = stalled;
+  priv->pressure_time = now;
+
+  g_free (contents);
+
+  return under_pressure;
+}
+
+static guint
+default_memory_func (gboolean *under_pressure,
+                     EphyTabDiscarder *discarder)
+{
+  EphyTabDiscarderPrivate *priv = discarder->priv;
+
+  if (priv->smaps == NULL)
+    priv->smaps = ephy_smaps_new ();
+
+  *under_pressure = system_under_pressure (discarder);
+
+  /* Only the UI process: there is no discarder with WebKit2, see
+   * ephy_shell_get_tab_discarder(). */
+  return ephy_smaps_get_private_size (priv->smaps);
+}
+
+static void
+touch_embed (EphyTabDiscarder *discarder,
+             EphyEmbed *embed)
+{
+  EphyTabDiscarderPrivate *priv = discarder->priv;
+
+  g_hash_table_insert (priv->last_used, embed, GUINT_TO_POINTER (++priv->use_count));
+}
+
+static gboolean
+can_discard (EphyEmbed *embed)
+{
+  GtkWidget *window;
+  EphyWebView *view;
+
+  window = gtk_widget_get_toplevel (GTK_WIDGET (embed));
+  if (!EPHY_IS_WINDOW (window))
+    return FALSE;
+
+  if (ephy_embed_container_get_active_child (EPHY_EMBED_CONTAINER (window)) == embed)
+    return FALSE;
+
+  view = ephy_embed_get_web_view (embed);
+
+  return !ephy_web_view_is_placeholder (view) &&
+         !ephy_web_view_get_is_blank (view) &&
+         !ephy_web_view_is_loading (view);
+}
+
+static EphyEmbed *
+find_least_recently_used (EphyTabDiscarder *discarder)
+{
+  GHashTableIter iter;
+  gpointer key, value;
+  EphyEmbed *lru = NULL;
+  guint lru_used = G_MAXUINT;
+
+  g_hash_table_iter_init (&iter, discarder->priv->last_used);
+  while (g_hash_table_iter_next (&iter, &key, &value)) {
+    EphyEmbed *embed = EPHY_EMBED (key);
+
+    if (GPOINTER_TO_UINT (value) >= lru_used || !can_discard (embed))
+      continue;
+
+    /* The most expensive check goes last. Losing what the user typed
+     * would be worse than keeping the page. */
+    if (ephy_web_view_has_modified_forms (ephy_embed_get_web_view (embed)))
+      continue;
+
+    lru = embed;
+    lru_used = GPOINTER_TO_UINT (value);
+  }
+
+  return lru;
+}
+
+static void
+discard_embed (EphyTabDiscarder *discarder,
+               EphyEmbed *embed)
+{
+  EphyWindow *window;
+  EphyEmbed *placeholder;
+
+  window = EPHY_WINDOW (gtk_widget_get_toplevel (GTK_WIDGET (embed)));
+
+  LOG ("Discarding tab %p (%s)", embed,
+       ephy_web_view_get_address (ephy_embed_get_web_view (embed)));
+
+  /* Destroying the web view is the only way to really get back what the
+   * page holds, so a blank tab takes its place. */
+  placeholder = ephy_shell_new_tab (ephy_shell, window, embed, NULL,
+                                    EPHY_NEW_TAB_IN_EXISTING_WINDOW |
+                                    EPHY_NEW_TAB_APPEND_AFTER |
+                                    EPHY_NEW_TAB_DONT_COPY_HISTORY |
+                                    EPHY_NEW_TAB_DONT_SHOW_WINDOW |
+                                    EPHY_NEW_TAB_RESTORE);
+  ephy_web_view_copy_placeholder (ephy_embed_get_web_view (embed),
+                                  ephy_embed_get_web_view (placeholder));
+
+  gtk_widget_destroy (GTK_WIDGET (embed));
+}
+
+/**
+ * ephy_tab_discarder_check:
+ * @discarder: an #EphyTabDiscarder
+ *
+ * Samples the memory in use now and, if it is over the budget or the
+ * system is short of memory, unloads the background tab that was used
+ * least recently. This is done periodically, but can be called to check
+ * right away.
+ *
+ * Return value: %TRUE if a tab was unloaded
+ **/
+gboolean
+ephy_tab_discarder_check (EphyTabDiscarder *discarder)
+{
+  EphyTabDiscarderPrivate *priv;
+  EphyEmbed *embed;
+  gboolean under_pressure = FALSE;
+  guint usage, limit;
+
+  g_return_val_if_fail (EPHY_IS_TAB_DISCARDER (discarder), FALSE);
+
+  priv = discarder->priv;
+
+  if (priv->memory_func != NULL)
+    usage = priv->memory_func (&under_pressure, priv->memory_data);
+  else
+    usage = default_memory_func (&under_pressure, discarder);
+
+  /* Whatever went away since the last tab was unloaded is put down to
+   * it. Not exact, but the memory of a page is not known otherwise. */
+  if (priv->discard_pending) {
+    priv->discard_pending = FALSE;
+    if (usage < priv->usage_before_discard)
+      priv->reclaimed += priv->usage_before_discard - usage;
+  }
+
+  limit = g_settings_get_uint (EPHY_SETTINGS_MAIN,
+                               EPHY_PREFS_TAB_DISCARD_MEMORY_LIMIT) * 1024;
+
+  if (!under_pressure && (limit == 0 || usage == 0 || usage <= limit))
+    return FALSE;
+
+  embed = find_least_recently_used (discarder);
+  if (embed == NULL) {
+    LOG ("Using %u kB, but there are no tabs to discard", usage);
+    return FALSE;
+  }
+
+  discard_embed (discarder, embed);
+
+  priv->n_discarded++;
+  priv->usage_before_discard = usage;
+  priv->discard_pending = TRUE;
+
+  return TRUE;
+}
+
+static void schedule_check (EphyTabDiscarder *discarder, guint interval);
+
+static gboolean
+check_timeout_cb (EphyTabDiscarder *discarder)
+{
+  discarder->priv->check_id = 0;
+
+  schedule_check (discarder,
+                  ephy_tab_discarder_check (discarder) ? DISCARD_INTERVAL : CHECK_INTERVAL);
+
+  return FALSE;
+}
+
+static void
+schedule_check (EphyTabDiscarder *discarder,
+                guint interval)
+{
+  EphyTabDiscarderPrivate *priv = discarder->priv;
+
+  if (priv->check_id != 0)
+    g_source_remove (priv->check_id);
+
+  priv->check_id = g_timeout_add_seconds (interval,
+                                          (GSourceFunc) check_timeout_cb,
+                                          discarder);
+}
+
+/**
+ * ephy_tab_discarder_set_memory_func:
+ * @discarder: an #EphyTabDiscarder
+ * @func: (allow-none): the function that measures memory, or %NULL
+ * @user_data: data for @func
+ * @destroy: (allow-none): frees @user_data when @func is replaced
+ *
+ * Replaces the way @discarder measures the memory in use, which is by
+ * default the private memory of the process and the memory pressure the
+ * kernel reports. Mostly useful for testing.
+ **/
+void
+ephy_tab_discarder_set_memory_func (EphyTabDiscarder *discarder,
+                                    EphyTabDiscarderMemoryFunc func,
+                                    gpointer user_data,
+                                    GDestroyNotify destroy)
+{
+  EphyTabDiscarderPrivate *priv;
+
+  g_return_if_fail (EPHY_IS_TAB_DISCARDER (discarder));
+
+  priv = discarder->priv;
+
+  if (priv->memory_destroy != NULL)
+    priv->memory_destroy (priv->memory_data);
+
+  priv->memory_func = func;
+  priv->memory_data = user_data;
+  priv->memory_destroy = destroy;
+  priv->discard_pending = FALSE;
+}
+
+/**
+ * ephy_tab_discarder_get_statistics:
+ * @discarder: an #EphyTabDiscarder
+ * @n_discarded: (out) (allow-none): return location for the number of
+ * tabs unloaded
+ * @reclaimed: (out) (allow-none): return location for the memory that
+ * went away after unloading them, in kB
+ *
+ * Tells how many tabs @discarder unloaded since it was created, and how
+ * much memory that gave back.
+ **/
+void
+ephy_tab_discarder_get_statistics (EphyTabDiscarder *discarder,
+                                   guint *n_discarded,
+                                   guint64 *reclaimed)
+{
+  g_return_if_fail (EPHY_IS_TAB_DISCARDER (discarder));
+
+  if (n_discarded != NULL)
+    *n_discarded = discarder->priv->n_discarded;
+  if (reclaimed != NULL)
+    *reclaimed = discarder->priv->reclaimed;
+}
+
+static void
+switch_page_cb (GtkNotebook *notebook,
+                GtkWidget *page,
+                guint page_num,
+                EphyTabDiscarder *discarder)
+{
+  touch_embed (discarder, EPHY_EMBED (page));
+}
+
+static void
+impl_attach_window (EphyExtension *extension,
+                    EphyWindow *window)
+{
+  EphyTabDiscarder *discarder = EPHY_TAB_DISCARDER (extension);
+
+  g_signal_connect (ephy_window_get_notebook (window), "switch-page",
+                    G_CALLBACK (switch_page_cb), discarder);
+
+  if (discarder->priv->n_windows++ == 0)
+    schedule_check (discarder, CHECK_INTERVAL);
+}
+
+static void
+impl_detach_window (EphyExtension *extension,
+                    EphyWindow *window)
+{
+  EphyTabDiscarder *discarder = EPHY_TAB_DISCARDER (extension);
+  EphyTabDiscarderPrivate *priv = discarder->priv;
+
+  g_signal_handlers_disconnect_by_func (ephy_window_get_notebook (window),
+                                        G_CALLBACK (switch_page_cb), discarder);
+
+  if (--priv->n_windows == 0 && priv->check_id != 0) {
+    g_source_remove (priv->check_id);
+    priv->check_id = 0;
+  }
+}
+
+static void
+impl_attach_tab (EphyExtension *extension,
+                 EphyWindow *window,
+                 EphyEmbed *embed)
+{
+  touch_embed (EPHY_TAB_DISCARDER (extension), embed);
+}
+
+static void
+impl_detach_tab (EphyExtension *extension,
+                 EphyWindow *window,
+                 EphyEmbed *embed)
+{
+  g_hash_table_remove (EPHY_TAB_DISCARDER (extension)->priv->last_used, embed);
+}
+
+static void
+ephy_tab_discarder_init (EphyTabDiscarder *discarder)
+{
+  discarder->priv = EPHY_TAB_DISCARDER_GET_PRIVATE (discarder);
+
+  LOG ("EphyTabDiscarder initialising");
+
+  discarder->priv->last_used = g_hash_table_new (g_direct_hash, g_direct_equal);
+}
+
+static void
+ephy_tab_discarder_dispose (GObject *object)
+{
+  EphyTabDiscarderPrivate *priv = EPHY_TAB_DISCARDER (object)->priv;
+
+  if (priv->check_id != 0) {
+    g_source_remove (priv->check_id);
+    priv->check_id = 0;
+  }
+
+  if (priv->memory_destroy != NULL) {
+    priv->memory_destroy (priv->memory_data);
+    priv->memory_destroy = NULL;
+  }
+
+  if (priv->smaps != NULL) {
+    g_object_unref (priv->smaps);
+    priv->smaps = NULL;
+  }
+
+  G_OBJECT_CLASS (ephy_tab_discarder_parent_class)->dispose (object);
+}
+
+static void
+ephy_tab_discarder_finalize (GObject *object)
+{
+  EphyTabDiscarderPrivate *priv = EPHY_TAB_DISCARDER (object)->priv;
+
+  g_hash_table_destroy (priv->last_used);
+
+  G_OBJECT_CLASS (ephy_tab_discarder_parent_class)->finalize (object);
+}
+
+static void
+ephy_tab_discarder_iface_init (EphyExtensionIface *iface)
+{
+  iface->attach_window = impl_attach_window;
+  iface->detach_window = impl_detach_window;
+  iface->attach_tab = impl_attach_tab;
+  iface->detach_tab = impl_detach_tab;
+}
+
+static void
+ephy_tab_discarder_class_init (EphyTabDiscarderClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = ephy_tab_discarder_dispose;
+  object_class->finalize = ephy_tab_discarder_finalize;
+
+  g_type_class_add_private (object_class, sizeof (EphyTabDiscarderPrivate));
+}
@@ -0,0 +1,80 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2012 Igalia S.L.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#if !defined (__EPHY_EPIPHANY_H_INSIDE__) && !defined (EPIPHANY_COMPILATION)
+#error "Only <epiphany/epiphany.h> can be included directly."
+#endif
+
+#ifndef EPHY_TAB_DISCARDER_H
+#define EPHY_TAB_DISCARDER_H
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define EPHY_TYPE_TAB_DISCARDER         (ephy_tab_discarder_get_type ())
+#define EPHY_TAB_DISCARDER(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), EPHY_TYPE_TAB_DISCARDER, EphyTabDiscarder))
+#define EPHY_TAB_DISCARDER_CLASS(k)     (G_TYPE_CHECK_CLASS_CAST ((k), EPHY_TYPE_TAB_DISCARDER, EphyTabDiscarderClass))
+#define EPHY_IS_TAB_DISCARDER(o)        (G_TYPE_CHECK_INSTANCE_TYPE ((o), EPHY_TYPE_TAB_DISCARDER))
+#define EPHY_IS_TAB_DISCARDER_CLASS(k)  (G_TYPE_CHECK_CLASS_TYPE ((k), EPHY_TYPE_TAB_DISCARDER))
+#define EPHY_TAB_DISCARDER_GET_CLASS(o) (G_TYPE_INSTANCE_GET_CLASS ((o), EPHY_TYPE_TAB_DISCARDER, EphyTabDiscarderClass))
+
+typedef struct _EphyTabDiscarder        EphyTabDiscarder;
+typedef struct _EphyTabDiscarderClass   EphyTabDiscarderClass;
+typedef struct _EphyTabDiscarderPrivate EphyTabDiscarderPrivate;
+
+struct _EphyTabDiscarder {
+  GObject parent;
+
+  /*< private >*/
+  EphyTabDiscarderPrivate *priv;
+};
+
+struct _EphyTabDiscarderClass {
+  GObjectClass parent_class;
+};
+
+/**
+ * EphyTabDiscarderMemoryFunc:
+ * @under_pressure: (out): return location for whether the system is short
+ * of memory
+ * @user_data: the data passed to ephy_tab_discarder_set_memory_func()
+ *
+ * Return value: the memory the browser uses, in kB
+ **/
+typedef guint (* EphyTabDiscarderMemoryFunc) (gboolean *under_pressure,
+                                              gpointer user_data);
+
+GType    ephy_tab_discarder_get_type        (void);
+
+void     ephy_tab_discarder_set_memory_func (EphyTabDiscarder *discarder,
+                                             EphyTabDiscarderMemoryFunc func,
+                                             gpointer user_data,
+                                             GDestroyNotify destroy);
+
+gboolean ephy_tab_discarder_check           (EphyTabDiscarder *discarder);
+
+void     ephy_tab_discarder_get_statistics  (EphyTabDiscarder *discarder,
+                                             guint *n_discarded,
+                                             guint64 *reclaimed);
+
+G_END_DECLS
+
+#endif /* EPHY_TAB_DISCARDER_H */
@@ -3040,6 +3040,9 @@ notebook_switch_page_cb (GtkNotebook *notebook,
 	ephy_window_set_active_tab (window, embed);
 
 	ephy_find_toolbar_set_embed (priv->find_toolbar, embed);
+
+	/* Tabs restored in the background wait until now to load. */
+	ephy_web_view_load_placeholder (ephy_embed_get_web_view (embed));
 }
 
 static GtkNotebook *
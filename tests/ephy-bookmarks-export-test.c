@@ -0,0 +1,303 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ * ephy-bookmarks-export-test.c
+ * This file is part of Epiphany
+ *
+ * Copyright © 2012 Igalia S.L.
+ *
+ * Epiphany is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Epiphany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Epiphany; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+
+#include "ephy-bookmarks-export.h"
+#include "ephy-bookmarks-import.h"
+#include "ephy-debug.h"
+#include "ephy-file-helpers.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gtk/gtk.h>
+#include <string.h>
+
+static EphyBookmarks *
+create_bookmarks (guint n_bookmarks)
+{
+  EphyBookmarks *bookmarks;
+  EphyBookmarkRecord *records;
+  char **topics;
+  guint i;
+
+  bookmarks = ephy_bookmarks_new ();
+
+  records = g_new (EphyBookmarkRecord, n_bookmarks);
+  topics = g_new (char *, 2 * n_bookmarks);
+
+  /* Every third bookmark has no topic. */
+  for (i = 0; i < n_bookmarks; i++) {
+    records[i].title = g_strdup_printf ("Bookmark <%u> & co", i);
+    records[i].address = g_strdup_printf ("http://www.example.com/%u/?a=1&b=2", i);
+    topics[2 * i] = i % 3 ? g_strdup_printf ("Topic %u", i % 10) : NULL;
+    topics[2 * i + 1] = NULL;
+    records[i].topics = &topics[2 * i];
+  }
+
+  g_ptr_array_free (ephy_bookmarks_add_many (bookmarks, records, n_bookmarks), TRUE);
+
+  for (i = 0; i < n_bookmarks; i++) {
+    g_free ((char *)records[i].title);
+    g_free ((char *)records[i].address);
+    g_free (topics[2 * i]);
+  }
+  g_free (records);
+  g_free (topics);
+
+  return bookmarks;
+}
+
+static char *
+get_export_path (const char *name)
+{
+  return g_build_filename (ephy_dot_dir (), name, NULL);
+}
+
+static void
+test_rdf_checksum (void)
+{
+  EphyBookmarks *bookmarks;
+  EphyNodeDbSnapshot *snapshot;
+  EphyNode *bookmark;
+  char *checksum, *other;
+
+  bookmarks = create_bookmarks (20);
+
+  snapshot = ephy_bookmarks_take_snapshot (bookmarks);
+  checksum = ephy_bookmarks_export_get_rdf_checksum (snapshot, "/tmp/bookmarks.rdf");
+  ephy_node_db_snapshot_unref (snapshot);
+
+  /* Nothing changed. */
+  snapshot = ephy_bookmarks_take_snapshot (bookmarks);
+  other = ephy_bookmarks_export_get_rdf_checksum (snapshot, "/tmp/bookmarks.rdf");
+  g_assert_cmpstr (checksum, ==, other);
+  g_free (other);
+
+  /* The file name is part of the export. */
+  other = ephy_bookmarks_export_get_rdf_checksum (snapshot, "/tmp/other.rdf");
+  g_assert_cmpstr (checksum, !=, other);
+  g_free (other);
+  ephy_node_db_snapshot_unref (snapshot);
+
+  /* So are titles and topics. */
+  bookmark = ephy_bookmarks_find_bookmark (bookmarks, "http://www.example.com/4/?a=1&b=2");
+  g_assert (bookmark != NULL);
+  ephy_node_set_property_string (bookmark, EPHY_NODE_BMK_PROP_TITLE, "Renamed");
+
+  snapshot = ephy_bookmarks_take_snapshot (bookmarks);
+  other = ephy_bookmarks_export_get_rdf_checksum (snapshot, "/tmp/bookmarks.rdf");
+  g_assert_cmpstr (checksum, !=, other);
+  g_free (checksum);
+  checksum = other;
+  ephy_node_db_snapshot_unref (snapshot);
+
+  ephy_bookmarks_set_keyword (bookmarks, ephy_bookmarks_add_keyword (bookmarks, "New"), bookmark);
+
+  snapshot = ephy_bookmarks_take_snapshot (bookmarks);
+  other = ephy_bookmarks_export_get_rdf_checksum (snapshot, "/tmp/bookmarks.rdf");
+  g_assert_cmpstr (checksum, !=, other);
+  g_free (other);
+  ephy_node_db_snapshot_unref (snapshot);
+
+  g_free (checksum);
+  g_object_unref (bookmarks);
+}
+
+static void
+test_mozilla (void)
+{
+  EphyBookmarks *bookmarks, *imported;
+  EphyNodeDbSnapshot *snapshot;
+  EphyNode *topic;
+  char *path, *contents;
+
+  bookmarks = create_bookmarks (30);
+  path = get_export_path ("export-mozilla.html");
+
+  snapshot = ephy_bookmarks_take_snapshot (bookmarks);
+  g_assert (ephy_bookmarks_export_snapshot (snapshot, path, EPHY_BOOKMARKS_EXPORT_MOZILLA,
+                                            NULL, NULL, NULL));
+  ephy_node_db_snapshot_unref (snapshot);
+
+  g_assert (g_file_get_contents (path, &contents, NULL, NULL));
+  g_assert (g_str_has_prefix (contents, "<!DOCTYPE NETSCAPE-Bookmark-file-1>"));
+  g_assert (strstr (contents, "<h3>Topic 1</h3>") != NULL);
+  g_assert (strstr (contents, "<a href=\"http://www.example.com/1/?a=1&amp;b=2\">Bookmark &lt;1&gt; &amp; co</a>") != NULL);
+  /* Topics come sorted by name, before the bookmarks without one. */
+  g_assert (strstr (contents, "<h3>Topic 1</h3>") < strstr (contents, "<h3>Topic 2</h3>"));
+  g_assert (strstr (contents, "<h3>Topic 9</h3>") < strstr (contents, "Bookmark &lt;0&gt;"));
+  g_free (contents);
+
+  /* What we write, we can read back. */
+  imported = ephy_bookmarks_new ();
+  g_assert (ephy_bookmarks_import_mozilla (imported, path));
+  g_assert_cmpint (ephy_node_get_n_children (ephy_bookmarks_get_bookmarks (imported)), ==, 30);
+  topic = ephy_bookmarks_find_keyword (imported, "Topic 1", FALSE);
+  g_assert (topic != NULL);
+  g_assert_cmpint (ephy_node_get_n_children (topic), ==, 2);
+  g_object_unref (imported);
+
+  g_unlink (path);
+  g_free (path);
+  g_object_unref (bookmarks);
+}
+
+typedef struct {
+  GMainLoop *loop;
+  gboolean success;
+  guint n_progress;
+  guint last_done;
+  guint last_total;
+} AsyncData;
+
+static void
+export_progress_cb (guint n_done, guint n_total, AsyncData *data)
+{
+  g_assert_cmpuint (n_done, >=, data->last_done);
+  g_assert_cmpuint (n_done, <=, n_total);
+
+  data->n_progress++;
+  data->last_done = n_done;
+  data->last_total = n_total;
+}
+
+static void
+export_finished_cb (EphyBookmarks *bookmarks, gboolean success, AsyncData *data)
+{
+  data->success = success;
+  g_main_loop_quit (data->loop);
+}
+
+static void
+test_async (void)
+{
+  EphyBookmarks *bookmarks;
+  GCancellable *cancellable;
+  AsyncData data = { 0, };
+  char *path;
+
+  bookmarks = create_bookmarks (1000);
+  path = get_export_path ("export-async.rdf");
+  data.loop = g_main_loop_new (NULL, FALSE);
+
+  ephy_bookmarks_export (bookmarks, path, EPHY_BOOKMARKS_EXPORT_RDF, NULL,
+                         (EphyBookmarksExportProgressFunc) export_progress_cb,
+                         (EphyBookmarksExportCallback) export_finished_cb, &data);
+  g_main_loop_run (data.loop);
+
+  g_assert (data.success);
+  g_assert_cmpuint (data.n_progress, >, 0);
+  g_assert_cmpuint (data.last_done, ==, 1000);
+  g_assert_cmpuint (data.last_total, ==, 1000);
+  g_assert (g_file_test (path, G_FILE_TEST_EXISTS));
+  g_unlink (path);
+
+  /* A cancelled export leaves nothing behind. */
+  cancellable = g_cancellable_new ();
+  g_cancellable_cancel (cancellable);
+
+  ephy_bookmarks_export (bookmarks, path, EPHY_BOOKMARKS_EXPORT_MOZILLA, cancellable,
+                         NULL, (EphyBookmarksExportCallback) export_finished_cb, &data);
+  g_main_loop_run (data.loop);
+
+  g_assert (!data.success);
+  g_assert (!g_file_test (path, G_FILE_TEST_EXISTS));
+
+  g_object_unref (cancellable);
+  g_main_loop_unref (data.loop);
+  g_free (path);
+  g_object_unref (bookmarks);
+}
+
+static void
+test_performance (void)
+{
+  EphyBookmarks *bookmarks;
+  EphyNodeDbSnapshot *snapshot;
+  char *path, *checksum;
+  double elapsed;
+
+  if (!g_test_perf ())
+    return;
+
+  bookmarks = create_bookmarks (50000);
+  path = get_export_path ("export-performance");
+
+  g_test_timer_start ();
+  snapshot = ephy_bookmarks_take_snapshot (bookmarks);
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed, "Took a snapshot of 50000 bookmarks in %.3f seconds", elapsed);
+
+  g_test_timer_start ();
+  g_assert (ephy_bookmarks_export_snapshot (snapshot, path, EPHY_BOOKMARKS_EXPORT_RDF, NULL, NULL, NULL));
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed, "Exported 50000 bookmarks as RDF in %.3f seconds", elapsed);
+
+  g_test_timer_start ();
+  g_assert (ephy_bookmarks_export_snapshot (snapshot, path, EPHY_BOOKMARKS_EXPORT_MOZILLA, NULL, NULL, NULL));
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed, "Exported 50000 bookmarks as Mozilla in %.3f seconds", elapsed);
+
+  /* This is what an unchanged automatic export costs. */
+  g_test_timer_start ();
+  checksum = ephy_bookmarks_export_get_rdf_checksum (snapshot, path);
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed, "Checksummed 50000 bookmarks in %.3f seconds", elapsed);
+
+  g_free (checksum);
+  ephy_node_db_snapshot_unref (snapshot);
+  g_unlink (path);
+  g_free (path);
+  g_object_unref (bookmarks);
+}
+
+int
+main (int argc, char *argv[])
+{
+  int ret;
+
+  g_setenv ("GSETTINGS_BACKEND", "memory", TRUE);
+
+  gtk_test_init (&argc, &argv);
+
+  ephy_debug_init ();
+
+  if (!ephy_file_helpers_init (NULL,
+                               EPHY_FILE_HELPERS_PRIVATE_PROFILE | EPHY_FILE_HELPERS_ENSURE_EXISTS,
+                               NULL)) {
+    g_debug ("Something wrong happened with ephy_file_helpers_init()");
+    return -1;
+  }
+
+  g_test_add_func ("/src/bookmarks/ephy-bookmarks-export/rdf_checksum", test_rdf_checksum);
+  g_test_add_func ("/src/bookmarks/ephy-bookmarks-export/mozilla", test_mozilla);
+  g_test_add_func ("/src/bookmarks/ephy-bookmarks-export/async", test_async);
+  g_test_add_func ("/src/bookmarks/ephy-bookmarks-export/performance", test_performance);
+
+  ret = g_test_run ();
+
+  ephy_file_helpers_shutdown ();
+
+  return ret;
+}
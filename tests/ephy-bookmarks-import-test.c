@@ -0,0 +1,330 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ * ephy-bookmarks-import-test.c
+ * This file is part of Epiphany
+ *
+ * Copyright © 2012 Igalia S.L.
+ *
+ * Epiphany is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Epiphany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Epiphany; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+
+#include "ephy-bookmarks-import.h"
+#include "ephy-bookmarks.h"
+#include "ephy-debug.h"
+#include "ephy-file-helpers.h"
+#include "ephy-node-common.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gtk/gtk.h>
+#include <string.h>
+
+static const char *netscape_bookmarks =
+  "<!DOCTYPE NETSCAPE-Bookmark-file-1>\n"
+  "<!-- This is an automatically generated file. -->\n"
+  "<META HTTP-EQUIV=\"Content-Type\" CONTENT=\"text/html; charset=UTF-8\">\n"
+  "<TITLE>Bookmarks</TITLE>\n"
+  "<H1>Bookmarks Menu</H1>\n"
+  "\n"
+  "<DL><p>\n"
+  "    <DT><A HREF=\"http://www.gnome.org/\" ADD_DATE=\"1339000000\">GNOME</A>\n"
+  "    <DT><H3 ADD_DATE=\"1339000000\" LAST_MODIFIED=\"1339000001\">News &amp; Blogs</H3>\n"
+  "    <DL><p>\n"
+  "        <DT><A HREF=\"http://planet.gnome.org/\" ADD_DATE=\"1339000002\" LAST_CHARSET=\"UTF-8\">  Planet GNOME  </A>\n"
+  "        <DT><A HREF=\"http://lwn.net/\">LWN &quot;Weekly&quot; &lt;Edition&gt;</A>\n"
+  "        <DD>Linux news\n"
+  "        <DT><H3>Tech</H3>\n"
+  "        <DL><p>\n"
+  "            <DT><A HREF=\"http://www.igalia.com/\" ICON=\"data:image/png;base64,AAAA\">Igalia</A>\n"
+  "            <DT><A HREF=\"http://www.gnome.org/\">GNOME again</A>\n"
+  "        </DL><p>\n"
+  "        <HR>\n"
+  "    </DL><p>\n"
+  "    <DT><A HREF=\"http://www.webkitgtk.org/\">WebKitGTK+</A>\n"
+  "</DL><p>\n";
+
+/* The regular expressions of the line based parser the streaming one
+ * replaced, kept here as the reference for its output. */
+static void
+reference_parse (const char *contents, GHashTable *expected)
+{
+  GRegex *site, *folder, *folder_end;
+  GList *folders = NULL;
+  char **lines;
+  guint i;
+
+  site = g_regex_new ("<a href=\"(?P<url>[^\"]*).*?>\\s*(?P<name>.*?)\\s*</a>",
+                      G_REGEX_CASELESS, G_REGEX_MATCH_NOTEMPTY, NULL);
+  folder = g_regex_new ("<h3.*>(?P<name>\\w.*)</h3>",
+                        G_REGEX_CASELESS, G_REGEX_MATCH_NOTEMPTY, NULL);
+  folder_end = g_regex_new ("</dl>", G_REGEX_CASELESS, G_REGEX_MATCH_NOTEMPTY, NULL);
+
+  lines = g_strsplit (contents, "\n", -1);
+  for (i = 0; lines[i]; i++) {
+    GMatchInfo *match_info;
+
+    if (g_regex_match (site, lines[i], 0, &match_info)) {
+      char *url = g_match_info_fetch_named (match_info, "url");
+      char *name = g_match_info_fetch_named (match_info, "name");
+      GString *value;
+      GList *l;
+
+      /* The first title wins, topics add up. */
+      value = g_hash_table_lookup (expected, url);
+      if (value == NULL) {
+        value = g_string_new (name);
+        g_hash_table_insert (expected, g_strdup (url), value);
+      }
+      for (l = folders; l; l = l->next)
+        g_string_append_printf (value, "|%s", (char *)l->data);
+
+      g_free (url);
+      g_free (name);
+    } else if (g_match_info_free (match_info),
+               g_regex_match (folder, lines[i], 0, &match_info)) {
+      folders = g_list_append (folders, g_match_info_fetch_named (match_info, "name"));
+    } else if (g_match_info_free (match_info),
+               g_regex_match (folder_end, lines[i], 0, &match_info)) {
+      if (folders) {
+        GList *last = g_list_last (folders);
+
+        g_free (last->data);
+        folders = g_list_delete_link (folders, last);
+      }
+    }
+    g_match_info_free (match_info);
+  }
+
+  g_strfreev (lines);
+  g_list_free_full (folders, g_free);
+  g_regex_unref (site);
+  g_regex_unref (folder);
+  g_regex_unref (folder_end);
+}
+
+static char *
+unescape (const char *string)
+{
+  GString *result = g_string_new (string);
+  const char *entities[][2] = { { "&amp;", "&" }, { "&lt;", "<" }, { "&gt;", ">" }, { "&quot;", "\"" } };
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (entities); i++) {
+    char *p;
+
+    while ((p = strstr (result->str, entities[i][0])) != NULL) {
+      gssize position = p - result->str;
+
+      g_string_erase (result, position, strlen (entities[i][0]));
+      g_string_insert (result, position, entities[i][1]);
+    }
+  }
+
+  return g_string_free (result, FALSE);
+}
+
+static char *
+write_bookmarks_file (const char *contents)
+{
+  char *filename;
+
+  filename = g_build_filename (ephy_dot_dir (), "bookmarks.html", NULL);
+  g_assert (g_file_set_contents (filename, contents, -1, NULL));
+
+  return filename;
+}
+
+static void
+test_import_mozilla (void)
+{
+  EphyBookmarks *bookmarks;
+  EphyNode *all, *keywords;
+  GHashTable *expected;
+  GHashTableIter iter;
+  gpointer key, value;
+  char *filename;
+  guint i;
+
+  expected = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                    (GDestroyNotify)g_string_free);
+  reference_parse (netscape_bookmarks, expected);
+  g_assert_cmpuint (g_hash_table_size (expected), ==, 5);
+
+  bookmarks = ephy_bookmarks_new ();
+  filename = write_bookmarks_file (netscape_bookmarks);
+  g_assert (ephy_bookmarks_import_mozilla (bookmarks, filename));
+
+  all = ephy_bookmarks_get_bookmarks (bookmarks);
+  keywords = ephy_bookmarks_get_keywords (bookmarks);
+  g_assert_cmpuint (ephy_node_get_n_children (all), ==, g_hash_table_size (expected));
+
+  g_hash_table_iter_init (&iter, expected);
+  while (g_hash_table_iter_next (&iter, &key, &value)) {
+    EphyNode *node;
+    char **fields, *title;
+    guint n_topics = 0;
+
+    node = ephy_bookmarks_find_bookmark (bookmarks, key);
+    g_assert (node != NULL);
+
+    fields = g_strsplit (((GString *)value)->str, "|", -1);
+    title = unescape (fields[0]);
+    g_assert_cmpstr (ephy_node_get_property_string (node, EPHY_NODE_BMK_PROP_TITLE), ==, title);
+    g_free (title);
+
+    for (i = 1; fields[i]; i++) {
+      char *name = unescape (fields[i]);
+      EphyNode *topic = ephy_bookmarks_find_keyword (bookmarks, name, FALSE);
+
+      g_assert (topic != NULL);
+      g_assert (ephy_node_has_child (topic, node));
+      g_free (name);
+    }
+
+    for (i = 0; i < ephy_node_get_n_children (keywords); i++) {
+      EphyNode *topic = ephy_node_get_nth_child (keywords, i);
+
+      if (ephy_node_get_property_int (topic, EPHY_NODE_KEYWORD_PROP_PRIORITY) == EPHY_NODE_NORMAL_PRIORITY &&
+          ephy_node_has_child (topic, node))
+        n_topics++;
+    }
+    g_assert_cmpuint (n_topics, ==, g_strv_length (fields) - 1);
+
+    g_strfreev (fields);
+  }
+
+  g_unlink (filename);
+  g_free (filename);
+  g_hash_table_destroy (expected);
+  g_object_unref (bookmarks);
+}
+
+static void
+test_import_mozilla_odd_markup (void)
+{
+  EphyBookmarks *bookmarks;
+  EphyNode *node, *topic;
+  char *filename;
+
+  /* Things the line based parser did not handle: several items on a
+   * line, tags spanning lines, unquoted or single quoted attributes and
+   * folders with no name. */
+  bookmarks = ephy_bookmarks_new ();
+  filename = write_bookmarks_file
+    ("<DL><DT><H3>Outer</H3><DL><DT><H3></H3><DL><DT><A HREF=\"http://a.example.com/\">A</A>"
+     "</DL></DL><DT><A\n  HREF=http://b.example.com/ >B</A></DL>"
+     "<DT><A NAME=\"anchor\">Not a bookmark</A>"
+     "<DT><A HREF='http://c.example.com/' TITLE='Say \"a > b\"'>C</A>");
+  g_assert (ephy_bookmarks_import_mozilla (bookmarks, filename));
+
+  g_assert_cmpuint (ephy_node_get_n_children (ephy_bookmarks_get_bookmarks (bookmarks)), ==, 3);
+
+  topic = ephy_bookmarks_find_keyword (bookmarks, "Outer", FALSE);
+  g_assert (topic != NULL);
+
+  node = ephy_bookmarks_find_bookmark (bookmarks, "http://a.example.com/");
+  g_assert (node != NULL);
+  g_assert (ephy_node_has_child (topic, node));
+
+  node = ephy_bookmarks_find_bookmark (bookmarks, "http://b.example.com/");
+  g_assert (node != NULL);
+  g_assert_cmpstr (ephy_node_get_property_string (node, EPHY_NODE_BMK_PROP_TITLE), ==, "B");
+  g_assert (!ephy_node_has_child (topic, node));
+
+  node = ephy_bookmarks_find_bookmark (bookmarks, "http://c.example.com/");
+  g_assert (node != NULL);
+  g_assert_cmpstr (ephy_node_get_property_string (node, EPHY_NODE_BMK_PROP_TITLE), ==, "C");
+
+  g_unlink (filename);
+  g_free (filename);
+  g_object_unref (bookmarks);
+}
+
+static void
+test_import_mozilla_performance (void)
+{
+  EphyBookmarks *bookmarks;
+  GString *contents;
+  char *filename;
+  double elapsed;
+  guint i;
+
+  if (!g_test_perf ())
+    return;
+
+  contents = g_string_new ("<!DOCTYPE NETSCAPE-Bookmark-file-1>\n<DL><p>\n");
+  for (i = 0; i < 60000; i++) {
+    if (i % 100 == 0)
+      g_string_append_printf (contents, "%s<DT><H3 ADD_DATE=\"1339000000\">Folder %u</H3>\n<DL><p>\n",
+                              i ? "</DL><p>\n" : "", i / 100);
+
+    g_string_append_printf (contents,
+                            "<DT><A HREF=\"http://www.example.com/%u/index.html?q=%u&amp;r=1\" ADD_DATE=\"1339000000\" "
+                            "LAST_MODIFIED=\"1339000000\" ICON_URI=\"http://www.example.com/favicon.ico\">Bookmark &amp; %u</A>\n",
+                            i, i, i);
+  }
+  g_string_append (contents, "</DL><p>\n</DL><p>\n");
+
+  filename = write_bookmarks_file (contents->str);
+  bookmarks = ephy_bookmarks_new ();
+
+  g_test_timer_start ();
+  g_assert (ephy_bookmarks_import_mozilla (bookmarks, filename));
+  elapsed = g_test_timer_elapsed ();
+
+  g_test_minimized_result (elapsed, "Imported 60000 bookmarks (%.1f MB) in %.3f seconds",
+                           contents->len / (1024.0 * 1024.0), elapsed);
+  g_test_message ("%.1f MB/s", contents->len / (1024.0 * 1024.0) / elapsed);
+
+  g_assert_cmpuint (ephy_node_get_n_children (ephy_bookmarks_get_bookmarks (bookmarks)), ==, 60000);
+
+  g_unlink (filename);
+  g_free (filename);
+  g_string_free (contents, TRUE);
+  g_object_unref (bookmarks);
+}
+
+int
+main (int argc, char *argv[])
+{
+  int ret;
+
+  /* Importing checks the lockdown settings. */
+  g_setenv ("GSETTINGS_BACKEND", "memory", TRUE);
+
+  gtk_test_init (&argc, &argv);
+
+  ephy_debug_init ();
+
+  if (!ephy_file_helpers_init (NULL,
+                               EPHY_FILE_HELPERS_PRIVATE_PROFILE | EPHY_FILE_HELPERS_ENSURE_EXISTS,
+                               NULL)) {
+    g_debug ("Something wrong happened with ephy_file_helpers_init()");
+    return -1;
+  }
+
+  g_test_add_func ("/src/bookmarks/ephy-bookmarks-import/mozilla", test_import_mozilla);
+  g_test_add_func ("/src/bookmarks/ephy-bookmarks-import/mozilla_odd_markup", test_import_mozilla_odd_markup);
+  g_test_add_func ("/src/bookmarks/ephy-bookmarks-import/mozilla_performance", test_import_mozilla_performance);
+
+  ret = g_test_run ();
+
+  ephy_file_helpers_shutdown ();
+
+  return ret;
+}
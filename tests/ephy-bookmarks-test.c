@@ -0,0 +1,379 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ * ephy-bookmarks-test.c
+ * This file is part of Epiphany
+ *
+ * Copyright © 2012 Igalia S.L.
+ *
+ * Epiphany is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Epiphany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Epiphany; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+
+#include "ephy-bookmarks.h"
+#include "ephy-debug.h"
+#include "ephy-file-helpers.h"
+#include "ephy-node-common.h"
+
+#include <glib.h>
+#include <gtk/gtk.h>
+#include <string.h>
+
+static int tree_changed;
+
+static void
+tree_changed_cb (EphyBookmarks *bookmarks)
+{
+  tree_changed++;
+}
+
+static void
+test_add_many (void)
+{
+  EphyBookmarks *bookmarks;
+  EphyNode *gnome, *news, *existing, *not_categorized;
+  GPtrArray *nodes;
+  char *gnome_topics[] = { "GNOME", NULL };
+  char *both_topics[] = { "GNOME", "News", NULL };
+  char *no_name_topics[] = { "", NULL };
+  EphyBookmarkRecord records[] = {
+    { "Planet GNOME", "http://planet.gnome.org/", gnome_topics },
+    { "LWN", "http://lwn.net/", NULL },
+    { NULL, NULL, gnome_topics },
+    { "Planet again", "http://planet.gnome.org/", both_topics },
+    { "", "http://www.igalia.com/", no_name_topics },
+    { "Existing", "http://www.webkitgtk.org/", gnome_topics }
+  };
+
+  bookmarks = ephy_bookmarks_new ();
+  g_signal_connect (bookmarks, "tree-changed", G_CALLBACK (tree_changed_cb), NULL);
+  not_categorized = ephy_bookmarks_get_not_categorized (bookmarks);
+
+  existing = ephy_bookmarks_add (bookmarks, "WebKitGTK+", "http://www.webkitgtk.org/");
+  g_assert (ephy_node_has_child (not_categorized, existing));
+
+  tree_changed = 0;
+  nodes = ephy_bookmarks_add_many (bookmarks, records, G_N_ELEMENTS (records));
+  g_assert_cmpint (tree_changed, ==, 1);
+
+  g_assert_cmpuint (nodes->len, ==, G_N_ELEMENTS (records));
+  g_assert (g_ptr_array_index (nodes, 2) == NULL);
+  g_assert (g_ptr_array_index (nodes, 0) == g_ptr_array_index (nodes, 3));
+  g_assert (g_ptr_array_index (nodes, 5) == existing);
+  g_assert_cmpint (ephy_node_get_n_children (ephy_bookmarks_get_bookmarks (bookmarks)), ==, 4);
+
+  /* The first title wins, topics add up. */
+  g_assert_cmpstr (ephy_node_get_property_string (g_ptr_array_index (nodes, 0), EPHY_NODE_BMK_PROP_TITLE),
+                   ==, "Planet GNOME");
+  g_assert_cmpstr (ephy_node_get_property_string (g_ptr_array_index (nodes, 4), EPHY_NODE_BMK_PROP_TITLE),
+                   ==, "Untitled");
+
+  gnome = ephy_bookmarks_find_keyword (bookmarks, "GNOME", FALSE);
+  news = ephy_bookmarks_find_keyword (bookmarks, "News", FALSE);
+  g_assert (gnome != NULL);
+  g_assert (news != NULL);
+  g_assert_cmpint (ephy_node_get_n_children (gnome), ==, 2);
+  g_assert (ephy_node_has_child (news, g_ptr_array_index (nodes, 0)));
+
+  g_assert (!ephy_node_has_child (not_categorized, g_ptr_array_index (nodes, 0)));
+  g_assert (!ephy_node_has_child (not_categorized, existing));
+  g_assert (ephy_node_has_child (not_categorized, g_ptr_array_index (nodes, 1)));
+  g_assert (ephy_node_has_child (not_categorized, g_ptr_array_index (nodes, 4)));
+
+  /* Topics are searchable through the keywords of their bookmarks. */
+  g_assert (strstr (ephy_node_get_property_string (g_ptr_array_index (nodes, 0), EPHY_NODE_BMK_PROP_KEYWORDS),
+                    "news") != NULL);
+  g_assert (strstr (ephy_node_get_property_string (existing, EPHY_NODE_BMK_PROP_KEYWORDS),
+                    "gnome") != NULL);
+
+  g_ptr_array_free (nodes, TRUE);
+  g_object_unref (bookmarks);
+}
+
+static void
+test_find_equivalent (void)
+{
+  EphyBookmarks *bookmarks;
+  EphyNode *bookmark, *exact;
+  GPtrArray *identical, *similar;
+
+  bookmarks = ephy_bookmarks_new ();
+  bookmark = ephy_bookmarks_add (bookmarks, "Igalia", "http://www.igalia.com/about/?lang=en");
+
+  g_assert (ephy_bookmarks_find_equivalent_bookmark (bookmarks, "http://www.igalia.com/about/?lang=en") == bookmark);
+  g_assert (ephy_bookmarks_find_equivalent_bookmark (bookmarks, "HTTP://WWW.Igalia.com:80/about?lang=en") == bookmark);
+  g_assert (ephy_bookmarks_find_equivalent_bookmark (bookmarks, "http://www.igalia.com/about//?lang=en#team") == bookmark);
+
+  /* The path and the query are not folded. */
+  g_assert (ephy_bookmarks_find_equivalent_bookmark (bookmarks, "http://www.igalia.com/About/?lang=en") == NULL);
+  g_assert (ephy_bookmarks_find_equivalent_bookmark (bookmarks, "http://www.igalia.com/about/?lang=es") == NULL);
+  g_assert (ephy_bookmarks_find_equivalent_bookmark (bookmarks, "http://www.igalia.com:8080/about/?lang=en") == NULL);
+  g_assert (ephy_bookmarks_find_equivalent_bookmark (bookmarks, "https://www.igalia.com/about/?lang=en") == NULL);
+
+  /* An exact match wins. */
+  exact = ephy_bookmarks_add (bookmarks, "Igalia again", "http://www.igalia.com:80/about?lang=en");
+  g_assert (ephy_bookmarks_find_equivalent_bookmark (bookmarks, "http://www.igalia.com:80/about?lang=en") == exact);
+  g_assert (ephy_bookmarks_find_equivalent_bookmark (bookmarks, "http://www.igalia.com/about/?lang=en") == bookmark);
+
+  /* Similar bookmarks use the same normalization, minus the query. */
+  ephy_bookmarks_add (bookmarks, "Igalia in Spanish", "http://WWW.IGALIA.COM/about/?lang=es");
+  ephy_bookmarks_add (bookmarks, "Not Igalia", "http://www.igalia.org/about/");
+
+  identical = g_ptr_array_new ();
+  similar = g_ptr_array_new ();
+  g_assert_cmpint (ephy_bookmarks_get_similar (bookmarks, bookmark, identical, similar), ==, 2);
+  g_assert_cmpuint (identical->len, ==, 0);
+  g_assert_cmpuint (similar->len, ==, 2);
+  g_ptr_array_free (identical, TRUE);
+  g_ptr_array_free (similar, TRUE);
+
+  g_object_unref (bookmarks);
+}
+
+static void
+test_complete_topic (void)
+{
+  EphyBookmarks *bookmarks;
+  EphyNode *gnome, *shell, *epiphany;
+  GPtrArray *topics;
+  guint i;
+
+  bookmarks = ephy_bookmarks_new ();
+  gnome = ephy_bookmarks_add_keyword (bookmarks, "GNOME");
+  shell = ephy_bookmarks_add_keyword (bookmarks, "Gnome Shell");
+  ephy_bookmarks_add_keyword (bookmarks, "GTK+");
+  epiphany = ephy_bookmarks_add_keyword (bookmarks, "\xc3\x89piphany");
+
+  topics = g_ptr_array_new ();
+  g_assert_cmpuint (ephy_bookmarks_complete_topic (bookmarks, "gN", topics), ==, 2);
+  g_assert (g_ptr_array_index (topics, 0) == gnome);
+  g_assert (g_ptr_array_index (topics, 1) == shell);
+  g_assert_cmpuint (ephy_bookmarks_complete_topic (bookmarks, "gnomes", topics), ==, 0);
+  g_ptr_array_set_size (topics, 0);
+
+  /* Special topics like "All" are never completed. */
+  g_assert_cmpuint (ephy_bookmarks_complete_topic (bookmarks, "", topics), >=, 4);
+  for (i = 0; i < topics->len; i++)
+    g_assert_cmpint (ephy_node_get_property_int (g_ptr_array_index (topics, i),
+                                                 EPHY_NODE_KEYWORD_PROP_PRIORITY),
+                     ==, EPHY_NODE_NORMAL_PRIORITY);
+  g_assert (ephy_bookmarks_lookup_topic (bookmarks, "All") != NULL);
+  g_ptr_array_set_size (topics, 0);
+
+  /* Neither case nor how accents are composed matter. */
+  g_assert (ephy_bookmarks_lookup_topic (bookmarks, "gnome") == gnome);
+  g_assert (ephy_bookmarks_lookup_topic (bookmarks, "E\xcc\x81PIPHANY") == epiphany);
+  g_assert_cmpuint (ephy_bookmarks_complete_topic (bookmarks, "\xc3\xa9pi", topics), ==, 1);
+  g_ptr_array_set_size (topics, 0);
+  g_assert_cmpstr (ephy_bookmarks_get_topic_key (bookmarks, shell), ==, "gnome shell");
+
+  /* The index follows renames. */
+  ephy_node_set_property_string (shell, EPHY_NODE_KEYWORD_PROP_NAME, "Shell");
+  g_assert_cmpuint (ephy_bookmarks_complete_topic (bookmarks, "gnome", topics), ==, 1);
+  g_assert (ephy_bookmarks_lookup_topic (bookmarks, "SHELL") == shell);
+
+  g_ptr_array_free (topics, TRUE);
+  g_object_unref (bookmarks);
+}
+
+static void
+test_complete_topic_performance (void)
+{
+  EphyBookmarks *bookmarks;
+  GPtrArray *topics;
+  char name[32];
+  double elapsed;
+  guint i, n_matches = 0;
+
+  if (!g_test_perf ())
+    return;
+
+  bookmarks = ephy_bookmarks_new ();
+  for (i = 0; i < 10000; i++) {
+    g_snprintf (name, sizeof (name), "Topic %u", i);
+    ephy_bookmarks_add_keyword (bookmarks, name);
+  }
+
+  topics = g_ptr_array_new ();
+
+  /* What typing "Topic 1234" costs, one keystroke at a time. */
+  g_test_timer_start ();
+  for (i = 1; i <= strlen ("Topic 1234"); i++) {
+    g_strlcpy (name, "Topic 1234", i + 1);
+    g_ptr_array_set_size (topics, 0);
+    n_matches += ephy_bookmarks_complete_topic (bookmarks, name, topics);
+  }
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed, "Completed a topic among 10000 in %.3f seconds", elapsed);
+  g_test_message ("Topics matched: %u", n_matches);
+
+  g_ptr_array_free (topics, TRUE);
+  g_object_unref (bookmarks);
+}
+
+static gpointer
+count_view_locations (EphyBookmarksView *view)
+{
+  const char * const *locations;
+  guint n = 0;
+
+  for (locations = ephy_bookmarks_view_get_locations (view); *locations; locations++)
+    if (g_str_has_prefix (*locations, "http://"))
+      n++;
+
+  return GUINT_TO_POINTER (n);
+}
+
+static void
+test_view (void)
+{
+  EphyBookmarks *bookmarks;
+  EphyBookmarksView *view, *other;
+  EphyNode *igalia, *gnome;
+  GThread *thread;
+  guint i, n;
+
+  bookmarks = ephy_bookmarks_new ();
+  igalia = ephy_bookmarks_add (bookmarks, "Igalia", "http://www.igalia.com/");
+  gnome = ephy_bookmarks_add (bookmarks, "GNOME", "http://www.gnome.org/");
+
+  view = ephy_bookmarks_get_view (bookmarks);
+  n = ephy_bookmarks_view_get_n_bookmarks (view);
+  g_assert_cmpuint (n, ==, ephy_node_get_n_children (ephy_bookmarks_get_bookmarks (bookmarks)));
+
+  for (i = 0; i < n; i++)
+    if (ephy_bookmarks_view_get_id (view, i) == ephy_node_get_id (igalia))
+      break;
+  g_assert_cmpuint (i, <, n);
+  g_assert_cmpstr (ephy_bookmarks_view_get_titles (view)[i], ==, "Igalia");
+  g_assert_cmpstr (ephy_bookmarks_view_get_locations (view)[i], ==, "http://www.igalia.com/");
+  g_assert (ephy_bookmarks_view_get_locations (view)[n] == NULL);
+
+  /* Nothing changed, so the same view is shared. */
+  other = ephy_bookmarks_get_view (bookmarks);
+  g_assert (other == view);
+  ephy_bookmarks_view_unref (other);
+
+  /* Views do not follow changes, they are replaced. */
+  ephy_node_set_property_string (igalia, EPHY_NODE_BMK_PROP_TITLE, "Igalia S.L.");
+  other = ephy_bookmarks_get_view (bookmarks);
+  g_assert (other != view);
+  g_assert_cmpuint (ephy_bookmarks_view_get_version (other), >, ephy_bookmarks_view_get_version (view));
+  g_assert_cmpstr (ephy_bookmarks_view_get_titles (view)[i], ==, "Igalia");
+  ephy_bookmarks_view_unref (other);
+
+  ephy_node_unref (gnome);
+  other = ephy_bookmarks_get_view (bookmarks);
+  g_assert_cmpuint (ephy_bookmarks_view_get_n_bookmarks (other), ==, n - 1);
+  ephy_bookmarks_view_unref (other);
+
+  /* A view can be read from another thread while the bookmarks change. */
+  thread = g_thread_new ("test-view", (GThreadFunc) count_view_locations, view);
+  ephy_bookmarks_add (bookmarks, "WebKitGTK+", "http://www.webkitgtk.org/");
+  g_assert_cmpuint (GPOINTER_TO_UINT (g_thread_join (thread)), ==,
+                    GPOINTER_TO_UINT (count_view_locations (view)));
+
+  ephy_bookmarks_view_unref (view);
+  g_object_unref (bookmarks);
+}
+
+static double
+time_add_many (EphyBookmarks *bookmarks, guint first, guint n_records)
+{
+  EphyBookmarkRecord *records;
+  char **topics;
+  double elapsed;
+  guint i;
+
+  records = g_new (EphyBookmarkRecord, n_records);
+  topics = g_new (char *, 2 * n_records);
+
+  for (i = 0; i < n_records; i++) {
+    records[i].title = g_strdup_printf ("Bookmark %u", first + i);
+    records[i].address = g_strdup_printf ("http://www.example.com/%u/", first + i);
+    topics[2 * i] = g_strdup_printf ("Topic %u", (first + i) % 200);
+    topics[2 * i + 1] = NULL;
+    records[i].topics = &topics[2 * i];
+  }
+
+  g_test_timer_start ();
+  g_ptr_array_free (ephy_bookmarks_add_many (bookmarks, records, n_records), TRUE);
+  elapsed = g_test_timer_elapsed ();
+
+  for (i = 0; i < n_records; i++) {
+    g_free ((char *)records[i].title);
+    g_free ((char *)records[i].address);
+    g_free (topics[2 * i]);
+  }
+  g_free (records);
+  g_free (topics);
+
+  return elapsed;
+}
+
+static void
+test_add_many_performance (void)
+{
+  EphyBookmarks *bookmarks;
+  double elapsed;
+
+  if (!g_test_perf ())
+    return;
+
+  bookmarks = ephy_bookmarks_new ();
+
+  elapsed = time_add_many (bookmarks, 0, 10000);
+  g_test_minimized_result (elapsed, "Added 10000 bookmarks in 200 topics in %.3f seconds", elapsed);
+
+  /* The cost per bookmark should not depend on how many there are. */
+  time_add_many (bookmarks, 10000, 40000);
+  elapsed = time_add_many (bookmarks, 50000, 10000);
+  g_test_minimized_result (elapsed, "Added 10000 more to 50000 bookmarks in %.3f seconds", elapsed);
+
+  g_object_unref (bookmarks);
+}
+
+int
+main (int argc, char *argv[])
+{
+  int ret;
+
+  g_setenv ("GSETTINGS_BACKEND", "memory", TRUE);
+
+  gtk_test_init (&argc, &argv);
+
+  ephy_debug_init ();
+
+  if (!ephy_file_helpers_init (NULL,
+                               EPHY_FILE_HELPERS_PRIVATE_PROFILE | EPHY_FILE_HELPERS_ENSURE_EXISTS,
+                               NULL)) {
+    g_debug ("Something wrong happened with ephy_file_helpers_init()");
+    return -1;
+  }
+
+  g_test_add_func ("/src/bookmarks/ephy-bookmarks/add_many", test_add_many);
+  g_test_add_func ("/src/bookmarks/ephy-bookmarks/find_equivalent", test_find_equivalent);
+  g_test_add_func ("/src/bookmarks/ephy-bookmarks/complete_topic", test_complete_topic);
+  g_test_add_func ("/src/bookmarks/ephy-bookmarks/complete_topic_performance", test_complete_topic_performance);
+  g_test_add_func ("/src/bookmarks/ephy-bookmarks/view", test_view);
+  g_test_add_func ("/src/bookmarks/ephy-bookmarks/add_many_performance", test_add_many_performance);
+
+  ret = g_test_run ();
+
+  ephy_file_helpers_shutdown ();
+
+  return ret;
+}
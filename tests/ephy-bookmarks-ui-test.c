@@ -0,0 +1,272 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ * ephy-bookmarks-ui-test.c
+ * This file is part of Epiphany
+ *
+ * Copyright © 2012 Igalia S.L.
+ *
+ * Epiphany is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Epiphany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Epiphany; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+
+#include "ephy-bookmark-action-group.h"
+#include "ephy-bookmark-action.h"
+#include "ephy-bookmarks-menu.h"
+#include "ephy-bookmarks-ui.h"
+#include "ephy-debug.h"
+#include "ephy-embed-prefs.h"
+#include "ephy-file-helpers.h"
+#include "ephy-private.h"
+#include "ephy-shell.h"
+#include "ephy-window.h"
+
+#include <glib.h>
+#include <gtk/gtk.h>
+#include <stdlib.h>
+#include <string.h>
+
+static guint n_added;
+
+static void
+add_bookmarks (guint n_bookmarks, guint n_topics)
+{
+  EphyBookmarks *bookmarks;
+  EphyBookmarkRecord *records;
+  char **topics;
+  guint i;
+
+  bookmarks = ephy_shell_get_bookmarks (ephy_shell);
+
+  records = g_new (EphyBookmarkRecord, n_bookmarks);
+  topics = g_new (char *, 2 * n_bookmarks);
+
+  for (i = 0; i < n_bookmarks; i++) {
+    records[i].title = g_strdup_printf ("Bookmark %u", n_added + i);
+    records[i].address = g_strdup_printf ("http://www.example.com/%u/", n_added + i);
+    topics[2 * i] = g_strdup_printf ("Topic %u", i % n_topics);
+    topics[2 * i + 1] = NULL;
+    records[i].topics = &topics[2 * i];
+  }
+
+  g_ptr_array_free (ephy_bookmarks_add_many (bookmarks, records, n_bookmarks), TRUE);
+  n_added += n_bookmarks;
+
+  for (i = 0; i < n_bookmarks; i++) {
+    g_free ((char *)records[i].title);
+    g_free ((char *)records[i].address);
+    g_free (topics[2 * i]);
+  }
+  g_free (records);
+  g_free (topics);
+}
+
+static guint
+count_actions (GtkActionGroup *action_group)
+{
+  GList *actions;
+  guint n_actions;
+
+  actions = gtk_action_group_list_actions (action_group);
+  n_actions = g_list_length (actions);
+  g_list_free (actions);
+
+  return n_actions;
+}
+
+static void
+test_lazy_actions (void)
+{
+  EphyBookmarks *bookmarks;
+  EphyNode *bookmark, *topic;
+  GtkActionGroup *action_group;
+  GtkAction *action;
+  char name[EPHY_BOOKMARK_ACTION_NAME_BUFFER_SIZE];
+
+  bookmarks = ephy_shell_get_bookmarks (ephy_shell);
+  bookmark = ephy_bookmarks_add (bookmarks, "Igalia", "http://www.igalia.com/");
+  topic = ephy_bookmarks_add_keyword (bookmarks, "Companies");
+
+  action_group = ephy_bookmark_group_new (ephy_bookmarks_get_bookmarks (bookmarks));
+  g_assert_cmpuint (count_actions (action_group), ==, 0);
+
+  EPHY_BOOKMARK_ACTION_NAME_PRINTF (name, bookmark);
+  action = gtk_action_group_get_action (action_group, name);
+  g_assert (EPHY_IS_BOOKMARK_ACTION (action));
+  g_assert (ephy_bookmark_action_get_bookmark (EPHY_BOOKMARK_ACTION (action)) == bookmark);
+  g_assert (gtk_action_group_get_action (action_group, name) == action);
+  g_assert_cmpuint (count_actions (action_group), ==, 1);
+
+  /* Only names of bookmarks in the group make actions. */
+  g_assert (gtk_action_group_get_action (action_group, "Bmk") == NULL);
+  g_assert (gtk_action_group_get_action (action_group, "Bmk12x") == NULL);
+  g_assert (gtk_action_group_get_action (action_group, "Bmk99999999") == NULL);
+  EPHY_BOOKMARK_ACTION_NAME_PRINTF (name, topic);
+  g_assert (gtk_action_group_get_action (action_group, name) == NULL);
+  g_assert_cmpuint (count_actions (action_group), ==, 1);
+
+  /* Removing the bookmark takes its action away. */
+  ephy_node_unref (bookmark);
+  g_assert_cmpuint (count_actions (action_group), ==, 0);
+
+  ephy_node_unref (topic);
+  g_object_unref (action_group);
+}
+
+static void
+test_lazy_submenus (void)
+{
+  EphyBookmarks *bookmarks;
+  EphyNode *topic;
+  GString *string;
+  char *item;
+
+  add_bookmarks (30, 3);
+
+  bookmarks = ephy_shell_get_bookmarks (ephy_shell);
+  topic = ephy_bookmarks_find_keyword (bookmarks, "Topic 0", FALSE);
+  g_assert (topic != NULL);
+
+  /* The 'All' menu leaves its submenus to the topic actions... */
+  string = g_string_new (NULL);
+  ephy_bookmarks_menu_build (string, NULL);
+
+  item = g_strdup_printf ("<menuitem action=\"" EPHY_TOPIC_ACTION_NAME_FORMAT "\"/>",
+                          ephy_node_get_id (topic));
+  g_assert (strstr (string->str, item) != NULL);
+  g_assert (strstr (string->str, "<menu ") == NULL);
+  g_free (item);
+
+  /* ...which still show their bookmarks inline. */
+  g_string_truncate (string, 0);
+  ephy_bookmarks_menu_build (string, topic);
+  g_assert (strstr (string->str, "<menuitem action=\"Bmk") != NULL);
+
+  g_string_free (string, TRUE);
+}
+
+#define N_WINDOWS 10
+
+static guint
+get_resident_memory (void)
+{
+  char *contents, *line;
+  guint rss = 0;
+
+  if (!g_file_get_contents ("/proc/self/status", &contents, NULL, NULL))
+    return 0;
+
+  line = strstr (contents, "VmRSS:");
+  if (line)
+    rss = strtoul (line + strlen ("VmRSS:"), NULL, 10);
+
+  g_free (contents);
+
+  return rss;
+}
+
+static GtkActionGroup *
+find_bookmarks_action_group (EphyWindow *window)
+{
+  GList *l;
+
+  l = gtk_ui_manager_get_action_groups (ephy_window_get_ui_manager (window));
+  for (; l != NULL; l = l->next)
+    if (strcmp (gtk_action_group_get_name (l->data), "BA") == 0)
+      return l->data;
+
+  return NULL;
+}
+
+static void
+measure_window_creation (guint n_bookmarks)
+{
+  GtkWidget *windows[N_WINDOWS];
+  GtkActionGroup *action_group;
+  double elapsed;
+  guint rss;
+  int i;
+
+  add_bookmarks (n_bookmarks - n_added, n_bookmarks / 100);
+
+  /* One window first, so that what is only built once is not counted. */
+  gtk_widget_destroy (GTK_WIDGET (ephy_window_new ()));
+
+  /* The windows are kept until the end, so their memory adds up. */
+  rss = get_resident_memory ();
+  g_test_timer_start ();
+
+  for (i = 0; i < N_WINDOWS; i++)
+    windows[i] = GTK_WIDGET (ephy_window_new ());
+
+  elapsed = g_test_timer_elapsed ();
+  rss = get_resident_memory () - rss;
+
+  action_group = find_bookmarks_action_group (EPHY_WINDOW (windows[0]));
+  g_assert (action_group != NULL);
+
+  g_test_minimized_result (elapsed / N_WINDOWS, "Created a window with %u bookmarks in %.3f seconds",
+                           n_bookmarks, elapsed / N_WINDOWS);
+  g_test_minimized_result ((double) rss / N_WINDOWS, "Each window with %u bookmarks took %.0f kB",
+                           n_bookmarks, (double) rss / N_WINDOWS);
+  g_test_message ("Bookmark actions per window: %u", count_actions (action_group));
+
+  for (i = 0; i < N_WINDOWS; i++)
+    gtk_widget_destroy (windows[i]);
+}
+
+static void
+test_window_creation_performance (void)
+{
+  if (!g_test_perf ())
+    return;
+
+  measure_window_creation (2000);
+  measure_window_creation (20000);
+}
+
+int
+main (int argc, char *argv[])
+{
+  int ret;
+
+  /* This should affect only this test, we use this to safely change
+   * settings. */
+  g_setenv ("GSETTINGS_BACKEND", "memory", TRUE);
+
+  gtk_test_init (&argc, &argv);
+
+  ephy_debug_init ();
+  ephy_embed_prefs_init ();
+
+  _ephy_shell_create_instance (EPHY_EMBED_SHELL_MODE_PRIVATE);
+
+  if (!ephy_file_helpers_init (NULL, EPHY_FILE_HELPERS_PRIVATE_PROFILE | EPHY_FILE_HELPERS_ENSURE_EXISTS, NULL)) {
+    g_debug ("Something wrong happened with ephy_file_helpers_init()");
+    return -1;
+  }
+
+  g_test_add_func ("/src/bookmarks/ephy-bookmarks-ui/lazy_actions", test_lazy_actions);
+  g_test_add_func ("/src/bookmarks/ephy-bookmarks-ui/lazy_submenus", test_lazy_submenus);
+  g_test_add_func ("/src/bookmarks/ephy-bookmarks-ui/window_creation_performance", test_window_creation_performance);
+
+  ret = g_test_run ();
+
+  g_object_unref (ephy_shell);
+  ephy_file_helpers_shutdown ();
+
+  return ret;
+}
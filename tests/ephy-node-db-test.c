@@ -0,0 +1,900 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ * ephy-node-db-test.c
+ * This file is part of Epiphany
+ *
+ * Copyright © 2012 Igalia S.L.
+ *
+ * Epiphany is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Epiphany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Epiphany; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+
+#include "ephy-node-db.h"
+#include "ephy-node.h"
+#include "ephy-node-index.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gtk/gtk.h>
+#include <libxml/parser.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_ROOT (const xmlChar *)"ephy_test"
+#define TEST_VERSION "1.0"
+#define TEST_ROOT_ID 1
+
+enum {
+  PROP_TITLE = 2,
+  PROP_LOCATION = 3,
+  PROP_COUNT = 4,
+  PROP_VISIBLE = 5,
+  PROP_TIME = 6,
+  PROP_SCORE = 7,
+  PROP_RATIO = 8
+};
+
+static EphyNode *
+create_db (EphyNodeDb **db)
+{
+  *db = ephy_node_db_new ("EphyNodeDbTest");
+
+  return ephy_node_new_with_id (*db, TEST_ROOT_ID);
+}
+
+static void
+populate_db (EphyNodeDb *db, EphyNode *root, guint n_nodes)
+{
+  guint i;
+
+  for (i = 0; i < n_nodes; i++) {
+    EphyNode *node;
+    char *title, *location;
+
+    node = ephy_node_new (db);
+
+    title = g_strdup_printf ("Bookmark number %u", i);
+    location = g_strdup_printf ("http://www.example.com/%u/index.html", i);
+
+    ephy_node_set_property_string (node, PROP_TITLE, title);
+    ephy_node_set_property_string (node, PROP_LOCATION, location);
+    ephy_node_set_property_int (node, PROP_COUNT, -(int)i);
+    ephy_node_set_property_boolean (node, PROP_VISIBLE, i % 2);
+    ephy_node_set_property_long (node, PROP_TIME, 1325376000L + i);
+    ephy_node_set_property_double (node, PROP_SCORE, i / 3.0);
+    ephy_node_set_property_float (node, PROP_RATIO, i / 7.0f);
+
+    ephy_node_add_child (root, node);
+
+    g_free (title);
+    g_free (location);
+  }
+}
+
+static void
+assert_dbs_equal (EphyNode *expected, EphyNode *actual)
+{
+  GPtrArray *expected_children, *actual_children;
+  guint i;
+
+  expected_children = ephy_node_get_children (expected);
+  actual_children = ephy_node_get_children (actual);
+
+  g_assert_cmpuint (expected_children->len, ==, actual_children->len);
+
+  for (i = 0; i < expected_children->len; i++) {
+    EphyNode *a = g_ptr_array_index (expected_children, i);
+    EphyNode *b = g_ptr_array_index (actual_children, i);
+
+    g_assert_cmpuint (ephy_node_get_id (a), ==, ephy_node_get_id (b));
+    g_assert_cmpstr (ephy_node_get_property_string (a, PROP_TITLE), ==,
+                     ephy_node_get_property_string (b, PROP_TITLE));
+    g_assert_cmpstr (ephy_node_get_property_string (a, PROP_LOCATION), ==,
+                     ephy_node_get_property_string (b, PROP_LOCATION));
+    g_assert_cmpint (ephy_node_get_property_int (a, PROP_COUNT), ==,
+                     ephy_node_get_property_int (b, PROP_COUNT));
+    g_assert_cmpint (ephy_node_get_property_boolean (a, PROP_VISIBLE), ==,
+                     ephy_node_get_property_boolean (b, PROP_VISIBLE));
+    g_assert_cmpint (ephy_node_get_property_long (a, PROP_TIME), ==,
+                     ephy_node_get_property_long (b, PROP_TIME));
+    g_assert_cmpfloat (ephy_node_get_property_double (a, PROP_SCORE), ==,
+                       ephy_node_get_property_double (b, PROP_SCORE));
+    g_assert_cmpfloat (ephy_node_get_property_float (a, PROP_RATIO), ==,
+                       ephy_node_get_property_float (b, PROP_RATIO));
+  }
+}
+
+static char *
+build_test_filename (const char *name)
+{
+  char *filename;
+
+  filename = g_build_filename (g_get_tmp_dir (), name, NULL);
+  g_unlink (filename);
+
+  return filename;
+}
+
+static void
+test_snapshot_roundtrip (void)
+{
+  EphyNodeDb *db, *loaded_db;
+  EphyNode *root, *loaded_root;
+  char *snapshot;
+
+  snapshot = build_test_filename ("epiphany-node-db-test.snapshot");
+
+  root = create_db (&db);
+  populate_db (db, root, 100);
+
+  g_assert_cmpint (ephy_node_db_write_to_snapshot_safe (db, snapshot, TEST_VERSION,
+                                                        root, NULL, NULL,
+                                                        NULL), ==, 0);
+
+  loaded_root = create_db (&loaded_db);
+  g_assert (ephy_node_db_load_from_snapshot (loaded_db, snapshot, NULL,
+                                             TEST_ROOT, (const xmlChar *)TEST_VERSION));
+  assert_dbs_equal (root, loaded_root);
+
+  /* Nor one whose nodes are already in the db. */
+  g_assert (!ephy_node_db_load_from_snapshot (loaded_db, snapshot, NULL,
+                                              TEST_ROOT, (const xmlChar *)TEST_VERSION));
+  assert_dbs_equal (root, loaded_root);
+
+  g_object_unref (loaded_db);
+
+  /* A snapshot written for another version must not be loaded. */
+  loaded_root = create_db (&loaded_db);
+  g_assert (!ephy_node_db_load_from_snapshot (loaded_db, snapshot, NULL,
+                                              TEST_ROOT, (const xmlChar *)"2.0"));
+  g_assert_cmpint (ephy_node_get_n_children (loaded_root), ==, 0);
+
+  g_object_unref (loaded_db);
+  g_object_unref (db);
+
+  g_unlink (snapshot);
+  g_free (snapshot);
+}
+
+static void
+test_snapshot_fallback (void)
+{
+  EphyNodeDb *db, *loaded_db;
+  EphyNode *root, *loaded_root;
+  char *snapshot, *xml, *contents;
+  gsize length;
+
+  snapshot = build_test_filename ("epiphany-node-db-test-fallback.snapshot");
+  xml = build_test_filename ("epiphany-node-db-test-fallback.xml");
+
+  root = create_db (&db);
+  populate_db (db, root, 100);
+
+  g_assert_cmpint (ephy_node_db_write_to_xml_safe (db, (const xmlChar *)xml, TEST_ROOT,
+                                                   (const xmlChar *)TEST_VERSION, NULL,
+                                                   root, NULL, NULL,
+                                                   NULL), ==, 0);
+  g_assert_cmpint (ephy_node_db_write_to_snapshot_safe (db, snapshot, TEST_VERSION,
+                                                        root, NULL, NULL,
+                                                        NULL), ==, 0);
+
+  /* Truncate the snapshot, the XML file has to be used instead. */
+  g_assert (g_file_get_contents (snapshot, &contents, &length, NULL));
+  g_assert (g_file_set_contents (snapshot, contents, length / 2, NULL));
+  g_free (contents);
+
+  loaded_root = create_db (&loaded_db);
+  g_assert (ephy_node_db_load_from_snapshot (loaded_db, snapshot, xml,
+                                             TEST_ROOT, (const xmlChar *)TEST_VERSION));
+  assert_dbs_equal (root, loaded_root);
+
+  g_object_unref (loaded_db);
+  g_object_unref (db);
+
+  g_unlink (snapshot);
+  g_unlink (xml);
+  g_free (snapshot);
+  g_free (xml);
+}
+
+static gpointer
+write_snapshot_thread (EphyNodeDbSnapshot *snapshot)
+{
+  char *filename;
+  gboolean success;
+
+  filename = g_build_filename (g_get_tmp_dir (), "epiphany-node-db-test-thread.snapshot", NULL);
+  success = ephy_node_db_snapshot_write (snapshot, filename);
+  g_free (filename);
+
+  return GINT_TO_POINTER (success);
+}
+
+static void
+test_snapshot_immutable (void)
+{
+  EphyNodeDb *db, *loaded_db;
+  EphyNode *root, *loaded_root, *first;
+  EphyNodeDbSnapshot *snapshot;
+  GThread *thread;
+  char *filename;
+
+  filename = build_test_filename ("epiphany-node-db-test-thread.snapshot");
+
+  root = create_db (&db);
+  populate_db (db, root, 10);
+  first = ephy_node_get_nth_child (root, 0);
+
+  snapshot = ephy_node_db_take_snapshot (db, TEST_VERSION, root, NULL, NULL, NULL);
+  g_assert (snapshot != NULL);
+  g_assert_cmpuint (ephy_node_db_snapshot_get_n_nodes (snapshot), ==, 10);
+
+  /* Changing the db must not change the snapshot. */
+  ephy_node_set_property_string (first, PROP_TITLE, "Changed");
+  ephy_node_set_property_int (first, PROP_COUNT, 42);
+
+  g_assert_cmpuint (ephy_node_db_snapshot_get_id (snapshot, 0), ==, ephy_node_get_id (first));
+  g_assert_cmpstr (ephy_node_db_snapshot_get_property_string (snapshot, 0, PROP_TITLE), ==, "Bookmark number 0");
+  g_assert_cmpint (ephy_node_db_snapshot_get_property_int (snapshot, 0, PROP_COUNT), ==, 0);
+  g_assert_cmpint (ephy_node_db_snapshot_get_property_int (snapshot, 0, PROP_LOCATION), ==, -1);
+  g_assert (ephy_node_db_snapshot_get_property_string (snapshot, 0, PROP_COUNT) == NULL);
+  g_assert_cmpuint (ephy_node_db_snapshot_get_n_parents (snapshot, 0), ==, 1);
+  g_assert (ephy_node_db_snapshot_has_parent (snapshot, 0, TEST_ROOT_ID));
+
+  thread = g_thread_new ("WriteSnapshot", (GThreadFunc) write_snapshot_thread, snapshot);
+  g_assert (g_thread_join (thread));
+  ephy_node_db_snapshot_unref (snapshot);
+
+  loaded_root = create_db (&loaded_db);
+  g_assert (ephy_node_db_load_from_snapshot (loaded_db, filename, NULL,
+                                             TEST_ROOT, (const xmlChar *)TEST_VERSION));
+  g_assert_cmpint (ephy_node_get_n_children (loaded_root), ==, 10);
+  g_assert_cmpstr (ephy_node_get_property_string (ephy_node_get_nth_child (loaded_root, 0), PROP_TITLE),
+                   ==, "Bookmark number 0");
+
+  g_object_unref (loaded_db);
+  g_object_unref (db);
+
+  g_unlink (filename);
+  g_free (filename);
+}
+
+static int
+compare_titles_descending (EphyNode **a, EphyNode **b)
+{
+  return g_strcmp0 (ephy_node_get_property_string (*b, PROP_TITLE),
+                    ephy_node_get_property_string (*a, PROP_TITLE));
+}
+
+static void
+test_journal_replay (void)
+{
+  EphyNodeDb *db, *loaded_db;
+  EphyNode *root, *loaded_root, *first, *node;
+  char *snapshot, *journal, *old_journal;
+  FILE *file;
+
+  snapshot = build_test_filename ("epiphany-node-db-test-journal.snapshot");
+  journal = build_test_filename ("epiphany-node-db-test-journal.snapshot.journal");
+  old_journal = build_test_filename ("epiphany-node-db-test-journal.snapshot.journal.old");
+
+  root = create_db (&db);
+  populate_db (db, root, 10);
+  first = ephy_node_get_nth_child (root, 0);
+
+  g_assert_cmpint (ephy_node_db_write_to_snapshot_safe (db, snapshot, TEST_VERSION,
+                                                        root, NULL, NULL,
+                                                        NULL), ==, 0);
+
+  /* The db was not loaded from the snapshot, so it cannot know they match. */
+  g_assert (!ephy_node_db_enable_journal (db, snapshot));
+
+  ephy_node_set_property_string (first, PROP_TITLE, "Changed");
+  node = ephy_node_new (db);
+  ephy_node_set_property_string (node, PROP_TITLE, "New");
+  ephy_node_add_child (root, node);
+  ephy_node_unref (ephy_node_get_nth_child (root, 1));
+  ephy_node_sort_children (root, (GCompareFunc) compare_titles_descending);
+  g_assert (ephy_node_db_journal_flush (db));
+
+  /* Pretend a new snapshot is being written but never makes it. */
+  ephy_node_db_journal_rotate (db);
+  g_assert (g_file_test (old_journal, G_FILE_TEST_EXISTS));
+
+  ephy_node_set_property_int (first, PROP_COUNT, 42);
+  ephy_node_remove_child (root, node);
+  g_assert (ephy_node_db_journal_flush (db));
+
+  /* A change that was only partially written must be ignored. */
+  file = fopen (journal, "ab");
+  g_assert (file != NULL);
+  fwrite ("\x20\0\0\0torn", 1, 8, file);
+  fclose (file);
+
+  loaded_root = create_db (&loaded_db);
+  g_assert (ephy_node_db_load_from_snapshot (loaded_db, snapshot, NULL,
+                                             TEST_ROOT, (const xmlChar *)TEST_VERSION));
+  g_assert_cmpint (ephy_node_get_n_children (loaded_root), ==, 9);
+  assert_dbs_equal (root, loaded_root);
+
+  g_assert (ephy_node_db_enable_journal (loaded_db, snapshot));
+  g_assert_cmpuint (ephy_node_db_get_journal_size (loaded_db), ==,
+                    ephy_node_db_get_journal_size (db));
+
+  ephy_node_db_journal_compacted (loaded_db);
+  g_assert (!g_file_test (old_journal, G_FILE_TEST_EXISTS));
+
+  g_object_unref (loaded_db);
+
+  /* A journal that cannot be read asks for a new snapshot. */
+  g_assert (g_file_set_contents (journal, "EPHYJNL\n\x63\0\0\0", 12, NULL));
+
+  loaded_root = create_db (&loaded_db);
+  g_assert (ephy_node_db_load_from_snapshot (loaded_db, snapshot, NULL,
+                                             TEST_ROOT, (const xmlChar *)TEST_VERSION));
+  g_assert (!ephy_node_db_enable_journal (loaded_db, snapshot));
+
+  g_object_unref (loaded_db);
+  g_object_unref (db);
+
+  g_unlink (snapshot);
+  g_unlink (journal);
+  g_free (snapshot);
+  g_free (journal);
+  g_free (old_journal);
+}
+
+static char *
+get_host_key (const char *location)
+{
+  return g_strndup (location, strcspn (location, "/"));
+}
+
+static void
+test_index (void)
+{
+  EphyNodeDb *db, *loaded_db;
+  EphyNode *root, *loaded_root, *first, *node;
+  EphyNodeIndex *titles, *hosts, *loaded_titles;
+  GPtrArray *nodes;
+  char *snapshot;
+
+  snapshot = build_test_filename ("epiphany-node-db-test-index.snapshot");
+
+  root = create_db (&db);
+  titles = ephy_node_db_add_index (db, root, PROP_TITLE, NULL, TRUE);
+  populate_db (db, root, 100);
+
+  /* Indexes declared on a populated parent index its children too. */
+  hosts = ephy_node_db_add_index (db, root, PROP_LOCATION,
+                                  (EphyNodeIndexKeyFunc) get_host_key, FALSE);
+
+  first = ephy_node_get_nth_child (root, 0);
+  g_assert (ephy_node_index_lookup (titles, "Bookmark number 0") == first);
+  g_assert (ephy_node_index_lookup (titles, "Bookmark number 100") == NULL);
+
+  nodes = g_ptr_array_new ();
+  g_assert_cmpuint (ephy_node_index_lookup_all (hosts, "http:", nodes), ==, 100);
+  g_assert (g_ptr_array_index (nodes, 0) == first);
+  g_assert (g_ptr_array_index (nodes, 99) == ephy_node_get_nth_child (root, 99));
+  g_ptr_array_free (nodes, TRUE);
+
+  g_assert (ephy_node_index_lookup (hosts, "http:") == first);
+  g_assert (ephy_node_index_lookup_last (hosts, "http:") == ephy_node_get_nth_child (root, 99));
+
+  /* Prefix lookups return the lowest sorting match. */
+  g_assert (ephy_node_index_lookup_prefix (titles, "Bookmark number 9") ==
+            ephy_node_get_nth_child (root, 9));
+  g_assert (ephy_node_index_lookup_prefix (titles, "Bookmark number 99") ==
+            ephy_node_get_nth_child (root, 99));
+  g_assert (ephy_node_index_lookup_prefix (titles, "Bookmark numbers") == NULL);
+
+  /* Or all of them, sorted by key. */
+  nodes = g_ptr_array_new ();
+  g_assert_cmpuint (ephy_node_index_lookup_prefix_all (titles, "Bookmark number 9", nodes), ==, 11);
+  g_assert (g_ptr_array_index (nodes, 0) == ephy_node_get_nth_child (root, 9));
+  g_assert (g_ptr_array_index (nodes, 1) == ephy_node_get_nth_child (root, 90));
+  g_assert (g_ptr_array_index (nodes, 10) == ephy_node_get_nth_child (root, 99));
+  g_assert_cmpuint (ephy_node_index_lookup_prefix_all (titles, "Bookmark numbers", nodes), ==, 0);
+  g_assert_cmpuint (nodes->len, ==, 11);
+  g_ptr_array_free (nodes, TRUE);
+
+  g_assert_cmpstr (ephy_node_index_get_key (titles, first), ==, "Bookmark number 0");
+  g_assert_cmpstr (ephy_node_index_get_key (hosts, first), ==, "http:");
+
+  ephy_node_set_property_string (first, PROP_TITLE, "Renamed");
+  g_assert (ephy_node_index_lookup (titles, "Bookmark number 0") == NULL);
+  g_assert (ephy_node_index_lookup (titles, "Renamed") == first);
+  g_assert (ephy_node_index_lookup_prefix (titles, "Ren") == first);
+
+  ephy_node_remove_child (root, first);
+  g_assert (ephy_node_index_lookup (titles, "Renamed") == NULL);
+  ephy_node_add_child (root, first);
+  g_assert (ephy_node_index_lookup (titles, "Renamed") == first);
+
+  node = ephy_node_index_lookup (titles, "Bookmark number 1");
+  ephy_node_unref (node);
+  g_assert (ephy_node_index_lookup (titles, "Bookmark number 1") == NULL);
+  g_assert (ephy_node_index_lookup_prefix (titles, "Bookmark number 1") ==
+            ephy_node_index_lookup (titles, "Bookmark number 10"));
+
+  /* Loading a db keeps the indexes declared before up to date. */
+  g_assert_cmpint (ephy_node_db_write_to_snapshot_safe (db, snapshot, TEST_VERSION,
+                                                        root, NULL, NULL,
+                                                        NULL), ==, 0);
+
+  loaded_root = create_db (&loaded_db);
+  loaded_titles = ephy_node_db_add_index (loaded_db, loaded_root, PROP_TITLE, NULL, FALSE);
+  g_assert (ephy_node_db_load_from_snapshot (loaded_db, snapshot, NULL,
+                                             TEST_ROOT, (const xmlChar *)TEST_VERSION));
+  g_assert_cmpuint (ephy_node_get_id (ephy_node_index_lookup (loaded_titles, "Renamed")), ==,
+                    ephy_node_get_id (first));
+
+  g_object_unref (loaded_db);
+  g_object_unref (db);
+
+  g_unlink (snapshot);
+  g_free (snapshot);
+}
+
+static GPtrArray *added_children;
+static guint n_child_changes;
+static guint n_removals;
+
+static void
+child_added_cb (EphyNode *node, EphyNode *child, gpointer data)
+{
+  /* Every child must be announced at the index it ended up at. */
+  g_assert_cmpint (ephy_node_get_child_index (node, child), ==, added_children->len);
+  g_ptr_array_add (added_children, child);
+}
+
+static void
+child_changed_cb (EphyNode *node, EphyNode *child, guint property_id, gpointer data)
+{
+  n_child_changes++;
+}
+
+static void
+child_removed_cb (EphyNode *node, EphyNode *child, guint old_index, gpointer data)
+{
+  g_assert (g_ptr_array_index (added_children, old_index) == child);
+  g_ptr_array_remove_index (added_children, old_index);
+  n_removals++;
+}
+
+static GArray *load_order;
+
+static void
+load_child_added_cb (EphyNode *node, EphyNode *child, gpointer data)
+{
+  guint id = ephy_node_get_id (child);
+
+  g_array_append_val (load_order, id);
+}
+
+/* What ephy_node_db_load_from_file() used to do, one node after the other. */
+static void
+load_xml_sequentially (EphyNodeDb *db, const char *filename)
+{
+  xmlDocPtr doc;
+  xmlNodePtr child;
+
+  doc = xmlReadFile (filename, NULL, 0);
+  g_assert (doc != NULL);
+
+  for (child = xmlDocGetRootElement (doc)->children; child != NULL; child = child->next) {
+    if (xmlStrEqual (child->name, (const xmlChar *)"node"))
+      ephy_node_new_from_xml (db, child);
+  }
+
+  xmlFreeDoc (doc);
+}
+
+static void
+test_xml_load (void)
+{
+  EphyNodeDb *db, *sequential_db, *parallel_db;
+  EphyNode *root, *topic, *sequential_root, *parallel_root;
+  GArray *sequential_order, *parallel_order;
+  char *xml, *sequential_xml, *parallel_xml;
+  char *sequential_contents, *parallel_contents;
+  gsize sequential_length, parallel_length;
+  guint i;
+
+  xml = build_test_filename ("epiphany-node-db-test-load.xml");
+  sequential_xml = build_test_filename ("epiphany-node-db-test-load-sequential.xml");
+  parallel_xml = build_test_filename ("epiphany-node-db-test-load-parallel.xml");
+
+  /* Enough nodes for several chunks, some with a second parent that
+   * is only written after them. */
+  root = create_db (&db);
+  populate_db (db, root, 2000);
+  topic = ephy_node_new (db);
+  for (i = 0; i < 2000; i += 3)
+    ephy_node_add_child (topic, ephy_node_get_nth_child (root, i));
+  ephy_node_add_child (root, topic);
+
+  g_assert_cmpint (ephy_node_db_write_to_xml_safe (db, (const xmlChar *)xml, TEST_ROOT,
+                                                   (const xmlChar *)TEST_VERSION, NULL,
+                                                   root, NULL, NULL,
+                                                   NULL), ==, 0);
+
+  sequential_root = create_db (&sequential_db);
+  sequential_order = load_order = g_array_new (FALSE, FALSE, sizeof (guint));
+  ephy_node_signal_connect_object (sequential_root, EPHY_NODE_CHILD_ADDED,
+                                   (EphyNodeCallback) load_child_added_cb, NULL);
+  load_xml_sequentially (sequential_db, xml);
+
+  parallel_root = create_db (&parallel_db);
+  parallel_order = load_order = g_array_new (FALSE, FALSE, sizeof (guint));
+  ephy_node_signal_connect_object (parallel_root, EPHY_NODE_CHILD_ADDED,
+                                   (EphyNodeCallback) load_child_added_cb, NULL);
+  g_assert (ephy_node_db_load_from_file (parallel_db, xml, TEST_ROOT,
+                                         (const xmlChar *)TEST_VERSION));
+
+  assert_dbs_equal (root, parallel_root);
+
+  /* Listeners see the same thing in the same order... */
+  g_assert_cmpuint (sequential_order->len, ==, parallel_order->len);
+  g_assert (memcmp (sequential_order->data, parallel_order->data,
+                    parallel_order->len * sizeof (guint)) == 0);
+
+  /* ...and both databases save to the same bytes. */
+  g_assert_cmpint (ephy_node_db_write_to_xml_safe (sequential_db, (const xmlChar *)sequential_xml,
+                                                   TEST_ROOT, (const xmlChar *)TEST_VERSION, NULL,
+                                                   sequential_root, NULL, NULL,
+                                                   NULL), ==, 0);
+  g_assert_cmpint (ephy_node_db_write_to_xml_safe (parallel_db, (const xmlChar *)parallel_xml,
+                                                   TEST_ROOT, (const xmlChar *)TEST_VERSION, NULL,
+                                                   parallel_root, NULL, NULL,
+                                                   NULL), ==, 0);
+
+  g_assert (g_file_get_contents (sequential_xml, &sequential_contents, &sequential_length, NULL));
+  g_assert (g_file_get_contents (parallel_xml, &parallel_contents, &parallel_length, NULL));
+  g_assert_cmpuint (sequential_length, ==, parallel_length);
+  g_assert (memcmp (sequential_contents, parallel_contents, parallel_length) == 0);
+
+  g_free (sequential_contents);
+  g_free (parallel_contents);
+  g_array_free (sequential_order, TRUE);
+  g_array_free (parallel_order, TRUE);
+  load_order = NULL;
+
+  g_object_unref (parallel_db);
+  g_object_unref (sequential_db);
+  g_object_unref (db);
+
+  g_unlink (xml);
+  g_unlink (sequential_xml);
+  g_unlink (parallel_xml);
+  g_free (xml);
+  g_free (sequential_xml);
+  g_free (parallel_xml);
+}
+
+static void
+test_properties (void)
+{
+  EphyNodeDb *db;
+  EphyNode *root, *a, *b;
+  GValue value = { 0, };
+
+  root = create_db (&db);
+  populate_db (db, root, 2);
+  a = ephy_node_get_nth_child (root, 0);
+  b = ephy_node_get_nth_child (root, 1);
+
+  /* Equal strings are shared, and survive one of their users going. */
+  ephy_node_set_property_string (a, PROP_TITLE, "Shared");
+  ephy_node_set_property_string (b, PROP_TITLE, "Shared");
+  g_assert (ephy_node_get_property_string (a, PROP_TITLE) ==
+            ephy_node_get_property_string (b, PROP_TITLE));
+  ephy_node_set_property_string (a, PROP_TITLE, "Not shared");
+  g_assert_cmpstr (ephy_node_get_property_string (b, PROP_TITLE), ==, "Shared");
+
+  /* Setting a property to its own value. */
+  ephy_node_set_property_string (b, PROP_TITLE,
+                                 ephy_node_get_property_string (b, PROP_TITLE));
+  g_assert_cmpstr (ephy_node_get_property_string (b, PROP_TITLE), ==, "Shared");
+
+  /* The caller owns what ephy_node_get_property() returns. */
+  g_assert (ephy_node_get_property (b, PROP_TITLE, &value));
+  ephy_node_set_property_string (b, PROP_TITLE, NULL);
+  g_assert_cmpstr (g_value_get_string (&value), ==, "Shared");
+  g_value_unset (&value);
+  g_assert (ephy_node_get_property_string (b, PROP_TITLE) == NULL);
+
+  /* A slot can change its type, and ids past the last one are unset. */
+  ephy_node_set_property_int (a, PROP_TITLE, 42);
+  g_assert_cmpint (ephy_node_get_property_int (a, PROP_TITLE), ==, 42);
+  g_assert_cmpint (ephy_node_get_property_long (a, PROP_RATIO + 10), ==, -1);
+  g_assert (!ephy_node_get_property (a, PROP_RATIO + 10, &value));
+
+  g_object_unref (db);
+}
+
+static void
+test_batch (void)
+{
+  EphyNodeDb *db;
+  EphyNode *root, *first;
+
+  root = create_db (&db);
+  added_children = g_ptr_array_new ();
+  n_child_changes = n_removals = 0;
+
+  ephy_node_signal_connect_object (root, EPHY_NODE_CHILD_ADDED,
+                                   (EphyNodeCallback) child_added_cb, NULL);
+  ephy_node_signal_connect_object (root, EPHY_NODE_CHILD_CHANGED,
+                                   (EphyNodeCallback) child_changed_cb, NULL);
+  ephy_node_signal_connect_object (root, EPHY_NODE_CHILD_REMOVED,
+                                   (EphyNodeCallback) child_removed_cb, NULL);
+
+  ephy_node_db_begin_batch (db);
+  ephy_node_db_begin_batch (db);
+  populate_db (db, root, 10);
+  ephy_node_db_end_batch (db);
+
+  first = ephy_node_get_nth_child (root, 0);
+  ephy_node_set_property_string (first, PROP_TITLE, "Changed");
+  ephy_node_set_property_string (first, PROP_TITLE, "Changed again");
+
+  /* Nothing is emitted until the outermost batch ends. */
+  g_assert_cmpuint (added_children->len, ==, 0);
+  g_assert_cmpuint (n_child_changes, ==, 0);
+  ephy_node_db_end_batch (db);
+
+  g_assert_cmpuint (added_children->len, ==, 10);
+  g_assert (g_ptr_array_index (added_children, 0) == first);
+
+  /* Each of the 7 properties of the 10 children once. */
+  g_assert_cmpuint (n_child_changes, ==, 70);
+
+  /* Removing a child emits the additions held back before it. */
+  ephy_node_db_begin_batch (db);
+  populate_db (db, root, 5);
+  ephy_node_unref (ephy_node_get_nth_child (root, 12));
+  g_assert_cmpuint (added_children->len, ==, 14);
+  g_assert_cmpuint (n_removals, ==, 1);
+  populate_db (db, root, 1);
+  ephy_node_db_end_batch (db);
+
+  g_assert_cmpuint (added_children->len, ==, 15);
+  g_assert_cmpint (ephy_node_get_n_children (root), ==, 15);
+
+  g_ptr_array_free (added_children, TRUE);
+  g_object_unref (db);
+}
+
+static void
+test_id_allocation (void)
+{
+  EphyNodeDb *db;
+  EphyNode *root, *node;
+  guint first_id, i;
+
+  root = create_db (&db);
+  populate_db (db, root, 100);
+  first_id = ephy_node_get_id (ephy_node_get_nth_child (root, 0));
+
+  /* Freed ids are handed out again before new ones. */
+  for (i = 0; i < 10; i++)
+    ephy_node_unref (ephy_node_get_nth_child (root, i * 5));
+
+  for (i = 0; i < 10; i++) {
+    node = ephy_node_new (db);
+    g_assert_cmpuint (ephy_node_get_id (node), <, first_id + 100);
+    ephy_node_add_child (root, node);
+  }
+
+  node = ephy_node_new (db);
+  g_assert_cmpuint (ephy_node_get_id (node), ==, first_id + 100);
+  ephy_node_unref (node);
+
+  /* Explicit ids leave holes behind them, which are used first. */
+  node = ephy_node_new_with_id (db, first_id + 110);
+  g_assert (ephy_node_db_get_node_from_id (db, first_id + 110) == node);
+  ephy_node_add_child (root, node);
+  node = ephy_node_new (db);
+  g_assert_cmpuint (ephy_node_get_id (node), <, first_id + 110);
+  ephy_node_unref (node);
+
+  /* Compacting drops the unused ids at the end and hands out the
+   * lowest unused ones first. */
+  while (ephy_node_get_n_children (root) > 50)
+    ephy_node_unref (ephy_node_get_nth_child (root, 50));
+  ephy_node_unref (ephy_node_get_nth_child (root, 10));
+
+  ephy_node_db_compact_ids (db);
+  g_assert (ephy_node_db_get_node_from_id (db, first_id + 110) == NULL);
+
+  for (i = 0; i < 2; i++) {
+    node = ephy_node_new (db);
+    g_assert_cmpuint (ephy_node_get_id (node), <, first_id + 100);
+    ephy_node_add_child (root, node);
+  }
+
+  for (i = 0; i < ephy_node_get_n_children (root); i++) {
+    node = ephy_node_get_nth_child (root, i);
+    g_assert (ephy_node_db_get_node_from_id (db, ephy_node_get_id (node)) == node);
+  }
+
+  g_object_unref (db);
+}
+
+static void
+test_id_performance (void)
+{
+  EphyNodeDb *db;
+  EphyNode *root;
+  double elapsed;
+  guint i;
+
+  if (!g_test_perf ())
+    return;
+
+  root = create_db (&db);
+  populate_db (db, root, 100000);
+
+  /* Removing a node used to send the next allocation back to the
+   * start of the id range. */
+  g_test_timer_start ();
+  for (i = 0; i < 10000; i++) {
+    ephy_node_unref (ephy_node_get_nth_child (root, ephy_node_get_n_children (root) - 1));
+    ephy_node_add_child (root, ephy_node_new (db));
+  }
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed, "Replaced 10000 of 100000 nodes in %.3f seconds", elapsed);
+
+  g_object_unref (db);
+}
+
+/* Resident memory in bytes, or 0 where /proc is not available. */
+static gsize
+get_resident_size (void)
+{
+  char *contents;
+  gsize size = 0;
+  unsigned long pages;
+
+  if (!g_file_get_contents ("/proc/self/statm", &contents, NULL, NULL))
+    return 0;
+
+  if (sscanf (contents, "%*lu %lu", &pages) == 1)
+    size = pages * sysconf (_SC_PAGESIZE);
+
+  g_free (contents);
+
+  return size;
+}
+
+static void
+test_memory_usage (void)
+{
+  EphyNodeDb *db;
+  EphyNode *root, *topic;
+  gsize before, after;
+  guint i;
+
+  if (!g_test_perf ())
+    return;
+
+  before = get_resident_size ();
+  if (before == 0)
+    return;
+
+  /* Like bookmarks: every node has a couple of parents, a few strings
+   * that repeat and no listeners of its own. */
+  root = create_db (&db);
+  topic = ephy_node_new (db);
+  populate_db (db, root, 50000);
+
+  for (i = 0; i < 50000; i++) {
+    EphyNode *node = ephy_node_get_nth_child (root, i);
+
+    ephy_node_set_property_string (node, PROP_TITLE, i % 2 ? "Odd" : "Even");
+    ephy_node_add_child (topic, node);
+  }
+
+  after = get_resident_size ();
+  g_test_minimized_result ((after - before) / 50000.0,
+                           "Memory used by 50000 nodes: %" G_GSIZE_FORMAT " KiB, %.0f bytes per node",
+                           (after - before) / 1024, (after - before) / 50000.0);
+
+  g_object_unref (db);
+}
+
+static void
+test_snapshot_performance (void)
+{
+  EphyNodeDb *db, *loaded_db;
+  EphyNode *root, *loaded_root;
+  char *snapshot, *xml;
+  double elapsed;
+
+  if (!g_test_perf ())
+    return;
+
+  snapshot = build_test_filename ("epiphany-node-db-test-perf.snapshot");
+  xml = build_test_filename ("epiphany-node-db-test-perf.xml");
+
+  root = create_db (&db);
+  populate_db (db, root, 100000);
+
+  g_test_timer_start ();
+  ephy_node_db_write_to_xml_safe (db, (const xmlChar *)xml, TEST_ROOT,
+                                  (const xmlChar *)TEST_VERSION, NULL,
+                                  root, NULL, NULL,
+                                  NULL);
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed, "Saved 100000 nodes to XML in %.3f seconds", elapsed);
+
+  g_test_timer_start ();
+  ephy_node_db_write_to_snapshot_safe (db, snapshot, TEST_VERSION,
+                                       root, NULL, NULL,
+                                       NULL);
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed, "Saved 100000 nodes to a snapshot in %.3f seconds", elapsed);
+
+  loaded_root = create_db (&loaded_db);
+  g_test_timer_start ();
+  g_assert (ephy_node_db_load_from_file (loaded_db, xml, TEST_ROOT,
+                                         (const xmlChar *)TEST_VERSION));
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed, "Loaded 100000 nodes from XML in %.3f seconds", elapsed);
+  g_assert_cmpint (ephy_node_get_n_children (loaded_root), ==, 100000);
+  g_object_unref (loaded_db);
+
+  loaded_root = create_db (&loaded_db);
+  g_test_timer_start ();
+  g_assert (ephy_node_db_load_from_snapshot (loaded_db, snapshot, NULL, TEST_ROOT,
+                                             (const xmlChar *)TEST_VERSION));
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed, "Loaded 100000 nodes from a snapshot in %.3f seconds", elapsed);
+  g_assert_cmpint (ephy_node_get_n_children (loaded_root), ==, 100000);
+  g_object_unref (loaded_db);
+
+  g_object_unref (db);
+
+  g_unlink (snapshot);
+  g_unlink (xml);
+  g_free (snapshot);
+  g_free (xml);
+}
+
+int
+main (int argc, char *argv[])
+{
+  gtk_test_init (&argc, &argv);
+
+  g_test_add_func ("/lib/ephy-node-db/snapshot_roundtrip", test_snapshot_roundtrip);
+  g_test_add_func ("/lib/ephy-node-db/snapshot_fallback", test_snapshot_fallback);
+  g_test_add_func ("/lib/ephy-node-db/snapshot_immutable", test_snapshot_immutable);
+  g_test_add_func ("/lib/ephy-node-db/journal_replay", test_journal_replay);
+  g_test_add_func ("/lib/ephy-node-db/index", test_index);
+  g_test_add_func ("/lib/ephy-node-db/xml_load", test_xml_load);
+  g_test_add_func ("/lib/ephy-node-db/properties", test_properties);
+  g_test_add_func ("/lib/ephy-node-db/batch", test_batch);
+  g_test_add_func ("/lib/ephy-node-db/id_allocation", test_id_allocation);
+  g_test_add_func ("/lib/ephy-node-db/snapshot_performance", test_snapshot_performance);
+  g_test_add_func ("/lib/ephy-node-db/id_performance", test_id_performance);
+  g_test_add_func ("/lib/ephy-node-db/memory_usage", test_memory_usage);
+
+  return g_test_run ();
+}
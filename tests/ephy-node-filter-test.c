@@ -0,0 +1,239 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ * ephy-node-filter-test.c
+ * This file is part of Epiphany
+ *
+ * Copyright © 2012 Igalia S.L.
+ *
+ * Epiphany is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Epiphany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Epiphany; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+
+#include "ephy-node-db.h"
+#include "ephy-node-filter.h"
+#include "ephy-node.h"
+
+#include <glib.h>
+#include <gtk/gtk.h>
+
+#define TEST_ROOT_ID 1
+
+enum {
+  PROP_TITLE = 2,
+  PROP_LOCATION = 3
+};
+
+static EphyNode *
+create_db (EphyNodeDb **db, guint n_nodes)
+{
+  EphyNode *root;
+  guint i;
+
+  *db = ephy_node_db_new ("EphyNodeFilterTest");
+  root = ephy_node_new_with_id (*db, TEST_ROOT_ID);
+
+  for (i = 0; i < n_nodes; i++) {
+    EphyNode *node;
+    char *title, *location;
+
+    node = ephy_node_new (*db);
+
+    title = g_strdup_printf ("Bookmark Number %u", i);
+    location = g_strdup_printf ("http://www.example.com/%u/", i);
+    ephy_node_set_property_string (node, PROP_TITLE, title);
+    ephy_node_set_property_string (node, PROP_LOCATION, location);
+    g_free (title);
+    g_free (location);
+
+    ephy_node_add_child (root, node);
+  }
+
+  return root;
+}
+
+/* What the bookmarks editor does for its search entry. */
+static void
+set_search (EphyNodeFilter *filter, EphyNode *parent, const char *search)
+{
+  ephy_node_filter_empty (filter);
+  ephy_node_filter_add_expression (filter,
+                                   ephy_node_filter_expression_new (EPHY_NODE_FILTER_EXPRESSION_HAS_PARENT,
+                                                                    parent),
+                                   0);
+  ephy_node_filter_add_expression (filter,
+                                   ephy_node_filter_expression_new (EPHY_NODE_FILTER_EXPRESSION_STRING_PROP_CONTAINS,
+                                                                    PROP_TITLE, search),
+                                   1);
+  ephy_node_filter_add_expression (filter,
+                                   ephy_node_filter_expression_new (EPHY_NODE_FILTER_EXPRESSION_STRING_PROP_CONTAINS,
+                                                                    PROP_LOCATION, search),
+                                   1);
+  ephy_node_filter_done_changing (filter);
+}
+
+static guint
+count_matches (EphyNodeFilter *filter, EphyNode *root)
+{
+  guint i, n = 0;
+
+  for (i = 0; i < ephy_node_get_n_children (root); i++) {
+    if (ephy_node_filter_evaluate (filter, ephy_node_get_nth_child (root, i)))
+      n++;
+  }
+
+  return n;
+}
+
+static void
+test_levels (void)
+{
+  EphyNodeDb *db;
+  EphyNode *root;
+  EphyNodeFilter *filter;
+
+  root = create_db (&db, 100);
+  filter = ephy_node_filter_new ();
+
+  /* No expressions, everything matches. */
+  g_assert_cmpuint (count_matches (filter, root), ==, 100);
+
+  /* Levels are ANDed, expressions within a level ORed. */
+  set_search (filter, root, "number 1");
+  g_assert_cmpuint (count_matches (filter, root), ==, 11);
+  set_search (filter, root, "/42/");
+  g_assert_cmpuint (count_matches (filter, root), ==, 1);
+  set_search (filter, root, "nowhere");
+  g_assert_cmpuint (count_matches (filter, root), ==, 0);
+
+  /* A level with no expressions is skipped. */
+  ephy_node_filter_empty (filter);
+  ephy_node_filter_add_expression (filter,
+                                   ephy_node_filter_expression_new (EPHY_NODE_FILTER_EXPRESSION_EQUALS,
+                                                                    ephy_node_get_nth_child (root, 3)),
+                                   2);
+  ephy_node_filter_done_changing (filter);
+  g_assert_cmpuint (count_matches (filter, root), ==, 1);
+
+  g_object_unref (filter);
+  g_object_unref (db);
+}
+
+static void
+test_changes (void)
+{
+  EphyNodeDb *db;
+  EphyNode *root, *node, *topic;
+  EphyNodeFilter *filter;
+
+  root = create_db (&db, 100);
+  topic = ephy_node_new (db);
+  filter = ephy_node_filter_new ();
+
+  set_search (filter, root, "renamed");
+  g_assert_cmpuint (count_matches (filter, root), ==, 0);
+
+  /* Cached results do not outlive a change to the node... */
+  node = ephy_node_get_nth_child (root, 10);
+  ephy_node_set_property_string (node, PROP_TITLE, "Renamed");
+  g_assert (ephy_node_filter_evaluate (filter, node));
+  g_assert_cmpuint (count_matches (filter, root), ==, 1);
+
+  /* ...nor to its parents... */
+  ephy_node_filter_empty (filter);
+  ephy_node_filter_add_expression (filter,
+                                   ephy_node_filter_expression_new (EPHY_NODE_FILTER_EXPRESSION_HAS_PARENT,
+                                                                    topic),
+                                   0);
+  ephy_node_filter_done_changing (filter);
+  g_assert (!ephy_node_filter_evaluate (filter, node));
+  ephy_node_add_child (topic, node);
+  g_assert (ephy_node_filter_evaluate (filter, node));
+  ephy_node_remove_child (topic, node);
+  g_assert (!ephy_node_filter_evaluate (filter, node));
+
+  /* ...nor to the node that had its id before. */
+  set_search (filter, root, "renamed");
+  g_assert (ephy_node_filter_evaluate (filter, node));
+  ephy_node_unref (node);
+  node = ephy_node_new (db);
+  ephy_node_set_property_string (node, PROP_TITLE, "Something else");
+  ephy_node_add_child (root, node);
+  g_assert (!ephy_node_filter_evaluate (filter, node));
+
+  /* Adding an expression without telling anyone still takes effect. */
+  ephy_node_filter_add_expression (filter,
+                                   ephy_node_filter_expression_new (EPHY_NODE_FILTER_EXPRESSION_EQUALS,
+                                                                    topic),
+                                   2);
+  g_assert_cmpuint (count_matches (filter, root), ==, 0);
+
+  g_object_unref (filter);
+  g_object_unref (db);
+}
+
+static void
+test_refilter_performance (void)
+{
+  EphyNodeDb *db;
+  EphyNode *root;
+  EphyNodeFilter *filter;
+  const char *searches[] = { "b", "bo", "boo", "book", "bookm", "bookmark 1", "bookmark 12" };
+  double elapsed;
+  guint i;
+
+  if (!g_test_perf ())
+    return;
+
+  root = create_db (&db, 50000);
+  filter = ephy_node_filter_new ();
+
+  g_test_timer_start ();
+  set_search (filter, root, "example");
+  count_matches (filter, root);
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed, "First filtering of 50000 nodes in %.3f seconds", elapsed);
+
+  /* Typing in the search entry of the bookmarks editor. */
+  g_test_timer_start ();
+  for (i = 0; i < G_N_ELEMENTS (searches); i++) {
+    set_search (filter, root, searches[i]);
+    count_matches (filter, root);
+  }
+  elapsed = g_test_timer_elapsed () / G_N_ELEMENTS (searches);
+  g_test_minimized_result (elapsed, "Refiltered 50000 nodes in %.3f seconds", elapsed);
+
+  /* Evaluating the same filter again. */
+  g_test_timer_start ();
+  count_matches (filter, root);
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed, "Evaluated an unchanged filter on 50000 nodes in %.3f seconds", elapsed);
+
+  g_object_unref (filter);
+  g_object_unref (db);
+}
+
+int
+main (int argc, char *argv[])
+{
+  gtk_test_init (&argc, &argv);
+
+  g_test_add_func ("/lib/ephy-node-filter/levels", test_levels);
+  g_test_add_func ("/lib/ephy-node-filter/changes", test_changes);
+  g_test_add_func ("/lib/ephy-node-filter/refilter_performance", test_refilter_performance);
+
+  return g_test_run ();
+}
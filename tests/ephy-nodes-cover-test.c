@@ -0,0 +1,185 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ * ephy-nodes-cover-test.c
+ * This file is part of Epiphany
+ *
+ * Copyright © 2012 Igalia S.L.
+ *
+ * Epiphany is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Epiphany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Epiphany; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+
+#include "ephy-node-db.h"
+#include "ephy-node.h"
+#include "ephy-nodes-cover.h"
+
+#include <glib.h>
+#include <gtk/gtk.h>
+
+static GPtrArray *
+create_nodes (EphyNodeDb *db, guint n_nodes)
+{
+  GPtrArray *nodes;
+  guint i;
+
+  nodes = g_ptr_array_sized_new (n_nodes);
+  for (i = 0; i < n_nodes; i++)
+    g_ptr_array_add (nodes, ephy_node_new (db));
+
+  return nodes;
+}
+
+static void
+add_children (EphyNode *parent, GPtrArray *children, guint first, guint last)
+{
+  guint i;
+
+  for (i = first; i <= last; i++)
+    ephy_node_add_child (parent, g_ptr_array_index (children, i));
+}
+
+static void
+test_covering (void)
+{
+  EphyNodeDb *db;
+  GPtrArray *topics, *bookmarks, *covering, *uncovered, *covered;
+  GArray *sizes;
+
+  db = ephy_node_db_new ("EphyNodesCoverTest");
+  topics = create_nodes (db, 5);
+  bookmarks = create_nodes (db, 8);
+
+  /* Topic 0 holds every bookmark, so it is no use for a menu. */
+  add_children (g_ptr_array_index (topics, 0), bookmarks, 0, 7);
+  add_children (g_ptr_array_index (topics, 1), bookmarks, 0, 5);
+  add_children (g_ptr_array_index (topics, 2), bookmarks, 0, 2);
+  add_children (g_ptr_array_index (topics, 3), bookmarks, 3, 5);
+  add_children (g_ptr_array_index (topics, 4), bookmarks, 6, 6);
+
+  g_assert_cmpint (ephy_nodes_count_covered (g_ptr_array_index (topics, 1), bookmarks), ==, 6);
+  g_assert (ephy_nodes_covered (g_ptr_array_index (topics, 0), bookmarks));
+  g_assert (!ephy_nodes_covered (g_ptr_array_index (topics, 1), bookmarks));
+
+  covered = ephy_nodes_get_covered (g_ptr_array_index (topics, 3), bookmarks, NULL);
+  g_assert_cmpuint (covered->len, ==, 3);
+  g_assert (g_ptr_array_index (covered, 0) == g_ptr_array_index (bookmarks, 3));
+  g_assert (g_ptr_array_index (covered, 2) == g_ptr_array_index (bookmarks, 5));
+  g_ptr_array_free (covered, TRUE);
+
+  uncovered = g_ptr_array_new ();
+  sizes = g_array_new (FALSE, FALSE, sizeof (int));
+  covering = ephy_nodes_get_covering (topics, bookmarks, NULL, uncovered, sizes);
+
+  g_assert_cmpuint (covering->len, ==, 2);
+  g_assert (g_ptr_array_index (covering, 0) == g_ptr_array_index (topics, 1));
+  g_assert (g_ptr_array_index (covering, 1) == g_ptr_array_index (topics, 4));
+  g_assert_cmpint (g_array_index (sizes, int, 0), ==, 6);
+  g_assert_cmpint (g_array_index (sizes, int, 1), ==, 1);
+  g_assert_cmpuint (uncovered->len, ==, 1);
+  g_assert (g_ptr_array_index (uncovered, 0) == g_ptr_array_index (bookmarks, 7));
+
+  /* Membership changes are picked up. */
+  ephy_node_remove_child (g_ptr_array_index (topics, 4), g_ptr_array_index (bookmarks, 6));
+  add_children (g_ptr_array_index (topics, 4), bookmarks, 6, 7);
+  ephy_nodes_get_covering (topics, bookmarks, covering, uncovered, sizes);
+
+  g_assert_cmpuint (covering->len, ==, 2);
+  g_assert (g_ptr_array_index (covering, 1) == g_ptr_array_index (topics, 4));
+  g_assert_cmpint (g_array_index (sizes, int, 1), ==, 2);
+  g_assert_cmpuint (uncovered->len, ==, 0);
+
+  ephy_nodes_remove_covered (g_ptr_array_index (topics, 2), bookmarks);
+  g_assert_cmpuint (bookmarks->len, ==, 5);
+  ephy_nodes_remove_not_covered (g_ptr_array_index (topics, 3), bookmarks);
+  g_assert_cmpuint (bookmarks->len, ==, 3);
+
+  g_ptr_array_free (covering, TRUE);
+  g_ptr_array_free (uncovered, TRUE);
+  g_array_free (sizes, TRUE);
+  g_ptr_array_free (topics, TRUE);
+  g_ptr_array_free (bookmarks, TRUE);
+  g_object_unref (db);
+}
+
+static void
+test_covering_performance (void)
+{
+  EphyNodeDb *db;
+  GPtrArray *topics, *bookmarks, *covering, *uncovered;
+  GArray *sizes;
+  GRand *rand;
+  double elapsed;
+  guint i, j;
+
+  if (!g_test_perf ())
+    return;
+
+  db = ephy_node_db_new ("EphyNodesCoverTest");
+  topics = create_nodes (db, 500);
+  bookmarks = create_nodes (db, 50000);
+
+  /* Every bookmark in one to three random topics. */
+  rand = g_rand_new_with_seed (42);
+  for (i = 0; i < bookmarks->len; i++) {
+    guint n = g_rand_int_range (rand, 1, 4);
+
+    for (j = 0; j < n; j++) {
+      EphyNode *topic = g_ptr_array_index (topics, g_rand_int_range (rand, 0, topics->len));
+      EphyNode *bookmark = g_ptr_array_index (bookmarks, i);
+
+      if (!ephy_node_has_child (topic, bookmark))
+        ephy_node_add_child (topic, bookmark);
+    }
+  }
+  g_rand_free (rand);
+
+  covering = g_ptr_array_new ();
+  uncovered = g_ptr_array_new ();
+  sizes = g_array_new (FALSE, FALSE, sizeof (int));
+
+  g_test_timer_start ();
+  ephy_nodes_get_covering (topics, bookmarks, covering, uncovered, sizes);
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed, "Covered 50000 bookmarks with %u of 500 topics in %.3f seconds",
+                           covering->len, elapsed);
+
+  /* What rebuilding the bookmarks menu does after editing one bookmark. */
+  ephy_node_remove_child (g_ptr_array_index (covering, 0), g_ptr_array_index (bookmarks, 0));
+
+  g_test_timer_start ();
+  ephy_nodes_get_covering (topics, bookmarks, covering, uncovered, sizes);
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed, "Covered again after a change in %.3f seconds", elapsed);
+
+  g_ptr_array_free (covering, TRUE);
+  g_ptr_array_free (uncovered, TRUE);
+  g_array_free (sizes, TRUE);
+  g_ptr_array_free (topics, TRUE);
+  g_ptr_array_free (bookmarks, TRUE);
+  g_object_unref (db);
+}
+
+int
+main (int argc, char *argv[])
+{
+  gtk_test_init (&argc, &argv);
+
+  g_test_add_func ("/src/bookmarks/ephy-nodes-cover/covering", test_covering);
+  g_test_add_func ("/src/bookmarks/ephy-nodes-cover/covering_performance", test_covering_performance);
+
+  return g_test_run ();
+}
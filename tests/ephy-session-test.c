@@ -24,13 +24,17 @@
 #include "ephy-embed-prefs.h"
 #include "ephy-embed-private.h"
 #include "ephy-file-helpers.h"
+#include "ephy-prefs.h"
 #include "ephy-private.h"
 #include "ephy-shell.h"
 #include "ephy-session.h"
+#include "ephy-settings.h"
 
 #include <glib.h>
 #include <glib/gstdio.h>
 #include <gtk/gtk.h>
+#include <libsoup/soup.h>
+#include <stdlib.h>
 #include <string.h>
 
 const char *session_data = 
@@ -112,11 +116,371 @@ test_ephy_session_load_many_windows ()
     }
 }
 
+static void
+test_ephy_session_save ()
+{
+    EphySession *session;
+    GList *l;
+    guint n_windows;
+    guint n_saves, n_saves_after, n_saves_last_minute;
+    guint64 bytes_written, bytes_written_after;
+    char *path, *contents;
+    gsize length;
+
+    session = EPHY_SESSION (ephy_shell_get_session (ephy_shell));
+    g_assert (session);
+
+    l = ephy_session_get_windows (session);
+    n_windows = g_list_length (l);
+    g_assert_cmpuint (n_windows, >, 0);
+    g_list_free (l);
+
+    path = g_build_filename (ephy_dot_dir (), "session-save-test.xml", NULL);
+
+    ephy_session_get_save_statistics (session, &n_saves, NULL, &bytes_written);
+    g_assert (ephy_session_save (session, path));
+    ephy_session_get_save_statistics (session, &n_saves_after, &n_saves_last_minute, &bytes_written_after);
+
+    g_assert_cmpuint (n_saves_after, ==, n_saves + 1);
+    g_assert_cmpuint (n_saves_last_minute, >=, 1);
+
+    g_assert (g_file_get_contents (path, &contents, &length, NULL));
+    g_assert_cmpuint (bytes_written_after - bytes_written, ==, length);
+    g_assert (strstr (contents, "<embed url=\"about:epiphany\"") != NULL);
+    g_free (contents);
+
+    /* What we write, we can read back. */
+    g_assert (ephy_session_load (session, path, 0));
+
+    l = ephy_session_get_windows (session);
+    g_assert_cmpuint (g_list_length (l), ==, 2 * n_windows);
+    g_list_free (l);
+
+    g_unlink (path);
+    g_free (path);
+}
+
+static void
+test_ephy_session_save_in_background ()
+{
+    EphySession *session;
+    EphyWindow *window;
+    guint n_saves, n_saves_after;
+    guint64 bytes_written, bytes_written_after;
+    int i;
+
+    session = EPHY_SESSION (ephy_shell_get_session (ephy_shell));
+    g_assert (session);
+
+    window = ephy_session_get_active_window (session);
+    g_assert (window);
+
+    ephy_session_get_save_statistics (session, &n_saves, NULL, &bytes_written);
+
+    for (i = 0; i < 5; i++)
+      ephy_shell_new_tab (ephy_shell, window, NULL, NULL,
+                          EPHY_NEW_TAB_DONT_SHOW_WINDOW | EPHY_NEW_TAB_IN_EXISTING_WINDOW);
+
+    /* Nothing is written as the tabs come... */
+    ephy_session_get_save_statistics (session, &n_saves_after, NULL, NULL);
+    g_assert_cmpuint (n_saves_after, ==, n_saves);
+
+    /* ...they all go in the same save, a bit later. */
+    while (n_saves_after == n_saves) {
+      g_main_context_iteration (NULL, TRUE);
+      ephy_session_get_save_statistics (session, &n_saves_after, NULL, &bytes_written_after);
+    }
+
+    g_assert_cmpuint (n_saves_after, ==, n_saves + 1);
+    g_assert_cmpuint (bytes_written_after, >, bytes_written);
+}
+
+const char *session_data_delaying_loads =
+"<?xml version=\"1.0\"?>"
+"<session>"
+	 "<window x=\"73\" y=\"26\" width=\"1067\" height=\"740\" active-tab=\"1\" role=\"epiphany-window-4b5e8a2c\">"
+	 	 "<embed url=\"about:memory\" title=\"Memory usage\"/>"
+	 	 "<embed url=\"about:epiphany\" title=\"Epiphany\"/>"
+	 	 "<embed url=\"about:plugins\" title=\"Plugins\"/>"
+	 "</window>"
+"</session>";
+
+static void
+destroy_windows (EphySession *session)
+{
+    GList *l, *p;
+
+    l = ephy_session_get_windows (session);
+    for (p = l; p; p = p->next)
+      gtk_widget_destroy (GTK_WIDGET (p->data));
+    g_list_free (l);
+}
+
+static void
+test_ephy_session_load_delaying_loads ()
+{
+    EphySession *session;
+    GList *l;
+    GtkWidget *notebook;
+    EphyWebView *view;
+
+    session = EPHY_SESSION (ephy_shell_get_session (ephy_shell));
+    g_assert (session);
+
+    destroy_windows (session);
+
+    g_assert (ephy_session_load_from_string (session, session_data_delaying_loads, -1, 0));
+
+    l = ephy_session_get_windows (session);
+    g_assert_cmpint (g_list_length (l), ==, 1);
+    notebook = ephy_window_get_notebook (EPHY_WINDOW (l->data));
+    g_list_free (l);
+
+    g_assert_cmpint (gtk_notebook_get_n_pages (GTK_NOTEBOOK (notebook)), ==, 3);
+    g_assert_cmpint (gtk_notebook_get_current_page (GTK_NOTEBOOK (notebook)), ==, 1);
+
+    /* The active tab loads... */
+    view = ephy_embed_get_web_view (EPHY_EMBED (gtk_notebook_get_nth_page (GTK_NOTEBOOK (notebook), 1)));
+    g_assert (!ephy_web_view_is_placeholder (view));
+    g_assert_cmpstr (ephy_web_view_get_address (view), ==, "ephy-about:epiphany");
+
+    /* ...the others only look like they did... */
+    view = ephy_embed_get_web_view (EPHY_EMBED (gtk_notebook_get_nth_page (GTK_NOTEBOOK (notebook), 2)));
+    g_assert (ephy_web_view_is_placeholder (view));
+    g_assert_cmpstr (ephy_web_view_get_address (view), ==, "about:plugins");
+    g_assert_cmpstr (ephy_web_view_get_title (view), ==, "Plugins");
+
+    /* ...until they are selected. */
+    gtk_notebook_set_current_page (GTK_NOTEBOOK (notebook), 2);
+    g_assert (!ephy_web_view_is_placeholder (view));
+    g_assert_cmpstr (ephy_web_view_get_address (view), ==, "ephy-about:plugins");
+
+    view = ephy_embed_get_web_view (EPHY_EMBED (gtk_notebook_get_nth_page (GTK_NOTEBOOK (notebook), 0)));
+    g_assert (ephy_web_view_is_placeholder (view));
+
+    destroy_windows (session);
+}
+
+static char *
+create_session_data (guint n_windows, guint n_tabs_per_window)
+{
+    GString *data;
+    guint i, j;
+
+    data = g_string_new ("<?xml version=\"1.0\"?><session>");
+
+    for (i = 0; i < n_windows; i++) {
+      g_string_append_printf (data, "<window x=\"0\" y=\"0\" width=\"800\" height=\"600\" active-tab=\"%u\">",
+                              i % n_tabs_per_window);
+      for (j = 0; j < n_tabs_per_window; j++)
+        g_string_append_printf (data, "<embed url=\"data:text/plain,Tab %u.%u\" title=\"Tab %u.%u\"/>",
+                                i, j, i, j);
+      g_string_append (data, "</window>");
+    }
+
+    g_string_append (data, "</session>");
+
+    return g_string_free (data, FALSE);
+}
+
+/* In kB, from /proc. */
+static guint
+get_resident_memory (void)
+{
+    char *contents, *line;
+    guint rss = 0;
+
+    if (!g_file_get_contents ("/proc/self/status", &contents, NULL, NULL))
+      return 0;
+
+    line = strstr (contents, "VmRSS:");
+    if (line)
+      rss = strtoul (line + strlen ("VmRSS:"), NULL, 10);
+
+    g_free (contents);
+
+    return rss;
+}
+
+static void
+measure_restore (EphySession *session, const char *data, gboolean delaying_loads)
+{
+    double elapsed;
+    guint rss;
+
+    g_settings_set_boolean (EPHY_SETTINGS_MAIN,
+                            EPHY_PREFS_RESTORE_SESSION_DELAYING_LOADS,
+                            delaying_loads);
+
+    rss = get_resident_memory ();
+    g_test_timer_start ();
+
+    g_assert (ephy_session_load_from_string (session, data, -1, 0));
+    while (gtk_events_pending ())
+      gtk_main_iteration ();
+
+    elapsed = g_test_timer_elapsed ();
+    g_test_minimized_result (elapsed, "Restored 500 tabs %s in %.3f seconds",
+                             delaying_loads ? "delaying loads" : "loading them all", elapsed);
+    g_test_message ("Resident memory grew by %d kB", (int) (get_resident_memory () - rss));
+
+    destroy_windows (session);
+}
+
+static void
+test_ephy_session_restore_performance ()
+{
+    EphySession *session;
+    char *data;
+
+    if (!g_test_perf ())
+      return;
+
+    session = EPHY_SESSION (ephy_shell_get_session (ephy_shell));
+    data = create_session_data (20, 25);
+
+    measure_restore (session, data, TRUE);
+    measure_restore (session, data, FALSE);
+
+    g_settings_reset (EPHY_SETTINGS_MAIN, EPHY_PREFS_RESTORE_SESSION_DELAYING_LOADS);
+    g_free (data);
+}
+
+#define TAB_HTML "<html><head><title>Tab</title></head><body>Tab</body></html>"
+
+static SoupServer *server;
+static char *server_uri;
+static GPtrArray *requests;
+static guint n_requests_pending;
+static guint max_requests_pending;
+
+static gboolean
+respond_cb (SoupMessage *msg)
+{
+    soup_message_set_status (msg, SOUP_STATUS_OK);
+    soup_message_set_response (msg, "text/html", SOUP_MEMORY_STATIC,
+                               TAB_HTML, strlen (TAB_HTML));
+    soup_server_unpause_message (server, msg);
+    g_object_unref (msg);
+
+    n_requests_pending--;
+
+    return FALSE;
+}
+
+static void
+server_callback (SoupServer *server,
+                 SoupMessage *msg,
+                 const char *path,
+                 GHashTable *query,
+                 SoupClientContext *context,
+                 gpointer data)
+{
+    if (!g_str_has_prefix (path, "/tab/")) {
+        soup_message_set_status (msg, SOUP_STATUS_NOT_FOUND);
+        return;
+    }
+
+    g_ptr_array_add (requests, g_strdup (path));
+    n_requests_pending++;
+    max_requests_pending = MAX (max_requests_pending, n_requests_pending);
+
+    /* Take a while to answer, like a real server. */
+    soup_server_pause_message (server, msg);
+    g_timeout_add (100, (GSourceFunc) respond_cb, g_object_ref (msg));
+}
+
+static void
+test_ephy_session_restore_scheduler ()
+{
+    EphySession *session;
+    GString *data;
+    GList *l, *p;
+    guint n_queued, n_loading;
+    int eta;
+    gboolean had_eta = FALSE;
+    guint i, j;
+
+    session = EPHY_SESSION (ephy_shell_get_session (ephy_shell));
+    g_assert (session);
+
+    destroy_windows (session);
+
+    g_settings_set_boolean (EPHY_SETTINGS_MAIN,
+                            EPHY_PREFS_RESTORE_SESSION_DELAYING_LOADS, FALSE);
+    g_settings_set_uint (EPHY_SETTINGS_MAIN,
+                         EPHY_PREFS_RESTORE_SESSION_MAX_LOADS, 2);
+
+    data = g_string_new ("<?xml version=\"1.0\"?><session>");
+    for (i = 0; i < 2; i++) {
+      g_string_append (data, "<window x=\"0\" y=\"0\" width=\"800\" height=\"600\" active-tab=\"2\">");
+      for (j = 0; j < 4; j++)
+        g_string_append_printf (data, "<embed url=\"%stab/%u/%u\" title=\"Tab %u.%u\"/>",
+                                server_uri, i, j, i, j);
+      g_string_append (data, "</window>");
+    }
+    g_string_append (data, "</session>");
+
+    requests = g_ptr_array_new_with_free_func (g_free);
+    max_requests_pending = 0;
+
+    g_assert (ephy_session_load_from_string (session, data->str, -1, 0));
+    g_string_free (data, TRUE);
+
+    /* The active tabs go first... */
+    ephy_session_get_restore_status (session, &n_queued, &n_loading, &eta);
+    g_assert_cmpuint (n_loading, ==, 2);
+    g_assert_cmpuint (n_queued, ==, 6);
+    g_assert_cmpint (eta, ==, -1);
+
+    l = ephy_session_get_windows (session);
+    g_assert_cmpint (g_list_length (l), ==, 2);
+    for (p = l; p; p = p->next) {
+      GtkWidget *notebook = ephy_window_get_notebook (EPHY_WINDOW (p->data));
+
+      for (j = 0; j < 4; j++) {
+        EphyEmbed *embed = EPHY_EMBED (gtk_notebook_get_nth_page (GTK_NOTEBOOK (notebook), j));
+        g_assert (ephy_web_view_is_placeholder (ephy_embed_get_web_view (embed)) == (j != 2));
+      }
+    }
+    g_list_free (l);
+
+    /* ...then the others, never more than two at a time. */
+    while (n_queued + n_loading > 0) {
+      g_main_context_iteration (NULL, TRUE);
+
+      ephy_session_get_restore_status (session, &n_queued, &n_loading, &eta);
+      g_assert_cmpuint (n_loading, <=, 2);
+      if (n_queued + n_loading > 0 && eta >= 0)
+        had_eta = TRUE;
+    }
+
+    g_assert (had_eta);
+    g_assert_cmpint (eta, ==, 0);
+
+    g_assert_cmpuint (requests->len, ==, 8);
+    g_assert_cmpuint (max_requests_pending, <=, 2);
+    g_assert (g_str_has_suffix (g_ptr_array_index (requests, 0), "/2"));
+    g_assert (g_str_has_suffix (g_ptr_array_index (requests, 1), "/2"));
+
+    g_ptr_array_free (requests, TRUE);
+    requests = NULL;
+
+    g_settings_reset (EPHY_SETTINGS_MAIN, EPHY_PREFS_RESTORE_SESSION_DELAYING_LOADS);
+    g_settings_reset (EPHY_SETTINGS_MAIN, EPHY_PREFS_RESTORE_SESSION_MAX_LOADS);
+
+    destroy_windows (session);
+}
+
 int
 main (int argc, char *argv[])
 {
   int ret;
 
+  /* This should affect only this test, we use this to safely change
+   * settings. */
+  g_setenv ("GSETTINGS_BACKEND", "memory", TRUE);
+
   gtk_test_init (&argc, &argv);
 
   ephy_debug_init ();
@@ -132,16 +496,39 @@ main (int argc, char *argv[])
   _ephy_shell_create_instance (EPHY_EMBED_SHELL_MODE_TEST);
   g_assert (ephy_shell);
 
+  server = soup_server_new (SOUP_SERVER_PORT, 0, NULL);
+  soup_server_add_handler (server, NULL, server_callback, NULL, NULL);
+  soup_server_run_async (server);
+  server_uri = g_strdup_printf ("http://127.0.0.1:%u/", soup_server_get_port (server));
+
   g_test_add_func ("/src/ephy-session/load",
                    test_ephy_session_load);
 
   g_test_add_func ("/src/ephy-session/load-many-windows",
                    test_ephy_session_load_many_windows);
 
+  g_test_add_func ("/src/ephy-session/save",
+                   test_ephy_session_save);
+
+  g_test_add_func ("/src/ephy-session/save-in-background",
+                   test_ephy_session_save_in_background);
+
+  g_test_add_func ("/src/ephy-session/load-delaying-loads",
+                   test_ephy_session_load_delaying_loads);
+
+  g_test_add_func ("/src/ephy-session/restore-scheduler",
+                   test_ephy_session_restore_scheduler);
+
+  g_test_add_func ("/src/ephy-session/restore-performance",
+                   test_ephy_session_restore_performance);
+
   ret = g_test_run ();
 
   ephy_file_helpers_shutdown ();
   g_object_unref (ephy_shell);
 
+  g_free (server_uri);
+  g_object_unref (server);
+
   return ret;
 }
@@ -318,6 +318,119 @@ test_ephy_shell_tab_no_history ()
 #endif
 }
 
+static void
+run_idle (void)
+{
+  while (gtk_events_pending ())
+    gtk_main_iteration ();
+}
+
+static void
+test_ephy_shell_embed_pool ()
+{
+  GtkWidget *window;
+  EphyEmbed *embed;
+  guint hits, misses, size, old_size, old_hits, old_misses;
+  guint i;
+
+  window = GTK_WIDGET (ephy_window_new ());
+
+  /* Once the pool is filled, a new tab gets a ready embed... */
+  embed = ephy_shell_new_tab (ephy_shell, EPHY_WINDOW (window), NULL, NULL,
+                              EPHY_NEW_TAB_DONT_SHOW_WINDOW | EPHY_NEW_TAB_IN_EXISTING_WINDOW);
+  run_idle ();
+  ephy_shell_get_embed_pool_statistics (ephy_shell, &old_hits, &old_misses, NULL);
+
+  embed = ephy_shell_new_tab (ephy_shell, EPHY_WINDOW (window), NULL, NULL,
+                              EPHY_NEW_TAB_DONT_SHOW_WINDOW | EPHY_NEW_TAB_IN_EXISTING_WINDOW);
+  g_assert (gtk_widget_get_toplevel (GTK_WIDGET (embed)) == window);
+  g_assert (ephy_web_view_get_is_blank (ephy_embed_get_web_view (embed)));
+
+  ephy_shell_get_embed_pool_statistics (ephy_shell, &hits, &misses, &size);
+  g_assert_cmpuint (hits, ==, old_hits + 1);
+  g_assert_cmpuint (misses, ==, old_misses);
+
+  /* Restored tabs come in bursts too, but do not resize it... */
+  for (i = 0; i < 3; i++)
+    ephy_shell_new_tab (ephy_shell, EPHY_WINDOW (window), NULL, NULL,
+                        EPHY_NEW_TAB_DONT_SHOW_WINDOW | EPHY_NEW_TAB_IN_EXISTING_WINDOW |
+                        EPHY_NEW_TAB_RESTORE);
+
+  ephy_shell_get_embed_pool_statistics (ephy_shell, NULL, &misses, &old_size);
+  g_assert_cmpuint (old_size, ==, size);
+
+  /* ...while opening many at once makes it grow, so that the next burst
+   * finds them ready. */
+  for (i = 0; i < 3; i++)
+    ephy_shell_new_tab (ephy_shell, EPHY_WINDOW (window), NULL, NULL,
+                        EPHY_NEW_TAB_DONT_SHOW_WINDOW | EPHY_NEW_TAB_IN_EXISTING_WINDOW);
+
+  ephy_shell_get_embed_pool_statistics (ephy_shell, &old_hits, &old_misses, &size);
+  g_assert_cmpuint (size, >, 1);
+  g_assert_cmpuint (old_misses, >, misses);
+
+  run_idle ();
+  for (i = 0; i < size; i++)
+    ephy_shell_new_tab (ephy_shell, EPHY_WINDOW (window), NULL, NULL,
+                        EPHY_NEW_TAB_DONT_SHOW_WINDOW | EPHY_NEW_TAB_IN_EXISTING_WINDOW);
+
+  ephy_shell_get_embed_pool_statistics (ephy_shell, &hits, &misses, NULL);
+  g_assert_cmpuint (hits, ==, old_hits + size);
+  g_assert_cmpuint (misses, ==, old_misses);
+
+  gtk_widget_destroy (window);
+}
+
+#define N_NEW_TABS 40
+
+static void
+test_ephy_shell_new_tab_performance ()
+{
+  GtkWidget *window;
+  double elapsed, hit_time = 0, miss_time = 0;
+  guint n_hits = 0, n_misses = 0, hits, old_hits;
+  guint i;
+
+  if (!g_test_perf ())
+    return;
+
+  window = GTK_WIDGET (ephy_window_new ());
+
+  /* What Ctrl+T does: the location entry is ready to type in when
+   * ephy_shell_new_tab() returns. Every other tab comes after an idle
+   * moment, the rest right after the previous one, so that both a
+   * filled and a drained pool are measured. */
+  for (i = 0; i < N_NEW_TABS; i++) {
+    if (i % 2)
+      run_idle ();
+
+    ephy_shell_get_embed_pool_statistics (ephy_shell, &old_hits, NULL, NULL);
+
+    g_test_timer_start ();
+    ephy_shell_new_tab (ephy_shell, EPHY_WINDOW (window), NULL, NULL,
+                        EPHY_NEW_TAB_DONT_SHOW_WINDOW | EPHY_NEW_TAB_IN_EXISTING_WINDOW |
+                        EPHY_NEW_TAB_HOME_PAGE | EPHY_NEW_TAB_JUMP);
+    elapsed = g_test_timer_elapsed ();
+
+    ephy_shell_get_embed_pool_statistics (ephy_shell, &hits, NULL, NULL);
+    if (hits > old_hits) {
+      hit_time += elapsed;
+      n_hits++;
+    } else {
+      miss_time += elapsed;
+      n_misses++;
+    }
+  }
+
+  g_test_message ("%u new tabs found a ready embed, %u did not", n_hits, n_misses);
+  if (n_hits > 0)
+    g_test_minimized_result (hit_time / n_hits, "Opened a tab with a ready embed in %.4f seconds", hit_time / n_hits);
+  if (n_misses > 0)
+    g_test_minimized_result (miss_time / n_misses, "Opened a tab building its embed in %.4f seconds", miss_time / n_misses);
+
+  gtk_widget_destroy (window);
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -357,6 +470,12 @@ main (int argc, char *argv[])
   g_test_add_func ("/src/ephy-shell/tab_no_history",
                    test_ephy_shell_tab_no_history);
 
+  g_test_add_func ("/src/ephy-shell/embed_pool",
+                   test_ephy_shell_embed_pool);
+
+  g_test_add_func ("/src/ephy-shell/new_tab_performance",
+                   test_ephy_shell_new_tab_performance);
+
   ret = g_test_run ();
 
   g_object_unref (ephy_shell);
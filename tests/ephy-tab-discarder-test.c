@@ -0,0 +1,197 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ * ephy-tab-discarder-test.c
+ * This file is part of Epiphany
+ *
+ * Copyright © 2012 Igalia S.L.
+ *
+ * Epiphany is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Epiphany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Epiphany; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+
+#include "ephy-debug.h"
+#include "ephy-embed-prefs.h"
+#include "ephy-file-helpers.h"
+#include "ephy-prefs.h"
+#include "ephy-private.h"
+#include "ephy-settings.h"
+#include "ephy-shell.h"
+#include "ephy-tab-discarder.h"
+#include "ephy-window.h"
+
+#include <glib.h>
+#include <gtk/gtk.h>
+
+#ifdef HAVE_WEBKIT2
+/* WebKit2 builds have no tab discarder. */
+#else
+#define N_TABS 4
+
+typedef struct {
+  guint usage;
+  gboolean under_pressure;
+} FakeMemory;
+
+static guint
+fake_memory_func (gboolean *under_pressure, FakeMemory *memory)
+{
+  *under_pressure = memory->under_pressure;
+
+  return memory->usage;
+}
+
+static EphyWebView *
+get_view (GtkNotebook *notebook, int page)
+{
+  return ephy_embed_get_web_view (EPHY_EMBED (gtk_notebook_get_nth_page (notebook, page)));
+}
+
+static void
+wait_for_loads (GtkNotebook *notebook)
+{
+  int i;
+
+  for (i = 0; i < gtk_notebook_get_n_pages (notebook); i++)
+    while (ephy_web_view_is_loading (get_view (notebook, i)))
+      gtk_main_iteration ();
+}
+
+static void
+test_discard (void)
+{
+  EphyTabDiscarder *discarder;
+  EphyWindow *window;
+  GtkNotebook *notebook;
+  EphyWebView *view;
+  FakeMemory memory = { 0, FALSE };
+  guint n_discarded;
+  guint64 reclaimed;
+  int i;
+
+  discarder = EPHY_TAB_DISCARDER (ephy_shell_get_tab_discarder (ephy_shell));
+  ephy_tab_discarder_set_memory_func (discarder, (EphyTabDiscarderMemoryFunc) fake_memory_func,
+                                      &memory, NULL);
+
+  window = ephy_window_new ();
+  notebook = GTK_NOTEBOOK (ephy_window_get_notebook (window));
+
+  for (i = 0; i < N_TABS; i++) {
+    char *url = g_strdup_printf ("data:text/html,<title>Tab %d</title>", i);
+    ephy_shell_new_tab (ephy_shell, window, NULL, url,
+                        EPHY_NEW_TAB_IN_EXISTING_WINDOW | EPHY_NEW_TAB_OPEN_PAGE |
+                        EPHY_NEW_TAB_APPEND_LAST);
+    g_free (url);
+  }
+  wait_for_loads (notebook);
+
+  /* Tab 0 is the one used least recently, tab 3 the active one. */
+  for (i = 1; i < N_TABS; i++)
+    gtk_notebook_set_current_page (notebook, i);
+
+  /* Without a budget nor memory pressure, nothing goes. */
+  memory.usage = 200 * 1024;
+  g_settings_set_uint (EPHY_SETTINGS_MAIN, EPHY_PREFS_TAB_DISCARD_MEMORY_LIMIT, 0);
+  g_assert (!ephy_tab_discarder_check (discarder));
+
+  g_settings_set_uint (EPHY_SETTINGS_MAIN, EPHY_PREFS_TAB_DISCARD_MEMORY_LIMIT, 100);
+  memory.usage = 50 * 1024;
+  g_assert (!ephy_tab_discarder_check (discarder));
+
+  /* Over the budget, the least recently used tab goes... */
+  memory.usage = 200 * 1024;
+  g_assert (ephy_tab_discarder_check (discarder));
+  g_assert_cmpint (gtk_notebook_get_n_pages (notebook), ==, N_TABS);
+  g_assert_cmpint (gtk_notebook_get_current_page (notebook), ==, N_TABS - 1);
+
+  view = get_view (notebook, 0);
+  g_assert (ephy_web_view_is_placeholder (view));
+  g_assert_cmpstr (ephy_web_view_get_address (view), ==, "data:text/html,<title>Tab 0</title>");
+  g_assert_cmpstr (ephy_web_view_get_title (view), ==, "Tab 0");
+  g_assert (!ephy_web_view_is_placeholder (get_view (notebook, 1)));
+
+  /* ...and then the next one, while it is not enough. */
+  memory.usage = 150 * 1024;
+  g_assert (ephy_tab_discarder_check (discarder));
+  g_assert (ephy_web_view_is_placeholder (get_view (notebook, 1)));
+
+  memory.usage = 90 * 1024;
+  g_assert (!ephy_tab_discarder_check (discarder));
+
+  ephy_tab_discarder_get_statistics (discarder, &n_discarded, &reclaimed);
+  g_assert_cmpuint (n_discarded, ==, 2);
+  g_assert_cmpuint (reclaimed, ==, 110 * 1024);
+
+  /* Memory pressure is enough on its own. The active tab stays anyway. */
+  memory.usage = 10 * 1024;
+  memory.under_pressure = TRUE;
+  g_assert (ephy_tab_discarder_check (discarder));
+  g_assert (ephy_web_view_is_placeholder (get_view (notebook, 2)));
+  g_assert (!ephy_tab_discarder_check (discarder));
+  g_assert (!ephy_web_view_is_placeholder (get_view (notebook, 3)));
+
+  /* Selecting a discarded tab brings the page back. */
+  gtk_notebook_set_current_page (notebook, 0);
+  view = get_view (notebook, 0);
+  g_assert (!ephy_web_view_is_placeholder (view));
+  wait_for_loads (notebook);
+  g_assert_cmpstr (ephy_web_view_get_address (view), ==, "data:text/html,<title>Tab 0</title>");
+  g_assert_cmpstr (ephy_web_view_get_title (view), ==, "Tab 0");
+
+  ephy_tab_discarder_get_statistics (discarder, &n_discarded, NULL);
+  g_assert_cmpuint (n_discarded, ==, 3);
+
+  gtk_widget_destroy (GTK_WIDGET (window));
+  g_settings_reset (EPHY_SETTINGS_MAIN, EPHY_PREFS_TAB_DISCARD_MEMORY_LIMIT);
+  ephy_tab_discarder_set_memory_func (discarder, NULL, NULL, NULL);
+}
+#endif
+
+int
+main (int argc, char *argv[])
+{
+  int ret;
+
+  /* This should affect only this test, we use this to safely change
+   * settings. */
+  g_setenv ("GSETTINGS_BACKEND", "memory", TRUE);
+
+  gtk_test_init (&argc, &argv);
+
+  ephy_debug_init ();
+  ephy_embed_prefs_init ();
+
+  if (!ephy_file_helpers_init (NULL,
+                               EPHY_FILE_HELPERS_PRIVATE_PROFILE | EPHY_FILE_HELPERS_ENSURE_EXISTS,
+                               NULL)) {
+    g_debug ("Something wrong happened with ephy_file_helpers_init()");
+    return -1;
+  }
+
+  _ephy_shell_create_instance (EPHY_EMBED_SHELL_MODE_TEST);
+  g_assert (ephy_shell);
+
+#ifndef HAVE_WEBKIT2
+  g_test_add_func ("/src/ephy-tab-discarder/discard", test_discard);
+#endif
+
+  ret = g_test_run ();
+
+  g_object_unref (ephy_shell);
+  ephy_file_helpers_shutdown ();
+
+  return ret;
+}
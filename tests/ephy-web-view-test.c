@@ -35,11 +35,57 @@
 #include <glib/gstdio.h>
 #include <gtk/gtk.h>
 #include <libsoup/soup.h>
+#include <stdlib.h>
 #include <string.h>
 
 #define HTML_STRING "testing-ephy-web-view"
 #define SERVER_PORT 12321
 
+/* A transparent 1x1 GIF. */
+static const char pixel_gif[] =
+  "GIF89a\x01\x00\x01\x00\x80\x00\x00\x00\x00\x00\xff\xff\xff!\xf9\x04\x01\x00\x00\x00\x00"
+  ",\x00\x00\x00\x00\x01\x00\x01\x00\x00\x02\x02" "D\x01\x00;";
+
+/* /page/N is a page with N images, all named pixel.gif. /page/names
+ * has images whose names need escaping in a URI. */
+static gboolean
+serve_page_with_images (SoupMessage *msg, const char *path)
+{
+  GString *page;
+  guint i, n_images;
+
+  if (g_str_has_prefix (path, "/image/")) {
+    soup_message_set_status (msg, SOUP_STATUS_OK);
+    soup_message_headers_replace (msg->response_headers, "Content-Type", "image/gif");
+    soup_message_body_append (msg->response_body, SOUP_MEMORY_STATIC,
+                              pixel_gif, sizeof (pixel_gif) - 1);
+    soup_message_body_complete (msg->response_body);
+    return TRUE;
+  }
+
+  if (!g_str_has_prefix (path, "/page/"))
+    return FALSE;
+
+  page = g_string_new ("<html><body>");
+  if (g_str_equal (path, "/page/names")) {
+    g_string_append (page, "<img src=\"/image/a/my%20pixel.gif\">");
+    g_string_append (page, "<img src=\"/image/b/pixel.php?id=1\">");
+  } else {
+    n_images = strtoul (path + strlen ("/page/"), NULL, 10);
+    for (i = 0; i < n_images; i++)
+      g_string_append_printf (page, "<img src=\"/image/%u/pixel.gif\">", i);
+  }
+  g_string_append (page, "</body></html>");
+
+  soup_message_set_status (msg, SOUP_STATUS_OK);
+  soup_message_headers_replace (msg->response_headers, "Content-Type", "text/html");
+  soup_message_body_append (msg->response_body, SOUP_MEMORY_TAKE, page->str, page->len);
+  soup_message_body_complete (msg->response_body);
+  g_string_free (page, FALSE);
+
+  return TRUE;
+}
+
 static void
 server_callback (SoupServer *server,
                  SoupMessage *msg,
@@ -48,6 +94,9 @@ server_callback (SoupServer *server,
                  SoupClientContext *context,
                  gpointer data)
 {
+  if (serve_page_with_images (msg, path))
+    return;
+
   if (g_str_equal (path, "/cancelled"))
     soup_message_set_status (msg, SOUP_STATUS_CANT_CONNECT);
   else if (g_str_equal (path, "/redirect")) {
@@ -264,6 +313,192 @@ test_ephy_web_view_non_search_regex ()
   g_regex_unref (regex);
 }
 
+#ifdef HAVE_WEBKIT2
+/* TODO: webkit_web_view_save() */
+#else
+#define N_SAVE_RESOURCES 300
+
+typedef struct {
+  GMainLoop *loop;
+  gboolean success;
+  guint n_progress;
+  guint last_saved;
+  guint last_total;
+} SaveData;
+
+static void
+save_progress_cb (guint n_saved, guint n_total, SaveData *data)
+{
+  g_assert_cmpuint (n_saved, >, data->last_saved);
+  g_assert_cmpuint (n_saved, <=, n_total);
+
+  data->n_progress++;
+  data->last_saved = n_saved;
+  data->last_total = n_total;
+}
+
+static void
+save_finished_cb (EphyWebView *view, gboolean success, SaveData *data)
+{
+  data->success = success;
+  g_main_loop_quit (data->loop);
+}
+
+static EphyWebView *
+load_page (const char *page)
+{
+  EphyWebView *view;
+  GMainLoop *loop;
+  char *url;
+
+  view = EPHY_WEB_VIEW (ephy_web_view_new ());
+  g_object_ref_sink (view);
+  loop = g_main_loop_new (NULL, FALSE);
+
+  url = g_strdup_printf ("http://127.0.0.1:%u/page/%s", SERVER_PORT, page);
+  ephy_web_view_load_url (view, url);
+
+  g_object_set_data (G_OBJECT (view), "test.expected_url", url);
+  g_signal_connect (view, "notify::load-status",
+                    G_CALLBACK (notify_load_status_cb), loop);
+
+  g_main_loop_run (loop);
+  g_main_loop_unref (loop);
+
+  return view;
+}
+
+static EphyWebView *
+load_page_with_images (guint n_images)
+{
+  EphyWebView *view;
+  char *page;
+
+  page = g_strdup_printf ("%u", n_images);
+  view = load_page (page);
+  g_free (page);
+
+  return view;
+}
+
+static void
+save_page (EphyWebView *view, const char *uri, GCancellable *cancellable, SaveData *data)
+{
+  memset (data, 0, sizeof (SaveData));
+  data->loop = g_main_loop_new (NULL, FALSE);
+
+  ephy_web_view_save_full (view, uri, cancellable,
+                           (EphyWebViewSaveProgressFunc) save_progress_cb,
+                           (EphyWebViewSaveCallback) save_finished_cb,
+                           data);
+  g_main_loop_run (data->loop);
+
+  g_main_loop_unref (data->loop);
+}
+
+static void
+test_ephy_web_view_save ()
+{
+  EphyWebView *view;
+  GCancellable *cancellable;
+  SaveData data;
+  char *path, *uri, *file;
+
+  view = load_page_with_images (10);
+  path = g_build_filename (ephy_dot_dir (), "saved.html", NULL);
+  uri = g_filename_to_uri (path, NULL, NULL);
+
+  save_page (view, uri, NULL, &data);
+
+  g_assert (data.success);
+  g_assert_cmpuint (data.n_progress, ==, 11);
+  g_assert_cmpuint (data.last_saved, ==, 11);
+  g_assert_cmpuint (data.last_total, ==, 11);
+  g_assert (g_file_test (path, G_FILE_TEST_EXISTS));
+
+  /* Images with the same name do not overwrite each other. */
+  file = g_build_filename (ephy_dot_dir (), "saved Files", "pixel.gif", NULL);
+  g_assert (g_file_test (file, G_FILE_TEST_EXISTS));
+  g_free (file);
+  file = g_build_filename (ephy_dot_dir (), "saved Files", "pixel-9.gif", NULL);
+  g_assert (g_file_test (file, G_FILE_TEST_EXISTS));
+  g_free (file);
+  file = g_build_filename (ephy_dot_dir (), "saved Files", "pixel-10.gif", NULL);
+  g_assert (!g_file_test (file, G_FILE_TEST_EXISTS));
+  g_free (file);
+
+  /* A cancelled save stops before saving anything more. */
+  cancellable = g_cancellable_new ();
+  g_cancellable_cancel (cancellable);
+
+  save_page (view, uri, cancellable, &data);
+
+  g_assert (!data.success);
+  g_assert_cmpuint (data.n_progress, ==, 0);
+
+  g_object_unref (cancellable);
+  g_free (uri);
+  g_free (path);
+  g_object_unref (view);
+}
+
+static void
+test_ephy_web_view_save_names ()
+{
+  EphyWebView *view;
+  SaveData data;
+  char *path, *uri, *file;
+
+  view = load_page ("names");
+  path = g_build_filename (ephy_dot_dir (), "names.html", NULL);
+  uri = g_filename_to_uri (path, NULL, NULL);
+
+  save_page (view, uri, NULL, &data);
+  g_assert (data.success);
+
+  /* Resources keep the names they have in their URIs. */
+  file = g_build_filename (ephy_dot_dir (), "names Files", "my%20pixel.gif", NULL);
+  g_assert (g_file_test (file, G_FILE_TEST_EXISTS));
+  g_free (file);
+  file = g_build_filename (ephy_dot_dir (), "names Files", "pixel.php?id=1", NULL);
+  g_assert (g_file_test (file, G_FILE_TEST_EXISTS));
+  g_free (file);
+
+  g_free (uri);
+  g_free (path);
+  g_object_unref (view);
+}
+
+static void
+test_ephy_web_view_save_performance ()
+{
+  EphyWebView *view;
+  SaveData data;
+  char *path, *uri;
+  double elapsed;
+
+  if (!g_test_perf ())
+    return;
+
+  view = load_page_with_images (N_SAVE_RESOURCES);
+  path = g_build_filename (ephy_dot_dir (), "performance.html", NULL);
+  uri = g_filename_to_uri (path, NULL, NULL);
+
+  g_test_timer_start ();
+  save_page (view, uri, NULL, &data);
+  elapsed = g_test_timer_elapsed ();
+
+  g_assert (data.success);
+  g_assert_cmpuint (data.last_saved, ==, N_SAVE_RESOURCES + 1);
+  g_test_minimized_result (elapsed, "Saved a page with %u subresources in %.3f seconds",
+                           N_SAVE_RESOURCES, elapsed);
+
+  g_free (uri);
+  g_free (path);
+  g_object_unref (view);
+}
+#endif
+
 int
 main (int argc, char *argv[])
 {
@@ -294,6 +529,17 @@ main (int argc, char *argv[])
   g_test_add_func ("/embed/ephy-web-view/load_url",
                    test_ephy_web_view_load_url);
 
+#ifndef HAVE_WEBKIT2
+  g_test_add_func ("/embed/ephy-web-view/save",
+                   test_ephy_web_view_save);
+
+  g_test_add_func ("/embed/ephy-web-view/save_names",
+                   test_ephy_web_view_save_names);
+
+  g_test_add_func ("/embed/ephy-web-view/save_performance",
+                   test_ephy_web_view_save_performance);
+#endif
+
   ret = g_test_run ();
 
   g_object_unref (server);